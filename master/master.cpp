@@ -1,34 +1,177 @@
-#include "msgtool.h"
-#include <iostream>
+#include "ctlproto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
 #include <string>
 
 using namespace std;
 
+//reads one frame from the server (a reply, or an event after follow) and prints it, returns its
+//type (or -2 if the connection was lost) and sets status to the status of a reply
+static int readFrame(int fd,int *status)
+{
+  FrameHeader h;
+  if(ctlReadAll(fd,&h,sizeof(h))<0)
+    return -2;
+  if(((h.type!=FRAME_REPLY)&&(h.type!=FRAME_EVENT))||(h.length>CTL_MAX_REPLY))
+    {
+      printf("Invalid reply from the server.\n");
+      return -2;
+    }
+  char *text=(char *)malloc(h.length+1);
+  if((text==NULL)||((h.length>0)&&(ctlReadAll(fd,text,h.length)<0)))
+    {
+      free(text);
+      return -2;
+    }
+  fwrite(text,1,h.length,stdout);
+  fflush(stdout);
+  free(text);
+  *status=h.status;
+  return h.type;
+}
+
+//reads frames until the reply to a command, returns its status (or -2 if the connection was lost)
+static int readReply(int fd)
+{
+  int status,type;
+  while((type=readFrame(fd,&status))==FRAME_EVENT)
+    ;
+  return (type==FRAME_REPLY) ? status : -2;
+}
+
+//sends the commands read from stdin (one per line) without waiting for the replies, and prints
+//the replies as they arrive; returns the number of commands which weren't understood
+static int runScript(int fd)
+{
+  string line;
+  unsigned int sent=0,answered=0;
+  int failed=0;
+  bool input=true;
+  char buf[4096];
+
+  while(input||(answered<sent))
+    {
+      struct pollfd fds[2];
+      int n=0;
+      fds[n].fd=fd;
+      fds[n++].events=POLLIN;
+      if(input)
+        {
+          fds[n].fd=0;
+          fds[n++].events=POLLIN;
+        }
+      if(poll(fds,n,-1)<0)
+        continue;
+      if(fds[0].revents)
+        {
+          int status;
+          int type=readFrame(fd,&status);
+          if(type==FRAME_EVENT)
+            continue;
+          if(type==-2)
+            {
+              printf("Lost the connection to the server (%u of %u commands answered).\n",answered,sent);
+              return failed+(sent-answered);
+            }
+          if(status!=0)
+            failed++;
+          answered++;
+        }
+      if(input&&(n>1)&&fds[1].revents)
+        {
+          ssize_t len=read(0,buf,sizeof(buf));
+          if(len<=0)
+            {
+              input=false;
+              buf[0]='\n'; //send a last line without a line break
+              len=1;
+            }
+          for(ssize_t i=0;i<len;i++)
+            {
+              if(buf[i]!='\n')
+                {
+                  line+=buf[i];
+                  continue;
+                }
+              if((line.length()>0)&&(line[line.length()-1]=='\r'))
+                line.erase(line.length()-1);
+              if(line.length()>CTL_MAX_COMMAND)
+                printf("Command too long (at most %i characters), not sent.\n",CTL_MAX_COMMAND);
+              else if(line.length()>0)
+                {
+                  if(ctlSendFrame(fd,FRAME_COMMAND,0,++sent,line.c_str(),line.length())<0)
+                    {
+                      printf("Lost the connection to the server.\n");
+                      return failed+1;
+                    }
+                }
+              line="";
+            }
+        }
+    }
+  return failed;
+}
+
 int main(int argc, char *argv[])
 {
+  const char *path=getenv("LN2_SOCKET");
+  int first=1;
 
-  if(argc==1)
+  if(path==NULL)
+    path=CTL_DEFAULT_PATH;
+  if((argc>2)&&(strcmp(argv[1],"-s")==0))
+    {
+      path=argv[2];
+      first=3;
+    }
+  if(argc<=first)
     {
-      printf("Usage: %s message\n",argv[0]);
+      printf("Usage: %s [-s socket] command [arguments]\n",argv[0]);
+      printf("       %s [-s socket] -   (sends the commands read from stdin, one per line)\n",argv[0]);
+      printf("       %s [-s socket] follow [channel ...]   (prints the readings and events as they happen)\n",argv[0]);
       exit(1);
     }
-  
-  MsgQ *test=new MsgQ();
 
-  
-  
-  if(argc==3)
+  int fd=ctlConnect(path);
+  if(fd<0)
     {
-      string one,two,three;
-      one=argv[1]; two=argv[2];
-      three=" ";
-      one=one+three+two;
-      test->send((char *)one.c_str());
+      perror(path);
+      printf("Could not connect to LN2_server, is it running?\n");
+      exit(1);
     }
-  else
 
-    test->send(argv[1]);
+  if(strcmp(argv[first],"-")==0)
+    exit((runScript(fd)==0) ? 0 : 1);
+
+  //the command and its arguments are sent as one command, separated by spaces
+  string message=argv[first];
+  for(int i=first+1;i<argc;i++)
+    {
+      message=message+" "+argv[i];
+    }
+  if(message.length()>CTL_MAX_COMMAND)
+    {
+      printf("Command too long (at most %i characters).\n",CTL_MAX_COMMAND);
+      exit(1);
+    }
+  if(ctlSendFrame(fd,FRAME_COMMAND,0,1,message.c_str(),message.length())<0)
+    {
+      perror("send");
+      exit(1);
+    }
+  int status=readReply(fd);
+  if(status==-2)
+    printf("Lost the connection to the server.\n");
+  else if((status==0)&&(strcmp(argv[first],"follow")==0))
+    {
+      //print the readings and events until the server stops (or drops us for falling behind)
+      while(readFrame(fd,&status)!=-2)
+        ;
+      printf("The server closed the connection.\n");
+      status=0;
+    }
+  close(fd);
 
-  
-  return 1;
+  return (status==0) ? 0 : 1;
 }
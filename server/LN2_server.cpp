@@ -1,9 +1,86 @@
 #include "LN2_server.h"
 #include "circbuffer.h"
 #include "influxdb.h"
-
-const int commandSize = 4096;
-char command[commandSize];
+#include "metrics.h"
+#include "alert.h"
+#include <errno.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <algorithm>
+
+//server state and run parameters (described in LN2_server.h)
+struct Signals signaled;
+lock *l;
+char port0[128];
+char port1[128];
+char port2[128];
+double tstart,tstop,tcurrent;
+double runStartTime;
+Checkpoint scheduleCheckpoint;
+double paused;
+float meas;
+double run_time;
+double current_run_time;
+float reading;
+char tmp [200];
+bool emailAllow;
+bool messageAllow;
+unsigned long long openValveMask;
+LatencyHist stageHist [NUM_STAGES];
+unsigned long long cycleOverruns;
+unsigned long long fillOverruns;
+double threshold;
+double scale_threshold;
+double tankAlertHours;
+double tankSwapKg;
+int deliveryDays;
+double tankFullKg;
+int planRuns;
+double planFillKg;
+int polling_time;
+char archiveFile [256];
+char fillHistoryFile [256];
+char traceDir [256];
+int traceInterval;
+int metricsPort;
+AlertConfig alertConfig;
+bool influxUDP;
+int influxMTU;
+char influxHost [256];
+char influxDB [256];
+char influxUser [256];
+char influxPassword [256];
+int iterations;
+double maxfilltime;
+int circBufferSize;
+char fillName [COMMAND_PARAM_SIZE];
+int masterValue;
+char masterParam [COMMAND_PARAM_SIZE];
+char controlSocket [108];
+char scheduleState [256];
+bool email;
+char mailaddress [200];
+char daqDriver [256];
+char daqConfig [256];
+bool virtualClock;
+double clockSpeedup;
+time_t clockStart;
+int numValves;
+int valveOutputs [20];
+int scaleInput;
+int measChans [MAXSCHEDENTRIES+1];
+double scaleFit [2];
+
+//The control loop (MainLoop and fill) is the only thread which touches the DAQ, the valves and
+//the fill state.  Commands are received and checked by the control socket thread (see ctlsock.h)
+//and queued for it, and it hands each set of readings to the telemetry threads, so that a client,
+//InfluxDB or the disk being slow never holds up a fill.  Alerts are sent from their own thread
+//(see alert.h).
+Ring commandQueue;
+sem_t commandReady; //posted for every command queued
+Worker influxWorker;
+Worker archiveWorker;
+Worker traceWorker;
 
 // declare circular buffer objects used to log run time and readings from the two sensors
 CircularBuffer rtbuffer;         //buffer for storing local time strings
@@ -21,35 +98,113 @@ ElemType tempValue[MAXSCHEDENTRIES];
 
 influx_client_t c;
 
+//InfluxDB series written every cycle (built by initSeries), and the buffer readings are encoded into
+influx_series_t scaleSeries;
+influx_series_t sensorSeries[MAXSCHEDENTRIES];
+char influxStorage[INFLUX_BATCH_SIZE];
+influx_buf_t influxBatch;
+
+//local archive of all readings
+ArchiveWriter archive;
+
+//readings kept for the save command
+ExportHistory readingHistory;
+ExportRequest saveRequest;
+
+//record of every fill, for the history command
+FillHistory fillHistory;
+HistoryQuery historyRequest;
+
+//high rate traces of the fills
+FillTrace fillTraces[TRACE_BUFFERS];
+
+//health of the channels read every cycle
+ChannelHealth channelHealth[MAXSCHEDENTRIES+1];
+int numHealthChannels = 0;
+HealthConfig healthConfig;
+bool sensorFaultStop;
+
+//supply tank estimates, updated from the scale readings
+TankEstimator tank;
+TankForecast tankOutlook;
+PlanRequest planRequest;
+influx_series_t tankSeries;
+bool tankPublish; //new estimates to send to InfluxDB with the next readings
+bool tankAlerted[3]; //alerts sent (tank below the refill weight, refill weight soon, fill won't fit)
+time_t tankShortAlerted = 0; //fill last warned about
+static const char *tankAlertKeys[3] = {"tank_low", "tank_soon", "tank_short"};
+
+#define TANK_FORECAST_HOURS 168.0 //how far ahead the tank forecast looks
+#define MAX_FORECAST_FILLS 1024   //scheduled fills it considers
+
 
 int Boot(FillSched *s) {
   printf("Setting up the acquisition...\n");
 
+  initMetrics();
   readParameters();  //get parameters for run from file
   readCalibration(); //get sensor calibration data from file
-	readSchedule(s); //read in the filling schedule
+	readSchedule(s,"schedule.dat"); //read in the filling schedule
+
+  //set up the clock before anything reads the time
+  if (virtualClock) {
+    setClock(new ManualClock((double)clockStart, clockSpeedup));
+    printTime("Running on a virtual clock, starting at", getClock()->realtime());
+  }
 
   //try to make a lock file, abort the program
-  //if one exists already
+  //if one exists already, before touching the schedule checkpoint or the DAQ hardware
   l = new lock("LN2");
 
-  // Initialize (or re-initialize) all data saving buffers prior to run
-  cbInit(&rtbuffer, circBufferSize);
-  cbInit(&tbuffer, circBufferSize);
-  cbInit(&weightbuffer, circBufferSize);
-  for (int i = 0; i < s->numEntries; i++) {
-    cbInit(&sensorBuffer[i], circBufferSize);
+  //carry on with the schedule where the server stopped (this may resume a run)
+  restoreSchedule(s);
+
+  //load the DAQ driver named in the parameter file
+  bool daqLoaded = (loadDriver(daqDriver, daqConfig) >= 0);
+  bool daqReady = daqLoaded;
+
+  //every valve in the schedule has to be connected to the DAQ loaded
+  for (int i = 0; daqLoaded && (i < s->numEntries); i++) {
+    for (int j = 0; j < s->sched[i].numValves; j++) {
+      if (!getDriver()->hasLine(s->sched[i].valves[j])) {
+        printf("ERROR: Valve %i in schedule entry %i (%s) is not connected to the DAQ.\n", s->sched[i].valves[j], i + 1, s->sched[i].entryName);
+        daqReady = false;
+      }
+    }
   }
-  for (int i = 0; i < s->numEntries; i++) {
-    cbInit(&tempBuffer[i], circBufferSize);
+  if (!daqReady) {
+    unloadDriver();
+    l->unlock();
+    delete l;
+    return -1;
   }
 
+  // Initialize (or re-initialize) all data saving buffers prior to run
+  initBuffers(s);
+  initSeries(s);
+  initArchive(s);
+  initHistory();
+  initTraces();
+  initHealth(s);
+
   emailAllow = true;
   messageAllow = true;
-
-  //last thing we do: we enable the msg queue
-  msg = new MsgQ();
-  printf("Acquisition ready!\nType './LN2_master list' for a list of available commands.\nOr type './LN2_master begin' to start running.\n");
+  resetStats(); //set up the latency histograms
+  tankInit(&tank, tankSwapKg);
+
+  //the control loop doesn't depend on the metrics endpoint, so carry on without it if it can't be started
+  if (startMetricsServer(metricsPort) < 0)
+    printf("Continuing without the metrics endpoint.\n");
+  if (alertStart(&alertConfig) < 0)
+    printf("Continuing without sending alerts.\n");
+
+  //last thing we do: we start taking commands
+  if (startThreads() < 0)
+    return -1;
+  if (signaled.RUNNING)
+    printf("Acquisition ready, the run was resumed!\nType './LN2_master list' for a list of available commands.\n");
+  else
+    printf("Acquisition ready!\nType './LN2_master list' for a list of available commands.\nOr type './LN2_master begin' to start running.\n");
 
   return 1;
 }
@@ -57,19 +212,22 @@ int Boot(FillSched *s) {
 //The main loop, in which data is acquired and saved.
 int MainLoop(FillSched *s) {
 	double current_run_min;
-  int day, hour, minute;
-  struct tm *goodtime;
-  time_t now;
+  int hour, minute;
+  struct tm goodtime;
   bool foundDetector;
-
-  goodtime = (tm *)malloc(sizeof(tm));
+  unsigned long long tcycle, tstage, tfills;
 
   while (true) {
-
-    //check the msg queue
-    if (msg->read(command) == 1) {
-      ReadCommand(&signaled, command);
-      ProcessSignal(s);
+    tcycle = latencyNow();
+    tfills = 0;
+
+    //carry out the commands received since the last cycle
+    checkCommands(s);
+    if (!signaled.RUNNING) {
+      //nothing to do until a command arrives
+      while ((sem_wait(&commandReady) != 0) && (errno == EINTR))
+        ;
+      continue;
     }
     //if the acquisition is on
     if (signaled.RUNNING) {
@@ -83,7 +241,9 @@ int MainLoop(FillSched *s) {
           //check for matching detector name
           if(strcmp(s->sched[i].entryName,fillName)==0){
             foundDetector=true;
-            fill(s,i);
+            tstage = latencyNow();
+            fill(s,i,-1);
+            tfills += latencyNow() - tstage;
             break;
           }
         }
@@ -93,77 +253,56 @@ int MainLoop(FillSched *s) {
         
       }
 
-      time(&now);
-      goodtime = localtime(&now);
+      clockLocalTime(&goodtime);
       // printf("goodtime received \n");
-      day = goodtime->tm_wday;
-      //printf("day received %d\n", day);
-      hour = goodtime->tm_hour;
+      hour = goodtime.tm_hour;
       //printf("hour received %d\n", hour);
-      minute = goodtime->tm_min;
+      minute = goodtime.tm_min;
       //printf("minute received %d\n", minute);
 
 			//SCHEDULE FILLING
-			//check for fill conditions
-      for (int i=0;i<s->numEntries;i++){
-				//only check entries which are not awaiting fill
-				if(s->sched[i].schedFlag==0){
-					if(s->sched[i].schedMode == 7){
-						//fill in a set interval (given in minutes)
-						if((current_run_min - s->sched[i].lastTriggerTime) > s->sched[i].schedMin){
-							printf("Scheduling fill for %s ...\n",s->sched[i].entryName);
-							s->sched[i].schedFlag=1; //set the fill flag
-							s->sched[i].lastTriggerTime = current_run_min;
-							s->sched[i].hasBeenTriggered = 1;
-						}
-					}else if((s->sched[i].schedMode < 7)||(s->sched[i].schedMode == 9)){
-						//fill on a day of the week
-						//check that the day of the week is correct (schedMode == 9 for every day of the week)
-						if((day==s->sched[i].schedMode)||(s->sched[i].schedMode == 9)){
-							//check that the time is correct
-							if(hour>=s->sched[i].schedHour){
-                //restrict filling times
-                if((hour - s->sched[i].schedHour) < 2){
-                  if(minute>=s->sched[i].schedMin){
-                    //don't automatically schedule the same entry more than once
-                    if(s->sched[i].hasBeenTriggered == 0){
-                      printf("[%i:%i] Scheduling fill for %s ...\n",hour,minute,s->sched[i].entryName);
-                      s->sched[i].schedFlag=1; //set the fill flag
-                      s->sched[i].lastTriggerTime = current_run_min;
-                      s->sched[i].hasBeenTriggered = 1;
-                    }
-                  }
-                }else{
-                  //enough time has passed, entry may be scheduled again
-                  s->sched[i].hasBeenTriggered = 0;
-                }
-							}
-						}else{
-							//wrong day of the week
-							s->sched[i].schedFlag=0;
-						}
-					}
-				}
-			}
+      tstage = latencyNow();
+			evaluateSchedule(s,current_run_min,&goodtime);
+      saveSchedule(s);
+      latencyRecord(&stageHist[STAGE_SCHEDULE], latencyNow() - tstage);
 
       //PERFORM FILLING
       for (int i=0;i<s->numEntries;i++){
         if(s->sched[i].schedFlag){
-          fill(s,i); //start the fill cycle
-
-          //schedule entries that are supposed to occur directly after fills
-          for(int j=0;j<s->numEntries;j++){
-            if(j!=i){ //entries cannot run directly after themselves
-              if(s->sched[j].schedMode == 8){
-                if(s->sched[j].schedAfterEntry == i){
-                  current_run_min = GetTime()/60.0;
-                  printf("[%i:%i] Scheduling fill for %s ...\n",hour,minute,s->sched[j].entryName);
-                  s->sched[j].schedFlag=1; //set the fill flag
-                  s->sched[j].lastTriggerTime = current_run_min;
-                  s->sched[j].hasBeenTriggered = 1;
+          //entries scheduled directly after a fill are run as one continuous
+          //chain, so that valves shared between the steps are never closed
+          int entry = i;
+          while(entry >= 0){
+            int next = chainedEntry(s,entry);
+            tstage = latencyNow();
+            fill(s,entry,next); //start the fill cycle
+            tfills += latencyNow() - tstage;
+
+            //schedule entries that are supposed to occur directly after fills
+            for(int j=0;j<s->numEntries;j++){
+              if(j!=entry){ //entries cannot run directly after themselves
+                if(s->sched[j].schedMode == 8){
+                  if(s->sched[j].schedAfterEntry == entry){
+                    current_run_min = GetTime()/60.0;
+                    printf("[%i:%i] Scheduling fill for %s ...\n",hour,minute,s->sched[j].entryName);
+                    s->sched[j].schedFlag=1; //set the fill flag
+                    s->sched[j].lastTriggerTime = current_run_min;
+                    s->sched[j].hasBeenTriggered = 1;
+                  }
                 }
               }
             }
+            saveSchedule(s);
+
+            if((next >= 0)&&(signaled.RUNNING)){
+              entry = next;
+            }else{
+              entry = -1;
+              if(openValveMask != 0){
+                chanOff(); //chain was interrupted, don't leave any valves open
+                openValveMask = 0;
+              }
+            }
           }
         }
       }
@@ -171,27 +310,191 @@ int MainLoop(FillSched *s) {
       //record data
       recordMeasurement(s);
 
+      //fills are timed separately (STAGE_FILL_STEP), so that a cycle which ran
+      //a fill doesn't count as an overrun
+      unsigned long long work = latencyNow() - tcycle - tfills;
+      latencyRecord(&stageHist[STAGE_CYCLE], work);
+      if (work > 1000ULL*polling_time)
+        __sync_fetch_and_add(&cycleOverruns, 1ULL);
+
       //wait for some interval
-      usleep(polling_time);
+      waitCommands(s, polling_time);
     }
   }
   return 0;
 }
 
+/*--------------------------------------------------------------*/
+// Function which (re-)initializes all data saving buffers
+//names of the channels read every cycle, as archived and saved: the scale voltage, the weight, then the overflow sensors
+static void channelNames(FillSched *s, char names[][ARCHIVE_NAME_LENGTH]) {
+  strcpy(names[0], "scale_voltage");
+  strcpy(names[1], "weight");
+  for (int i = 0; i < s->numEntries; i++) {
+    strncpy(names[i+2], s->sched[i].entryName, ARCHIVE_NAME_LENGTH - 1);
+    names[i+2][ARCHIVE_NAME_LENGTH - 1] = '\0';
+  }
+}
+/*--------------------------------------------------------------*/
+void initBuffers(FillSched *s) {
+  static char names[MAXSCHEDENTRIES+2][ARCHIVE_NAME_LENGTH];
+
+  channelNames(s, names);
+  exportHistoryInit(&readingHistory, circBufferSize, s->numEntries + 2, names);
+  ctlChannels(s->numEntries + 2, names);
+  cbInit(&rtbuffer, circBufferSize);
+  cbInit(&tbuffer, circBufferSize);
+  cbInit(&weightbuffer, circBufferSize);
+  for (int i = 0; i < s->numEntries; i++) {
+    cbInit(&sensorBuffer[i], circBufferSize);
+  }
+  for (int i = 0; i < s->numEntries; i++) {
+    cbInit(&tempBuffer[i], circBufferSize);
+  }
+}
+/*--------------------------------------------------------------*/
+// Function which checks the fill conditions of every schedule entry at the given
+// run time (minutes) and time of day, and sets the fill flag of entries which are due.
+// Returns the number of entries which were scheduled.
+int evaluateSchedule(FillSched *s, double current_run_min, struct tm *now) {
+  int day = now->tm_wday;
+  int hour = now->tm_hour;
+  int minute = now->tm_min;
+  int numScheduled = 0;
+
+  //check for fill conditions
+  for (int i=0;i<s->numEntries;i++){
+    //only check entries which are not awaiting fill
+    if(s->sched[i].schedFlag==0){
+      if(s->sched[i].schedMode == 7){
+        //fill in a set interval (given in minutes)
+        if((current_run_min - s->sched[i].lastTriggerTime) > s->sched[i].schedMin){
+          printf("Scheduling fill for %s ...\n",s->sched[i].entryName);
+          s->sched[i].schedFlag=1; //set the fill flag
+          s->sched[i].lastTriggerTime = current_run_min;
+          s->sched[i].hasBeenTriggered = 1;
+          numScheduled++;
+        }
+      }else if((s->sched[i].schedMode < 7)||(s->sched[i].schedMode == 9)){
+        //fill on a day of the week
+        //check that the day of the week is correct (schedMode == 9 for every day of the week)
+        if((day==s->sched[i].schedMode)||(s->sched[i].schedMode == 9)){
+          //check that the time is correct
+          if(hour>=s->sched[i].schedHour){
+            //restrict filling times
+            if((hour - s->sched[i].schedHour) < 2){
+              if(minute>=s->sched[i].schedMin){
+                //don't automatically schedule the same entry more than once
+                if(s->sched[i].hasBeenTriggered == 0){
+                  printf("[%i:%i] Scheduling fill for %s ...\n",hour,minute,s->sched[i].entryName);
+                  s->sched[i].schedFlag=1; //set the fill flag
+                  s->sched[i].lastTriggerTime = current_run_min;
+                  s->sched[i].hasBeenTriggered = 1;
+                  numScheduled++;
+                }
+              }
+            }else{
+              //enough time has passed, entry may be scheduled again
+              s->sched[i].hasBeenTriggered = 0;
+            }
+          }
+        }else{
+          //wrong day of the week
+          s->sched[i].schedFlag=0;
+        }
+      }
+    }
+  }
+  return numScheduled;
+}
+/*--------------------------------------------------------------*/
+// Function which restores the schedule's trigger state saved by the last server (see checkpoint.h),
+// and resumes its run if it was running one
+void restoreSchedule(FillSched *s) {
+  static CheckpointState saved;
+  double now = getClock()->realtime();
+  int restored = 0;
+
+  runStartTime = now;
+  if (strcmp(scheduleState, "off") == 0)
+    return;
+  int ret = checkpointOpen(&scheduleCheckpoint, scheduleState, &saved);
+  if (ret < 0)
+    printf("Continuing without saving the schedule state.\n");
+  if (ret <= 0)
+    return;
+  if (saved.saved > now + 60.0) {
+    printf("The schedule state in %s was saved later than the current time (was the clock set back?), not restoring it.\n", scheduleState);
+    return;
+  }
+
+  if (saved.running)
+    runStartTime = saved.runStart;
+  for (int k = 0; k < saved.numEntries; k++) {
+    CheckpointEntry *c = &saved.entries[k];
+    for (int i = 0; i < s->numEntries; i++) {
+      SchedEntry *e = &s->sched[i];
+      if (strncmp(e->entryName, c->name, CHECKPOINT_NAME_LENGTH - 1) != 0)
+        continue;
+      e->schedFlag = c->schedFlag;
+      e->hasBeenTriggered = c->hasBeenTriggered;
+      e->lastTriggerTime = (c->lastTrigger > 0.0) ? (c->lastTrigger - runStartTime)/60.0 : 0.0;
+      //a time of day was triggered in an earlier window if it was over 2 hours ago (the server
+      //may have been down when the window ended), so it may be triggered again
+      if ((e->schedMode < 7) || (e->schedMode == 9))
+        if (now - c->lastTrigger >= 7200.0)
+          e->hasBeenTriggered = 0;
+      restored++;
+      break;
+    }
+  }
+  printTime("Restored the schedule state saved at", saved.saved);
+  printf("%i of %i schedule entries restored from %s.\n", restored, s->numEntries, scheduleState);
+
+  if (saved.running) {
+    //the run time carries on from the start of the run
+    signaled.RUNNING = true;
+    tstart = getClock()->monotonic() - (now - runStartTime);
+    printTime("Resuming the run started at", runStartTime);
+  }
+  saveSchedule(s);
+}
+/*--------------------------------------------------------------*/
+// Function which checkpoints the schedule's trigger state, if it changed since it was last saved
+void saveSchedule(FillSched *s) {
+  static CheckpointState state;
+
+  if (scheduleCheckpoint.map == NULL)
+    return;
+  memset(&state, 0, sizeof(state));
+  state.running = signaled.RUNNING;
+  state.runStart = runStartTime;
+  state.numEntries = (s->numEntries < CHECKPOINT_MAX_ENTRIES) ? s->numEntries : CHECKPOINT_MAX_ENTRIES;
+  for (int i = 0; i < state.numEntries; i++) {
+    SchedEntry *e = &s->sched[i];
+    CheckpointEntry *c = &state.entries[i];
+    strncpy(c->name, e->entryName, CHECKPOINT_NAME_LENGTH - 1);
+    c->schedFlag = e->schedFlag;
+    c->hasBeenTriggered = e->hasBeenTriggered;
+    c->lastTrigger = e->hasBeenTriggered ? runStartTime + 60.0*e->lastTriggerTime : 0.0;
+  }
+  if (checkpointSave(&scheduleCheckpoint, &state, getClock()->realtime()) < 0)
+    printf("ERROR: Could not save the schedule state to %s.\n", scheduleState);
+}
 /*--------------------------------------------------------------*/
 
 void ProcessSignal(FillSched* s) {
   if (signaled.BEGIN) {
     signaled.BEGIN = false;
     if (signaled.RUNNING == false) {
-      BeginRun();
+      BeginRun(s);
     } else
-      printf("Run started already, command ignored\n");
+      ctlPrintf("Run started already, command ignored\n");
   }
   if (signaled.TIME) {
     signaled.TIME = false;
     run_time = GetTime();
-    printf(" Time since the last filling is %f s.\n", run_time);
+    ctlPrintf(" Time since the last filling is %f s.\n", run_time);
   }
   if (signaled.END) {
     signaled.END = false;
@@ -199,16 +502,17 @@ void ProcessSignal(FillSched* s) {
     if (signaled.RUNNING == true)
       EndRun(s);
     else
-      printf("Run ended already, command ignored\n");
+      ctlPrintf("Run ended already, command ignored\n");
   }
   if (signaled.STOPFILL) {
+    signaled.STOPFILL = false;
     signaled.FILLING = false;
   }
   if (signaled.ON) {
     signaled.ON = false;
-    printf(".");
-    chanOn(atoi(masterParam)); //turn specified DAQ channel on
-    printf(".");
+    ctlPrintf(".");
+    chanOn(masterValue); //turn specified DAQ channel on
+    ctlPrintf(".");
   }
   if (signaled.OFF) {
     signaled.OFF = false;
@@ -216,174 +520,713 @@ void ProcessSignal(FillSched* s) {
   }
   if (signaled.MEASURE) {
     signaled.MEASURE = false;
-    meas = measure(atoi(masterParam)); //measure voltage
-    printf("Average voltage value is %10.5f\n", meas);
+    meas = measure(masterValue); //measure voltage
+    ctlPrintf("Average voltage value is %10.5f\n", meas);
   }
   if (signaled.PLOT) {
     signaled.PLOT = false;
-    getPlot(s);
+    if (masterParam[0] != '\0')
+      getRollupPlot(rollupFind(masterParam));
+    else
+      getPlot(s);
   }
   if (signaled.SAVE) {
     signaled.SAVE = false;
-    Save(s,filename);
+    if (exportStart(&readingHistory, &saveRequest) < 0) //the file is written in the background
+      ctlFail();
+  }
+  if (signaled.TANK) {
+    signaled.TANK = false;
+    printTank(s);
+  }
+  if (signaled.HISTORY) {
+    signaled.HISTORY = false;
+    printHistory();
+  }
+  if (signaled.PLAN) {
+    signaled.PLAN = false;
+    printPlan(s);
+  }
+  if (signaled.HEALTH) {
+    signaled.HEALTH = false;
+    printHealth();
+  }
+  if (signaled.STATS) {
+    signaled.STATS = false;
+    if (strcmp(masterParam, "reset") == 0) {
+      resetStats();
+      ctlPrintf("Latency statistics cleared.\n");
+    } else
+      printStats();
   }
   if (signaled.LIST) {
     signaled.LIST = false;
-    printf("begin              -- Begins the run.  The LN2 filling process will occur based on\n"); 
-    printf("                      the schedule defined in schedule.dat.\n");
-    printf("start              -- Same as above.\n");
-    printf("end                -- Ends the run.  If currently filling, ends the filling process.\n");
-    printf("stop               -- Same as above.\n");
-    printf("fill detector_name -- Starts the dewar filling process immediately for the detector\n");
-    printf("                      with name detector_name defined in schedule.dat.\n");
-    printf("stopfill           -- Stops any fill which is currently in progress, and continues the\n");
-    printf("                      run normally.\n");
-    printf("time               -- Shows the time elapsed since the last filling operation.\n");
-    printf("on X               -- Manually turns on the DAQ switch X, where X is an integer\n");
-    printf("                      (from 0 to 7 on the NIDAQ controller).\n");
-    printf("off                -- Manually turns off all DAQ switches, closing all valves.\n");
-    printf("measure X          -- Shows the voltage reading on DAQ channel X, where X is an\n");
-    printf("                      integer (from 0 to 7 on the NIDAQ controller).\n");
-    printf("table              -- Shows recent sensor data in a table format.\n");
-    printf("save filename      -- Saves recent sensor data to a text file with name specifed\n");
-    printf("                      by filename.\n");
-    printf("exit               -- Ends the run and exits the LN2_server program.\n");
-    printf("quit               -- Same as above.\n\n");
-    printf("Run parameters can be modified by editing the text file parameters.dat in the same folder as the main program.  Parameters may be edited while the program is running, in which case they will be applied on the subsequent run.\n");
+    ctlPrintf("begin              -- Begins the run.  The LN2 filling process will occur based on\n"); 
+    ctlPrintf("                      the schedule defined in schedule.dat.\n");
+    ctlPrintf("start              -- Same as above.\n");
+    ctlPrintf("end                -- Ends the run.  If currently filling, ends the filling process.\n");
+    ctlPrintf("stop               -- Same as above.\n");
+    ctlPrintf("fill detector_name -- Starts the dewar filling process immediately for the detector\n");
+    ctlPrintf("                      with name detector_name defined in schedule.dat.\n");
+    ctlPrintf("stopfill           -- Stops any fill which is currently in progress, and continues the\n");
+    ctlPrintf("                      run normally.\n");
+    ctlPrintf("time               -- Shows the time elapsed since the last filling operation.\n");
+    ctlPrintf("on X               -- Manually turns on the DAQ switch X, where X is an integer\n");
+    ctlPrintf("                      (from 0 to %i with the DAQ driver loaded).\n", getCapabilities()->numDigitalLines - 1);
+    ctlPrintf("off                -- Manually turns off all DAQ switches, closing all valves.\n");
+    ctlPrintf("measure X          -- Shows the voltage reading on DAQ channel X, where X is an\n");
+    ctlPrintf("                      integer (from 0 to %i with the DAQ driver loaded).\n", getCapabilities()->numAnalogInputs - 1);
+    ctlPrintf("table              -- Shows recent sensor data in a table format.\n");
+    ctlPrintf("table R            -- Shows the mean, minimum and maximum of each channel over every\n");
+    ctlPrintf("                      1 min, 15 min, 1 hour or 1 day (R = 1m, 15m, 1h or 1d).\n");
+    ctlPrintf("save filename [csv|bin] [R] [from TIME] [to TIME] [channels name,name,...]\n");
+    ctlPrintf("                   -- Saves recent sensor data to the file filename, as CSV (default)\n");
+    ctlPrintf("                      or in the archive format read by ln2_query (bin).  With a\n");
+    ctlPrintf("                      resolution R (1m, 15m, 1h or 1d), saves the mean, minimum and\n");
+    ctlPrintf("                      maximum over each interval instead of every reading.  TIME is\n");
+    ctlPrintf("                      HH:MM[:SS] or YYYY-MM-DD,HH:MM[:SS].  The file is written in the\n");
+    ctlPrintf("                      background.\n");
+    ctlPrintf("history [name] [last N] [from TIME] [to TIME] [today|week|month]\n");
+    ctlPrintf("                   -- Lists the last N fills (20 by default) of the detector name, or\n");
+    ctlPrintf("                      of all of them: when they started, how long they took, how they\n");
+    ctlPrintf("                      ended, the scale weight before and after and the peak sensor\n");
+    ctlPrintf("                      voltage.  today, week and month are since midnight, 7 days ago\n");
+    ctlPrintf("                      and the first of the month.\n");
+    ctlPrintf("history summary [name] [from TIME] [to TIME] [today|week|month]\n");
+    ctlPrintf("                   -- Shows the number of fills of each detector in the range, their\n");
+    ctlPrintf("                      mean time and LN2 used, and how many timed out or were stopped.\n");
+    ctlPrintf("health             -- Shows the mean, noise and problems found (open, saturated, frozen\n");
+    ctlPrintf("                      or erratic) of the scale and of each overflow sensor.\n");
+    ctlPrintf("tank               -- Shows the estimated LN2 supply tank level, boil-off and LN2 used\n");
+    ctlPrintf("                      by each fill, and when the tank is expected to need refilling.\n");
+    ctlPrintf("plan [every DAYS] [runs N] [risk PERCENT] [csv FILE]\n");
+    ctlPrintf("                   -- Simulates the schedule many times over, with the LN2 used by each\n");
+    ctlPrintf("                      fill drawn from its recorded fills, and shows the chance of the\n");
+    ctlPrintf("                      supply tank running dry by each day, when to swap it at the\n");
+    ctlPrintf("                      latest, and the best weekday for deliveries DAYS apart\n");
+    ctlPrintf("                      (delivery_interval_days by default).  Also written to FILE.\n");
+    ctlPrintf("follow [name ...]  -- Prints every new reading of the channels named (scale_voltage,\n");
+    ctlPrintf("                      weight or a detector name; all of them if none are named), and\n");
+    ctlPrintf("                      the valves opened and closed and the fills, as they happen.\n");
+    ctlPrintf("stats              -- Shows how long each stage of the server cycle takes (median,\n");
+    ctlPrintf("                      99th percentile and maximum) and how often cycles overran.\n");
+    ctlPrintf("stats reset        -- Clears the statistics shown by the stats command.\n");
+    ctlPrintf("exit               -- Ends the run and exits the LN2_server program.\n");
+    ctlPrintf("quit               -- Same as above.\n\n");
+    ctlPrintf("Run parameters can be modified by editing the text file parameters.dat in the same folder as the main program.  Parameters may be edited while the program is running, in which case they will be applied on the subsequent run.\n");
   }
   if (signaled.EXIT) {
-    if (signaled.FILLING == true) {
-      printf("\nFilling stopped partway.  Turning off DAQ switch ... \n\n");
+    if ((signaled.FILLING == true)||(openValveMask != 0)) {
+      ctlPrintf("\nFilling stopped partway.  Turning off DAQ switch ... \n\n");
       chanOff(); //make sure DAQ switch is off
+      openValveMask = 0;
     }
     if (signaled.RUNNING)
       EndRun(s);
+    ctlFinish(); //answer the exit command
+    planWait(); //let a plan being run be answered too
+    collectPlan();
+    ctlStop();
+    stopThreads(); //send and archive the readings still queued
+    archiveClose(&archive);
+    historyClose(&fillHistory);
+    for (int i = 0; i < TRACE_BUFFERS; i++)
+      traceFree(&fillTraces[i]);
+    if (scheduleCheckpoint.map != NULL)
+      checkpointClose(&scheduleCheckpoint);
+    exportWait(); //let a file being saved be completed
+    alertStop();  //and the alerts still queued be sent
+    unloadDriver();
     l->unlock();
     delete l;
     exit(EXIT_SUCCESS);
   }
 }
 /*--------------------------------------------------------------*/
-void ReadCommand(struct Signals *signal, char *command) {
-  if (signal == NULL || command == NULL) {
-    return;
+// Function which parses a command received from LN2_master (called by the command thread, so it
+// only checks the command and leaves carrying it out to the control loop, see applyCommand).
+// Returns -1 if the command wasn't understood.
+int ReadCommand(Command *cmd, char *command) {
+  char *param;
+
+  if (cmd == NULL || command == NULL) {
+    return -1;
   }
+  metricsAdd(&metrics.commands);
+  memset(cmd, 0, sizeof(Command));
   if (((strcmp(command, "end")) == 0) || ((strcmp(command, "stop")) == 0)) {
-    printf("\n Received end command ... \n\n");
-    signal->END = true;
+    ctlPrintf("\n Received end command ... \n\n");
+    cmd->type = CMD_END;
   } else if (((strcmp(command, "begin")) == 0) || ((strcmp(command, "start")) == 0)) {
-    printf("\n Starting run ...\n\n");
-    signal->BEGIN = true;
+    ctlPrintf("\n Starting run ...\n\n");
+    cmd->type = CMD_BEGIN;
   } else if ((strcmp(command, "time")) == 0) {
-    signal->TIME = true;
+    cmd->type = CMD_TIME;
+  } else if ((strcmp(command, "tank")) == 0) {
+    cmd->type = CMD_TANK;
+  } else if ((strcmp(command, "health")) == 0) {
+    cmd->type = CMD_HEALTH;
+  } else if ((strncmp(command, "stats", 5)) == 0) {
+    strtok(command, " ");
+    param = strtok(NULL, " ");
+    if (param != NULL)
+      strncpy(cmd->name, param, COMMAND_PARAM_SIZE - 1);
+    cmd->type = CMD_STATS;
+  } else if ((strncmp(command, "plan", 4)) == 0) {
+    strtok(command, " ");
+    if (planParse(&cmd->plan, strtok(NULL, "")) > 0) {
+      cmd->type = CMD_PLAN;
+    } else {
+      ctlPrintf("\n Invalid plan command (syntax: ./LN2_master plan [every DAYS] [runs N] [risk PERCENT] [csv FILE]).\n\n");
+      return -1;
+    }
+  } else if ((strncmp(command, "history", 7)) == 0) {
+    strtok(command, " ");
+    if (historyParse(&cmd->history, strtok(NULL, ""), clockTime()) > 0) {
+      cmd->type = CMD_HISTORY;
+    } else {
+      ctlPrintf("\n Invalid history command (syntax: ./LN2_master history [summary] [detector_name] [last N] [from TIME] [to TIME] [today|week|month]).\n\n");
+      return -1;
+    }
   } else if ((strstr(command, "save")) != NULL) {
-    filename = strtok(command, " ");
-    filename = strtok(NULL, " ");
-    printf("\n Saving data with filename %s ...\n\n", filename);
-    signal->SAVE = true;
+    char *saveFile;
+    strtok(command, " ");
+    saveFile = strtok(NULL, " ");
+    if ((saveFile != NULL) && (exportParse(&cmd->save, saveFile, strtok(NULL, ""), clockTime()) > 0)) {
+      cmd->type = CMD_SAVE;
+    } else {
+      ctlPrintf("\n Invalid save command (syntax: ./LN2_master save filename [csv|bin] [1m|15m|1h|1d] [from TIME] [to TIME] [channels name,name,...]).\n\n");
+      return -1;
+    }
   } else if (((strcmp(command, "exit")) == 0) || ((strcmp(command, "quit")) == 0)) {
-    printf("\n Received exit command ... \n\n");
-    signal->EXIT = true;
+    ctlPrintf("\n Received exit command ... \n\n");
+    cmd->type = CMD_EXIT;
   } else if ((strstr(command, "on")) != NULL) {
-    masterParam = strtok(command, " ");
-    masterParam = strtok(NULL, " ");
-    if (masterParam != NULL && atoi(masterParam) >= 0 && atoi(masterParam) < 8) {
-      printf("\n Turning on DAQ switch P0.%i... \n\n", atoi(masterParam));
-      signal->ON = true;
+    strtok(command, " ");
+    param = strtok(NULL, " ");
+    if (param != NULL && atoi(param) >= 0 && atoi(param) < getCapabilities()->numDigitalLines) {
+      ctlPrintf("\n Turning on DAQ switch %i... \n\n", atoi(param));
+      cmd->type = CMD_ON;
+      cmd->value = atoi(param);
     } else {
-      printf("\n Invalid valve specified.  Type 'on X', where 'X' is an integer from 0 to 7. \n\n");
+      ctlPrintf("\n Invalid valve specified.  Type 'on X', where 'X' is an integer from 0 to %i. \n\n", getCapabilities()->numDigitalLines - 1);
+      return -1;
     }
   } else if ((strcmp(command, "off")) == 0) {
-    printf("\n Turning off DAQ switch ... \n\n");
-    signal->OFF = true;
+    ctlPrintf("\n Turning off DAQ switch ... \n\n");
+    cmd->type = CMD_OFF;
   } else if ((strstr(command, "measure")) != NULL) {
-    masterParam = strtok(command, " ");
-    masterParam = strtok(NULL, " ");
-    if (masterParam != NULL && atoi(masterParam) >= 0 && atoi(masterParam) < 8) {
-      printf("\n Measuring voltage on DAQ channel ai%i... \n\n", atoi(masterParam));
-      signal->MEASURE = true;
+    strtok(command, " ");
+    param = strtok(NULL, " ");
+    if (param != NULL && atoi(param) >= 0 && atoi(param) < getCapabilities()->numAnalogInputs) {
+      ctlPrintf("\n Measuring voltage on DAQ channel ai%i... \n\n", atoi(param));
+      cmd->type = CMD_MEASURE;
+      cmd->value = atoi(param);
     } else {
-      printf("\n Invalid DAQ channel specified.  Type 'measure X', where 'X' is an integer from 0 to 7. \n\n");
+      ctlPrintf("\n Invalid DAQ channel specified.  Type 'measure X', where 'X' is an integer from 0 to %i. \n\n", getCapabilities()->numAnalogInputs - 1);
+      return -1;
     }
   } else if ((strcmp(command, "stopfill")) == 0) {
-    printf("\n Received command to stop the current fill ... \n\n");
-    signal->STOPFILL = true;
+    ctlPrintf("\n Received command to stop the current fill ... \n\n");
+    cmd->type = CMD_STOPFILL;
   } else if ((strstr(command, "fill")) != NULL) {
-    fillName = strtok(command, " ");
-    fillName = strtok(NULL, " ");
-    if(fillName != NULL){
-      printf("\n Received command to fill %s ...\n\n", fillName);
-      signal->FILL = true;
-      //start the run if it hasn't already been started
-      if(signal->RUNNING == false){
-        signal->BEGIN = true;
-      }
+    strtok(command, " ");
+    param = strtok(NULL, " ");
+    if(param != NULL){
+      ctlPrintf("\n Received command to fill %s ...\n\n", param);
+      cmd->type = CMD_FILL;
+      strncpy(cmd->name, param, COMMAND_PARAM_SIZE - 1);
     }else{
-      printf("\n Invalid fill command (syntax: ./LN2_master fill detector_name).\n\n");
+      ctlPrintf("\n Invalid fill command (syntax: ./LN2_master fill detector_name).\n\n");
+      return -1;
+    }
+  } else if ((strncmp(command, "table", 5)) == 0) {
+    strtok(command, " ");
+    param = strtok(NULL, " ");
+    if ((param != NULL) && (rollupFind(param) < 0)) {
+      ctlPrintf("\n Invalid resolution %s.  Type 'table', or 'table R' where 'R' is 1m, 15m, 1h or 1d. \n\n", param);
+      return -1;
+    } else {
+      ctlPrintf("\n Showing table of recent data ... \n\n");
+      cmd->type = CMD_TABLE;
+      if (param != NULL)
+        strncpy(cmd->name, param, COMMAND_PARAM_SIZE - 1);
     }
-  } else if ((strcmp(command, "table")) == 0) {
-    printf("\n Showing table of recent data ... \n\n");
-    signal->PLOT = true;
   } else if (((strcmp(command, "list")) == 0) || ((strcmp(command, "help")) == 0)) {
-    printf("\n Showing list of available commands ... \n\n");
-    signal->LIST = true;
+    ctlPrintf("\n Showing list of available commands ... \n\n");
+    cmd->type = CMD_LIST;
   } else {
-    printf("\n Command not understood (%s).\n\n",command);
-    ;
+    ctlPrintf("\n Command not understood (%s).\n\n",command);
+    return -1;
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+// Function which sets the signals (and their parameters) for a command taken from the command
+// queue, for ProcessSignal to act on.  Only called by the control loop.
+void applyCommand(const Command *cmd) {
+  switch (cmd->type) {
+  case CMD_BEGIN:
+    signaled.BEGIN = true;
+    break;
+  case CMD_END:
+    signaled.END = true;
+    break;
+  case CMD_TIME:
+    signaled.TIME = true;
+    break;
+  case CMD_TANK:
+    signaled.TANK = true;
+    break;
+  case CMD_HEALTH:
+    signaled.HEALTH = true;
+    break;
+  case CMD_STATS:
+    strcpy(masterParam, cmd->name);
+    signaled.STATS = true;
+    break;
+  case CMD_SAVE:
+    saveRequest = cmd->save;
+    signaled.SAVE = true;
+    break;
+  case CMD_EXIT:
+    signaled.EXIT = true;
+    break;
+  case CMD_ON:
+    masterValue = cmd->value;
+    signaled.ON = true;
+    break;
+  case CMD_OFF:
+    signaled.OFF = true;
+    break;
+  case CMD_MEASURE:
+    masterValue = cmd->value;
+    signaled.MEASURE = true;
+    break;
+  case CMD_STOPFILL:
+    signaled.STOPFILL = true;
+    break;
+  case CMD_FILL:
+    strcpy(fillName, cmd->name);
+    signaled.FILL = true;
+    //start the run if it hasn't already been started
+    if(signaled.RUNNING == false){
+      signaled.BEGIN = true;
+    }
+    break;
+  case CMD_TABLE:
+    strcpy(masterParam, cmd->name);
+    signaled.PLOT = true;
+    break;
+  case CMD_LIST:
+    signaled.LIST = true;
+    break;
+  case CMD_HISTORY:
+    historyRequest = cmd->history;
+    signaled.HISTORY = true;
+    break;
+  case CMD_PLAN:
+    planRequest = cmd->plan;
+    signaled.PLAN = true;
+    break;
+  case CMD_NONE:
+    break;
+  }
+}
+/*--------------------------------------------------------------*/
+// Function which carries out the commands queued since it was last called, in the order they were
+// received, and gives back what they printed to be sent to the clients which sent them
+void checkCommands(FillSched *s) {
+  Command cmd;
+  unsigned long long tstage;
+
+  collectPlan();
+  while (ringPop(&commandQueue, &cmd)) {
+    tstage = latencyNow();
+    ctlBegin(cmd.reply);
+    applyCommand(&cmd);
+    ProcessSignal(s);
+    ctlFinish();
+    latencyRecord(&stageHist[STAGE_COMMAND], latencyNow() - tstage);
+  }
+}
+/*--------------------------------------------------------------*/
+// Function which waits for the given time on the server clock, carrying out commands as they arrive.
+// Returns early if a command stops the fill in progress, or (outside of fills) asks for a fill or
+// ends the run.
+void waitCommands(FillSched *s, long usec) {
+  bool filling = signaled.FILLING;
+
+  while (usec > 0) {
+    long wait = (usec < COMMAND_CHECK_TIME) ? usec : COMMAND_CHECK_TIME;
+    getClock()->sleep(wait);
+    usec -= wait;
+    checkCommands(s);
+    if (filling ? !signaled.FILLING : (signaled.FILL || !signaled.RUNNING))
+      return;
+  }
+}
+/*--------------------------------------------------------------*/
+// Function called by the control socket thread for every command received: checks the command and
+// queues it for the control loop.  Commands which weren't understood are queued too, so that every
+// client is answered in the order it sent its commands.
+static int queueCommand(Reply *reply, char *command) {
+  Command cmd;
+
+  if (ringCount(&commandQueue) == COMMAND_QUEUE_SIZE)
+    return 0; //full, the socket thread hands the command over again later
+  if (ReadCommand(&cmd, command) < 0) {
+    cmd.type = CMD_NONE;
+    reply->status = -1;
   }
+  cmd.reply = reply;
+  ringPush(&commandQueue, &cmd);
+  sem_post(&commandReady);
+  return 1;
 }
 /*--------------------------------------------------------------*/
-int BeginRun(void) {
+int BeginRun(FillSched *s) {
+  double now = getClock()->realtime();
   signaled.RUNNING = true;
 
-  ftime(&tstart);
-  printf("Run start at %s\n", ctime(&tstart.time));
+  tstart = getClock()->monotonic();
+  //the trigger times are run times (minutes), keep them pointing at the same time in the new run
+  //(so that intervals are counted from the last fill, and not from the start of the run)
+  for (int i = 0; i < s->numEntries; i++) {
+    if (s->sched[i].hasBeenTriggered)
+      s->sched[i].lastTriggerTime += (runStartTime - now)/60.0;
+    else
+      s->sched[i].lastTriggerTime = 0.0;
+  }
+  runStartTime = now;
+  saveSchedule(s);
+  printTime("Run start at", now);
   return 1;
 }
 /*--------------------------------------------------------------*/
 int EndRun(FillSched* s) {
-  ftime(&tstop);
-  printf("Run end at %s\n", ctime(&tstop.time));
+  tstop = getClock()->monotonic();
+  printTime("Run end at", getClock()->realtime());
   current_run_time = GetTime();
-  printf("Ending acquisition\n");
-  printf("Run time %15.3f [s]\n", current_run_time);
+  ctlPrintf("Ending acquisition\n");
+  ctlPrintf("Run time %15.3f [s]\n", current_run_time);
   signaled.RUNNING = false;
+  saveSchedule(s);
+
+  //don't leave the last readings of the run only in memory (the archive thread
+  //does it once it has appended the readings queued before)
+  Reading r;
+  r.flush = true;
+  if (!archiveWorker.running)
+    archiveFlush(&archive);
+  else if (!workerPush(&archiveWorker, &r))
+    ctlPrintf("WARNING: The archive thread is behind, the archive wasn't flushed.\n");
 
   return 1;
 }
 /*--------------------------------------------------------------*/
 double GetTime(void) {
-  double telapsed;
-  ftime(&tcurrent);
-  telapsed = tcurrent.millitm - tstart.millitm;
-  telapsed = telapsed / 1000 + tcurrent.time - tstart.time;
-  return telapsed;
+  tcurrent = getClock()->monotonic();
+  return tcurrent - tstart;
+}
+/*--------------------------------------------------------------*/
+// Function which prints the latency statistics of each stage of the server cycle (all times in ms)
+void printStats(void) {
+  const double ms = 1.0E-6;
+  ctlPrintf("%-14s %10s %10s %10s %10s %10s\n", "stage", "count", "mean", "p50", "p99", "max");
+  for (int i = 0; i < NUM_STAGES; i++) {
+    LatencyHist *h = &stageHist[i];
+    unsigned long long count = latencyLoad(&h->count);
+    ctlPrintf("%-14s %10llu %10.3f %10.3f %10.3f %10.3f\n", h->name, count,
+           count ? ms*latencyLoad(&h->sum)/count : 0.0,
+           ms*latencyPercentile(h, 50.0), ms*latencyPercentile(h, 99.0), ms*latencyLoad(&h->max));
+  }
+  ctlPrintf("\nCycles taking longer than the polling time (%i us): %llu of %llu\n", polling_time, cycleOverruns, stageHist[STAGE_CYCLE].count);
+  ctlPrintf("Fill loop passes taking longer than 1 s: %llu of %llu\n\n", fillOverruns, stageHist[STAGE_FILL_STEP].count);
 }
-// Function which records current sensor values in circular buffers
+/*--------------------------------------------------------------*/
+void resetStats(void) {
+  const char *names[NUM_STAGES] = {"cycle", "command", "schedule", "measure", "buffer", "post_http", "archive", "record", "fill_measure", "fill_step"};
+  for (int i = 0; i < NUM_STAGES; i++)
+    latencyInit(&stageHist[i], names[i]);
+  cycleOverruns = 0;
+  fillOverruns = 0;
+}
+/*--------------------------------------------------------------*/
+// Function which prints a message followed by a clock time (seconds since the epoch)
+void printTime(const char *message, double t) {
+  time_t tt = (time_t)t;
+  char str[64];
+  ctime_r(&tt, str);
+  ctlPrintf("%s %s\n", message, str);
+}
+// Function which counts the readings sent to InfluxDB, given the return value of post_http
+static void countPost(int ret, int points) {
+  __sync_fetch_and_add(&metrics.posts, (unsigned long long)points);
+  if (ret != 0)
+    __sync_fetch_and_add(&metrics.postFailures, (unsigned long long)points);
+}
+// Function which sends the encoded readings to InfluxDB with the transport chosen in parameters.dat
+static void sendMeasurement(int points) {
+  int ret;
+  if (influxUDP) {
+    int failed;
+    int sent = send_udp_lines(&c, influxBatch.buf, influxBatch.used, influxMTU, &failed);
+    if (sent < 0)
+      failed = 1;
+    else
+      __sync_fetch_and_add(&metrics.udpDatagrams, (unsigned long long)sent);
+    if (failed > 0)
+      __sync_fetch_and_add(&metrics.udpSendFailures, (unsigned long long)failed);
+    ret = (failed > 0) ? -1 : 0;
+  } else {
+    ret = post_http_lines(&c, influxBatch.buf, influxBatch.used);
+  }
+  countPost(ret, points);
+}
+// Function which builds the InfluxDB series written by encodeMeasurement.  All readings go to the
+// ln2 measurement, tagged with the DAQ channel, the schedule entry (for overflow sensors) and the
+// kind of reading, so that they don't depend on the order of the entries in schedule.dat.
+void initSeries(FillSched *s) {
+  char channel[16];
+
+  sprintf(channel, "ai%i", scaleInput);
+  influx_series_init(&scaleSeries, "ln2");
+  influx_series_tag(&scaleSeries, "channel", channel);
+  influx_series_tag(&scaleSeries, "kind", "scale");
+  for (int i = 0; i < s->numEntries; i++) {
+    sprintf(channel, "ai%i", s->sched[i].overflowSensor);
+    influx_series_init(&sensorSeries[i], "ln2");
+    influx_series_tag(&sensorSeries[i], "channel", channel);
+    influx_series_tag(&sensorSeries[i], "entry", s->sched[i].entryName);
+    influx_series_tag(&sensorSeries[i], "kind", "overflow");
+  }
+  influx_series_init(&tankSeries, "ln2");
+  influx_series_tag(&tankSeries, "kind", "tank");
+  influx_buf_init(&influxBatch, influxStorage, sizeof(influxStorage));
+}
+// Function which opens the local archive, with one column for the scale voltage, one for the
+// weight and one for each overflow sensor (named after the schedule entry)
+void initArchive(FillSched *s) {
+  static char names[MAXSCHEDENTRIES+2][ARCHIVE_NAME_LENGTH];
+
+  memset(&archive, 0, sizeof(archive));
+  if (strcmp(archiveFile, "off") == 0)
+    return;
+  channelNames(s, names);
+  if (archiveOpen(&archive, archiveFile, s->numEntries + 2, names) < 0)
+    printf("Continuing without the local archive.\n");
+}
+// Function which opens the history of the fills
+void initHistory(void) {
+  memset(&fillHistory, 0, sizeof(fillHistory));
+  if (strcmp(fillHistoryFile, "off") == 0)
+    return;
+  int n = historyOpen(&fillHistory, fillHistoryFile);
+  if (n < 0)
+    printf("Continuing without the fill history.\n");
+  else
+    printf("%i fills in the fill history %s.\n", n, fillHistoryFile);
+}
+// Function which allocates the buffers the fills are traced into, each large enough for the longest fill
+void initTraces(void) {
+  memset(fillTraces, 0, sizeof(fillTraces));
+  if ((traceInterval <= 0) || (strcmp(traceDir, "off") == 0))
+    return;
+  if ((mkdir(traceDir, 0755) < 0) && (errno != EEXIST)) {
+    perror(traceDir);
+    printf("Continuing without fill traces.\n");
+    return;
+  }
+  int maxSamples = (int)((maxfilltime + 60.0)*1000.0/traceInterval) + 2;
+  for (int i = 0; i < TRACE_BUFFERS; i++) {
+    if (traceAlloc(&fillTraces[i], maxSamples) < 0) {
+      printf("ERROR: Could not allocate the fill trace buffers.\nContinuing without fill traces.\n");
+      for (int j = 0; j < i; j++)
+        traceFree(&fillTraces[j]);
+      return;
+    }
+  }
+  printf("Fills are traced every %i ms to %s.\n", traceInterval, traceDir);
+}
+// Function which writes one set of readings into the InfluxDB batch buffer, in line protocol
+// (returns the length of the batch, or -1 if it didn't fit)
+int encodeMeasurement(const Reading *r) {
+  long long ts = 1000000000LL*r->t;
+
+  influx_buf_reset(&influxBatch);
+
+  influx_line_begin(&influxBatch, &scaleSeries);
+  influx_line_float(&influxBatch, "voltage", r->weightV);
+  influx_line_float(&influxBatch, "weight", r->weight);
+  influx_line_int(&influxBatch, "health", r->health[0]);
+  influx_line_end(&influxBatch, ts);
+
+  for (int i = 0; i < r->numSensors; i++) {
+    influx_line_begin(&influxBatch, &sensorSeries[i]);
+    influx_line_float(&influxBatch, "voltage", r->sensor[i]);
+    influx_line_bool(&influxBatch, "overflow", r->sensor[i] > threshold);
+    influx_line_int(&influxBatch, "health", r->health[i+1]);
+    influx_line_end(&influxBatch, ts);
+  }
+
+  //supply tank estimates, whenever they are updated
+  if (r->tank) {
+    influx_line_begin(&influxBatch, &tankSeries);
+    influx_line_float(&influxBatch, "level", r->tankLevel);
+    if (r->tankBoiloffValid)
+      influx_line_float(&influxBatch, "boiloff", r->tankBoiloff);
+    if (r->tankHours >= 0.0)
+      influx_line_float(&influxBatch, "hours_to_empty", r->tankHours);
+    influx_line_bool(&influxBatch, "fills_fit", r->tankFillsFit);
+    influx_line_end(&influxBatch, ts);
+  }
+
+  return influxBatch.error ? -1 : (int)influxBatch.used;
+}
+// Function run by the InfluxDB thread for each set of readings: sends them all in one request
+// (or as few datagrams as possible)
+static void sendReading(const void *record) {
+  const Reading *r = (const Reading *)record;
+  unsigned long long tstage = latencyNow();
+  int points = r->numSensors + 1 + (r->tank ? 1 : 0);
+
+  if (encodeMeasurement(r) < 0)
+    countPost(-1, points);
+  else
+    sendMeasurement(points);
+  latencyRecord(&stageHist[STAGE_POST], latencyNow() - tstage);
+}
+// Function run by the archive thread for each set of readings
+static void archiveReading(const void *record) {
+  const Reading *r = (const Reading *)record;
+  float row[MAXSCHEDENTRIES+2];
+  unsigned long long tstage = latencyNow();
+
+  if (r->flush) {
+    archiveFlush(&archive);
+    return;
+  }
+  row[0] = r->weightV; //row: scale voltage, weight, then the overflow sensors
+  row[1] = r->weight;
+  for (int i = 0; i < r->numSensors; i++)
+    row[i+2] = r->sensor[i];
+  archiveAppend(&archive, 1000LL*r->t, row);
+  latencyRecord(&stageHist[STAGE_ARCHIVE], latencyNow() - tstage);
+}
+// Function run by the trace thread for each fill which has ended: writes its trace, and frees the buffer
+static void writeTrace(const void *record) {
+  FillTrace *trace = &fillTraces[*(const int *)record];
+
+  if (traceWrite(trace) < 0)
+    printf("ERROR: Could not write the fill trace %s.\n", trace->path);
+  __sync_lock_release(&trace->busy);
+}
+// Function which starts the control socket and the telemetry threads (the telemetry isn't needed
+// to control the fills, so the server carries on without a thread which can't be started)
+int startThreads(void) {
+  if (ringInit(&commandQueue, COMMAND_QUEUE_SIZE, sizeof(Command)) < 0) {
+    printf("ERROR: Could not allocate the command queue.\n");
+    return -1;
+  }
+  sem_init(&commandReady, 0, 0);
+  if (ctlStart(controlSocket, queueCommand) < 0)
+    return -1;
+  if (workerStart(&influxWorker, "InfluxDB", TELEMETRY_QUEUE_SIZE, sizeof(Reading), sendReading) < 0)
+    printf("Continuing without sending the readings to InfluxDB.\n");
+  if ((archive.data != NULL) && (workerStart(&archiveWorker, "archive", TELEMETRY_QUEUE_SIZE, sizeof(Reading), archiveReading) < 0))
+    printf("Continuing without the local archive.\n");
+  if ((fillTraces[0].samples != NULL) && (workerStart(&traceWorker, "trace", TRACE_QUEUE_SIZE, sizeof(int), writeTrace) < 0))
+    printf("Continuing without fill traces.\n");
+  return 1;
+}
+// Function which stops the telemetry threads once they have dealt with the readings queued for them
+void stopThreads(void) {
+  workerStop(&influxWorker);
+  workerStop(&archiveWorker);
+  workerStop(&traceWorker);
+}
+// Function which records current sensor values in circular buffers, and hands them to the telemetry threads
 int recordMeasurement(FillSched *s) {
   double weightV, weight;
+  float volts[MAXSCHEDENTRIES+2];
   double sensor[MAXSCHEDENTRIES];
-  char sensorName[256];
   time_t current_time;
-  long long ts;
+  unsigned long long trecord, tstage;
+  Reading r;
 
-  time(&current_time);
-  ts = current_time;
-  ts *= 1000000000;
-  //	printf("current time %ld time stame %lld\n",current_time,ts);
+  trecord = latencyNow();
+  current_time = clockTime();
+  current_run_time = GetTime(); //run time saved with the readings
 
-  weightV = measure(scaleInput);
+  //read the scale and all overflow sensors in one batch
+  measChans[0] = scaleInput;
   for(int i=0;i<s->numEntries;i++){
-    if(i<MAXSCHEDENTRIES){
-      sensor[i] = measure(s->sched[i].overflowSensor);
-    }
+    measChans[i+1] = s->sched[i].overflowSensor;
+  }
+  tstage = latencyNow();
+  measureChannels(measChans, s->numEntries+1, volts);
+  latencyRecord(&stageHist[STAGE_MEASURE], latencyNow() - tstage);
+  checkHealth(s, volts);
+  weightV = volts[0];
+  for(int i=0;i<s->numEntries;i++){
+    sensor[i] = volts[i+1];
   }
   weight = findWeight(weightV);
+  __sync_lock_test_and_set(&metrics.weightGrams, (long long)(weight*1000.0));
+
+  //update the supply tank estimates (every few minutes, between fills)
+  int tankFlags = tankAdd(&tank, current_time, weight);
+  if (tankFlags != 0)
+    checkTank(s, tankFlags);
+
+  //save the readings to the local buffers
+  tstage = latencyNow();
+  bufferMeasurement(s, current_time, weight, sensor);
+  latencyRecord(&stageHist[STAGE_BUFFER], latencyNow() - tstage);
+
+  //keep the readings for the save command
+  volts[1] = weight; //row: scale voltage, weight, then the overflow sensors
+  for (int i = 0; i < s->numEntries; i++)
+    volts[i+2] = sensor[i];
+  exportHistoryAppend(&readingHistory, current_time, current_run_time, volts);
+  ctlPublishSample(current_time, volts); //and send them to the clients following them
+
+  //and hand them to the threads sending them to InfluxDB and the archive
+  r.flush = false;
+  r.t = current_time;
+  r.runTime = current_run_time;
+  r.weightV = weightV;
+  r.weight = weight;
+  r.numSensors = s->numEntries;
+  for (int i = 0; i < s->numEntries; i++)
+    r.sensor[i] = sensor[i];
+  for (int i = 0; i < s->numEntries + 1; i++)
+    r.health[i] = (unsigned char)channelHealth[i].flags;
+  r.tank = tankPublish;
+  if (tankPublish) {
+    tankPublish = false;
+    r.tankLevel = tankLevel(&tank, current_time);
+    r.tankBoiloff = tank.boiloff;
+    r.tankBoiloffValid = tank.boiloffValid;
+    r.tankHours = tankOutlook.hoursToEmpty;
+    r.tankFillsFit = tankOutlook.shortEntry < 0;
+  }
+  if (!workerPush(&influxWorker, &r))
+    metricsAdd(&metrics.telemetryDropped);
+  if ((archive.data != NULL) && !workerPush(&archiveWorker, &r))
+    metricsAdd(&metrics.telemetryDropped);
 
-      
+  latencyRecord(&stageHist[STAGE_RECORD], latencyNow() - trecord);
+  return 1;
+}
+// Function which saves one set of readings to the circular buffers
+void bufferMeasurement(FillSched *s, time_t current_time, double weight, double *sensor) {
+  struct tm local;
 
   //save real time to buffer
-  strftime(rtelement.value, 80, "%d-%m-%Y,%H:%M:%S", localtime(&tcurrent.time));
+  localtime_r(&current_time, &local);
+  strftime(rtelement.value, 80, "%d-%m-%Y,%H:%M:%S", &local);
   cbWrite(&rtbuffer, &rtelement);
   //save run time to buffer
   sprintf(telement.value, "%f", current_run_time);
@@ -391,49 +1234,24 @@ int recordMeasurement(FillSched *s) {
   //save scale sensor measurement to buffer
   sprintf(weightelement.value, "%f", weight);
   cbWrite(&weightbuffer, &weightelement);
-  post_http(&c,
-            INFLUX_MEAS("scale"),
-            INFLUX_F_FLT("scale", weightV, 6),
-            INFLUX_TS(ts),
-            INFLUX_END);
-
-  post_http(&c,
-            INFLUX_MEAS("weight"),
-            INFLUX_F_FLT("weight", weight, 6),
-            INFLUX_TS(ts),
-            INFLUX_END);
-
-  for(int i=0;i<s->numEntries;i++){
-    if(i<MAXSCHEDENTRIES){
-      sprintf(sensorName,"sensor%i",i);
-      post_http(&c,
-            INFLUX_MEAS(sensorName),
-            INFLUX_F_FLT(sensorName, sensor[i], 6),
-            INFLUX_TS(ts),
-            INFLUX_END);
-    }
-  }
-  
 
   for (int i = 0; i < s->numEntries; i++) {
     //save overflow sensor measurement to buffer
-    sprintf(sensorValue[i].value, "%f", measure(s->sched[i].overflowSensor));
+    sprintf(sensorValue[i].value, "%f", sensor[i]);
     cbWrite(&sensorBuffer[i], &sensorValue[i]);
   }
-
-  return 1;
 }
 // Function which prints a table of sensor values to the command line
 int getPlot(FillSched *s) {
 
-  printf("Real Time		Run Time (s)	Scale Sensor (V)	");
+  ctlPrintf("Real Time		Run Time (s)	Scale Sensor (V)	");
   for (int i = 0; i < s->numEntries; i++) {
-    printf("Sensor %i (V)	", i + 1);
+    ctlPrintf("Sensor %i (V)	", i + 1);
   }
   for (int i = 0; i < s->numEntries; i++) {
-    printf("Temp. Sensor %i (K)	", i + 1);
+    ctlPrintf("Temp. Sensor %i (K)	", i + 1);
   }
-  printf("\n"); //Line break at end
+  ctlPrintf("\n"); //Line break at end
 
   // Print all elements in the buffers
   for (int i = 0; i < cbCount(&tbuffer); i++) {
@@ -441,64 +1259,603 @@ int getPlot(FillSched *s) {
     cbRead(&rtbuffer, &rtelement); //read values from buffers
     cbRead(&tbuffer, &telement);
     cbRead(&weightbuffer, &weightelement);
-    printf("%s	%s	%s	", rtelement.value, telement.value, weightelement.value); //print readings
+    ctlPrintf("%s	%s	%s	", rtelement.value, telement.value, weightelement.value); //print readings
     cbWrite(&rtbuffer, &rtelement);                                                           //put values that were just read back in buffers so that they can be read again
     cbWrite(&tbuffer, &telement);
     cbWrite(&weightbuffer, &weightelement);
     for (int i = 0; i < s->numEntries; i++) {
       cbRead(&sensorBuffer[i], &sensorValue[i]);
-      printf("%s	", sensorValue[i].value); //print all voltage sensor values
+      ctlPrintf("%s	", sensorValue[i].value); //print all voltage sensor values
       cbWrite(&sensorBuffer[i], &sensorValue[i]);
     }
     for (int i = 0; i < s->numEntries; i++) {
       cbRead(&tempBuffer[i], &tempValue[i]);
-      printf("%s	", tempValue[i].value); //print all temp sensor values
+      ctlPrintf("%s	", tempValue[i].value); //print all temp sensor values
       cbWrite(&tempBuffer[i], &tempValue[i]);
     }
-    printf("\n"); //Line break at end
+    ctlPrintf("\n"); //Line break at end
   }
   return 1;
 }
-// Function which prints a table of sensor values to a text file
-int Save(FillSched *s, char *filename) {
-  FILE *fp;
-  fp = fopen(filename, "w");
-  printf("Saving data...\n");
-
-  fprintf(fp, "Real Time		Run Time (s)	Scale Sensor (V)	");
-  for (int i = 0; i < s->numEntries; i++) {
-    fprintf(fp, "Sensor %i (V)	", i + 1);
+// Function which prints the mean, minimum and maximum of each channel over each interval of a rollup tier
+int getRollupPlot(int tier) {
+  RollupTier *r = &readingHistory.rollups[tier];
+  char timeStr[32];
+  struct tm local;
+
+  ctlPrintf("Start Time		Readings	");
+  for (int c = 0; c < r->numChannels; c++) {
+    ctlPrintf("%s mean/min/max	", readingHistory.names[c]);
   }
+  ctlPrintf("\n"); //Line break at end
+
+  for (int i = 0; i < r->count; i++) {
+    int slot = rollupSlot(r, i);
+    localtime_r(&r->t[slot], &local);
+    strftime(timeStr, sizeof(timeStr), "%d-%m-%Y,%H:%M:%S", &local);
+    ctlPrintf("%s	%u	", timeStr, r->samples[slot]);
+    for (int c = 0; c < r->numChannels; c++) {
+      int k = slot*r->numChannels + c;
+      ctlPrintf("%f/%f/%f	", r->sum[k] / r->samples[slot], r->min[k], r->max[k]);
+    }
+    ctlPrintf("\n"); //Line break at end
+  }
+  return 1;
+}
+/*------------------------------------------------------------*/
+/*Supply tank estimates--------------------------------------*/
+/*----------------------------------------------------------*/
+// Function which lists the fills the schedule will start in the next hours, sorted by time
+// (the schedule only runs during a run).  Returns the number of fills.
+int upcomingFills(FillSched *s, time_t now, double hours, time_t *fillTime, int *fillEntry, int max) {
+  time_t end = now + (time_t)(3600.0*hours);
+  int n = 0;
+
+  if (signaled.RUNNING == false)
+    return 0;
+  double runMin = GetTime()/60.0;
   for (int i = 0; i < s->numEntries; i++) {
-    fprintf(fp, "Temp. Sensor %i (K)	", i + 1);
+    SchedEntry *e = &s->sched[i];
+    if (e->schedMode == 7) {
+      //interval in minutes, counted from the last fill
+      if (e->schedMin <= 0)
+        continue;
+      double next = e->lastTriggerTime + e->schedMin - runMin;
+      if (next < 0.0)
+        next = 0.0;
+      for (time_t t = now + (time_t)(60.0*next); (t <= end) && (n < max); t += 60*e->schedMin) {
+        fillTime[n] = t;
+        fillEntry[n++] = i;
+      }
+    } else if ((e->schedMode < 7) || (e->schedMode == 9)) {
+      //day of the week (or every day) at a time
+      for (int d = 0; (d <= (int)(hours/24.0) + 1) && (n < max); d++) {
+        struct tm day;
+        localtime_r(&now, &day);
+        day.tm_mday += d;
+        day.tm_hour = e->schedHour;
+        day.tm_min = e->schedMin;
+        day.tm_sec = 0;
+        day.tm_isdst = -1;
+        time_t t = mktime(&day); //also sets the day of the week
+        if ((t > now) && (t <= end) && ((e->schedMode == 9) || (day.tm_wday == e->schedMode))) {
+          fillTime[n] = t;
+          fillEntry[n++] = i;
+        }
+      }
+    }
+  }
+  //entries which run directly after another one run whenever it does
+  for (int k = 0; k < n; k++) {
+    for (int i = 0; (i < s->numEntries) && (n < max); i++) {
+      if ((s->sched[i].schedMode == 8) && (s->sched[i].schedAfterEntry == fillEntry[k]) && (i != fillEntry[k])) {
+        fillTime[n] = fillTime[k];
+        fillEntry[n++] = i;
+      }
+    }
   }
-  fprintf(fp, "\n"); //Line break at end
 
-  // Print all elements in the buffers
-  for (int i = 0; i < cbCount(&tbuffer); i++) {
+  //sort by time, keeping chained entries in order
+  for (int k = 1; k < n; k++) {
+    time_t t = fillTime[k];
+    int entry = fillEntry[k];
+    int j = k - 1;
+    while ((j >= 0) && (fillTime[j] > t)) {
+      fillTime[j+1] = fillTime[j];
+      fillEntry[j+1] = fillEntry[j];
+      j--;
+    }
+    fillTime[j+1] = t;
+    fillEntry[j+1] = entry;
+  }
+  return n;
+}
+/*--------------------------------------------------------------*/
+static void forecastTank(FillSched *s, time_t now) {
+  static time_t fillTime[MAX_FORECAST_FILLS];
+  static int fillEntry[MAX_FORECAST_FILLS];
 
-    cbRead(&rtbuffer, &rtelement); //read values from buffers
-    cbRead(&tbuffer, &telement);
-    cbRead(&weightbuffer, &weightelement);
-    fprintf(fp, "%s	%s	%s	", rtelement.value, telement.value, weightelement.value); //print readings
-    cbWrite(&rtbuffer, &rtelement);                                                           //put values that were just read back in buffers so that they can be read again
-    cbWrite(&tbuffer, &telement);
-    cbWrite(&weightbuffer, &weightelement);
-    for (int i = 0; i < s->numEntries; i++) {
-      cbRead(&sensorBuffer[i], &sensorValue[i]);
-      fprintf(fp, "%s	", sensorValue[i].value); //print all voltage sensor values
-      cbWrite(&sensorBuffer[i], &sensorValue[i]);
+  int n = upcomingFills(s, now, TANK_FORECAST_HOURS, fillTime, fillEntry, MAX_FORECAST_FILLS);
+  tankForecast(&tank, now, scale_threshold, fillTime, fillEntry, n, TANK_FORECAST_HOURS, &tankOutlook);
+}
+/*--------------------------------------------------------------*/
+// Function which sends a tank alert once, until clear is set (or the tank is swapped).
+// Returns true if it was sent.
+static bool tankAlert(int kind, bool raise, bool clear, const char *text) {
+  if (clear)
+    tankAlerted[kind] = false;
+  if (!raise || tankAlerted[kind])
+    return false;
+  tankAlerted[kind] = true;
+  printf("\nWARNING: %s\n\n", text);
+  alertRaise(tankAlertKeys[kind], "%s", text);
+  return true;
+}
+/*--------------------------------------------------------------*/
+// Function which acts on new supply tank estimates: updates the forecast, the metrics
+// and InfluxDB, and warns early if the tank will need refilling soon
+void checkTank(FillSched *s, int flags) {
+  time_t now = clockTime();
+  char text[512], when[64];
+  struct tm local;
+
+  if (flags & TANK_SWAP) {
+    printf("Supply tank swap detected, the tank now holds %.1f kg.\n", tank.level);
+    metricsAdd(&metrics.tankSwaps);
+    memset(tankAlerted, 0, sizeof(tankAlerted));
+  }
+  if (flags & TANK_STEP)
+    printf("WARNING: The supply tank level dropped by more than %.1f kg while no fill was running.\n", tankSwapKg);
+  if (flags & TANK_FILL_MEASURED)
+    printf("The last fill used %.1f kg of LN2 from the supply tank.\n", tank.lastUsed);
+  if (!tank.valid)
+    return;
+
+  forecastTank(s, now);
+  double level = tankLevel(&tank, now);
+  double hours = tankOutlook.hoursToEmpty;
+  __sync_lock_test_and_set(&metrics.tankLevelGrams, (long long)(1000.0*level));
+  __sync_lock_test_and_set(&metrics.tankBoiloffGramsPerHour, tank.boiloffValid ? (long long)(1000.0*tank.boiloff) : 0LL);
+  __sync_lock_test_and_set(&metrics.tankSecondsToEmpty, (hours >= 0.0) ? (long long)(3600.0*hours) : -1LL);
+  tankPublish = true;
+
+  sprintf(text, "The LN2 supply tank is down to %.1f kg, below the refill weight of %.1f kg.", level, scale_threshold);
+  tankAlert(0, level < scale_threshold, level > scale_threshold + 0.5*tankSwapKg, text);
+
+  localtime_r(&now, &local);
+  if (hours >= 0.0) {
+    time_t t = now + (time_t)(3600.0*hours);
+    localtime_r(&t, &local);
+  }
+  strftime(when, sizeof(when), "%a %d %b %H:%M", &local);
+  sprintf(text, "The LN2 supply tank is expected to reach the refill weight of %.1f kg in %.1f hours (%s).", scale_threshold, hours, when);
+  tankAlert(1, (hours >= 0.0) && (hours <= tankAlertHours) && (tankOutlook.shortEntry < 0) && (level >= scale_threshold),
+            hours > 1.5*tankAlertHours, text); //no forecast (eg. boil-off not known) doesn't clear it
+
+  bool shortSoon = (tankOutlook.shortEntry >= 0) && (tankOutlook.shortTime - now <= (time_t)(3600.0*tankAlertHours));
+  if (tankOutlook.shortEntry >= 0) {
+    localtime_r(&tankOutlook.shortTime, &local);
+    strftime(when, sizeof(when), "%a %d %b %H:%M", &local);
+    sprintf(text, "The fill of %s on %s is not expected to fit: the LN2 supply tank should hold %.1f kg then, the fill uses about %.1f kg and the refill weight is %.1f kg.",
+            s->sched[tankOutlook.shortEntry].entryName, when, tankOutlook.shortLevel, tankOutlook.shortNeed, scale_threshold);
+  }
+  //only warned again about an earlier fill, or once the fill warned about has run, as the forecast
+  //for fills close to the limit can go either way
+  if (tankAlert(2, shortSoon, shortSoon && ((tankOutlook.shortTime < tankShortAlerted) || (now >= tankShortAlerted)), text))
+    tankShortAlerted = tankOutlook.shortTime;
+}
+/*--------------------------------------------------------------*/
+// Function which prints the supply tank estimates
+void printTank(FillSched *s) {
+  time_t now = clockTime();
+  char when[64];
+  struct tm local;
+
+  if (!tank.valid) {
+    ctlPrintf("The supply tank level is not known yet (it is measured over %i minutes between fills).\n", TANK_BIN_SECONDS/60);
+    return;
+  }
+  forecastTank(s, now);
+  ctlPrintf("Supply tank level   %8.1f kg (refill weight %.1f kg)\n", tankLevel(&tank, now), scale_threshold);
+  if (tank.boiloffValid)
+    ctlPrintf("Boil-off            %8.2f kg/hour\n", tank.boiloff);
+  else
+    ctlPrintf("Boil-off            not known yet (needs %i minutes without fills)\n", TANK_MIN_BINS*TANK_BIN_SECONDS/60);
+  for (int i = 0; (i < s->numEntries) && (i < TANK_MAX_ENTRIES); i++) {
+    if (tank.fills[i] > 0)
+      ctlPrintf("Fill of %-20s %8.1f kg (%i fills measured)\n", s->sched[i].entryName, tank.used[i], tank.fills[i]);
+  }
+  if (tankOutlook.shortEntry >= 0) {
+    localtime_r(&tankOutlook.shortTime, &local);
+    strftime(when, sizeof(when), "%a %d %b %H:%M", &local);
+    ctlPrintf("The fill of %s on %s is not expected to fit (%.1f kg left then, the fill uses about %.1f kg).\n",
+           s->sched[tankOutlook.shortEntry].entryName, when, tankOutlook.shortLevel, tankOutlook.shortNeed);
+  } else if (tankOutlook.hoursToEmpty >= 0.0) {
+    time_t t = now + (time_t)(3600.0*tankOutlook.hoursToEmpty);
+    localtime_r(&t, &local);
+    strftime(when, sizeof(when), "%a %d %b %H:%M", &local);
+    ctlPrintf("Expected to reach the refill weight in %.1f hours (%s).\n", tankOutlook.hoursToEmpty, when);
+  } else {
+    ctlPrintf("Not expected to reach the refill weight in the next %.0f days.\n", TANK_FORECAST_HOURS/24.0);
+  }
+  ctlPrintf("Tank swaps detected %u\n", tank.swaps);
+}
+/*------------------------------------------------------------*/
+/*Supply tank planning---------------------------------------*/
+/*----------------------------------------------------------*/
+static bool plannedBefore(const PlanFill &a, const PlanFill &b) {
+  return a.t < b.t;
+}
+/*--------------------------------------------------------------*/
+// Function which collects the LN2 used by the recent fills of each schedule entry, from the fill history
+// (fills which reached the threshold or timed out), else the tank estimates, else plan_fill_kg
+static void planUsage(FillSched *s, PlanUsage *usage) {
+  HistoryRecord r;
+
+  for (int i = 0; (i < s->numEntries) && (i < PLAN_MAX_ENTRIES); i++) {
+    PlanUsage *u = &usage[i];
+    u->numSamples = 0;
+    int e = (fillHistory.file != NULL) ? historyEntry(&fillHistory, s->sched[i].entryName) : -1;
+    if (e >= 0) {
+      for (int n = fillHistory.numFills[e] - 1; (n >= 0) && (n >= fillHistory.numFills[e] - 4*PLAN_MAX_SAMPLES)
+             && (u->numSamples < PLAN_MAX_SAMPLES); n--) {
+        if ((historyRead(&fillHistory, fillHistory.fills[e][n], &r) < 0) || (r.massBefore <= 0.0)
+            || ((r.reason != HISTORY_THRESHOLD) && (r.reason != HISTORY_TIMEOUT)))
+          continue;
+        u->kg[u->numSamples++] = historyUsed(&r);
+      }
     }
-    for (int i = 0; i < s->numEntries; i++) {
-      cbRead(&tempBuffer[i], &tempValue[i]);
-      fprintf(fp, "%s	", tempValue[i].value); //print all temp sensor values
-      cbWrite(&tempBuffer[i], &tempValue[i]);
+    if (u->numSamples > 0)
+      continue;
+    if ((i < TANK_MAX_ENTRIES) && (tank.fills[i] > 0))
+      u->kg[u->numSamples++] = tank.used[i];
+    else if (planFillKg > 0.0)
+      u->kg[u->numSamples++] = planFillKg;
+  }
+}
+/*--------------------------------------------------------------*/
+// Function which copies what the plan command works from (the fills scheduled, what each entry's fills
+// use, the tank level and boil-off) and starts the plan in the background: the plan thread adds the
+// chance of the supply tank running dry, from the current level and from a full tank delivered on each
+// day of the week, to the reply, which checkCommands gives back once the plan is done
+void printPlan(FillSched *s) {
+  static time_t fillTime[PLAN_MAX_FILLS];
+  static int fillEntry[PLAN_MAX_FILLS];
+  time_t now = clockTime();
+
+  if (planRunning()) {
+    ctlPrintf("ERROR: Still running the previous plan, try again when it is done.\n");
+    ctlFail();
+    return;
+  }
+  if (signaled.RUNNING == false) {
+    ctlPrintf("The supply tank is only planned for while the run is going (start it with begin).\n");
+    ctlFail();
+    return;
+  }
+  PlanJob *j = (PlanJob *)malloc(sizeof(PlanJob));
+  if (j == NULL) {
+    ctlPrintf("ERROR: Could not allocate memory for the plan.\n");
+    ctlFail();
+    return;
+  }
+  memset(j, 0, sizeof(PlanJob));
+  j->req = planRequest;
+  if (j->req.every <= 0)
+    j->req.every = deliveryDays;
+  if (j->req.runs <= 0)
+    j->req.runs = planRuns;
+  if ((j->req.every <= 0) || (j->req.every > PLAN_MAX_DAYS)) {
+    ctlPrintf("Deliveries must be 1 to %i days apart (delivery_interval_days in parameters.dat).\n", PLAN_MAX_DAYS);
+    ctlFail();
+    free(j);
+    return;
+  }
+  if (j->req.runs <= 0)
+    j->req.runs = 10000;
+  else if (j->req.runs > PLAN_MAX_RUNS)
+    j->req.runs = PLAN_MAX_RUNS;
+  j->now = now;
+  j->refillKg = scale_threshold;
+  j->boiloff = tank.boiloffValid ? tank.boiloff : 0.0;
+  j->levelValid = tank.valid;
+  j->level = tank.valid ? tankLevel(&tank, now) : 0.0;
+  j->fullKg = (tankFullKg > 0.0) ? tankFullKg : tank.swapLevel;
+  j->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  //the fills of the schedule up to the end of the last case, in time order
+  j->numFills = upcomingFills(s, now, 24.0*(7 + j->req.every + 1), fillTime, fillEntry, PLAN_MAX_FILLS);
+  for (int k = 0; k < j->numFills; k++) {
+    j->fills[k].t = fillTime[k];
+    j->fills[k].entry = fillEntry[k];
+  }
+  std::sort(j->fills, j->fills + j->numFills, plannedBefore);
+  planUsage(s, j->usage);
+  for (int i = 0; (i < s->numEntries) && (i < PLAN_MAX_ENTRIES); i++) {
+    const PlanUsage *u = &j->usage[i];
+    if (u->numSamples == 0) {
+      ctlPrintf("Fill of %-20s not known, left out (set plan_fill_kg to count it)\n", s->sched[i].entryName);
+      continue;
+    }
+    float lo = u->kg[0], hi = u->kg[0];
+    double sum = 0.0;
+    for (int n = 0; n < u->numSamples; n++) {
+      lo = (u->kg[n] < lo) ? u->kg[n] : lo;
+      hi = (u->kg[n] > hi) ? u->kg[n] : hi;
+      sum += u->kg[n];
     }
-    fprintf(fp, "\n"); //Line break at end
+    ctlPrintf("Fill of %-20s %8.1f kg (%.1f to %.1f kg over %i fills)\n", s->sched[i].entryName, sum/u->numSamples, lo, hi, u->numSamples);
+  }
+  if (tank.boiloffValid)
+    ctlPrintf("Boil-off            %8.2f kg/hour\n", tank.boiloff);
+  else
+    ctlPrintf("Boil-off            not known yet, left out\n");
+
+  Reply *reply = ctlDetach(); //given back by checkCommands once the plan is done
+  if (planStart(j, reply) < 0) {
+    ctlBegin(reply);
+    ctlPrintf("ERROR: Could not start the plan.\n");
+    ctlFail();
+  }
+}
+/*--------------------------------------------------------------*/
+// Function which gives back the reply of the plan run in the background once it is done
+void collectPlan(void) {
+  Reply *reply;
+
+  if (planCollect(&reply)) {
+    ctlBegin(reply);
+    ctlFinish();
+  }
+}
+/*------------------------------------------------------------*/
+/*Fill history-----------------------------------------------*/
+/*----------------------------------------------------------*/
+#define WEIGH_READINGS 5 //scale readings averaged to weigh the tank as a fill starts and ends
+
+// Function which weighs the supply tank for the fill history, averaging a few scale readings
+double weighTank(void) {
+  double sum = 0.0;
+
+  for (int i = 0; i < WEIGH_READINGS; i++)
+    sum += measure(scaleInput);
+  return findWeight(sum/WEIGH_READINGS);
+}
+/*--------------------------------------------------------------*/
+// Function which appends a fill to the fill history
+void recordFill(SchedEntry *e, time_t start, int reason, int flags, double duration, double massBefore, double massAfter, float peakVoltage) {
+  HistoryRecord r;
+
+  if (fillHistory.file == NULL)
+    return;
+  memset(&r, 0, sizeof(r));
+  snprintf(r.entry, sizeof(r.entry), "%s", e->entryName);
+  r.start = start;
+  r.end = clockTime();
+  r.reason = reason;
+  r.flags = flags;
+  r.duration = duration;
+  r.massBefore = massBefore;
+  r.massAfter = massAfter;
+  r.peakVoltage = peakVoltage;
+  if (historyAppend(&fillHistory, &r) < 0)
+    printf("ERROR: Could not add the fill to the fill history %s.\n", fillHistoryFile);
+}
+/*--------------------------------------------------------------*/
+static void printSummary(int entry, const HistoryQuery *q) {
+  HistorySummary sum;
+
+  if (historySummarize(&fillHistory, entry, q->from, q->to, &sum) <= 0)
+    return;
+  ctlPrintf("%-24s %6i %10.0f s %9.2f kg %10.1f kg %9i %8i\n", fillHistory.names[entry], sum.fills,
+            sum.duration/sum.fills, sum.used/sum.fills, sum.used, sum.timeouts, sum.stopped);
+}
+/*--------------------------------------------------------------*/
+// Function which shows the fills (or their totals for each entry) asked for with the history command
+void printHistory(void) {
+  static const char *reasons[4] = {"threshold", "timeout", "stopped", "sensor"};
+  const HistoryQuery *q = &historyRequest;
+  HistoryRecord r;
+  char when[64], path[512];
+  struct tm local;
+  int entry = -1;
+
+  if (fillHistory.file == NULL) {
+    ctlPrintf("No fill history is kept (fill_history in parameters.dat).\n");
+    return;
+  }
+  if (q->entry[0] != '\0') {
+    entry = historyEntry(&fillHistory, q->entry);
+    if (entry < 0) {
+      ctlPrintf("No fills of %s in the fill history.\n", q->entry);
+      return;
+    }
+  }
+
+  if (q->summary) {
+    ctlPrintf("%-24s %6s %12s %12s %13s %9s %8s\n", "entry", "fills", "mean time", "mean LN2", "total LN2", "timeouts", "stopped");
+    if (entry >= 0)
+      printSummary(entry, q);
+    else
+      for (int e = 0; e < fillHistory.numEntries; e++)
+        printSummary(e, q);
+    return;
+  }
+
+  //the last fills started in the range
+  int n0 = historyCount(&fillHistory, entry, q->from);
+  int n1 = historyCount(&fillHistory, entry, q->to);
+  if ((n0 < 0) || (n1 < 0)) {
+    ctlPrintf("ERROR: Could not read the fill history.\n");
+    return;
+  }
+  if (n1 - n0 > q->last)
+    n0 = n1 - q->last;
+  if (n1 <= n0) {
+    ctlPrintf("No fills in that time range.\n");
+    return;
+  }
+  ctlPrintf("%-19s %-24s %8s %-9s %8s %8s %7s %7s\n", "start", "entry", "time", "ended", "before", "after", "LN2", "peak");
+  for (int n = n0; n < n1; n++) {
+    if (historyRead(&fillHistory, historyFill(&fillHistory, entry, n), &r) < 0)
+      break;
+    time_t start = (time_t)r.start;
+    localtime_r(&start, &local);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+    ctlPrintf("%-19s %-24s %6.0f s %-9s %5.1f kg %5.1f kg %4.1f kg %5.2f V%s", when, r.entry, r.duration,
+              ((r.reason >= 0) && (r.reason < 4)) ? reasons[r.reason] : "?", r.massBefore, r.massAfter,
+              historyUsed(&r), r.peakVoltage, (r.flags & HISTORY_MANUAL) ? " (manual)" : "");
+    if (r.flags & HISTORY_TRACE) {
+      tracePath(path, sizeof(path), traceDir, r.entry, start);
+      ctlPrintf("  %s", path);
+    }
+    ctlPrintf("\n");
+  }
+}
+/*------------------------------------------------------------*/
+/*Fill traces------------------------------------------------*/
+/*----------------------------------------------------------*/
+// Function which takes a free trace buffer for a fill starting now (NULL if the fill isn't traced)
+static FillTrace *beginTrace(SchedEntry *e, time_t start) {
+  char path[512];
+
+  if (!traceWorker.running)
+    return NULL;
+  for (int i = 0; i < TRACE_BUFFERS; i++) {
+    if (__sync_bool_compare_and_swap(&fillTraces[i].busy, 0, 1)) {
+      tracePath(path, sizeof(path), traceDir, e->entryName, start);
+      traceStart(&fillTraces[i], path);
+      return &fillTraces[i];
+    }
+  }
+  printf("WARNING: The last fill traces are still being written, the fill of %s isn't traced.\n", e->entryName);
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+// Function which adds a reading of the entry's overflow sensor, the scale and the open valves to the trace
+static void sampleTrace(FillTrace *trace, SchedEntry *e) {
+  int chans[2];
+  float volts[2];
+
+  if (trace == NULL)
+    return;
+  chans[0] = e->overflowSensor;
+  chans[1] = scaleInput;
+  measureChannels(chans, 2, volts);
+  traceAdd(trace, (long long)(1000.0*getClock()->realtime()), volts[0], findWeight(volts[1]), openValveMask);
+}
+/*--------------------------------------------------------------*/
+// Function which waits like waitCommands while the fill goes on, tracing it every trace_interval_ms
+static void waitTrace(FillSched *s, SchedEntry *e, FillTrace *trace, long usec) {
+  if (trace == NULL) {
+    waitCommands(s, usec);
+    return;
+  }
+  while ((usec > 0) && signaled.FILLING) {
+    long wait = (usec < 1000L*traceInterval) ? usec : 1000L*traceInterval;
+    waitCommands(s, wait);
+    usec -= wait;
+    if (signaled.FILLING)
+      sampleTrace(trace, e);
+  }
+}
+/*--------------------------------------------------------------*/
+// Function which hands the trace of a fill which has ended to the thread writing it
+static void endTrace(FillTrace *trace) {
+  int buffer;
+
+  if (trace == NULL)
+    return;
+  if (trace->dropped > 0)
+    printf("WARNING: The last %i readings of the fill didn't fit in its trace.\n", trace->dropped);
+  buffer = trace - fillTraces;
+  if (!workerPush(&traceWorker, &buffer)) {
+    printf("ERROR: Could not queue the fill trace %s.\n", trace->path);
+    __sync_lock_release(&trace->busy);
+  }
+}
+/*------------------------------------------------------------*/
+/*Sensor health----------------------------------------------*/
+/*----------------------------------------------------------*/
+// Function which sets up the health of the channels read every cycle (the scale, then each overflow sensor),
+// checked against the input range of the DAQ
+void initHealth(FillSched *s) {
+  healthConfig.minV = getCapabilities()->minVoltage;
+  healthConfig.maxV = getCapabilities()->maxVoltage;
+  healthInit(&channelHealth[0], "scale_voltage", false);
+  for (int i = 0; i < s->numEntries; i++)
+    healthInit(&channelHealth[i+1], s->sched[i].entryName, true);
+  numHealthChannels = s->numEntries + 1;
+}
+/*--------------------------------------------------------------*/
+// Function which reports the problems found (or gone) with the last reading of a channel
+static void reportHealth(int channel, int changed) {
+  ChannelHealth *h = &channelHealth[channel];
+  char state[64], key[ALERT_KEY_SIZE];
+
+  healthDescribe(h->flags, state, sizeof(state));
+  ctlPublishEvent(clockTime(), "sensor %s: %s", h->name, state);
+  if ((changed & h->flags) == 0) {
+    printf("%s reads %.3f V, %s.\n", h->name, h->last, state);
+    return;
+  }
+  metricsAdd(&metrics.sensorFaults);
+  printf("WARNING: %s reads %.3f V, %s.\n", h->name, h->last, state);
+  snprintf(key, sizeof(key), "sensor:%s", h->name);
+  alertRaise(key, "The %s input of the LN2 system reads %.3f V and looks %s.%s", h->name, h->last, state,
+             (h->sensor && sensorFaultStop && (h->flags & HEALTH_FAULT)) ? "  It won't be filled until the sensor reads normally again." : "");
+}
+/*--------------------------------------------------------------*/
+// Function which updates the health of the channels with a set of readings (the scale voltage, then the overflow sensors)
+void checkHealth(FillSched *s, const float *volts) {
+  double t = getClock()->monotonic();
+
+  for (int i = 0; i < s->numEntries + 1; i++) {
+    int changed = healthUpdate(&channelHealth[i], &healthConfig, t, volts[i]);
+    if (changed != 0)
+      reportHealth(i, changed);
+  }
+}
+/*--------------------------------------------------------------*/
+// Function which takes a few quick readings of an entry's overflow sensor before its valves are opened,
+// returns the faults found (0 if the sensor can be trusted to tell when the dewar is full)
+static int checkSensor(FillSched *s, int schedEntry) {
+  ChannelHealth *h = &channelHealth[schedEntry + 1];
+
+  for (int i = 0; i < healthConfig.faultReadings; i++) {
+    if (i > 0)
+      getClock()->sleep(HEALTH_CHECK_INTERVAL);
+    float v = measure(s->sched[schedEntry].overflowSensor);
+    int changed = healthUpdate(h, &healthConfig, getClock()->monotonic(), v);
+    if (changed != 0)
+      reportHealth(schedEntry + 1, changed);
+  }
+  return h->flags & HEALTH_FAULT;
+}
+/*--------------------------------------------------------------*/
+// Function which shows the health of the channels read every cycle
+void printHealth(void) {
+  char state[64];
+
+  ctlPrintf("Open below %.2f V, saturated within %.2f V of %.1f V or %.1f V (for %i readings), frozen after %i\n",
+            healthConfig.openV, 0.01*(healthConfig.maxV - healthConfig.minV), healthConfig.minV, healthConfig.maxV,
+            healthConfig.faultReadings, healthConfig.frozenReadings);
+  ctlPrintf("identical readings, erratic after %i changes faster than %.1f V/s in %i readings.\n\n",
+            HEALTH_MAX_JUMPS, healthConfig.maxRate, HEALTH_WINDOW);
+  ctlPrintf("%-24s %5s %9s %9s %9s %6s %5s  %s\n", "channel", "input", "last", "mean", "std dev", "same", "fast", "state");
+  for (int i = 0; i < numHealthChannels; i++) {
+    const ChannelHealth *h = &channelHealth[i];
+    if (h->readings == 0) {
+      ctlPrintf("%-24s %5i %9s\n", h->name, measChans[i], "no readings yet");
+      continue;
+    }
+    //over the last complete window, or the readings so far
+    bool window = (h->readings > h->n);
+    double mean = window ? h->windowMean : h->mean;
+    double std = window ? h->windowStd : ((h->n > 1) ? sqrt(h->m2/(h->n - 1)) : 0.0);
+    ctlPrintf("%-24s %5i %7.3f V %7.3f V %7.4f V %6i %5i  %s\n", h->name, measChans[i], h->last, mean, std, h->stuckRun,
+              window ? h->windowJumps : h->jumps, healthDescribe(h->flags, state, sizeof(state)));
   }
-  fclose(fp);
-  printf("Data saved locally file %s.\n", filename);
-  return 1;
 }
 /*------------------------------------------------------------*/
 /*Function containing fill cycle instructions----------------*/
@@ -512,7 +1869,10 @@ int Save(FillSched *s, char *filename) {
   // valve 5: valve blocking the outlet from the GEARBOX
   // GEARBOX sensor is on channel 0, input from the parameter file is ignored
   // scale sensor is on channel 7
-int fill(FillSched *s, int schedEntry) {
+// If nextEntry is a valid schedule entry, the fill is one step of a chain and the
+// valves are left open on a normal finish so that the next step only has to switch
+// the valves which differ between the two entries.
+int fill(FillSched *s, int schedEntry, int nextEntry) {
 
   if((schedEntry >= s->numEntries)||(schedEntry < 0)){
     printf("ERROR: Invalid fill schedule entry (%i)!\n",schedEntry);
@@ -520,94 +1880,183 @@ int fill(FillSched *s, int schedEntry) {
   }
 
   //set up timer
-  ftime(&tcurrent);
   double tfillstart = GetTime(); //reset fill timer
   double tfillelapsed = GetTime() - tfillstart;
+  time_t now = clockTime();
+  char alertKey[ALERT_KEY_SIZE];
+  char nowStr[64];
+  ctime_r(&now, nowStr);
+  int historyFlags = signaled.FILL ? HISTORY_MANUAL : 0;
+
+  //don't open the valves unless the overflow sensor can tell when the dewar is full
+  int faults = checkSensor(s, schedEntry);
+  if ((faults != 0) && sensorFaultStop) {
+    char state[64];
+    healthDescribe(faults, state, sizeof(state));
+    printf("\nERROR: The overflow sensor of %s is %s, not filling it.\n\n", s->sched[schedEntry].entryName, state);
+    ctlPublishEvent(now, "fill refused: %s, sensor %s", s->sched[schedEntry].entryName, state);
+    sprintf(alertKey, "fill_refused:%s", s->sched[schedEntry].entryName);
+    alertRaise(alertKey, "The LN2 fill of %s was not started since its overflow sensor is %s.", s->sched[schedEntry].entryName, state);
+    if (openValveMask != 0) {
+      chanOff(); //left open by the previous step of a chain
+      openValveMask = 0;
+    }
+    double weight = weighTank();
+    recordFill(&s->sched[schedEntry], now, HISTORY_SENSOR, historyFlags, 0.0, weight, weight, channelHealth[schedEntry + 1].last);
+    signaled.FILL = false;
+    s->sched[schedEntry].schedFlag=0;
+    saveSchedule(s);
+    return 0;
+  }
+  double massBefore = weighTank(); //scale weight as the fill starts
+  float peakVoltage = 0.0f;
+  int readings = 0;
+  bool timedOut = false;
+  bool sensorFault = false;
+  FillTrace *trace = beginTrace(&s->sched[schedEntry], now);
+  if (trace != NULL)
+    historyFlags |= HISTORY_TRACE;
 
   //print a different message depending on whether the user started fill process manually
   if (signaled.FILL == true)
-    printf("\nManual fill requested for %s.  Starting fill at: %s \n",s->sched[schedEntry].entryName,ctime(&tcurrent.time));
+    printf("\nManual fill requested for %s.  Starting fill at: %s \n",s->sched[schedEntry].entryName,nowStr);
   else
-    printf("\nStarting fill for %s at: %s \n",s->sched[schedEntry].entryName,ctime(&tcurrent.time));
+    printf("\nStarting fill for %s at: %s \n",s->sched[schedEntry].entryName,nowStr);
   signaled.FILL = false;
+  ctlPublishEvent(now, "fill started: %s", s->sched[schedEntry].entryName);
 
   //signal that filling is in progress
   signaled.FILLING = true;
+  metricsAdd(&metrics.fillsStarted);
+  tankFillStart(&tank, schedEntry, now);
   
 
   //turn on all valves
-  chanOn(s->sched[schedEntry].valves,s->sched[schedEntry].numValves);
+  unsigned long long mask = valveMask(&s->sched[schedEntry]);
+  if(openValveMask == 0){
+    chanOn(s->sched[schedEntry].valves,s->sched[schedEntry].numValves);
+  }else if(openValveMask != mask){
+    //the valves shared with the previous step of a chained fill are still open,
+    //open the others (the DAQ port is written as a whole, so valves common to
+    //both steps stay open throughout)
+    for(int v=0;v<MAXVALVES;v++){
+      if((openValveMask & ~mask) & (1ULL << v))
+        printf("Closing valve %i.\n",v);
+      if((mask & ~openValveMask) & (1ULL << v))
+        printf("Opening valve %i.\n",v);
+    }
+    chanOn(s->sched[schedEntry].valves,s->sched[schedEntry].numValves);
+  }
+  openValveMask = mask;
+  sampleTrace(trace, &s->sched[schedEntry]);
 
   //check voltage while filling, and allow viewer to stop filling with the end command
-  //filling automatically stops if sfilling time is greater than maxfilltime
+  //filling automatically stops if sfilling time is greater than maxfilltime (see fillrule.h)
+  FillRule rule = {threshold, iterations, maxfilltime, sensorFaultStop};
   int inum = 0;
-  while (((inum < iterations) && signaled.FILLING == true) && (tfillelapsed < maxfilltime)) {
-    usleep(1000000); //wait 1s
+  int step = FILL_RUNNING;
+  unsigned long long tstep, tstage;
+  while ((step == FILL_RUNNING) && signaled.FILLING == true) {
+    waitTrace(s, &s->sched[schedEntry], trace, FILL_STEP_US); //wait 1s (tracing the fill), the user can still issue commands
+    tstep = latencyNow();
     //current_run_time = GetTime();
     //printf("current run time %f \n", current_run_time);
+    tstage = latencyNow();
     reading = measure(s->sched[schedEntry].overflowSensor); //measure voltage on overflow sensor
+    latencyRecord(&stageHist[STAGE_FILL_MEASURE], latencyNow() - tstage);
     printf("Sensor reading is %10.3f V\n", reading);
-    if (reading > threshold)
-      inum++;
-
-    if (msg->read(command) == 1) //keep this so that user can still issue commands
-    {
-      ReadCommand(&signaled, command);
-      ProcessSignal(s);
-    }
+    if ((readings++ == 0) || (reading > peakVoltage))
+      peakVoltage = reading;
 
     //figure out how much time has elapsed since filling started
     tfillelapsed = GetTime() - tfillstart;
-    if (tfillelapsed > maxfilltime) {
+    recordMeasurement(s);
+    step = fillStep(&rule, &inum, tfillelapsed, reading, channelHealth[schedEntry + 1].flags);
+
+    //unless it was stopped by a command while waiting
+    if ((step == FILL_TIMEOUT) && signaled.FILLING) {
       printf("\nSensor voltage threshold is not being reached.  Threshold may be set poorly, or perhaps LN2 tank is empty.\nAborting run ...\n");
 
-      if (email == true) {
-        /*Converting the email message into a C string that can be read as a terminal command*/
-        stringstream tmpcommand;
-        tmpcommand << "sh emailalert.sh "
-                    << "\"" << mailaddress << "\" "
-                    << "The LN2 system was shut off automatically when filling " << s->sched[schedEntry].entryName << " since the sensor did not indicate filling was done after " << maxfilltime << " seconds.";
-        const std::string tmp = tmpcommand.str();
-        const char *command = tmp.c_str();
-        /*send email using external bash script*/
-        if((system(command))!=0){
-          printf("Email sent.\n");
-        }
-      }
+      ctlPublishEvent(clockTime(), "fill timed out: %s after %.0f s", s->sched[schedEntry].entryName, tfillelapsed);
+      sprintf(alertKey, "fill_timeout:%s", s->sched[schedEntry].entryName);
+      alertRaise(alertKey, "The LN2 system was shut off automatically when filling %s since the sensor did not indicate filling was done after %.0f seconds.",
+                 s->sched[schedEntry].entryName, maxfilltime);
+      signaled.FILLING = false;
+      timedOut = true;
+    } else if ((step == FILL_SENSOR) && signaled.FILLING) {
+      //a sensor which has stopped responding can't end the fill
+      char state[64];
+      healthDescribe(channelHealth[schedEntry + 1].flags & (HEALTH_OPEN | HEALTH_FROZEN), state, sizeof(state));
+      printf("\nThe overflow sensor of %s is %s, stopping the fill ...\n", s->sched[schedEntry].entryName, state);
+      sprintf(alertKey, "fill_sensor:%s", s->sched[schedEntry].entryName);
+      alertRaise(alertKey, "The LN2 fill of %s was stopped after %.0f seconds since its overflow sensor is %s.",
+                 s->sched[schedEntry].entryName, tfillelapsed, state);
       signaled.FILLING = false;
+      sensorFault = true;
     }
 
-    recordMeasurement(s);
+    unsigned long long work = latencyNow() - tstep;
+    latencyRecord(&stageHist[STAGE_FILL_STEP], work);
+    if (work > 1000000000ULL)
+      __sync_fetch_and_add(&fillOverruns, 1ULL);
   }
 
 
-  //take action depending on whether filling was finished normally or stopped by user
+  //take action depending on whether filling was finished normally or stopped by user,
+  //closing the valves first (unless the next step of a chain goes on with them)
+  bool keepValvesOpen = signaled.FILLING && (nextEntry >= 0);
+  if(!keepValvesOpen){
+    chanOff(); //close all valves
+    openValveMask = 0;
+  }else{
+    //only the valves the next step shares stay open while its sensor is checked (this dewar is full)
+    unsigned long long shared = openValveMask & valveMask(&s->sched[nextEntry]);
+    if(shared != openValveMask){
+      int valves[MAXVALVES];
+      int numValves = 0;
+      for(int v=0;v<MAXVALVES;v++){
+        if(shared & (1ULL << v))
+          valves[numValves++] = v;
+        else if(openValveMask & (1ULL << v))
+          printf("Closing valve %i.\n",v);
+      }
+      chanOn(valves,numValves); //closes all of them if none are shared
+      openValveMask = shared;
+    }
+  }
+  double duration = GetTime() - tfillstart;
+  latencyRecord(&metrics.fillDuration, (unsigned long long)(1.0E9*duration));
+  tankFillEnd(&tank);
+  recordFill(&s->sched[schedEntry], now, signaled.FILLING ? HISTORY_THRESHOLD : (timedOut ? HISTORY_TIMEOUT : (sensorFault ? HISTORY_SENSOR : HISTORY_STOPPED)),
+             historyFlags, duration, massBefore, weighTank(), peakVoltage);
   if (signaled.FILLING == true) {
     signaled.FILLING = false;
+    metricsAdd(&metrics.fillsCompleted);
     printf("\nSensor threshold reached.  Finishing fill for %s ... \n\n",s->sched[schedEntry].entryName);
+    ctlPublishEvent(clockTime(), "fill done: %s in %.0f s", s->sched[schedEntry].entryName, tfillelapsed);
 
-    if (email == true) {
-      /*Convert the email message into a C string that can be read as a terminal command*/
-      stringstream tmpcommand;
-      tmpcommand << "sh emailalert.sh "
-                 << "\"" << mailaddress << "\" "
-                 << "LN2 system filling operation for " << s->sched[schedEntry].entryName << " was successfully completed.  Fill time was " << tfillelapsed << " seconds.";
-      const std::string tmp = tmpcommand.str();
-      const char *command = tmp.c_str();
-      /*send email using external bash script*/
-      if((system(command))!=0){
-        printf("Email sent.\n");
-      }
+    sprintf(alertKey, "fill_done:%s", s->sched[schedEntry].entryName);
+    alertRaise(alertKey, "LN2 system filling operation for %s was successfully completed.  Fill time was %.0f seconds.",
+               s->sched[schedEntry].entryName, tfillelapsed);
+
+    if(keepValvesOpen){
+      //the valves were left open, the next step of the chain switches only what it needs to
+      printf("Continuing directly to %s without closing shared valves ...\n\n",s->sched[nextEntry].entryName);
     }
 
   } else {
+    metricsAdd(&metrics.fillsStopped);
     printf("\nFilling stopped partway, closing all valves ... \n\n");
+    ctlPublishEvent(clockTime(), "fill stopped: %s after %.0f s", s->sched[schedEntry].entryName, tfillelapsed);
   }
 
-  chanOff(); //close all valves
-  usleep(1000000); //wait a bit so that switching between valves isn't instantaneous
+  sampleTrace(trace, &s->sched[schedEntry]); //the valves closed (or left open for the next step)
+  endTrace(trace);
+  if(!keepValvesOpen)
+    getClock()->sleep(1000000); //wait a bit so that switching between valves isn't instantaneous
 
   s->sched[schedEntry].schedFlag=0; //reset the fill flag
+  saveSchedule(s);
   ProcessSignal(s);
 
   return 1;
@@ -620,6 +2069,41 @@ int readParameters(void) {
 
   FILE *parfile = fopen("parameters.dat", "r");
 
+  strcpy(daqDriver,"./daq_nidaq.so"); //default to the NIDAQ hardware
+  daqConfig[0] = '\0';
+  virtualClock = false;
+  clockSpeedup = 0.0;
+  clockStart = time(NULL);
+  metricsPort = 0;
+  strcpy(controlSocket,CTL_DEFAULT_PATH);
+  strcpy(scheduleState,"LN2_schedule.state");
+  memset(&alertConfig, 0, sizeof(alertConfig));
+  strcpy(alertConfig.file,"LN2_alerts.log");
+  alertConfig.interval = 3600;
+  strcpy(archiveFile,"LN2_archive.dat");
+  strcpy(fillHistoryFile,"LN2_fills.dat");
+  strcpy(traceDir,"traces");
+  traceInterval = 100;
+  memset(&healthConfig, 0, sizeof(healthConfig));
+  healthConfig.openV = 0.1;
+  healthConfig.faultReadings = 3;
+  healthConfig.frozenReadings = 20;
+  healthConfig.maxRate = 5.0;
+  sensorFaultStop = true;
+  tankAlertHours = 24.0;
+  tankSwapKg = 20.0;
+  deliveryDays = 7;
+  tankFullKg = 0.0;
+  planRuns = 10000;
+  planFillKg = 0.0;
+  influxUDP = false;
+  influxMTU = INFLUX_UDP_MTU;
+  strcpy(influxHost,"127.0.0.1");
+  strcpy(influxDB,"LN2");
+  influxUser[0] = '\0';
+  influxPassword[0] = '\0';
+  c.port = 8086;
+
   while(!(feof(parfile)))//go until the end of file is reached
     {
 			if(fgets(str,256,parfile)!=NULL) //get an entire line
@@ -638,6 +2122,18 @@ int readParameters(void) {
                   threshold = atof(value);
                 }else if(strcmp(parameter,"scale_threshold_kg")==0){
                   scale_threshold = atof(value);
+                }else if(strcmp(parameter,"tank_alert_hours")==0){
+                  tankAlertHours = atof(value);
+                }else if(strcmp(parameter,"tank_swap_kg")==0){
+                  tankSwapKg = atof(value);
+                }else if(strcmp(parameter,"delivery_interval_days")==0){
+                  deliveryDays = atoi(value);
+                }else if(strcmp(parameter,"tank_full_kg")==0){
+                  tankFullKg = atof(value);
+                }else if(strcmp(parameter,"plan_runs")==0){
+                  planRuns = atoi(value);
+                }else if(strcmp(parameter,"plan_fill_kg")==0){
+                  planFillKg = atof(value);
                 }else if(strcmp(parameter,"sensor_reading_interval_ms")==0){
                   polling_time = atoi(value) * 1000; //convert from milliseconds into microseconds
                 }else if(strcmp(parameter,"readings_before_fill_stop")==0){
@@ -650,6 +2146,89 @@ int readParameters(void) {
                   email = atoi(value);
                 }else if(strcmp(parameter,"email_adress")==0){
                   strcpy(mailaddress,value);
+                }else if(strcmp(parameter,"daq_driver")==0){
+                  strcpy(daqDriver,value);
+                }else if(strcmp(parameter,"daq_config")==0){
+                  strcpy(daqConfig,value);
+                }else if(strcmp(parameter,"influx_transport")==0){
+                  if(strcmp(value,"udp")==0){
+                    influxUDP = true;
+                  }else if(strcmp(value,"http")==0){
+                    influxUDP = false;
+                  }else{
+                    printf("ERROR: Invalid influx_transport (%s), expected http or udp.\n",value);
+                    exit(-1);
+                  }
+                }else if(strcmp(parameter,"influx_host")==0){
+                  strcpy(influxHost,value);
+                }else if(strcmp(parameter,"influx_port")==0){
+                  c.port = atoi(value);
+                }else if(strcmp(parameter,"influx_db")==0){
+                  strcpy(influxDB,value);
+                }else if(strcmp(parameter,"influx_user")==0){
+                  strcpy(influxUser,value);
+                }else if(strcmp(parameter,"influx_password")==0){
+                  strcpy(influxPassword,value);
+                }else if(strcmp(parameter,"influx_udp_mtu")==0){
+                  influxMTU = atoi(value);
+                }else if(strcmp(parameter,"archive_file")==0){
+                  strcpy(archiveFile,value);
+                }else if(strcmp(parameter,"fill_history")==0){
+                  snprintf(fillHistoryFile,sizeof(fillHistoryFile),"%s",value);
+                }else if(strcmp(parameter,"trace_dir")==0){
+                  snprintf(traceDir,sizeof(traceDir),"%s",value);
+                }else if(strcmp(parameter,"trace_interval_ms")==0){
+                  traceInterval = atoi(value);
+                }else if(strcmp(parameter,"sensor_open_V")==0){
+                  healthConfig.openV = atof(value);
+                }else if(strcmp(parameter,"sensor_fault_readings")==0){
+                  healthConfig.faultReadings = atoi(value);
+                }else if(strcmp(parameter,"sensor_frozen_readings")==0){
+                  healthConfig.frozenReadings = atoi(value);
+                }else if(strcmp(parameter,"sensor_max_rate_V_s")==0){
+                  healthConfig.maxRate = atof(value);
+                }else if(strcmp(parameter,"sensor_fault_action")==0){
+                  if(strcmp(value,"stop")==0){
+                    sensorFaultStop = true;
+                  }else if(strcmp(value,"alert")==0){
+                    sensorFaultStop = false;
+                  }else{
+                    printf("ERROR: Invalid sensor_fault_action (%s), expected stop or alert.\n",value);
+                    exit(-1);
+                  }
+                }else if(strcmp(parameter,"alert_file")==0){
+                  if(strcmp(value,"off")==0)
+                    alertConfig.file[0] = '\0';
+                  else
+                    snprintf(alertConfig.file,sizeof(alertConfig.file),"%s",value);
+                }else if(strcmp(parameter,"alert_webhook")==0){
+                  if((strcmp(value,"off")!=0) && (alertParseWebhook(&alertConfig,value) < 0))
+                    printf("ERROR: Alert webhook '%s' should be host:port/path, no webhook will be used.\n", value);
+                }else if(strcmp(parameter,"alert_interval_s")==0){
+                  alertConfig.interval = atoi(value);
+                }else if(strcmp(parameter,"metrics_port")==0){
+                  metricsPort = atoi(value);
+                }else if(strcmp(parameter,"control_socket")==0){
+                  snprintf(controlSocket,sizeof(controlSocket),"%s",value);
+                }else if(strcmp(parameter,"schedule_state")==0){
+                  snprintf(scheduleState,sizeof(scheduleState),"%s",value);
+                }else if(strcmp(parameter,"clock")==0){
+                  virtualClock = (strcmp(value,"virtual")==0);
+                }else if(strcmp(parameter,"clock_speedup")==0){
+                  clockSpeedup = atof(value);
+                }else if(strcmp(parameter,"clock_start")==0){
+                  //time of day to start the virtual clock at (YYYY-MM-DD HH:MM)
+                  struct tm start;
+                  memset(&start,0,sizeof(start));
+                  if(sscanf(value,"%d-%d-%d %d:%d",&start.tm_year,&start.tm_mon,&start.tm_mday,&start.tm_hour,&start.tm_min)==5){
+                    start.tm_year -= 1900;
+                    start.tm_mon -= 1;
+                    start.tm_isdst = -1;
+                    clockStart = mktime(&start);
+                  }else{
+                    printf("ERROR: Invalid clock_start (%s), expected YYYY-MM-DD HH:MM.\n",value);
+                    exit(-1);
+                  }
                 }
               }
             }
@@ -660,18 +2239,46 @@ int readParameters(void) {
   printf("\nFile 'parameters.dat' read sucessfully!\n");
   printf("Sensor threshold to indicate LN2 overflow (V) = %.2f \n", threshold);
   printf("Weight at which tank needs refilling (kg) = %.2f \n", scale_threshold);
+  printf("Warning %.1f hours before the tank is expected to need refilling, tank swaps above %.1f kg \n", tankAlertHours, tankSwapKg);
+  printf("Deliveries planned every %i days with %i runs, full tank %.1f kg (0 = level after the last swap) \n", deliveryDays, planRuns, tankFullKg);
   printf("Time between readings when not filling (microsec) = %i \n", polling_time);
   printf("Number of measurements allowed above sensor threshold = %i \n", iterations);
   printf("Maximum length of time filling can take place (s) = %.0f \n", maxfilltime);
+  printf("Sensors are open below %.2f V or frozen after %i identical readings, fills %s with a sensor fault \n",
+         healthConfig.openV, healthConfig.frozenReadings, sensorFaultStop ? "are stopped" : "only raise alerts");
   printf("Number of saved data points = %i \n", circBufferSize);
+  printf("DAQ driver = %s \n", daqDriver);
+  if(influxUDP)
+    printf("InfluxDB = udp://%s:%i (MTU %i) \n", influxHost, c.port, influxMTU);
+  else
+    printf("InfluxDB = http://%s:%i, database %s \n", influxHost, c.port, influxDB);
+  if(metricsPort > 0)
+    printf("Metrics port = %i \n", metricsPort);
+  if(virtualClock){
+    if(clockSpeedup > 0.0)
+      printf("Using a virtual clock running %.0f times faster than real time.\n", clockSpeedup);
+    else
+      printf("Using a virtual clock running as fast as possible.\n");
+  }
   if(email==1){
     printf("Will send email alerts to: %s\n", mailaddress);
+    strcpy(alertConfig.mailTo,mailaddress);
   }else{
     printf("Will not send email alerts.\n");
   }
+  if(alertConfig.webhookHost[0] != '\0')
+    printf("Will send alerts to http://%s:%i%s\n", alertConfig.webhookHost, alertConfig.webhookPort, alertConfig.webhookPath);
+  if(alertConfig.file[0] != '\0')
+    printf("Alerts are logged to %s\n", alertConfig.file);
+  printf("Alerts of the same kind are sent at most every %i s.\n", alertConfig.interval);
   
   fclose(parfile);
 
+  c.host = influxHost;
+  c.db = influxDB;
+  c.usr = influxUser;
+  c.pwd = influxPassword;
+
   return 1;
 }
 
@@ -720,7 +2327,7 @@ int readCalibration(void) {
   return 1;
 }
 
-void readSchedule(FillSched *s){
+void readSchedule(FillSched *s, const char *schedfilename){
 
 	char *tok,*tok2;
   char str[256];//string to be read from file (will be tokenized)
@@ -730,7 +2337,11 @@ void readSchedule(FillSched *s){
 	int currentParameter=0;
 	int val=0;
 
-	FILE *schedfile = fopen("schedule.dat", "r");
+	FILE *schedfile = fopen(schedfilename, "r");
+	if(schedfile == NULL){
+		printf("ERROR: Could not open schedule file %s.\n",schedfilename);
+		exit(-1);
+	}
 
 	while(!(feof(schedfile)))//go until the end of file is reached
     {
@@ -772,6 +2383,10 @@ void readSchedule(FillSched *s){
 									while(tok2!=NULL){
 										if(k<MAXNUMVALVES){
 											s->sched[currentEntry].valves[k] = atoi(tok2);
+											if((atoi(tok2) < 0)||(atoi(tok2) >= MAXVALVES)){
+												printf("ERROR: Invalid valve %i in schedule entry %i (valves are numbered from 0 to %i).\n",atoi(tok2),currentEntry+1,MAXVALVES-1);
+												exit(-1);
+											}
 											tok2=strtok (NULL,",");
 											if(tok2!=NULL){
 												tok2[strcspn(tok2, "\r\n")] = 0;//strips newline characters from the string
@@ -936,6 +2551,28 @@ void readSchedule(FillSched *s){
 	printf("\n");
 }
 
+// Function which returns the first entry scheduled directly after the given entry
+// (ie. the next step of a chained fill), or -1 if there is none
+int chainedEntry(FillSched *s, int schedEntry) {
+  for(int j=0;j<s->numEntries;j++){
+    if((j!=schedEntry)&&(s->sched[j].schedMode == 8)&&(s->sched[j].schedAfterEntry == schedEntry)){
+      return j;
+    }
+  }
+  return -1;
+}
+
+// Function which returns the valves of a schedule entry as a bitmask
+unsigned long long valveMask(SchedEntry *e) {
+  unsigned long long mask = 0;
+  for(int i=0;i<e->numValves;i++){
+    if((e->valves[i] >= 0)&&(e->valves[i] < MAXVALVES)){
+      mask |= 1ULL << e->valves[i];
+    }
+  }
+  return mask;
+}
+
 // Function which converts scale voltage values into weight
 // Currently using a very rough calibration defined in calibration.dat
 double findWeight(double vScale) {
@@ -947,6 +2584,7 @@ double findWeight(double vScale) {
 
 
 
+#ifndef LN2_SERVER_NO_MAIN
 int main()
 {
   
@@ -967,12 +2605,7 @@ int main()
   signaled.FILLING = false;
   signaled.MEASURE = false;
   signaled.LIST = false;
-
-  c.host = strdup("127.0.0.1");
-  c.port = 8086;
-  c.db = strdup("LN2");
-  c.usr = strdup("");
-  c.pwd = strdup("");
+  signaled.STATS = false;
 
   retval = Boot(s);
   if (retval < 0)
@@ -984,3 +2617,4 @@ int main()
 
   exit(EXIT_SUCCESS);
 }
+#endif
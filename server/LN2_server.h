@@ -1,26 +1,65 @@
+#ifndef __LN2_SERVER
+#define __LN2_SERVER
+
 #include <sstream>
-#include <sys/timeb.h>
 #include <stdio.h>
-#include "msgtool.h"
 #include "lock.h"
+#include "daq_driver.h"
+#include "clock.h"
+#include "latency.h"
+#include "archive.h"
+#include "export.h"
+#include "tank.h"
+#include "worker.h"
+#include "ctlsock.h"
+#include "checkpoint.h"
+#include "history.h"
+#include "trace.h"
+#include "health.h"
+#include "fillrule.h"
+#include "plan.h"
 #include <cstdlib>
 #include <unistd.h>
 
-#define MAXNUMVALVES 8
+#define MAXNUMVALVES 32 //valves opened by one schedule entry
+#define MAXVALVES 64 //valves which can be used (numbered 0 to MAXVALVES-1)
 #define MAXSCHEDENTRIES 256
+#define INFLUX_BATCH_SIZE 131072 //size of the buffer the readings of one cycle are encoded into
+#define TELEMETRY_QUEUE_SIZE 1024 //readings queued for each telemetry thread (power of 2)
+#define TRACE_QUEUE_SIZE 4 //fill traces queued for the thread writing them (power of 2, at least TRACE_BUFFERS)
+#define COMMAND_QUEUE_SIZE CTL_MAX_PENDING //commands queued for the control loop (power of 2)
+#define COMMAND_PARAM_SIZE 256 //longest name given with a command
+#define COMMAND_CHECK_TIME 100000 //while waiting between readings, commands are carried out at least this often (microseconds)
+#define HEALTH_CHECK_INTERVAL 100000 //time between the readings of an overflow sensor checked before a fill (microseconds)
 
 #define read_ports 2
 #define first_port_read 1
 #define write_ports 1
 
+//stages of the server cycle which are timed (see the stats command)
+enum {
+  STAGE_CYCLE,        //one pass of the main loop, not counting the wait and any fills
+  STAGE_COMMAND,      //carrying out a command received from LN2_master
+  STAGE_SCHEDULE,     //evaluating the fill schedule
+  STAGE_MEASURE,      //reading the scale and overflow sensors
+  STAGE_BUFFER,       //writing a set of readings to the circular buffers
+  STAGE_POST,         //sending the readings to InfluxDB (influx thread)
+  STAGE_ARCHIVE,      //appending the readings to the local archive (archive thread)
+  STAGE_RECORD,       //recordMeasurement as a whole, up to handing the readings to the telemetry threads
+  STAGE_FILL_MEASURE, //reading the overflow sensor of the dewar being filled
+  STAGE_FILL_STEP,    //one pass of the fill loop, not counting the 1 s wait
+  NUM_STAGES
+};
+
 #define DAQmxErrChk(functionCall) if( DAQmxFailed(error=(functionCall)) ) goto Error; else
 
 
-//valve and sensor measurement functions which should be implemented for any DAQ used with this code
+//valve and sensor measurement functions, these call into the DAQ driver loaded at startup (see daq_driver.h)
 int chanOn(int);
 int chanOn(int*,int);
 int chanOff();
 float measure(int);
+int measureChannels(int*,int,float*);
 
 //data structures for fill schedule
 typedef struct {
@@ -60,65 +99,196 @@ struct Signals
   bool FILL;
   bool LIST;
 	bool STOPFILL;
+  bool STATS;
+  bool TANK;
+  bool HISTORY;
+  bool HEALTH;
+  bool PLAN;
 };
 
+//commands, as parsed by the command thread and carried out by the control loop
+typedef enum {
+  CMD_BEGIN,
+  CMD_END,
+  CMD_TIME,
+  CMD_TANK,
+  CMD_STATS,    //name: "reset" or empty
+  CMD_SAVE,     //save: the file, format and range to save
+  CMD_EXIT,
+  CMD_ON,       //value: the valve
+  CMD_OFF,
+  CMD_MEASURE,  //value: the analog input
+  CMD_STOPFILL,
+  CMD_FILL,     //name: the schedule entry
+  CMD_TABLE,    //name: the resolution, or empty for recent readings
+  CMD_LIST,
+  CMD_HISTORY,  //history: the fills or totals asked for
+  CMD_HEALTH,
+  CMD_PLAN,     //plan: the delivery interval, runs and risk asked for
+  CMD_NONE      //not understood, only answered
+} CommandType;
+
+typedef struct {
+  CommandType type;
+  int value;
+  char name[COMMAND_PARAM_SIZE];
+  ExportRequest save;
+  HistoryQuery history;
+  PlanRequest plan;
+  Reply *reply; //collects what the command prints, for the client which sent it
+} Command;
+
+//one set of readings, handed by the control loop to the telemetry threads
+typedef struct {
+  time_t t;
+  double runTime;                 //run time (s) when the readings were taken
+  double weightV, weight;         //scale voltage and weight (kg)
+  int numSensors;
+  float sensor[MAXSCHEDENTRIES];  //overflow sensor voltages, in schedule order
+  unsigned char health[MAXSCHEDENTRIES+1]; //health flags of the scale and the overflow sensors (see health.h)
+  bool tank;                      //new supply tank estimates to send with the readings
+  double tankLevel, tankBoiloff, tankHours;
+  bool tankBoiloffValid, tankFillsFit;
+  bool flush;                     //no readings, the archive thread flushes the archive instead
+} Reading;
+
   int Boot(FillSched*);
   int MainLoop(FillSched*);
   int recordMeasurement(FillSched*);
-  void ReadCommand (struct Signals*, char*);
+  void bufferMeasurement(FillSched*, time_t, double, double*);
+  void initBuffers(FillSched*);
+  void initSeries(FillSched*);
+  void initArchive(FillSched*);
+  int encodeMeasurement(const Reading*);
+  int startThreads(void);
+  void stopThreads(void);
+  int evaluateSchedule(FillSched*, double, struct tm*);
+  void restoreSchedule(FillSched*);
+  void saveSchedule(FillSched*);
+  int ReadCommand (Command*, char*);
+  void applyCommand (const Command*);
+  void checkCommands (FillSched*);
+  void waitCommands (FillSched*, long);
   void ProcessSignal (FillSched*);
-  int BeginRun(void);
+  int BeginRun(FillSched*);
   int EndRun(FillSched*);
   int PauseRun(void);
   int ResumeRun(void);
   int ClearSpectrum(void);
-  int Save(FillSched*, char*);
   int getPlot(FillSched*);
+  int getRollupPlot(int);
+  int upcomingFills(FillSched*, time_t, double, time_t*, int*, int);
+  void checkTank(FillSched*, int);
+  void printTank(FillSched*);
+  void printPlan(FillSched*);
+  void collectPlan(void);
+  void initHistory(void);
+  void recordFill(SchedEntry*, time_t, int, int, double, double, double, float);
+  void printHistory(void);
+  void initTraces(void);
+  void initHealth(FillSched*);
+  void checkHealth(FillSched*, const float*);
+  void printHealth(void);
   double GetTime(void);
-  int fill(FillSched*,int);
+  void printStats(void);
+  void resetStats(void);
+  int fill(FillSched*,int,int);
+  int chainedEntry(FillSched*,int);
+  unsigned long long valveMask(SchedEntry*);
   int readParameters(void);
+  void printTime(const char*, double);
   int readConnections(void);
   int readCalibration(void);
-	void readSchedule(FillSched*);
+	void readSchedule(FillSched*, const char*);
   double findTemp(double vSensor, int sensorPort);
   double findWeight(double vScale);
+  double weighTank(void);
 
-	struct Signals signaled;
-	MsgQ *msg;
-	lock *l;
+	extern struct Signals signaled;
+	extern Ring commandQueue; //commands from the control socket thread to the control loop
+	extern Worker influxWorker; //threads which send the readings to InfluxDB and the archive
+	extern Worker archiveWorker;
+	extern Worker traceWorker; //thread which writes the trace of each fill
+	extern lock *l;
 	// Channel parameters
 
-	char port0[128];
-	char port1[128];
-	char port2[128];
+	extern char port0[128];
+	extern char port1[128];
+	extern char port2[128];
 	
-	struct timeb tstart,tstop,pstart,pstop,tcurrent;
-	double paused;
-	float meas;
-	double run_time;
-	double current_run_time;
-	float reading;
-	char tmp [200]; //for temporary storage of content in parameter file
-	bool emailAllow; //trigger to allow or disallow e-mail, set by program
-	bool messageAllow; //trigger to allow or disallow messages, set by program
+	extern double tstart,tstop,tcurrent; //monotonic clock readings (s) at the start/end of the run and the last GetTime() call
+	extern double runStartTime; //clock realtime (s since the epoch) at the start of the run, the schedule is checkpointed relative to it
+	extern Checkpoint scheduleCheckpoint; //file the schedule's trigger state is saved to whenever it changes
+	extern double paused;
+	extern float meas;
+	extern double run_time;
+	extern double current_run_time;
+	extern float reading;
+	extern char tmp [200]; //for temporary storage of content in parameter file
+	extern bool emailAllow; //trigger to allow or disallow e-mail, set by program
+	extern bool messageAllow; //trigger to allow or disallow messages, set by program
+	extern unsigned long long openValveMask; //valves currently held open by the fill cycle (bit N = valve N)
+	extern LatencyHist stageHist [NUM_STAGES]; //time spent in each stage of the server cycle
+	extern unsigned long long cycleOverruns; //cycles whose work took longer than polling_time
+	extern unsigned long long fillOverruns; //fill loop passes whose work took longer than their 1 s wait
+	extern char influxStorage [INFLUX_BATCH_SIZE]; //line protocol of the last set of readings sent to InfluxDB (see encodeMeasurement)
+	extern ExportHistory readingHistory; //the last buffer_size rows of readings, which the save command exports
+	extern ExportRequest saveRequest; //file, format and range given with the last save command
+	extern FillHistory fillHistory; //every fill, with the time it took, why it ended and the LN2 it used
+	extern HistoryQuery historyRequest; //fills or totals asked for with the last history command
+	extern FillTrace fillTraces [TRACE_BUFFERS]; //buffers the fills are traced into, written by traceWorker
+	extern ChannelHealth channelHealth [MAXSCHEDENTRIES+1]; //health of the channels read every cycle: the scale, then each overflow sensor
+	extern int numHealthChannels;
+	extern HealthConfig healthConfig; //what makes a channel open, saturated, frozen or erratic
+	extern bool sensorFaultStop; //if true, fills aren't started (or are stopped) when their overflow sensor can't be trusted
+	extern TankEstimator tank; //supply tank level, boil-off and LN2 used by fills, estimated from the scale readings
+	extern TankForecast tankOutlook; //when the supply tank is expected to need refilling, updated with the estimates
+	extern PlanRequest planRequest; //delivery interval, runs and risk given with the last plan command
 	
 	//Run parameter declarations
-	double threshold; //the sensor threshold (in volts) that indicates an overflow
-	double scale_threshold; //scale sensor threshold which triggers a warning that the LN2 tank is close to empty
-	int polling_time; //the amount of time (in microseconds) between sensor readings when not filling
-	int iterations; //number of measurements allowed above the sensor threshold before stopping LN2 flow
-	double maxfilltime; //maximum length of time (in seconds) during which filling can take place before automatic shut-off of valves
-	int circBufferSize; //size of the circular buffers (# of data points)
-	char* filename; //name of file to save data to
-	char* fillName; //name of system to fill
-	char* masterParam; //additional parameter that can be given to master
-	bool email; //if true, alerts (tank nearly empty, automatic shutdown) will be sent by e-mail
-	char mailaddress [200]; //e-mail address to send alerts to
+	extern double threshold; //the sensor threshold (in volts) that indicates an overflow
+	extern double scale_threshold; //scale sensor threshold which triggers a warning that the LN2 tank is close to empty
+	extern double tankAlertHours; //warn this long (in hours) before the tank is expected to reach scale_threshold
+	extern double tankSwapKg; //jump in the tank level (kg) taken as a tank swap
+	extern int deliveryDays; //days between supply tank deliveries, planned for by the plan command
+	extern double tankFullKg; //level (kg) of a newly delivered tank (0=the level measured after the last swap)
+	extern int planRuns; //runs of the schedule the plan command simulates for each case
+	extern double planFillKg; //LN2 (kg) a fill is taken to use when neither its history nor the tank estimates know (0=left out)
+	extern int polling_time; //the amount of time (in microseconds) between sensor readings when not filling
+	extern char archiveFile [256]; //file every reading is archived to (off=no archive)
+	extern char fillHistoryFile [256]; //file a record of every fill is appended to (off=none)
+	extern char traceDir [256]; //directory the trace of each fill is written to (off=none)
+	extern int traceInterval; //time (in milliseconds) between the readings of a fill trace (0=no traces)
+	extern int metricsPort; //local port on which metrics are served in the Prometheus format (0=disabled)
+	extern char controlSocket [108]; //local socket commands are received on (see ctlproto.h)
+	extern char scheduleState [256]; //file the schedule's trigger state is checkpointed to (off=none)
+	extern bool influxUDP; //if true, readings are sent to InfluxDB over UDP instead of HTTP
+	extern int influxMTU; //MTU of the path to InfluxDB, UDP datagrams are packed up to this size
+	extern char influxHost [256]; //address of the InfluxDB server
+	extern char influxDB [256]; //InfluxDB database (HTTP only)
+	extern char influxUser [256]; //InfluxDB user and password (HTTP only, may be empty)
+	extern char influxPassword [256];
+	extern int iterations; //number of measurements allowed above the sensor threshold before stopping LN2 flow
+	extern double maxfilltime; //maximum length of time (in seconds) during which filling can take place before automatic shut-off of valves
+	extern int circBufferSize; //size of the circular buffers (# of data points)
+	extern char fillName [COMMAND_PARAM_SIZE]; //name of system to fill
+	extern int masterValue; //valve or analog input given with the on and measure commands
+	extern char masterParam [COMMAND_PARAM_SIZE]; //additional parameter given with the stats and table commands (empty if none)
+	extern bool email; //if true, alerts (tank nearly empty, automatic shutdown) will be sent by e-mail
+	extern char mailaddress [200]; //e-mail address to send alerts to
+	extern char daqDriver [256]; //shared object implementing the DAQ driver (eg. ./daq_nidaq.so)
+	extern char daqConfig [256]; //configuration string passed to the DAQ driver
+	extern bool virtualClock; //if true, the server runs on a virtual clock instead of the system clock
+	extern double clockSpeedup; //how many times faster than real time the virtual clock runs (0=as fast as possible)
+	extern time_t clockStart; //time of day at which the virtual clock starts
 	
 	//cooling system component value declarations
-	int numValves; //number of valves/overflow sensors used in the setup
-	int valveOutputs [20]; //array of output DAQ channels for each valve
-	int scaleInput; //input DAQ channel for the scale reading
+	extern int numValves; //number of valves/overflow sensors used in the setup
+	extern int valveOutputs [20]; //array of output DAQ channels for each valve
+	extern int scaleInput; //input DAQ channel for the scale reading
+	extern int measChans [MAXSCHEDENTRIES+1]; //DAQ channels read every cycle: the scale followed by each entry's overflow sensor
 	
 	//Sensor calibration parameter declarations
-	double scaleFit [2]; //array of fit parameters for scale reading
+	extern double scaleFit [2]; //array of fit parameters for scale reading
+
+#endif
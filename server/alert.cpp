@@ -0,0 +1,301 @@
+//alerts sent in the background (see alert.h)
+#include "alert.h"
+#include "clock.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+
+#define ALERT_WEBHOOK_TIMEOUT 5 //s
+
+extern char **environ;
+
+typedef struct {
+  time_t t;                 //server clock time it was raised
+  char key[ALERT_KEY_SIZE];
+  char text[ALERT_TEXT_SIZE];
+} Alert;
+
+//last alert sent for a key (only used by the worker)
+typedef struct {
+  char key[ALERT_KEY_SIZE];
+  time_t lastSent;
+  unsigned int suppressed;  //alerts not sent since
+} AlertKey;
+
+static AlertConfig config;
+static Alert queue[ALERT_QUEUE_SIZE];
+static int queueStart, queueCount;
+static volatile bool running = false;
+static bool stopping;
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueReady = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static AlertKey keys[ALERT_MAX_KEYS];
+static int numKeys;
+
+/*--------------------------------------------------------------*/
+int alertParseWebhook(AlertConfig *c, const char *url) {
+  if (strncmp(url, "http://", 7) == 0)
+    url += 7;
+  const char *colon = strchr(url, ':');
+  if ((colon == NULL) || (colon == url) || (colon - url >= (int)sizeof(c->webhookHost)))
+    return -1;
+  char *end;
+  long port = strtol(colon + 1, &end, 10);
+  if ((end == colon + 1) || (port <= 0) || (port > 65535) || ((*end != '\0') && (*end != '/')))
+    return -1;
+  if (strlen(end) >= sizeof(c->webhookPath))
+    return -1;
+
+  memcpy(c->webhookHost, url, colon - url);
+  c->webhookHost[colon - url] = '\0';
+  c->webhookPort = (int)port;
+  strcpy(c->webhookPath, (*end == '\0') ? "/" : end);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//e-mail through emailalert.sh, waiting for it to finish
+static bool sendMail(const char *text) {
+  char script[] = "emailalert.sh", shell[] = "sh";
+  char *argv[] = {shell, script, config.mailTo, (char *)text, NULL};
+  pid_t pid;
+  int status;
+  posix_spawn_file_actions_t actions;
+
+  //the script's messages would end up in the middle of the server's
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+  int err = posix_spawnp(&pid, "sh", &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if (err != 0) {
+    printf("ERROR: Could not start emailalert.sh (%s).\n", strerror(err));
+    return false;
+  }
+  if (waitpid(pid, &status, 0) < 0) {
+    printf("ERROR: Lost track of emailalert.sh.\n");
+    return false;
+  }
+  if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+    printf("ERROR: emailalert.sh could not send the alert to %s.\n", config.mailTo);
+    return false;
+  }
+  printf("Email alert sent to %s.\n", config.mailTo);
+  return true;
+}
+/*--------------------------------------------------------------*/
+//appends src to a JSON string being built in dest
+static int jsonString(char *dest, int len, const char *src) {
+  int n = 0;
+  dest[n++] = '"';
+  for (; (*src != '\0') && (n < len - 8); src++) {
+    unsigned char ch = (unsigned char)*src;
+    if ((ch == '"') || (ch == '\\')) {
+      dest[n++] = '\\';
+      dest[n++] = ch;
+    } else if (ch < 0x20) {
+      n += sprintf(dest + n, "\\u%04x", ch);
+    } else {
+      dest[n++] = ch;
+    }
+  }
+  dest[n++] = '"';
+  dest[n] = '\0';
+  return n;
+}
+/*--------------------------------------------------------------*/
+//POST of {"key":...,"time":...,"suppressed":...,"text":...} to the webhook, which must answer 2xx
+static bool sendWebhook(const Alert *a, const char *when, unsigned int suppressed) {
+  char body[2*ALERT_TEXT_SIZE + 256], header[512], reply[64], port[16];
+  struct addrinfo hints, *addr;
+  struct timeval timeout;
+
+  int n = sprintf(body, "{\"key\":");
+  n += jsonString(body + n, ALERT_KEY_SIZE + 16, a->key);
+  n += sprintf(body + n, ",\"time\":\"%s\",\"suppressed\":%u,\"text\":", when, suppressed);
+  n += jsonString(body + n, sizeof(body) - n - 2, a->text);
+  n += sprintf(body + n, "}");
+  int h = snprintf(header, sizeof(header), "POST %s HTTP/1.0\r\nHost: %s:%i\r\nContent-Type: application/json\r\nContent-Length: %i\r\n\r\n",
+                   config.webhookPath, config.webhookHost, config.webhookPort, n);
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  sprintf(port, "%i", config.webhookPort);
+  if (getaddrinfo(config.webhookHost, port, &hints, &addr) != 0) {
+    printf("ERROR: Could not find the alert webhook host %s.\n", config.webhookHost);
+    return false;
+  }
+  int sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+  if (sock < 0) {
+    freeaddrinfo(addr);
+    printf("ERROR: Could not create the alert webhook socket.\n");
+    return false;
+  }
+  timeout.tv_sec = ALERT_WEBHOOK_TIMEOUT;
+  timeout.tv_usec = 0;
+  setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  bool ok = (connect(sock, addr->ai_addr, addr->ai_addrlen) == 0) &&
+            (send(sock, header, h, MSG_NOSIGNAL) == h) && (send(sock, body, n, MSG_NOSIGNAL) == n);
+  freeaddrinfo(addr);
+
+  int status = 0;
+  if (ok) {
+    int used = 0, r;
+    while ((used < (int)sizeof(reply) - 1) && ((r = recv(sock, reply + used, sizeof(reply) - 1 - used, 0)) > 0))
+      used += r;
+    reply[used] = '\0';
+    if (sscanf(reply, "HTTP/%*s %i", &status) != 1)
+      status = 0;
+  }
+  close(sock);
+  if ((status < 200) || (status > 299)) {
+    printf("ERROR: The alert webhook http://%s:%i%s did not accept the alert.\n", config.webhookHost, config.webhookPort, config.webhookPath);
+    return false;
+  }
+  return true;
+}
+/*--------------------------------------------------------------*/
+static bool sendFile(const Alert *a, const char *when, const char *text) {
+  FILE *f = fopen(config.file, "a");
+  if (f == NULL) {
+    printf("ERROR: Could not open the alert log %s.\n", config.file);
+    return false;
+  }
+  fprintf(f, "%s %s %s\n", when, a->key, text);
+  fclose(f);
+  return true;
+}
+/*--------------------------------------------------------------*/
+//sends an alert to every sink, unless one with the same key was sent within the interval
+static void dispatch(const Alert *a) {
+  char text[ALERT_TEXT_SIZE + 128], when[32];
+  struct tm local;
+  AlertKey *k = NULL;
+
+  for (int i = 0; i < numKeys; i++) {
+    if (strcmp(keys[i].key, a->key) == 0) {
+      k = &keys[i];
+      break;
+    }
+  }
+  if (k == NULL) {
+    if (numKeys < ALERT_MAX_KEYS) {
+      k = &keys[numKeys++];
+    } else {
+      //forget the key sent longest ago
+      k = &keys[0];
+      for (int i = 1; i < numKeys; i++)
+        if (keys[i].lastSent < k->lastSent)
+          k = &keys[i];
+    }
+    strcpy(k->key, a->key);
+    k->suppressed = 0;
+  } else if ((a->t >= k->lastSent) && (a->t - k->lastSent < config.interval)) {
+    k->suppressed++;
+    metricsAdd(&metrics.alertsSuppressed);
+    return;
+  }
+
+  unsigned int suppressed = k->suppressed;
+  k->lastSent = a->t;
+  k->suppressed = 0;
+  if (suppressed > 0)
+    snprintf(text, sizeof(text), "%s (%u more alerts like this were not sent since the last one.)", a->text, suppressed);
+  else
+    strcpy(text, a->text);
+  localtime_r(&a->t, &local);
+  strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+
+  bool ok = true;
+  if (config.file[0] != '\0')
+    ok = sendFile(a, when, text) && ok;
+  if (config.webhookHost[0] != '\0')
+    ok = sendWebhook(a, when, suppressed) && ok;
+  if (config.mailTo[0] != '\0')
+    ok = sendMail(text) && ok;
+  metricsAdd(ok ? &metrics.alertsSent : &metrics.alertFailures);
+}
+/*--------------------------------------------------------------*/
+static void *alertWorker(void *arg) {
+  Alert a;
+
+  pthread_mutex_lock(&queueLock);
+  while (true) {
+    while ((queueCount == 0) && !stopping)
+      pthread_cond_wait(&queueReady, &queueLock);
+    if (queueCount == 0)
+      break;
+    a = queue[queueStart];
+    queueStart = (queueStart + 1) % ALERT_QUEUE_SIZE;
+    queueCount--;
+    pthread_mutex_unlock(&queueLock);
+    dispatch(&a);
+    pthread_mutex_lock(&queueLock);
+  }
+  pthread_mutex_unlock(&queueLock);
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+int alertStart(const AlertConfig *c) {
+  if (running)
+    return 1;
+  config = *c;
+  if ((config.mailTo[0] == '\0') && (config.webhookHost[0] == '\0') && (config.file[0] == '\0'))
+    return 0;
+
+  queueStart = queueCount = 0;
+  numKeys = 0;
+  stopping = false;
+  if (pthread_create(&worker, NULL, alertWorker, NULL) != 0) {
+    printf("ERROR: Could not start the alert thread.\n");
+    return -1;
+  }
+  running = true;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void alertRaise(const char *key, const char *fmt, ...) {
+  Alert a;
+  va_list ap;
+
+  if (!running)
+    return;
+  a.t = clockTime();
+  snprintf(a.key, sizeof(a.key), "%s", key);
+  va_start(ap, fmt);
+  vsnprintf(a.text, sizeof(a.text), fmt, ap);
+  va_end(ap);
+
+  pthread_mutex_lock(&queueLock);
+  if (queueCount == ALERT_QUEUE_SIZE) {
+    pthread_mutex_unlock(&queueLock);
+    metricsAdd(&metrics.alertsDropped);
+    return;
+  }
+  queue[(queueStart + queueCount) % ALERT_QUEUE_SIZE] = a;
+  queueCount++;
+  pthread_cond_signal(&queueReady);
+  pthread_mutex_unlock(&queueLock);
+}
+/*--------------------------------------------------------------*/
+void alertStop(void) {
+  if (!running)
+    return;
+  pthread_mutex_lock(&queueLock);
+  stopping = true;
+  pthread_cond_signal(&queueReady);
+  pthread_mutex_unlock(&queueLock);
+  pthread_join(worker, NULL);
+  running = false;
+}
@@ -0,0 +1,39 @@
+//alerts (automatic shutdowns, tank running low, ...) sent in the background
+//
+//alertRaise only copies the alert into a queue and returns, so raising one never
+//holds up the control loop or a fill.  A worker thread sends each alert to every sink
+//which is set up: an e-mail through emailalert.sh (started with posix_spawn, so the
+//address and message are passed as arguments and never parsed by a shell), an HTTP
+//POST of a JSON object to a local webhook, and a line in a log file.
+//
+//Alerts with the same key are rate limited: after one is sent, the others raised
+//within interval seconds are only counted, and the count is added to the next one
+//sent.  The interval is measured on the server clock, at the time they are raised.
+
+#ifndef __ALERT
+#define __ALERT
+
+#include <time.h>
+
+#define ALERT_QUEUE_SIZE 64  //alerts waiting to be sent (more are dropped)
+#define ALERT_KEY_SIZE 64
+#define ALERT_TEXT_SIZE 512
+#define ALERT_MAX_KEYS 128   //keys whose last alert is remembered for the rate limit
+
+typedef struct {
+  char mailTo[200];          //e-mail address, empty for no e-mails
+  char webhookHost[64];      //webhook, empty for none
+  int webhookPort;
+  char webhookPath[128];
+  char file[256];            //log file, empty for none
+  int interval;              //minimum time between alerts with the same key (s)
+} AlertConfig;
+
+//parses a webhook given as host:port/path (eg. 127.0.0.1:8080/ln2), returns -1 if it isn't one
+int alertParseWebhook(AlertConfig *c, const char *url);
+
+int alertStart(const AlertConfig *c); //starts the worker, returns 0 if there are no sinks and -1 on errors
+void alertRaise(const char *key, const char *fmt, ...);
+void alertStop(void);                 //sends the alerts still queued and stops the worker
+
+#endif
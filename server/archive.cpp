@@ -0,0 +1,590 @@
+//compressed archive of readings (see archive.h for the format)
+#define _FILE_OFFSET_BITS 64 //the archive may grow past 2 GB on 32 bit systems
+#include "archive.h"
+#include "checksum.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define TIME_COLUMN_BYTES(rows) ((rows)*9 + 16)  //worst case: 69 bits per timestamp
+#define VALUE_COLUMN_BYTES(rows) ((rows)*6 + 16) //worst case: 44 bits per value
+
+/*------------------------------------------------------------*/
+/*Bit streams------------------------------------------------*/
+/*----------------------------------------------------------*/
+//writes the low n bits of value (n <= 64), most significant bit first
+static void putBits(BitWriter *w, unsigned long long value, int n) {
+  while (n > 0) {
+    unsigned int byte = w->bits >> 3;
+    int used = w->bits & 7;
+    int space = 8 - used;
+    int take = (n < space) ? n : space;
+    unsigned int chunk = (unsigned int)(value >> (n - take)) & ((1u << take) - 1);
+    if (used == 0)
+      w->buf[byte] = 0;
+    w->buf[byte] |= chunk << (space - take);
+    w->bits += take;
+    n -= take;
+  }
+}
+/*--------------------------------------------------------------*/
+//reads n bits (n <= 64), reading past the end of the stream leaves pos > bits
+static unsigned long long getBits(BitReader *r, int n) {
+  unsigned long long v = 0;
+  if (r->pos + n > r->bits) {
+    r->pos = r->bits + 1;
+    return 0;
+  }
+  while (n > 0) {
+    unsigned int byte = r->pos >> 3;
+    int avail = 8 - (r->pos & 7);
+    int take = (n < avail) ? n : avail;
+    unsigned int chunk = (r->buf[byte] >> (avail - take)) & ((1u << take) - 1);
+    v = (v << take) | chunk;
+    r->pos += take;
+    n -= take;
+  }
+  return v;
+}
+/*------------------------------------------------------------*/
+/*Column encoding--------------------------------------------*/
+/*----------------------------------------------------------*/
+//timestamps: the first one in full, then the change in the interval between readings
+//'0' = same interval, '10' + 7 bits, '110' + 9 bits, '1110' + 12 bits, '11110' + 32 bits, '11111' + 64 bits
+static void encodeTime(BitWriter *w, TimeEncoder *e, long long t, bool first) {
+  if (first) {
+    putBits(w, (unsigned long long)t, 64);
+    e->prev = t;
+    e->prevDelta = 0;
+    return;
+  }
+  long long delta = t - e->prev;
+  long long dod = delta - e->prevDelta;
+  if (dod == 0) {
+    putBits(w, 0x0, 1);
+  } else if ((dod >= -63) && (dod <= 64)) {
+    putBits(w, 0x2, 2);
+    putBits(w, (unsigned long long)(dod + 63), 7);
+  } else if ((dod >= -255) && (dod <= 256)) {
+    putBits(w, 0x6, 3);
+    putBits(w, (unsigned long long)(dod + 255), 9);
+  } else if ((dod >= -2047) && (dod <= 2048)) {
+    putBits(w, 0xE, 4);
+    putBits(w, (unsigned long long)(dod + 2047), 12);
+  } else if ((dod >= -2147483647LL) && (dod <= 2147483648LL)) {
+    putBits(w, 0x1E, 5);
+    putBits(w, (unsigned long long)(dod + 2147483647LL), 32);
+  } else {
+    putBits(w, 0x1F, 5);
+    putBits(w, (unsigned long long)dod, 64);
+  }
+  e->prev = t;
+  e->prevDelta = delta;
+}
+/*--------------------------------------------------------------*/
+static long long decodeTime(BitReader *r, TimeEncoder *e, bool first) {
+  if (first) {
+    e->prev = (long long)getBits(r, 64);
+    e->prevDelta = 0;
+    return e->prev;
+  }
+  int ones = 0;
+  while ((ones < 5) && getBits(r, 1))
+    ones++;
+  long long dod;
+  switch (ones) {
+    case 0: dod = 0; break;
+    case 1: dod = (long long)getBits(r, 7) - 63; break;
+    case 2: dod = (long long)getBits(r, 9) - 255; break;
+    case 3: dod = (long long)getBits(r, 12) - 2047; break;
+    case 4: dod = (long long)getBits(r, 32) - 2147483647LL; break;
+    default: dod = (long long)getBits(r, 64); break;
+  }
+  e->prevDelta += dod;
+  e->prev += e->prevDelta;
+  return e->prev;
+}
+/*--------------------------------------------------------------*/
+//values: the first one in full, then the XOR with the previous value.
+//'0' = unchanged, '10' + the changed bits if they fit in the previous window of changed bits,
+//'11' + 5 bits number of leading zeros + 5 bits (number of changed bits - 1) + the changed bits
+static void encodeValue(BitWriter *w, ValueEncoder *e, float value, bool first) {
+  unsigned int bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if (first) {
+    putBits(w, bits, 32);
+    e->prev = bits;
+    e->leading = -1;
+    e->trailing = 0;
+    return;
+  }
+  unsigned int x = bits ^ e->prev;
+  e->prev = bits;
+  if (x == 0) {
+    putBits(w, 0x0, 1);
+    return;
+  }
+  int leading = __builtin_clz(x);
+  int trailing = __builtin_ctz(x);
+  if (leading > 31)
+    leading = 31;
+  if ((e->leading >= 0) && (leading >= e->leading) && (trailing >= e->trailing)) {
+    putBits(w, 0x2, 2);
+    putBits(w, x >> e->trailing, 32 - e->leading - e->trailing);
+  } else {
+    int meaningful = 32 - leading - trailing;
+    putBits(w, 0x3, 2);
+    putBits(w, leading, 5);
+    putBits(w, meaningful - 1, 5);
+    putBits(w, x >> trailing, meaningful);
+    e->leading = leading;
+    e->trailing = trailing;
+  }
+}
+/*--------------------------------------------------------------*/
+static float decodeValue(BitReader *r, ValueEncoder *e, bool first) {
+  float value;
+  if (first) {
+    e->prev = (unsigned int)getBits(r, 32);
+    e->leading = -1;
+    e->trailing = 0;
+  } else if (getBits(r, 1)) {
+    if (getBits(r, 1)) {
+      e->leading = (int)getBits(r, 5);
+      int meaningful = (int)getBits(r, 5) + 1;
+      e->trailing = 32 - e->leading - meaningful;
+      if (e->trailing < 0) {
+        r->pos = r->bits + 1; //corrupt
+        e->trailing = 0;
+      }
+    }
+    if (e->leading < 0) {
+      r->pos = r->bits + 1; //window used before it was set, corrupt
+      e->leading = 0;
+    }
+    int meaningful = 32 - e->leading - e->trailing;
+    e->prev ^= (unsigned int)getBits(r, meaningful) << e->trailing;
+  }
+  memcpy(&value, &e->prev, sizeof(value));
+  return value;
+}
+/*------------------------------------------------------------*/
+/*Blocks and the index---------------------------------------*/
+/*----------------------------------------------------------*/
+static int addIndexEntry(ArchiveIndexEntry **index, int *numBlocks, int *cap, ArchiveIndexEntry *entry) {
+  if (*numBlocks >= *cap) {
+    int newCap = (*cap > 0) ? 2*(*cap) : 256;
+    ArchiveIndexEntry *p = (ArchiveIndexEntry *)realloc(*index, newCap*sizeof(ArchiveIndexEntry));
+    if (p == NULL)
+      return -1;
+    *index = p;
+    *cap = newCap;
+  }
+  (*index)[(*numBlocks)++] = *entry;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//checks the block at offset, and reads it into *buf (resized as needed) if it is complete and intact
+static int readBlockAt(FILE *data, off_t offset, off_t fileSize, unsigned char **buf, unsigned int *bufSize) {
+  ArchiveBlockHeader h;
+  if (offset + (off_t)sizeof(h) > fileSize)
+    return -1;
+  if ((fseeko(data, offset, SEEK_SET) != 0) || (fread(&h, sizeof(h), 1, data) != 1))
+    return -1;
+  if ((memcmp(h.magic, "LN2A", 4) != 0) || (h.version != ARCHIVE_VERSION) || (h.blockBytes < sizeof(h)) ||
+      (h.numChannels > ARCHIVE_MAX_CHANNELS) || (offset + (off_t)h.blockBytes > fileSize))
+    return -1;
+  if (h.blockBytes > *bufSize) {
+    unsigned char *p = (unsigned char *)realloc(*buf, h.blockBytes);
+    if (p == NULL)
+      return -1;
+    *buf = p;
+    *bufSize = h.blockBytes;
+  }
+  memcpy(*buf, &h, sizeof(h));
+  if (fread(*buf + sizeof(h), h.blockBytes - sizeof(h), 1, data) != 1)
+    return -1;
+  if (checksum(*buf + sizeof(h), h.blockBytes - sizeof(h)) != h.checksum)
+    return -1;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//adds the intact blocks from offset onwards to the index, returns the end of the last one
+static off_t scanBlocks(FILE *data, off_t offset, ArchiveIndexEntry **index, int *numBlocks, int *cap) {
+  unsigned char *buf = NULL;
+  unsigned int bufSize = 0;
+
+  fseeko(data, 0, SEEK_END);
+  off_t fileSize = ftello(data);
+  while (readBlockAt(data, offset, fileSize, &buf, &bufSize) > 0) {
+    ArchiveBlockHeader *h = (ArchiveBlockHeader *)buf;
+    ArchiveIndexEntry entry;
+    entry.tFirst = h->tFirst;
+    entry.tLast = h->tLast;
+    entry.offset = offset;
+    entry.blockBytes = h->blockBytes;
+    entry.numRows = h->numRows;
+    if (addIndexEntry(index, numBlocks, cap, &entry) < 0)
+      break;
+    offset += h->blockBytes;
+  }
+  free(buf);
+  return offset;
+}
+/*--------------------------------------------------------------*/
+//loads the index file, and completes it with any blocks written after it (or rebuilds it if
+//it doesn't match the archive).  Returns the end of the last intact block in the archive.
+static off_t loadIndex(FILE *data, const char *indexPath, ArchiveIndexEntry **index, int *numBlocks, bool *rebuilt) {
+  ArchiveIndexEntry entry;
+  int cap = 0;
+  off_t end = 0;
+
+  *index = NULL;
+  *numBlocks = 0;
+  *rebuilt = false;
+  FILE *f = fopen(indexPath, "rb");
+  if (f != NULL) {
+    while (fread(&entry, sizeof(entry), 1, f) == 1) {
+      if ((entry.offset != end) || (addIndexEntry(index, numBlocks, &cap, &entry) < 0)) {
+        *rebuilt = true; //index doesn't describe consecutive blocks
+        break;
+      }
+      end = entry.offset + entry.blockBytes;
+    }
+    fclose(f);
+  }
+
+  //make sure the last indexed block is really there
+  fseeko(data, 0, SEEK_END);
+  off_t fileSize = ftello(data);
+  if (*numBlocks > 0) {
+    ArchiveBlockHeader h;
+    ArchiveIndexEntry *last = &(*index)[*numBlocks - 1];
+    if ((end > fileSize) || (fseeko(data, last->offset, SEEK_SET) != 0) || (fread(&h, sizeof(h), 1, data) != 1) ||
+        (memcmp(h.magic, "LN2A", 4) != 0) || (h.blockBytes != last->blockBytes))
+      *rebuilt = true;
+  }
+  if (*rebuilt) {
+    *numBlocks = 0;
+    end = 0;
+  }
+
+  return scanBlocks(data, end, index, numBlocks, &cap);
+}
+/*------------------------------------------------------------*/
+/*Writing----------------------------------------------------*/
+/*----------------------------------------------------------*/
+//column buffers, and room for the largest possible block
+static void allocBuffers(ArchiveWriter *a) {
+  int numChannels = a->numChannels;
+
+  a->timeColumn.cap = TIME_COLUMN_BYTES(ARCHIVE_BLOCK_ROWS);
+  a->timeColumn.buf = (unsigned char *)malloc(a->timeColumn.cap);
+  a->valueColumn = (BitWriter *)calloc(numChannels, sizeof(BitWriter));
+  a->valueEnc = (ValueEncoder *)calloc(numChannels, sizeof(ValueEncoder));
+  for (int i = 0; i < numChannels; i++) {
+    a->valueColumn[i].cap = VALUE_COLUMN_BYTES(ARCHIVE_BLOCK_ROWS);
+    a->valueColumn[i].buf = (unsigned char *)malloc(a->valueColumn[i].cap);
+  }
+  a->blockBufSize = sizeof(ArchiveBlockHeader) + numChannels*(ARCHIVE_NAME_LENGTH + 1) + (numChannels + 1)*4 +
+                    TIME_COLUMN_BYTES(ARCHIVE_BLOCK_ROWS) + numChannels*VALUE_COLUMN_BYTES(ARCHIVE_BLOCK_ROWS);
+  a->blockBuf = (unsigned char *)malloc(a->blockBufSize);
+}
+/*--------------------------------------------------------------*/
+int archiveOpen(ArchiveWriter *a, const char *path, int numChannels, const char names[][ARCHIVE_NAME_LENGTH]) {
+  char indexPath[272];
+  ArchiveIndexEntry *index;
+  int numBlocks, oldBlocks = 0;
+  bool rebuilt;
+
+  memset(a, 0, sizeof(ArchiveWriter));
+  if ((numChannels < 1) || (numChannels > ARCHIVE_MAX_CHANNELS)) {
+    printf("ERROR: Can't archive %i channels (maximum %i).\n", numChannels, ARCHIVE_MAX_CHANNELS);
+    return -1;
+  }
+  strncpy(a->path, path, sizeof(a->path) - 1);
+  a->numChannels = numChannels;
+  for (int i = 0; i < numChannels; i++)
+    strncpy(a->names[i], names[i], ARCHIVE_NAME_LENGTH - 1);
+
+  a->data = fopen(path, "r+b");
+  if (a->data == NULL)
+    a->data = fopen(path, "w+b");
+  if (a->data == NULL) {
+    printf("ERROR: Could not open the archive %s.\n", path);
+    return -1;
+  }
+
+  //find where the last complete block ends, anything after it is a block which was
+  //being written when the server stopped and is dropped
+  sprintf(indexPath, "%s.idx", path);
+  FILE *f = fopen(indexPath, "rb");
+  if (f != NULL) {
+    fseeko(f, 0, SEEK_END);
+    oldBlocks = ftello(f) / sizeof(ArchiveIndexEntry);
+    fclose(f);
+  }
+  off_t end = loadIndex(a->data, indexPath, &index, &numBlocks, &rebuilt);
+  if (ftruncate(fileno(a->data), end) != 0)
+    printf("WARNING: Could not remove the incomplete block at the end of %s.\n", path);
+  fseeko(a->data, end, SEEK_SET);
+
+  //rewrite the index if it was incomplete
+  if (rebuilt || (numBlocks != oldBlocks)) {
+    a->index = fopen(indexPath, "wb");
+    if (a->index != NULL)
+      fwrite(index, sizeof(ArchiveIndexEntry), numBlocks, a->index);
+  } else {
+    a->index = fopen(indexPath, "ab");
+  }
+  free(index);
+  if (a->index == NULL) {
+    printf("ERROR: Could not open the archive index %s.\n", indexPath);
+    fclose(a->data);
+    a->data = NULL;
+    return -1;
+  }
+  fflush(a->index);
+  allocBuffers(a);
+
+  printf("Archiving %i channels to %s (%i blocks so far).\n", numChannels, path, numBlocks);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+int archiveCreate(ArchiveWriter *a, const char *path, int numChannels, const char names[][ARCHIVE_NAME_LENGTH]) {
+  memset(a, 0, sizeof(ArchiveWriter));
+  if ((numChannels < 1) || (numChannels > ARCHIVE_MAX_CHANNELS)) {
+    printf("ERROR: Can't archive %i channels (maximum %i).\n", numChannels, ARCHIVE_MAX_CHANNELS);
+    return -1;
+  }
+  strncpy(a->path, path, sizeof(a->path) - 1);
+  a->numChannels = numChannels;
+  for (int i = 0; i < numChannels; i++)
+    strncpy(a->names[i], names[i], ARCHIVE_NAME_LENGTH - 1);
+
+  a->data = fopen(path, "wb");
+  if (a->data == NULL) {
+    printf("ERROR: Could not create %s.\n", path);
+    return -1;
+  }
+  allocBuffers(a);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//adds one row (a value for every channel) to the block being built, the block is written
+//once it holds ARCHIVE_BLOCK_ROWS rows
+int archiveAppend(ArchiveWriter *a, long long tMs, const float *values) {
+  if (a->data == NULL)
+    return -1;
+  bool first = (a->numRows == 0);
+  if (first)
+    a->tFirst = tMs;
+  a->tLast = tMs;
+  encodeTime(&a->timeColumn, &a->timeEnc, tMs, first);
+  for (int i = 0; i < a->numChannels; i++)
+    encodeValue(&a->valueColumn[i], &a->valueEnc[i], values[i], first);
+  a->numRows++;
+
+  if (a->numRows >= ARCHIVE_BLOCK_ROWS)
+    return archiveFlush(a);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//writes the rows collected so far as a block
+int archiveFlush(ArchiveWriter *a) {
+  ArchiveBlockHeader h;
+  ArchiveIndexEntry entry;
+  unsigned int used = sizeof(h);
+
+  if ((a->data == NULL) || (a->numRows == 0))
+    return 0;
+
+  //column names, then the size of each column, then the columns
+  for (int i = 0; i < a->numChannels; i++) {
+    unsigned char len = (unsigned char)strlen(a->names[i]);
+    a->blockBuf[used++] = len;
+    memcpy(a->blockBuf + used, a->names[i], len);
+    used += len;
+  }
+  unsigned int columnBytes = (a->timeColumn.bits + 7) / 8;
+  memcpy(a->blockBuf + used, &columnBytes, 4);
+  used += 4;
+  for (int i = 0; i < a->numChannels; i++) {
+    columnBytes = (a->valueColumn[i].bits + 7) / 8;
+    memcpy(a->blockBuf + used, &columnBytes, 4);
+    used += 4;
+  }
+  columnBytes = (a->timeColumn.bits + 7) / 8;
+  memcpy(a->blockBuf + used, a->timeColumn.buf, columnBytes);
+  used += columnBytes;
+  for (int i = 0; i < a->numChannels; i++) {
+    columnBytes = (a->valueColumn[i].bits + 7) / 8;
+    memcpy(a->blockBuf + used, a->valueColumn[i].buf, columnBytes);
+    used += columnBytes;
+  }
+
+  memcpy(h.magic, "LN2A", 4);
+  h.version = ARCHIVE_VERSION;
+  h.blockBytes = used;
+  h.numRows = a->numRows;
+  h.numChannels = a->numChannels;
+  h.checksum = checksum(a->blockBuf + sizeof(h), used - sizeof(h));
+  h.tFirst = a->tFirst;
+  h.tLast = a->tLast;
+  memcpy(a->blockBuf, &h, sizeof(h));
+
+  //start the next block whatever happens to this one
+  a->numRows = 0;
+  a->timeColumn.bits = 0;
+  for (int i = 0; i < a->numChannels; i++)
+    a->valueColumn[i].bits = 0;
+
+  entry.offset = ftello(a->data);
+  if ((fwrite(a->blockBuf, used, 1, a->data) != 1) || (fflush(a->data) != 0)) {
+    printf("ERROR: Could not write to the archive %s.\n", a->path);
+    return -1;
+  }
+  entry.tFirst = h.tFirst;
+  entry.tLast = h.tLast;
+  entry.blockBytes = h.blockBytes;
+  entry.numRows = h.numRows;
+  if (a->index != NULL) {
+    fwrite(&entry, sizeof(entry), 1, a->index);
+    fflush(a->index);
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void archiveClose(ArchiveWriter *a) {
+  if (a->data == NULL)
+    return;
+  archiveFlush(a);
+  fclose(a->data);
+  if (a->index != NULL)
+    fclose(a->index);
+  a->data = NULL;
+  a->index = NULL;
+  free(a->timeColumn.buf);
+  for (int i = 0; i < a->numChannels; i++)
+    free(a->valueColumn[i].buf);
+  free(a->valueColumn);
+  free(a->valueEnc);
+  free(a->blockBuf);
+}
+/*------------------------------------------------------------*/
+/*Reading----------------------------------------------------*/
+/*----------------------------------------------------------*/
+int archiveOpenReader(ArchiveReader *r, const char *path) {
+  char indexPath[272];
+  bool rebuilt;
+
+  memset(r, 0, sizeof(ArchiveReader));
+  r->data = fopen(path, "rb");
+  if (r->data == NULL) {
+    printf("ERROR: Could not open the archive %s.\n", path);
+    return -1;
+  }
+  sprintf(indexPath, "%s.idx", path);
+  loadIndex(r->data, indexPath, &r->index, &r->numBlocks, &rebuilt);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//blocks are appended in time order, so the index can be searched by time
+int archiveFindBlock(ArchiveReader *r, long long tMs) {
+  int lo = 0, hi = r->numBlocks;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (r->index[mid].tLast < tMs)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+/*--------------------------------------------------------------*/
+//decodes a block, b must be zeroed before its first use (its arrays are reused for later blocks)
+int archiveReadBlock(ArchiveReader *r, int block, ArchiveBlock *b) {
+  unsigned char *buf = NULL;
+  unsigned int bufSize = 0, columnBytes[ARCHIVE_MAX_CHANNELS + 1];
+  TimeEncoder te = {0, 0};
+  ValueEncoder ve = {0, -1, 0};
+  BitReader br;
+
+  if ((block < 0) || (block >= r->numBlocks))
+    return -1;
+  fseeko(r->data, 0, SEEK_END);
+  off_t fileSize = ftello(r->data);
+  if (readBlockAt(r->data, r->index[block].offset, fileSize, &buf, &bufSize) < 0) {
+    printf("ERROR: Block %i of the archive is damaged.\n", block);
+    free(buf);
+    return -1;
+  }
+  ArchiveBlockHeader *h = (ArchiveBlockHeader *)buf;
+  unsigned int used = sizeof(ArchiveBlockHeader);
+
+  b->numChannels = h->numChannels;
+  for (int i = 0; i < b->numChannels; i++) {
+    unsigned char len = buf[used++];
+    if ((len >= ARCHIVE_NAME_LENGTH) || (used + len > h->blockBytes))
+      goto Corrupt;
+    memcpy(b->names[i], buf + used, len);
+    b->names[i][len] = '\0';
+    used += len;
+  }
+  if (used + 4*(b->numChannels + 1) > h->blockBytes)
+    goto Corrupt;
+  memcpy(columnBytes, buf + used, 4*(b->numChannels + 1));
+  used += 4*(b->numChannels + 1);
+
+  b->numRows = h->numRows;
+  b->t = (long long *)realloc(b->t, (b->numRows + 1)*sizeof(long long));
+  b->values = (float *)realloc(b->values, ((long long)b->numRows*b->numChannels + 1)*sizeof(float));
+
+  for (int c = -1; c < b->numChannels; c++) {
+    unsigned int bytes = columnBytes[c + 1];
+    if (used + bytes > h->blockBytes)
+      goto Corrupt;
+    br.buf = buf + used;
+    br.bits = 8*bytes;
+    br.pos = 0;
+    for (int row = 0; row < b->numRows; row++) {
+      if (c < 0)
+        b->t[row] = decodeTime(&br, &te, row == 0);
+      else
+        b->values[c*b->numRows + row] = decodeValue(&br, &ve, row == 0);
+    }
+    if (br.pos > br.bits)
+      goto Corrupt;
+    used += bytes;
+  }
+
+  free(buf);
+  return 1;
+Corrupt:
+  printf("ERROR: Block %i of the archive could not be decoded.\n", block);
+  free(buf);
+  return -1;
+}
+/*--------------------------------------------------------------*/
+int archiveChannel(ArchiveBlock *b, const char *name) {
+  for (int i = 0; i < b->numChannels; i++)
+    if (strcmp(b->names[i], name) == 0)
+      return i;
+  return -1;
+}
+/*--------------------------------------------------------------*/
+void archiveFreeBlock(ArchiveBlock *b) {
+  free(b->t);
+  free(b->values);
+  b->t = NULL;
+  b->values = NULL;
+}
+/*--------------------------------------------------------------*/
+void archiveCloseReader(ArchiveReader *r) {
+  if (r->data != NULL)
+    fclose(r->data);
+  free(r->index);
+  r->data = NULL;
+  r->index = NULL;
+}
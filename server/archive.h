@@ -0,0 +1,123 @@
+//compressed local archive of every reading taken by the server
+//
+//The archive is a file of self-contained blocks, each holding up to ARCHIVE_BLOCK_ROWS
+//rows of readings (one row per cycle, one column per DAQ channel).  Columns are stored
+//separately and compressed the way Gorilla (Facebook's time series database) does it:
+//timestamps as delta-of-deltas, which take a single bit while readings arrive at a
+//steady interval, and values as the XOR with the previous value, storing only the bits
+//that changed.  Values are kept as 32 bit floats, which is more than the resolution of
+//the DAQ.  A row typically takes a few bytes per channel.
+//
+//Each block starts with a header giving its time range and the names of its columns,
+//so the set of channels may change between blocks (eg. after editing schedule.dat).
+//A separate index file (<archive>.idx) lists the time range and position of every
+//block, so that readers can seek to a time range without scanning the archive.  It is
+//rebuilt from the archive if it is missing or out of date.
+
+#ifndef __ARCHIVE
+#define __ARCHIVE
+
+#include <stdio.h>
+
+#define ARCHIVE_BLOCK_ROWS 360     //rows per block (1 hour at the default reading interval)
+#define ARCHIVE_MAX_CHANNELS 260   //columns per block
+#define ARCHIVE_NAME_LENGTH 64     //longest column name, including the terminating 0
+#define ARCHIVE_VERSION 1
+
+//header at the start of each block (stored little endian, as on x86)
+typedef struct {
+  char magic[4];            //"LN2A"
+  unsigned int version;     //ARCHIVE_VERSION
+  unsigned int blockBytes;  //size of the block including this header
+  unsigned int numRows;
+  unsigned int numChannels;
+  unsigned int checksum;    //FNV-1a hash of the block after the header
+  long long tFirst;         //time of the first and last row (ms since the epoch)
+  long long tLast;
+} ArchiveBlockHeader;
+
+//entry of the index file
+typedef struct {
+  long long tFirst;
+  long long tLast;
+  long long offset;         //position of the block in the archive
+  unsigned int blockBytes;
+  unsigned int numRows;
+} ArchiveIndexEntry;
+
+//bit stream that one column is encoded into
+typedef struct {
+  unsigned char *buf;
+  unsigned int cap;         //size of buf in bytes
+  unsigned int bits;        //number of bits written
+} BitWriter;
+
+typedef struct {
+  const unsigned char *buf;
+  unsigned int bits;        //number of bits available
+  unsigned int pos;         //next bit to read
+} BitReader;
+
+//state of the delta-of-delta timestamp encoder
+typedef struct {
+  long long prev;
+  long long prevDelta;
+} TimeEncoder;
+
+//state of the XOR value encoder
+typedef struct {
+  unsigned int prev;
+  int leading;              //leading and trailing zeros of the last stored XOR, -1 before the first
+  int trailing;
+} ValueEncoder;
+
+//archive opened for appending (used by the server)
+typedef struct {
+  FILE *data;
+  FILE *index;              //NULL for files made with archiveCreate
+  char path[256];
+  int numChannels;
+  char names[ARCHIVE_MAX_CHANNELS][ARCHIVE_NAME_LENGTH];
+  unsigned int numRows;     //rows in the block being built
+  long long tFirst, tLast;
+  BitWriter timeColumn;
+  TimeEncoder timeEnc;
+  BitWriter *valueColumn;
+  ValueEncoder *valueEnc;
+  unsigned char *blockBuf;  //the block is assembled here before it is written
+  unsigned int blockBufSize;
+} ArchiveWriter;
+
+//one decoded block
+typedef struct {
+  int numRows;
+  int numChannels;
+  char names[ARCHIVE_MAX_CHANNELS][ARCHIVE_NAME_LENGTH];
+  long long *t;             //t[row], ms since the epoch
+  float *values;            //values[channel*numRows + row]
+} ArchiveBlock;
+
+//archive opened for reading (used by ln2_query)
+typedef struct {
+  FILE *data;
+  ArchiveIndexEntry *index;
+  int numBlocks;
+} ArchiveReader;
+
+//writing
+int archiveOpen(ArchiveWriter *a, const char *path, int numChannels, const char names[][ARCHIVE_NAME_LENGTH]);
+//a new file of blocks without an index, for small files which readers scan (eg. fill traces)
+int archiveCreate(ArchiveWriter *a, const char *path, int numChannels, const char names[][ARCHIVE_NAME_LENGTH]);
+int archiveAppend(ArchiveWriter *a, long long tMs, const float *values);
+int archiveFlush(ArchiveWriter *a);
+void archiveClose(ArchiveWriter *a);
+
+//reading
+int archiveOpenReader(ArchiveReader *r, const char *path);
+int archiveFindBlock(ArchiveReader *r, long long tMs); //first block which ends at or after tMs
+int archiveReadBlock(ArchiveReader *r, int block, ArchiveBlock *b);
+int archiveChannel(ArchiveBlock *b, const char *name); //column index of a channel, -1 if not in the block
+void archiveFreeBlock(ArchiveBlock *b);
+void archiveCloseReader(ArchiveReader *r);
+
+#endif
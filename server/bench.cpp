@@ -0,0 +1,545 @@
+//microbenchmarks for the paths the LN2 server runs constantly (build and run with 'make bench')
+//
+//Results are written to stdout as JSON, one record per benchmark, so that they can be
+//compared from run to run.  Everything the benchmarked code prints goes to /dev/null.
+#include "LN2_server.h"
+#include "circbuffer.h"
+#include "influxdb.h"
+#include <pthread.h>
+#include <time.h>
+
+#define BENCH_MIN_TIME 0.5      //minimum time (s) each benchmark runs for
+#define BENCH_SCHED_ENTRIES 250 //size of the generated schedule (must be below MAXSCHEDENTRIES)
+
+typedef void (*bench_fn)(long);
+
+static FILE *json;
+static int numResults = 0;
+static FillSched *sched;
+static FillSched *bigSched;
+static influx_client_t stub;
+static influx_client_t udpStub;
+static char schedFile[256];
+
+/*--------------------------------------------------------------*/
+static double benchTime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1.0E9;
+}
+/*--------------------------------------------------------------*/
+//runs fn with an increasing number of iterations until it takes at least BENCH_MIN_TIME
+static void runBench(const char *name, bench_fn fn) {
+  long n = 1;
+  double elapsed = 0.0;
+
+  fprintf(stderr, "Running %s ...\n", name);
+  for(;;){
+    double t0 = benchTime();
+    fn(n);
+    elapsed = benchTime() - t0;
+    if((elapsed >= BENCH_MIN_TIME)||(n >= (1L << 30)))
+      break;
+    //aim a bit past the minimum time on the next attempt
+    if(elapsed < BENCH_MIN_TIME/100.0)
+      n *= 100;
+    else
+      n = (long)(n*1.2*BENCH_MIN_TIME/elapsed) + 1;
+    if(n > (1L << 30))
+      n = 1L << 30;
+  }
+
+  fprintf(json, "%s\n    {\"name\": \"%s\", \"iterations\": %ld, \"total_s\": %.6f, \"ns_per_op\": %.3f, \"ops_per_s\": %.1f}",
+          numResults ? "," : "", name, n, elapsed, elapsed*1.0E9/n, n/elapsed);
+  numResults++;
+}
+/*------------------------------------------------------------*/
+/*Line protocol encoding-------------------------------------*/
+/*----------------------------------------------------------*/
+static int formatLine(char **buf, ...) {
+  va_list ap;
+  va_start(ap, buf);
+  int len = _format_line(buf, ap);
+  va_end(ap);
+  return len;
+}
+/*--------------------------------------------------------------*/
+static void benchFormatLine(long n) {
+  char *buf;
+  for(long i=0;i<n;i++){
+    formatLine(&buf,
+               INFLUX_MEAS("sensor3"),
+               INFLUX_F_FLT("sensor3", 4.123456, 6),
+               INFLUX_TS(1512722735522840439LL),
+               INFLUX_END);
+    free(buf);
+  }
+}
+/*--------------------------------------------------------------*/
+static void benchFormatLineTags(long n) {
+  char *buf;
+  for(long i=0;i<n;i++){
+    formatLine(&buf,
+               INFLUX_MEAS("ln2"),
+               INFLUX_TAG("channel", "ai3"), INFLUX_TAG("entry", "CSS_precool1"), INFLUX_TAG("kind", "overflow"),
+               INFLUX_F_FLT("voltage", 4.123456, 6), INFLUX_F_FLT("weight", 171.25, 6),
+               INFLUX_TS(1512722735522840439LL),
+               INFLUX_END);
+    free(buf);
+  }
+}
+/*--------------------------------------------------------------*/
+static void benchEscapedAppend(long n) {
+  size_t len = 0x100, used;
+  char *buf = (char*)malloc(len);
+  for(long i=0;i<n;i++){
+    used = 0;
+    _escaped_append(&buf, &len, &used, "GEARS monday,precool=1 tank", ",= ");
+  }
+  free(buf);
+}
+/*--------------------------------------------------------------*/
+static volatile int sinkLen;
+static void benchDtoa(long n) {
+  char out[INFLUX_NUMBER_MAX];
+  for(long i=0;i<n;i++){
+    sinkLen = influx_dtoa(4.123456 + 1.0E-6*(i & 1023), out);
+  }
+}
+/*--------------------------------------------------------------*/
+static void benchEncodeLine(long n) {
+  static char storage[4096];
+  influx_series_t series;
+  influx_buf_t b;
+  influx_series_init(&series, "ln2");
+  influx_series_tag(&series, "channel", "ai3");
+  influx_series_tag(&series, "entry", "CSS_precool1");
+  influx_series_tag(&series, "kind", "overflow");
+  influx_buf_init(&b, storage, sizeof(storage));
+  for(long i=0;i<n;i++){
+    influx_buf_reset(&b);
+    influx_line_begin(&b, &series);
+    influx_line_float(&b, "voltage", 4.123456);
+    influx_line_float(&b, "weight", 171.25);
+    influx_line_end(&b, 1512722735522840439LL);
+  }
+  sinkLen = b.used;
+}
+/*--------------------------------------------------------------*/
+//one set of readings for the generated schedule
+static void benchReading(Reading *r) {
+  memset(r, 0, sizeof(Reading));
+  r->t = 1512722735;
+  r->weightV = 3.4567;
+  r->weight = 171.25;
+  r->numSensors = sched->numEntries;
+  for(int i=0;i<sched->numEntries;i++)
+    r->sensor[i] = 1.0 + 0.1*i;
+}
+/*--------------------------------------------------------------*/
+//encodes all readings of one cycle, the way the InfluxDB thread does
+static void benchEncodeMeasurement(long n) {
+  Reading r;
+  benchReading(&r);
+  for(long i=0;i<n;i++){
+    sinkLen = encodeMeasurement(&r);
+  }
+}
+/*------------------------------------------------------------*/
+/*HTTP posting against a local stub server-------------------*/
+/*----------------------------------------------------------*/
+//accepts connections and answers every request with 204 No Content, like InfluxDB does
+static void *stubServer(void *arg) {
+  int listenSock = *(int*)arg;
+  char buf[4096];
+
+  for(;;){
+    int sock = accept(listenSock, NULL, NULL);
+    if(sock < 0)
+      continue;
+    //read the request headers and body before answering
+    int used = 0, contentLength = -1;
+    char *body = NULL;
+    while(used < (int)sizeof(buf) - 1){
+      int r = recv(sock, buf + used, sizeof(buf) - 1 - used, 0);
+      if(r <= 0)
+        break;
+      used += r;
+      buf[used] = '\0';
+      if((body == NULL)&&((body = strstr(buf, "\r\n\r\n")) != NULL)){
+        char *cl = strstr(buf, "Content-Length: ");
+        contentLength = cl ? atoi(cl + 16) : 0;
+        body += 4;
+      }
+      if((body != NULL)&&(used - (body - buf) >= contentLength))
+        break;
+    }
+    const char *response = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+    send(sock, response, strlen(response), 0);
+    close(sock);
+  }
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+static int startStub(void) {
+  static int listenSock;
+  struct sockaddr_in addr;
+  socklen_t addrLen = sizeof(addr);
+  pthread_t thread;
+
+  listenSock = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = 0; //any free port
+  if((bind(listenSock, (struct sockaddr*)&addr, sizeof(addr)) < 0)||(listen(listenSock, 64) < 0))
+    return -1;
+  getsockname(listenSock, (struct sockaddr*)&addr, &addrLen);
+  pthread_create(&thread, NULL, stubServer, &listenSock);
+
+  stub.host = strdup("127.0.0.1");
+  stub.port = ntohs(addr.sin_port);
+  stub.db = strdup("LN2");
+  stub.usr = strdup("");
+  stub.pwd = strdup("");
+  return 1;
+}
+/*--------------------------------------------------------------*/
+static void benchPostHttp(long n) {
+  for(long i=0;i<n;i++){
+    if(post_http(&stub,
+                 INFLUX_MEAS("sensor3"),
+                 INFLUX_F_FLT("sensor3", 4.123456, 6),
+                 INFLUX_TS(1512722735522840439LL),
+                 INFLUX_END) != 0){
+      fprintf(stderr, "post_http to the stub server failed.\n");
+      exit(1);
+    }
+  }
+}
+/*--------------------------------------------------------------*/
+static void benchPostBatch(long n) {
+  Reading r;
+  benchReading(&r);
+  int len = encodeMeasurement(&r);
+  for(long i=0;i<n;i++){
+    if(post_http_lines(&stub, influxStorage, len) != 0){
+      fprintf(stderr, "post_http_lines to the stub server failed.\n");
+      exit(1);
+    }
+  }
+}
+/*--------------------------------------------------------------*/
+//a bound UDP socket which is never read, datagrams which don't fit its buffer are dropped by the kernel
+static int startUdpStub(void) {
+  struct sockaddr_in addr;
+  socklen_t addrLen = sizeof(addr);
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = 0;
+  if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    return -1;
+  getsockname(sock, (struct sockaddr*)&addr, &addrLen);
+
+  udpStub.host = strdup("127.0.0.1");
+  udpStub.port = ntohs(addr.sin_port);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+static void benchSendUdpBatch(long n) {
+  Reading r;
+  int failed;
+  benchReading(&r);
+  int len = encodeMeasurement(&r);
+  for(long i=0;i<n;i++){
+    if((send_udp_lines(&udpStub, influxStorage, len, INFLUX_UDP_MTU, &failed) < 0)||(failed > 0)){
+      fprintf(stderr, "send_udp_lines to the stub socket failed.\n");
+      exit(1);
+    }
+  }
+}
+/*------------------------------------------------------------*/
+/*Local data buffers-----------------------------------------*/
+/*----------------------------------------------------------*/
+static CircularBuffer benchBuffer;
+static volatile char sink;
+static void benchCbWriteRead(long n) {
+  ElemType e;
+  cbInit(&benchBuffer, 1000);
+  for(int i=0;i<1000;i++){
+    sprintf(e.value, "%f", 0.001*i);
+    cbWrite(&benchBuffer, &e);
+  }
+  for(long i=0;i<n;i++){
+    cbRead(&benchBuffer, &e);
+    sink = e.value[i % 8]; //keep the read from being optimized away
+    cbWrite(&benchBuffer, &e);
+  }
+  cbFree(&benchBuffer);
+}
+/*--------------------------------------------------------------*/
+static void benchBufferMeasurement(long n) {
+  double sensor[MAXSCHEDENTRIES];
+  for(int i=0;i<sched->numEntries;i++)
+    sensor[i] = 1.0 + 0.1*i;
+  time_t t = 1512722735;
+  for(long i=0;i<n;i++){
+    bufferMeasurement(sched, t + i, 171.25, sensor);
+  }
+}
+/*--------------------------------------------------------------*/
+//fills all buffers and the history of readings, so that the dumps below work on a full window
+static void fillBuffers(void) {
+  float row[MAXSCHEDENTRIES+2];
+  initBuffers(sched);
+  benchBufferMeasurement(circBufferSize);
+  for(int c=0;c<readingHistory.numChannels;c++)
+    row[c] = 1.0 + 0.1*c;
+  for(int i=0;i<circBufferSize;i++){
+    row[0] += 0.0001f;
+    exportHistoryAppend(&readingHistory, 1512722735 + 10*i, 10.0*i, row);
+  }
+}
+/*--------------------------------------------------------------*/
+static void benchTable(long n) {
+  for(long i=0;i<n;i++){
+    getPlot(sched);
+  }
+}
+/*--------------------------------------------------------------*/
+//what the save command costs the control loop: copying the rows out of the history
+static void benchSaveSnapshot(long n) {
+  ExportRequest r;
+  exportParse(&r, "/dev/null", NULL, 0);
+  for(long i=0;i<n;i++){
+    exportFree(exportSnapshot(&readingHistory, &r));
+  }
+}
+/*--------------------------------------------------------------*/
+//what the background writer then does with them
+static void benchSaveWrite(ExportRequest *r, long n) {
+  ExportJob *j = exportSnapshot(&readingHistory, r);
+  for(long i=0;i<n;i++){
+    exportWrite(j);
+  }
+  exportFree(j);
+}
+/*--------------------------------------------------------------*/
+static void benchSaveCSV(long n) {
+  ExportRequest r;
+  char saveFile[256];
+  sprintf(saveFile, "/tmp/LN2_bench_save_%i.csv", (int)getpid());
+  exportParse(&r, saveFile, NULL, 0);
+  benchSaveWrite(&r, n);
+  remove(saveFile);
+}
+/*--------------------------------------------------------------*/
+static void benchSaveArchive(long n) {
+  ExportRequest r;
+  char saveFile[256], options[8] = "bin";
+  sprintf(saveFile, "/tmp/LN2_bench_save_%i.ln2", (int)getpid());
+  exportParse(&r, saveFile, options, 0);
+  benchSaveWrite(&r, n);
+  remove(saveFile);
+  strcat(saveFile, ".idx");
+  remove(saveFile);
+}
+/*--------------------------------------------------------------*/
+//appends rows of slowly varying, noisy readings like the server does every cycle (blocks are written as they fill up)
+static void benchArchiveAppend(long n) {
+  static ArchiveWriter a;
+  static char names[MAXSCHEDENTRIES+2][ARCHIVE_NAME_LENGTH];
+  float values[MAXSCHEDENTRIES+2];
+  char archiveFile[256];
+  int numChannels = sched->numEntries + 2;
+  unsigned int seed = 12345;
+
+  sprintf(archiveFile, "/tmp/LN2_bench_archive_%i.dat", (int)getpid());
+  for(int c=0;c<numChannels;c++)
+    sprintf(names[c], "channel%i", c);
+  archiveOpen(&a, archiveFile, numChannels, names);
+  for(long i=0;i<n;i++){
+    for(int c=0;c<numChannels;c++){
+      seed = seed*1103515245u + 12345u;
+      values[c] = 1.0f + 0.1f*c + 0.001f*(seed >> 22);
+    }
+    archiveAppend(&a, 1512722735000LL + 10000LL*i, values);
+  }
+  archiveClose(&a);
+  remove(archiveFile);
+  strcat(archiveFile, ".idx");
+  remove(archiveFile);
+}
+/*--------------------------------------------------------------*/
+//adds a row to the history of readings kept for the save command, which updates all rollup tiers
+static void benchHistoryAppend(long n) {
+  float row[MAXSCHEDENTRIES+2];
+  for(int c=0;c<readingHistory.numChannels;c++)
+    row[c] = 1.0 + 0.1*c;
+  for(long i=0;i<n;i++){
+    row[0] += 0.0001f;
+    exportHistoryAppend(&readingHistory, 1512722735 + 10*i, 10.0*i, row);
+  }
+}
+/*--------------------------------------------------------------*/
+//updates the health of the scale and every overflow sensor with one cycle of noisy readings
+static void benchHealthUpdate(long n) {
+  static ChannelHealth health[MAXSCHEDENTRIES+1];
+  HealthConfig c;
+  unsigned int seed = 12345;
+  int numChannels = sched->numEntries + 1;
+
+  memset(&c, 0, sizeof(c));
+  c.minV = -10.0;
+  c.maxV = 10.0;
+  c.openV = 0.1;
+  c.faultReadings = 3;
+  c.frozenReadings = 20;
+  c.maxRate = 5.0;
+  for(int i=0;i<numChannels;i++)
+    healthInit(&health[i], "bench", i > 0);
+  for(long i=0;i<n;i++){
+    for(int ch=0;ch<numChannels;ch++){
+      seed = seed*1103515245u + 12345u;
+      healthUpdate(&health[ch], &c, 10.0*i, 1.0f + ((seed >> 16) & 0xFF)*0.0001f);
+    }
+  }
+}
+/*--------------------------------------------------------------*/
+//one case of the plan command: 10000 runs of a week with 10 entries filling 4 times a day, on one thread
+static void benchPlanRun(long n) {
+  static PlanUsage usage[10];
+  static double fillHour[7*4*10];
+  static int fillEntry[7*4*10];
+  double dayEnd[7];
+  PlanCase c;
+  PlanResult r;
+
+  for(int e=0;e<10;e++){
+    usage[e].numSamples = PLAN_MAX_SAMPLES;
+    for(int k=0;k<PLAN_MAX_SAMPLES;k++)
+      usage[e].kg[k] = 2.0f + 0.1f*((k*7 + e) % 40);
+  }
+  for(int k=0;k<7*4*10;k++){
+    fillHour[k] = 6.0*(k/10);
+    fillEntry[k] = k % 10;
+  }
+  for(int d=0;d<7;d++)
+    dayEnd[d] = 24.0*(d + 1);
+  memset(&c, 0, sizeof(c));
+  c.startKg = 600.0;
+  c.refillKg = 50.0;
+  c.boiloff = 0.5;
+  c.numDays = 7;
+  c.dayEnd = dayEnd;
+  c.numFills = 7*4*10;
+  c.fillHour = fillHour;
+  c.fillEntry = fillEntry;
+  c.usage = usage;
+  c.runs = 10000;
+  for(long i=0;i<n;i++){
+    c.seed = (unsigned int)i;
+    planRun(&c, 1, &r);
+  }
+}
+/*------------------------------------------------------------*/
+/*Schedule---------------------------------------------------*/
+/*----------------------------------------------------------*/
+//a quiet time of day (Wednesday 03:00) at which no day/time entry is due,
+//which is what the main loop sees almost every cycle
+static void benchEvaluate(FillSched *s, long n) {
+  struct tm now;
+  memset(&now, 0, sizeof(now));
+  now.tm_wday = 3;
+  now.tm_hour = 3;
+  for(long i=0;i<n;i++){
+    evaluateSchedule(s, 0.0, &now);
+  }
+}
+/*--------------------------------------------------------------*/
+static void benchEvaluateSchedule(long n) {
+  benchEvaluate(sched, n);
+}
+/*--------------------------------------------------------------*/
+static void benchEvaluateLargeSchedule(long n) {
+  benchEvaluate(bigSched, n);
+}
+/*--------------------------------------------------------------*/
+//writes a schedule using every scheduling mode, with precool/after_entry pairs like schedule.dat
+static void writeLargeSchedule(const char *path) {
+  const char *days[] = {"sunday","monday","tuesday","wednesday","thursday","friday","saturday","everyday"};
+  FILE *f = fopen(path, "w");
+  for(int i=0;i<BENCH_SCHED_ENTRIES;i+=2){
+    if(i % 10 == 8)
+      fprintf(f, "entry%i_precool,valve[0,1,4,7],overflow_sensor[3],time[by_minute,%i]\n", i, 60 + i);
+    else
+      fprintf(f, "entry%i_precool,valve[0,1,4,7],overflow_sensor[3],time[%s,%i:%.2i]\n", i, days[i % 8], (i/8) % 24, i % 60);
+    fprintf(f, "entry%i,valve[0,1,3,5],overflow_sensor[%i],time[after_entry,entry%i_precool]\n", i + 1, i % 4, i);
+  }
+  fclose(f);
+}
+/*--------------------------------------------------------------*/
+static void benchReadSchedule(long n) {
+  for(long i=0;i<n;i++){
+    readSchedule(bigSched, schedFile);
+  }
+}
+/*--------------------------------------------------------------*/
+int main(int argc, char *argv[]) {
+
+  //keep stdout for the results, everything printed by the server code is discarded
+  json = fdopen(dup(fileno(stdout)), "w");
+  if(freopen("/dev/null", "w", stdout) == NULL){
+    fprintf(stderr, "Could not redirect stdout.\n");
+    return 1;
+  }
+
+  sched = (FillSched*)calloc(1, sizeof(FillSched));
+  bigSched = (FillSched*)calloc(1, sizeof(FillSched));
+  readSchedule(sched, "schedule.dat");
+  initSeries(sched);
+  sprintf(schedFile, "/tmp/LN2_bench_schedule_%i.dat", (int)getpid());
+  writeLargeSchedule(schedFile);
+  readSchedule(bigSched, schedFile);
+  circBufferSize = 1000;
+  if((startStub() < 0)||(startUdpStub() < 0)){
+    fprintf(stderr, "Could not start the stub InfluxDB server.\n");
+    return 1;
+  }
+
+  fprintf(json, "{\n  \"suite\": \"LN2_server\",\n  \"schedule_entries\": %i,\n  \"large_schedule_entries\": %i,\n  \"buffer_size\": %i,\n  \"benchmarks\": [",
+          sched->numEntries, bigSched->numEntries, circBufferSize);
+
+  runBench("influx_format_line", benchFormatLine);
+  runBench("influx_format_line_tags", benchFormatLineTags);
+  runBench("influx_escaped_append", benchEscapedAppend);
+  runBench("influx_dtoa", benchDtoa);
+  runBench("influx_encode_line", benchEncodeLine);
+  runBench("influx_encode_measurement", benchEncodeMeasurement);
+  runBench("influx_post_http_stub", benchPostHttp);
+  runBench("influx_post_batch_stub", benchPostBatch);
+  runBench("influx_send_udp_batch", benchSendUdpBatch);
+  runBench("cb_write_read", benchCbWriteRead);
+  fillBuffers();
+  runBench("buffer_measurement", benchBufferMeasurement);
+  runBench("table_dump", benchTable);
+  runBench("history_append", benchHistoryAppend);
+  fillBuffers();
+  runBench("save_snapshot", benchSaveSnapshot);
+  runBench("save_write_csv", benchSaveCSV);
+  runBench("save_write_bin", benchSaveArchive);
+  runBench("archive_append", benchArchiveAppend);
+  runBench("health_update", benchHealthUpdate);
+  runBench("plan_run", benchPlanRun);
+  runBench("schedule_evaluate", benchEvaluateSchedule);
+  runBench("schedule_evaluate_large", benchEvaluateLargeSchedule);
+  runBench("read_schedule_large", benchReadSchedule);
+
+  fprintf(json, "\n  ]\n}\n");
+  fclose(json);
+  remove(schedFile);
+  return 0;
+}
@@ -0,0 +1,98 @@
+//checkpoint of the schedule's trigger state (see checkpoint.h for the format)
+#include "checkpoint.h"
+#include "checksum.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define STATE_OFFSET offsetof(CheckpointState, running)  //the part compared with the last state written
+
+/*--------------------------------------------------------------*/
+static bool validSlot(const CheckpointState *s) {
+  return (memcmp(s->magic, "LN2C", 4) == 0) && (s->version == CHECKPOINT_VERSION) &&
+         (s->numEntries >= 0) && (s->numEntries <= CHECKPOINT_MAX_ENTRIES) &&
+         (s->checksum == checksum((const unsigned char *)s, offsetof(CheckpointState, checksum)));
+}
+/*--------------------------------------------------------------*/
+int checkpointOpen(Checkpoint *c, const char *path, CheckpointState *restored) {
+  long page = sysconf(_SC_PAGESIZE);
+  struct stat st;
+
+  memset(c, 0, sizeof(Checkpoint));
+  c->slotSize = ((sizeof(CheckpointState) + page - 1)/page)*page;
+  c->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (c->fd < 0) {
+    perror(path);
+    return -1;
+  }
+  if (fstat(c->fd, &st) < 0) {
+    perror(path);
+    checkpointClose(c);
+    return -1;
+  }
+  if ((size_t)st.st_size != 2*c->slotSize) {
+    //new (or from a build with another layout, which can't be restored): start with two empty slots
+    if ((ftruncate(c->fd, 0) < 0) || (ftruncate(c->fd, 2*c->slotSize) < 0) || (fsync(c->fd) < 0)) {
+      perror(path);
+      checkpointClose(c);
+      return -1;
+    }
+  }
+  c->map = (char *)mmap(NULL, 2*c->slotSize, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+  if (c->map == MAP_FAILED) {
+    c->map = NULL;
+    perror(path);
+    checkpointClose(c);
+    return -1;
+  }
+
+  //the newest complete slot
+  const CheckpointState *slot[2];
+  int newest = -1;
+  for (int i = 0; i < 2; i++) {
+    slot[i] = (const CheckpointState *)(c->map + i*c->slotSize);
+    if (validSlot(slot[i]) && ((newest < 0) || (slot[i]->sequence > slot[newest]->sequence)))
+      newest = i;
+  }
+  if (newest < 0)
+    return 0;
+  memcpy(&c->last, slot[newest], sizeof(CheckpointState));
+  memcpy(restored, slot[newest], sizeof(CheckpointState));
+  return 1;
+}
+/*--------------------------------------------------------------*/
+int checkpointSave(Checkpoint *c, CheckpointState *state, double now) {
+  if (c->map == NULL)
+    return -1;
+  if ((c->last.sequence > 0) &&
+      (memcmp((char *)state + STATE_OFFSET, (char *)&c->last + STATE_OFFSET, offsetof(CheckpointState, checksum) - STATE_OFFSET) == 0))
+    return 0;
+
+  memcpy(state->magic, "LN2C", 4);
+  state->version = CHECKPOINT_VERSION;
+  state->sequence = c->last.sequence + 1;
+  state->saved = now;
+  state->checksum = checksum((const unsigned char *)state, offsetof(CheckpointState, checksum));
+
+  //over the older slot, which is no longer needed once this one is on disk
+  char *slot = c->map + (state->sequence % 2)*c->slotSize;
+  memcpy(slot, state, sizeof(CheckpointState));
+  if (msync(slot, c->slotSize, MS_SYNC) < 0) {
+    perror("checkpoint");
+    return -1;
+  }
+  memcpy(&c->last, state, sizeof(CheckpointState));
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void checkpointClose(Checkpoint *c) {
+  if (c->map != NULL)
+    munmap(c->map, 2*c->slotSize);
+  if (c->fd >= 0)
+    close(c->fd);
+  c->map = NULL;
+  c->fd = -1;
+}
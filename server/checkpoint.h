@@ -0,0 +1,59 @@
+//checkpoint of the schedule's trigger state, so that a restarted server carries on where it stopped
+//
+//The state (whether a run is in progress, and for each schedule entry whether a fill is due, has
+//been triggered, and when it was last triggered) is saved with wall clock times, since the run
+//times the schedule works with start again from 0 with each run.  It is small, so the whole of
+//it is written each time it changes.
+//
+//The file is memory-mapped and holds two slots, written alternately: a new state goes into the
+//slot holding the older one, with a higher sequence number and a checksum, and is synced to disk
+//(msync) before the next one can be written over the other slot.  Whatever point a crash stops a
+//write at, one slot still holds a complete state, and on opening the newest slot whose checksum
+//matches is the state restored.
+
+#ifndef __CHECKPOINT
+#define __CHECKPOINT
+
+#include <stddef.h>
+
+#define CHECKPOINT_MAX_ENTRIES 256  //schedule entries (MAXSCHEDENTRIES)
+#define CHECKPOINT_NAME_LENGTH 64   //longest entry name kept, including the terminating 0
+#define CHECKPOINT_VERSION 1
+
+typedef struct {
+  char name[CHECKPOINT_NAME_LENGTH]; //the state is only restored to an entry of the same name
+  int schedFlag;            //a fill was due and hadn't finished
+  int hasBeenTriggered;
+  double lastTrigger;       //when the entry was last triggered (s since the epoch), 0 if never
+} CheckpointEntry;
+
+//one slot of the file (stored little endian, as on x86)
+typedef struct {
+  char magic[4];            //"LN2C"
+  unsigned int version;     //CHECKPOINT_VERSION
+  unsigned long long sequence; //the higher of the two slots is the newer one
+  double saved;             //when the state was saved (s since the epoch)
+  //the state
+  int running;              //a run was in progress
+  double runStart;          //when it started (s since the epoch)
+  int numEntries;
+  CheckpointEntry entries[CHECKPOINT_MAX_ENTRIES];
+  unsigned int checksum;    //FNV-1a hash of the slot up to here
+} CheckpointState;
+
+typedef struct {
+  int fd;
+  char *map;
+  size_t slotSize;          //a whole number of pages, so each slot can be synced on its own
+  CheckpointState last;     //last state written, the next one is only written if it differs
+} Checkpoint;
+
+//returns 1 if restored holds the last state saved in the file, 0 if there is none (the file is
+//created if needed), -1 on errors
+int checkpointOpen(Checkpoint *c, const char *path, CheckpointState *restored);
+//the state (from running on, the rest is set here) must have been zeroed before it was filled in;
+//returns 1 if it was written, 0 if it hadn't changed, -1 on errors
+int checkpointSave(Checkpoint *c, CheckpointState *state, double now);
+void checkpointClose(Checkpoint *c);
+
+#endif
@@ -0,0 +1,16 @@
+//FNV-1a hash, which the archive blocks, the schedule checkpoint and the fill history records
+//carry to tell complete data from torn writes and garbage
+
+#ifndef __CHECKSUM
+#define __CHECKSUM
+
+static inline unsigned int checksum(const unsigned char *buf, unsigned int len) {
+  unsigned int h = 2166136261u;
+  for (unsigned int i = 0; i < len; i++) {
+    h ^= buf[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+#endif
@@ -14,28 +14,28 @@ typedef struct {
     ElemType   *elems;  /* vector of elements                   */
 } CircularBuffer;
  
-void cbInit(CircularBuffer *cb, int size) {
+static inline void cbInit(CircularBuffer *cb, int size) {
     cb->size  = size;
     cb->start = 0;
     cb->count = 0;
     cb->elems = (ElemType *)calloc(cb->size, sizeof(ElemType));
 }
  
-void cbFree(CircularBuffer *cb) {
+static inline void cbFree(CircularBuffer *cb) {
     free(cb->elems); /* OK if null */ }
  
-int cbIsFull(CircularBuffer *cb) {
+static inline int cbIsFull(CircularBuffer *cb) {
     return cb->count == cb->size; }
  
-int cbIsEmpty(CircularBuffer *cb) {
+static inline int cbIsEmpty(CircularBuffer *cb) {
     return cb->count == 0; }
 
-int cbCount(CircularBuffer *cb) {
+static inline int cbCount(CircularBuffer *cb) {
     return cb->count; }
  
 /* Write an element, overwriting oldest element if buffer is full. App can
    choose to avoid the overwrite by checking cbIsFull(). */
-void cbWrite(CircularBuffer *cb, ElemType *elem) {
+static inline void cbWrite(CircularBuffer *cb, ElemType *elem) {
     int end = (cb->start + cb->count) % cb->size;
     cb->elems[end] = *elem;
     if (cb->count == cb->size)
@@ -45,7 +45,7 @@ void cbWrite(CircularBuffer *cb, ElemType *elem) {
 }
  
 /* Read oldest element. App must ensure !cbIsEmpty() first. */
-void cbRead(CircularBuffer *cb, ElemType *elem) {
+static inline void cbRead(CircularBuffer *cb, ElemType *elem) {
     *elem = cb->elems[cb->start];
     cb->start = (cb->start + 1) % cb->size;
     -- cb->count;
@@ -0,0 +1,67 @@
+#include "clock.h"
+#include <errno.h>
+
+static RealClock realClock;
+static Clock *clk = &realClock;
+
+/*--------------------------------------------------------------*/
+double RealClock::monotonic(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1.0E9;
+}
+/*--------------------------------------------------------------*/
+double RealClock::realtime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec + ts.tv_nsec/1.0E9;
+}
+/*--------------------------------------------------------------*/
+void RealClock::sleep(long usec) {
+  struct timespec ts;
+  ts.tv_sec = usec / 1000000;
+  ts.tv_nsec = (usec % 1000000) * 1000;
+  while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR))
+    ;
+}
+/*--------------------------------------------------------------*/
+ManualClock::ManualClock(double start, double speedup) {
+  this->start = start;
+  this->speedup = speedup;
+  now = 0.0;
+}
+/*--------------------------------------------------------------*/
+double ManualClock::monotonic(void) {
+  return now;
+}
+/*--------------------------------------------------------------*/
+double ManualClock::realtime(void) {
+  return start + now;
+}
+/*--------------------------------------------------------------*/
+void ManualClock::sleep(long usec) {
+  if (speedup > 0.0)
+    realClock.sleep((long)(usec / speedup));
+  now += usec / 1.0E6;
+}
+/*--------------------------------------------------------------*/
+void ManualClock::advance(double seconds) {
+  now += seconds;
+}
+/*--------------------------------------------------------------*/
+Clock *getClock(void) {
+  return clk;
+}
+/*--------------------------------------------------------------*/
+void setClock(Clock *c) {
+  clk = (c != NULL) ? c : &realClock;
+}
+/*--------------------------------------------------------------*/
+time_t clockTime(void) {
+  return (time_t)clk->realtime();
+}
+/*--------------------------------------------------------------*/
+void clockLocalTime(struct tm *result) {
+  time_t now = clockTime();
+  localtime_r(&now, result);
+}
@@ -0,0 +1,54 @@
+//timekeeping used by the LN2 server
+//
+//All times in the server (run/fill timers, time of day for the schedule, sleeps between
+//readings) go through a Clock, so that the scheduling and fill logic can be run on a
+//virtual clock (faster than real time, or exactly reproducible) for simulation and replay.
+
+#ifndef __LN2_CLOCK
+#define __LN2_CLOCK
+
+#include <time.h>
+
+class Clock
+{
+public:
+  virtual ~Clock(void) {};
+  virtual double monotonic(void) = 0; //seconds from an arbitrary origin, never goes backwards (use for elapsed times)
+  virtual double realtime(void) = 0;  //seconds since the epoch (use for time of day and timestamps)
+  virtual void sleep(long usec) = 0;  //wait for the given number of microseconds
+};
+
+//the system clock: CLOCK_MONOTONIC, CLOCK_REALTIME and nanosleep
+class RealClock : public Clock
+{
+public:
+  double monotonic(void);
+  double realtime(void);
+  void sleep(long usec);
+};
+
+//a deterministic clock which only moves when sleep() or advance() is called.
+//With a speedup > 0, sleep() also waits usec/speedup of real time so that the
+//server runs at a fixed multiple of real time; with speedup = 0 it doesn't wait at all.
+class ManualClock : public Clock
+{
+public:
+  ManualClock(double start, double speedup);
+  double monotonic(void);
+  double realtime(void);
+  void sleep(long usec);
+  void advance(double seconds);
+private:
+  double start;   //epoch time corresponding to monotonic() = 0
+  double now;     //seconds elapsed on this clock
+  double speedup;
+};
+
+Clock *getClock(void);
+void setClock(Clock *clk);
+
+//helpers for the common conversions
+time_t clockTime(void);                //clock realtime() as a time_t
+void clockLocalTime(struct tm *result); //broken down local time of the clock
+
+#endif
@@ -0,0 +1,115 @@
+//protocol of the control socket, over which LN2_master (or any script) sends commands to LN2_server
+//
+//The server listens on a local (unix domain) stream socket, control_socket in parameters.dat.
+//Every message in either direction is a frame: a FrameHeader followed by length bytes of payload.
+//Clients send FRAME_COMMAND frames holding one command as typed for LN2_master ("fill CSS1"),
+//with an id of their choosing.  The server answers every command with one FRAME_REPLY frame
+//with the same id, holding everything the command printed (which can be a whole table) and its
+//status: 0, or -1 if the command wasn't understood.  A client may send any number of commands
+//without waiting for the replies; they are carried out, and answered, in the order they were sent.
+//Any number of clients can be connected at once.
+//
+//After a "follow [channel ...]" command, the server also pushes FRAME_EVENT frames to the client,
+//each holding one line of text: every new reading of the channels followed (all of them if none
+//are named), valves being opened or closed, and fills starting and finishing.  A client which
+//doesn't keep up with the events is disconnected.
+//
+//Only used between processes on one machine, so the header is in the host byte order.
+
+#ifndef __CTLPROTO
+#define __CTLPROTO
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#define CTL_DEFAULT_PATH "/tmp/LN2_server.sock"
+#define CTL_MAX_COMMAND 4096         //longest command (bytes)
+#define CTL_MAX_REPLY (64*1024*1024) //longest reply (bytes)
+
+enum {
+  FRAME_COMMAND = 1, //client to server: a command
+  FRAME_REPLY = 2,   //server to client: the output of the command with the same id
+  FRAME_EVENT = 3    //server to client, after a follow command: a reading or event (id 0)
+};
+
+typedef struct {
+  unsigned int length; //bytes of payload following the header
+  unsigned short type;
+  short status;        //replies: 0 if the command was carried out, -1 if it wasn't understood
+  unsigned int id;     //chosen by the client, returned with the reply
+} FrameHeader;
+
+//connects to the server's socket (blocking), returns the socket or -1
+static inline int ctlConnect(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+  return fd;
+}
+
+//blocking write/read of exactly len bytes, -1 on error or if the other end closed the socket
+static inline int ctlWriteAll(int fd, const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+static inline int ctlReadAll(int fd, void *buf, size_t len) {
+  char *p = (char *)buf;
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 1;
+}
+
+//sends one frame
+static inline int ctlSendFrame(int fd, int type, int status, unsigned int id, const char *payload, unsigned int length) {
+  FrameHeader h;
+  h.length = length;
+  h.type = (unsigned short)type;
+  h.status = (short)status;
+  h.id = id;
+  if (ctlWriteAll(fd, &h, sizeof(h)) < 0)
+    return -1;
+  return (length > 0) ? ctlWriteAll(fd, payload, length) : 1;
+}
+
+#endif
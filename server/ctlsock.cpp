@@ -0,0 +1,590 @@
+//server end of the control socket (see ctlsock.h and ctlproto.h)
+#include "ctlsock.h"
+#include "ring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define CTL_READ_SIZE 65536             //read from a client at most this much at a time
+#define CTL_MAX_INPUT (4*CTL_MAX_COMMAND) //stop reading from a client with this much not taken yet
+#define CTL_RETRY_MS 50                 //wait before handing over commands again when the server is busy
+
+typedef struct {
+  int fd;              //-1 if the slot is free
+  unsigned int serial;
+  bool eof;            //the client closed its end, close ours once its replies are sent
+  int pending;         //commands handed over and not answered yet
+  char *in;            //received, not taken yet
+  size_t inLength, inSize;
+  char *out;           //replies not sent yet (from outStart)
+  size_t outStart, outLength, outSize;
+  bool follow;         //sent a follow command: gets the readings and events
+  bool followAll;      //of every channel, or only those in channels
+  bool channels[CTL_MAX_CHANNELS];
+} Client;
+
+enum {EVENT_SAMPLE, EVENT_TEXT};
+
+typedef struct {
+  int kind;
+  time_t t;
+  float values[CTL_MAX_CHANNELS]; //readings
+  char text[CTL_EVENT_TEXT];      //events
+} Event;
+
+static Client clients[CTL_MAX_CLIENTS];
+static int numClients = 0;
+static unsigned int nextSerial = 1;
+static int pending = 0;            //commands handed over and not answered yet, all clients
+static int listenFd = -1;
+static int wakeFd[2] = {-1, -1};   //written by ctlFinish and ctlStop to wake the socket thread
+static Ring replies;               //Reply* given back by ctlFinish
+static ctl_handler_t handler;
+static char socketPath[108];
+static pthread_t thread;
+static bool running = false;
+static volatile bool stopping = false;
+static __thread Reply *current = NULL; //reply ctlPrintf adds to, for the calling thread
+static Ring events;                    //Event published and not fanned out yet
+static Event event;                    //being published
+static volatile int numFollowers = 0;
+static int numChannels = 0;
+static char channelNames[CTL_MAX_CHANNELS][CTL_CHANNEL_NAME];
+static char line[CTL_MAX_CHANNELS*(CTL_CHANNEL_NAME+16) + 64]; //one event, as sent to a follower
+
+/*--------------------------------------------------------------*/
+static void wake(void) {
+  if (write(wakeFd[1], "", 1) < 0)
+    ; //the pipe is full, so the thread is woken anyway
+}
+
+/*--------------------------------------------------------------*/
+static void dropClient(Client *c) {
+  if (c->follow)
+    numFollowers--;
+  close(c->fd);
+  c->fd = -1;
+  free(c->in);
+  free(c->out);
+  c->in = c->out = NULL;
+  c->inLength = c->inSize = 0;
+  c->outStart = c->outLength = c->outSize = 0;
+  numClients--;
+}
+/*--------------------------------------------------------------*/
+//adds a frame to the data waiting to be sent to the client
+static void queueFrame(Client *c, int type, int status, unsigned int id, const char *payload, size_t length) {
+  FrameHeader h;
+  size_t need = c->outLength - c->outStart + sizeof(h) + length;
+
+  if (c->outStart > 0) {
+    memmove(c->out, c->out + c->outStart, c->outLength - c->outStart);
+    c->outLength -= c->outStart;
+    c->outStart = 0;
+  }
+  if (need > c->outSize) {
+    size_t size = (c->outSize > 0) ? c->outSize : 4096;
+    while (size < need)
+      size *= 2;
+    char *out = (char *)realloc(c->out, size);
+    if (out == NULL) {
+      printf("ERROR: Out of memory for a reply, closing the connection.\n");
+      dropClient(c);
+      return;
+    }
+    c->out = out;
+    c->outSize = size;
+  }
+  h.length = (unsigned int)length;
+  h.type = (unsigned short)type;
+  h.status = (short)status;
+  h.id = id;
+  memcpy(c->out + c->outLength, &h, sizeof(h));
+  memcpy(c->out + c->outLength + sizeof(h), payload, length);
+  c->outLength += sizeof(h) + length;
+}
+/*--------------------------------------------------------------*/
+//queues the replies given back since the last call for their clients
+static void takeReplies(void) {
+  Reply *r;
+
+  while (ringPop(&replies, &r)) {
+    Client *c = &clients[r->client];
+    pending--;
+    if ((c->fd >= 0) && (c->serial == r->serial)) {
+      c->pending--;
+      queueFrame(c, FRAME_REPLY, r->status, r->id, r->text, r->length);
+    }
+    free(r->text);
+    free(r);
+  }
+}
+/*--------------------------------------------------------------*/
+//formats an event for a follower, returns its length (0: none of the channels it follows were read)
+static int formatEvent(const Event *e, const Client *c) {
+  struct tm local;
+  int n, start;
+
+  localtime_r(&e->t, &local);
+  n = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &local);
+  if (e->kind == EVENT_TEXT)
+    return n + sprintf(line + n, " %s\n", e->text);
+  start = n;
+  for (int i = 0; i < numChannels; i++)
+    if ((c->followAll || c->channels[i]) && !isnan(e->values[i]))
+      n += sprintf(line + n, " %s=%g", channelNames[i], e->values[i]);
+  if (n == start)
+    return 0;
+  line[n++] = '\n';
+  return n;
+}
+/*--------------------------------------------------------------*/
+//queues the readings and events published since the last call for the clients following them,
+//dropping those which have fallen too far behind
+static void takeEvents(void) {
+  static Event e;
+
+  while (ringPop(&events, &e)) {
+    for (int i = 0; (i < CTL_MAX_CLIENTS) && (numFollowers > 0); i++) {
+      Client *c = &clients[i];
+      if ((c->fd < 0) || !c->follow)
+        continue;
+      int n = formatEvent(&e, c);
+      if (n == 0)
+        continue;
+      queueFrame(c, FRAME_EVENT, 0, 0, line, n);
+      if ((c->fd >= 0) && (c->outLength - c->outStart > CTL_FOLLOW_BUFFER)) {
+        printf("Dropped a client following the readings, it wasn't keeping up.\n");
+        dropClient(c);
+      }
+    }
+  }
+}
+/*--------------------------------------------------------------*/
+static void acceptClients(void) {
+  int fd;
+
+  //clients connecting while every slot is taken wait in the listen backlog
+  while (numClients < CTL_MAX_CLIENTS) {
+    int i;
+    if ((fd = accept(listenFd, NULL, NULL)) < 0)
+      break;
+    for (i = 0; i < CTL_MAX_CLIENTS; i++)
+      if (clients[i].fd < 0)
+        break;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    memset(&clients[i], 0, sizeof(Client));
+    clients[i].fd = fd;
+    clients[i].serial = nextSerial++;
+    numClients++;
+  }
+}
+/*--------------------------------------------------------------*/
+static void readClient(Client *c) {
+  if (c->inSize < c->inLength + CTL_READ_SIZE) {
+    char *in = (char *)realloc(c->in, c->inLength + CTL_READ_SIZE);
+    if (in == NULL) {
+      dropClient(c);
+      return;
+    }
+    c->in = in;
+    c->inSize = c->inLength + CTL_READ_SIZE;
+  }
+  ssize_t n = read(c->fd, c->in + c->inLength, CTL_READ_SIZE);
+  if (n > 0)
+    c->inLength += n;
+  else if (n == 0)
+    c->eof = true;
+  else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+    dropClient(c);
+}
+/*--------------------------------------------------------------*/
+static bool isFollow(const char *command) {
+  while (isspace(*command))
+    command++;
+  return (strncmp(command, "follow", 6) == 0) && ((command[6] == '\0') || isspace(command[6]));
+}
+/*--------------------------------------------------------------*/
+//adds to the n characters of text in buf[size], returns the new length (the text is cut at size-1)
+static int appendText(char *buf, int size, int n, const char *format, ...) {
+  va_list args;
+
+  if (n >= size - 1)
+    return size - 1;
+  va_start(args, format);
+  int m = vsnprintf(buf + n, size - n, format, args);
+  va_end(args);
+  if (m < 0)
+    return n;
+  return (n + m < size - 1) ? n + m : size - 1;
+}
+/*--------------------------------------------------------------*/
+//follow [channel ...]: from now on, sends the client the readings of those channels (separated by
+//spaces or commas, all of them if none are given) and every event
+static void follow(Client *c, unsigned int id, char *command) {
+  bool channels[CTL_MAX_CHANNELS];
+  bool all = true;
+  char reply[CTL_EVENT_TEXT + sizeof(channelNames)];
+  char *save, *name;
+  int n;
+
+  memset(channels, 0, sizeof(channels));
+  strtok_r(command, " \t", &save); //follow
+  while ((name = strtok_r(NULL, " ,\t\r\n", &save)) != NULL) {
+    int i;
+    for (i = 0; i < numChannels; i++)
+      if (strcmp(name, channelNames[i]) == 0)
+        break;
+    if (i == numChannels) {
+      n = appendText(reply, sizeof(reply), 0, "Unknown channel %.*s, the channels are:\n", CTL_CHANNEL_NAME, name);
+      for (i = 0; i < numChannels; i++)
+        n = appendText(reply, sizeof(reply), n, "  %s\n", channelNames[i]);
+      queueFrame(c, FRAME_REPLY, -1, id, reply, n);
+      return;
+    }
+    channels[i] = true;
+    all = false;
+  }
+
+  if (!c->follow)
+    numFollowers++;
+  c->follow = true;
+  c->followAll = all;
+  memcpy(c->channels, channels, sizeof(channels));
+  if (all)
+    n = sprintf(reply, "Following every channel.\n");
+  else {
+    n = appendText(reply, sizeof(reply), 0, "Following");
+    for (int i = 0; i < numChannels; i++)
+      if (channels[i])
+        n = appendText(reply, sizeof(reply), n, " %s", channelNames[i]);
+    n = appendText(reply, sizeof(reply), n, ".\n");
+  }
+  queueFrame(c, FRAME_REPLY, 0, id, reply, n);
+  printf("A client is following the readings (%i following).\n", numFollowers);
+}
+/*--------------------------------------------------------------*/
+//hands the complete commands received from the client to the handler, returns false if the
+//server couldn't take them all
+static bool takeCommands(Client *c, int slot) {
+  FrameHeader h;
+  char command[CTL_MAX_COMMAND + 1];
+  size_t used = 0;
+  bool taken = true;
+
+  while ((c->fd >= 0) && (c->inLength - used >= sizeof(h))) {
+    memcpy(&h, c->in + used, sizeof(h));
+    if ((h.type != FRAME_COMMAND) || (h.length > CTL_MAX_COMMAND)) {
+      printf("ERROR: Invalid frame on the control socket, closing the connection.\n");
+      dropClient(c);
+      return true;
+    }
+    if (c->inLength - used < sizeof(h) + h.length)
+      break;
+    if (pending >= CTL_MAX_PENDING) {
+      taken = false;
+      break;
+    }
+    memcpy(command, c->in + used + sizeof(h), h.length);
+    command[h.length] = '\0';
+
+    //follow is answered here, after the commands sent before it so that the replies stay in order
+    if (isFollow(command)) {
+      if (c->pending > 0)
+        break;
+      follow(c, h.id, command);
+      used += sizeof(h) + h.length;
+      continue;
+    }
+
+    Reply *r = (Reply *)calloc(1, sizeof(Reply));
+    if (r == NULL) {
+      taken = false;
+      break;
+    }
+    r->client = slot;
+    r->serial = c->serial;
+    r->id = h.id;
+    ctlBegin(r);
+    int ok = handler(r, command);
+    ctlBegin(NULL);
+    if (!ok) {
+      free(r->text);
+      free(r);
+      taken = false;
+      break;
+    }
+    pending++;
+    c->pending++;
+    used += sizeof(h) + h.length;
+  }
+  if ((c->fd >= 0) && (used > 0)) {
+    memmove(c->in, c->in + used, c->inLength - used);
+    c->inLength -= used;
+  }
+  return taken;
+}
+/*--------------------------------------------------------------*/
+static void writeClient(Client *c) {
+  ssize_t n = send(c->fd, c->out + c->outStart, c->outLength - c->outStart, MSG_NOSIGNAL);
+  if (n > 0)
+    c->outStart += n;
+  else if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+    dropClient(c);
+}
+/*--------------------------------------------------------------*/
+static void *ctlThread(void *arg) {
+  struct pollfd fds[CTL_MAX_CLIENTS + 2];
+  int slots[CTL_MAX_CLIENTS + 2];
+  bool busy = false; //commands are waiting for the server to take them
+
+  while (!stopping) {
+    int n = 0;
+    fds[n].fd = wakeFd[0];
+    fds[n].events = POLLIN;
+    slots[n++] = -1;
+    if (numClients < CTL_MAX_CLIENTS) {
+      fds[n].fd = listenFd;
+      fds[n].events = POLLIN;
+      slots[n++] = -2;
+    }
+    for (int i = 0; i < CTL_MAX_CLIENTS; i++) {
+      Client *c = &clients[i];
+      if (c->fd < 0)
+        continue;
+      fds[n].fd = c->fd;
+      fds[n].events = 0;
+      if (!c->eof && (c->inLength < CTL_MAX_INPUT))
+        fds[n].events |= POLLIN;
+      if (c->outLength > c->outStart)
+        fds[n].events |= POLLOUT;
+      if (fds[n].events != 0) //(a client which hung up would otherwise wake us up constantly)
+        slots[n++] = i;
+    }
+    if (poll(fds, n, busy ? CTL_RETRY_MS : -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    for (int k = 0; k < n; k++) {
+      if (fds[k].revents == 0)
+        continue;
+      if (slots[k] == -1) {
+        char buf[256];
+        while (read(wakeFd[0], buf, sizeof(buf)) > 0)
+          ;
+      } else if (slots[k] == -2) {
+        acceptClients();
+      } else {
+        Client *c = &clients[slots[k]];
+        if ((c->fd >= 0) && (fds[k].revents & POLLOUT))
+          writeClient(c);
+        if ((c->fd >= 0) && (fds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+          readClient(c);
+      }
+    }
+
+    //hand over the commands received, and queue the replies given back and the events published
+    takeReplies();
+    takeEvents();
+    busy = false;
+    for (int i = 0; i < CTL_MAX_CLIENTS; i++) {
+      Client *c = &clients[i];
+      if (c->fd < 0)
+        continue;
+      bool taken = takeCommands(c, i);
+      if (!taken)
+        busy = true;
+      if (c->fd < 0)
+        continue;
+      if (c->outLength > c->outStart)
+        writeClient(c);
+      //a client which has closed its end is closed once it has been sent every reply
+      if ((c->fd >= 0) && c->eof && taken && (c->pending == 0) && (c->outLength == c->outStart))
+        dropClient(c);
+    }
+  }
+
+  //send what has been answered (waiting at most a few seconds for each client), then close
+  struct timeval timeout = {2, 0};
+  takeReplies();
+  for (int i = 0; i < CTL_MAX_CLIENTS; i++) {
+    Client *c = &clients[i];
+    if (c->fd < 0)
+      continue;
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(c->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    ctlWriteAll(c->fd, c->out + c->outStart, c->outLength - c->outStart);
+    dropClient(c);
+  }
+  close(listenFd);
+  listenFd = -1;
+  unlink(socketPath);
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+void ctlChannels(int n, const char names[][CTL_CHANNEL_NAME]) {
+  numChannels = (n < CTL_MAX_CHANNELS) ? n : CTL_MAX_CHANNELS;
+  for (int i = 0; i < numChannels; i++) {
+    strncpy(channelNames[i], names[i], CTL_CHANNEL_NAME - 1);
+    channelNames[i][CTL_CHANNEL_NAME - 1] = '\0';
+  }
+}
+/*--------------------------------------------------------------*/
+int ctlStart(const char *path, ctl_handler_t h) {
+  struct sockaddr_un addr;
+
+  for (int i = 0; i < CTL_MAX_CLIENTS; i++)
+    clients[i].fd = -1;
+  handler = h;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    printf("ERROR: Control socket path %s is too long.\n", path);
+    return -1;
+  }
+  strcpy(socketPath, path);
+  if ((ringInit(&replies, CTL_MAX_PENDING, sizeof(Reply *)) < 0) || (ringInit(&events, CTL_EVENT_QUEUE, sizeof(Event)) < 0) || (pipe(wakeFd) < 0)) {
+    printf("ERROR: Could not set up the control socket.\n");
+    return -1;
+  }
+  fcntl(wakeFd[0], F_SETFL, O_NONBLOCK);
+  fcntl(wakeFd[1], F_SETFL, O_NONBLOCK);
+
+  //only one server runs at a time (see the lock file), so a socket left there is from one which crashed
+  unlink(path);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((listenFd < 0) || (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(listenFd, SOMAXCONN) < 0)) {
+    perror("control socket");
+    printf("ERROR: Could not listen on %s.\n", path);
+    if (listenFd >= 0)
+      close(listenFd);
+    listenFd = -1;
+    return -1;
+  }
+  chmod(path, 0660);
+  fcntl(listenFd, F_SETFL, O_NONBLOCK);
+
+  if (pthread_create(&thread, NULL, ctlThread, NULL) != 0) {
+    printf("ERROR: Could not start the control socket thread.\n");
+    close(listenFd);
+    unlink(path);
+    return -1;
+  }
+  running = true;
+  printf("Listening for commands on %s\n", path);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void ctlStop(void) {
+  if (!running)
+    return;
+  stopping = true;
+  wake();
+  pthread_join(thread, NULL);
+  running = false;
+}
+/*--------------------------------------------------------------*/
+int ctlClients(void) {
+  return numClients;
+}
+/*--------------------------------------------------------------*/
+void ctlBegin(Reply *r) {
+  current = r;
+}
+/*--------------------------------------------------------------*/
+void ctlFinish(void) {
+  Reply *r = current;
+
+  current = NULL;
+  if (r == NULL)
+    return;
+  //at most CTL_MAX_PENDING replies are ever outstanding, so there is always room
+  ringPush(&replies, &r);
+  wake();
+}
+/*--------------------------------------------------------------*/
+Reply *ctlDetach(void) {
+  Reply *r = current;
+
+  current = NULL;
+  return r;
+}
+/*--------------------------------------------------------------*/
+void ctlFail(void) {
+  if (current != NULL)
+    current->status = -1;
+}
+/*--------------------------------------------------------------*/
+void ctlPrintf(const char *fmt, ...) {
+  Reply *r = current;
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  if ((r == NULL) || (r->size > CTL_MAX_REPLY))
+    return;
+
+  va_start(ap, fmt);
+  n = vsnprintf(r->text + r->length, r->size - r->length, fmt, ap);
+  va_end(ap);
+  if ((n >= 0) && (r->length + n >= r->size)) {
+    size_t size = (r->size > 0) ? r->size : 4096;
+    while (size <= r->length + n)
+      size *= 2;
+    char *text = (char *)realloc(r->text, size);
+    if (text == NULL)
+      return;
+    r->text = text;
+    r->size = size;
+    va_start(ap, fmt);
+    n = vsnprintf(r->text + r->length, r->size - r->length, fmt, ap);
+    va_end(ap);
+  }
+  if (n > 0)
+    r->length += n;
+  if (r->length > CTL_MAX_REPLY) {
+    r->length = CTL_MAX_REPLY;
+    r->size = CTL_MAX_REPLY + 1; //stop adding to it
+  }
+}
+/*--------------------------------------------------------------*/
+bool ctlFollowed(void) {
+  return running && (numFollowers > 0);
+}
+/*--------------------------------------------------------------*/
+void ctlPublishSample(time_t t, const float *values) {
+  if (!ctlFollowed())
+    return;
+  event.kind = EVENT_SAMPLE;
+  event.t = t;
+  memcpy(event.values, values, numChannels * sizeof(float));
+  if (ringPush(&events, &event))
+    wake();
+}
+/*--------------------------------------------------------------*/
+void ctlPublishEvent(time_t t, const char *fmt, ...) {
+  va_list ap;
+
+  if (!ctlFollowed())
+    return;
+  event.kind = EVENT_TEXT;
+  event.t = t;
+  va_start(ap, fmt);
+  vsnprintf(event.text, sizeof(event.text), fmt, ap);
+  va_end(ap);
+  if (ringPush(&events, &event))
+    wake();
+}
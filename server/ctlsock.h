@@ -0,0 +1,63 @@
+//server end of the control socket (protocol in ctlproto.h)
+//
+//One thread runs the socket: it accepts clients, reads their commands and hands each one to
+//the server (the handler given to ctlStart) together with a Reply, which collects everything
+//printed with ctlPrintf while the command is checked and carried out.  The thread carrying out
+//the commands gives each Reply back with ctlFinish, and the socket thread sends it to the client
+//which sent the command.  Neither side ever waits for the other.
+//
+//The same thread also fans out the readings and events published with ctlPublishSample and
+//ctlPublishEvent to the clients following them (the follow command, which it answers itself).
+//Each client has its own buffer of data not sent yet; one which lets it grow past
+//CTL_FOLLOW_BUFFER is disconnected rather than slowing anything down.
+
+#ifndef __CTLSOCK
+#define __CTLSOCK
+
+#include <stddef.h>
+#include <time.h>
+#include "ctlproto.h"
+
+#define CTL_MAX_CLIENTS 32  //clients connected at once
+#define CTL_MAX_PENDING 256 //commands handed over and not answered yet (power of 2)
+#define CTL_MAX_CHANNELS 260 //channels a published reading can hold
+#define CTL_CHANNEL_NAME 64  //longest channel name, including the terminating 0
+#define CTL_EVENT_QUEUE 512  //readings and events published and not fanned out yet (power of 2)
+#define CTL_EVENT_TEXT 200   //longest event
+#define CTL_FOLLOW_BUFFER (1024*1024) //data waiting to be sent to a following client before it is disconnected
+
+typedef struct {
+  int client;          //slot of the client which sent the command
+  unsigned int serial; //connection in that slot when the command was sent
+  unsigned int id;     //id of the command frame
+  int status;          //0, or -1 if the command wasn't understood or failed
+  char *text;          //everything printed for the command
+  size_t length, size;
+} Reply;
+
+//called on the socket thread for each command: returns 1 if the command was taken (its reply is
+//then given back with ctlFinish once it has been carried out), or 0 if it can't be taken yet, in
+//which case the handler is called with it again later
+typedef int (*ctl_handler_t)(Reply *reply, char *command);
+
+void ctlChannels(int numChannels, const char names[][CTL_CHANNEL_NAME]); //channels of the readings published (before ctlStart)
+int ctlStart(const char *path, ctl_handler_t handler);
+void ctlStop(void);  //sends the replies given back so far, closes the socket and stops the thread
+int ctlClients(void);
+
+//Only one thread may carry out commands and call ctlFinish
+void ctlBegin(Reply *r); //ctlPrintf on the calling thread adds to r (NULL: prints only)
+void ctlFinish(void);    //gives the calling thread's reply back to be sent
+void ctlFail(void);      //marks the calling thread's reply as failed (status -1)
+Reply *ctlDetach(void);  //takes the calling thread's reply, to add to and give back later (ctlBegin, then ctlFinish)
+void ctlPrintf(const char *fmt, ...) __attribute__((format(printf, 1, 2))); //printf, also adding the text to the reply
+
+//Readings and events for the clients following them, published by that same thread: a reading has
+//a value for every channel (NaN for those which weren't read), an event is one line of text sent
+//to every follower.  Nothing is published while nobody is following (ctlFollowed is false), and
+//what can't be queued is dropped.
+bool ctlFollowed(void);
+void ctlPublishSample(time_t t, const float *values);
+void ctlPublishEvent(time_t t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
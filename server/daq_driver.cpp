@@ -0,0 +1,135 @@
+//loads the DAQ backend shared object and provides the valve and sensor
+//functions used throughout the server on top of it
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+#include "daq_driver.h"
+#include "metrics.h"
+#include "ctlsock.h"
+
+static void *driverHandle = NULL;
+static DAQDriver *driver = NULL;
+static DAQCapabilities driverCaps;
+static unsigned long long linesOn = 0; //digital lines last switched on (the valves open)
+
+int loadDriver(const char *path, const char *config) {
+
+  DAQCapabilities &caps = driverCaps;
+
+  driverHandle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (driverHandle == NULL) {
+    printf("ERROR: Could not load DAQ driver %s (%s).\n", path, dlerror());
+    return -1;
+  }
+
+  daq_driver_api_version_t version = (daq_driver_api_version_t)dlsym(driverHandle, "daq_driver_api_version");
+  create_daq_driver_t create = (create_daq_driver_t)dlsym(driverHandle, "create_daq_driver");
+  if ((version == NULL) || (create == NULL)) {
+    printf("ERROR: %s is not a DAQ driver (missing DAQ_DRIVER_EXPORT).\n", path);
+    dlclose(driverHandle);
+    driverHandle = NULL;
+    return -2;
+  }
+  if (version() != DAQ_DRIVER_API_VERSION) {
+    printf("ERROR: DAQ driver %s was built for driver API version %i, server uses version %i.  Rebuild the driver.\n", path, version(), DAQ_DRIVER_API_VERSION);
+    dlclose(driverHandle);
+    driverHandle = NULL;
+    return -3;
+  }
+
+  driver = create();
+  driver->setClock(getClock());
+  if (driver->open(config) < 0) {
+    printf("ERROR: DAQ driver %s failed to initialize.\n", path);
+    delete driver;
+    driver = NULL;
+    dlclose(driverHandle);
+    driverHandle = NULL;
+    return -4;
+  }
+
+  driver->capabilities(&caps);
+  printf("\nDAQ driver '%s' loaded from %s.\n", caps.description, path);
+  printf("Digital outputs = %i, analog inputs = %i (%.1f V to %.1f V)", caps.numDigitalLines, caps.numAnalogInputs, caps.minVoltage, caps.maxVoltage);
+  if (caps.flags & DAQ_CAP_STREAMING)
+    printf(", streaming up to %.0f samples/s", caps.maxStreamRate);
+  if (caps.flags & DAQ_CAP_SIMULATED)
+    printf(", simulated");
+  printf("\n");
+
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void unloadDriver(void) {
+  if (driver != NULL) {
+    driver->close();
+    delete driver;
+    driver = NULL;
+  }
+  if (driverHandle != NULL) {
+    dlclose(driverHandle);
+    driverHandle = NULL;
+  }
+}
+/*--------------------------------------------------------------*/
+DAQDriver *getDriver(void) {
+  return driver;
+}
+/*--------------------------------------------------------------*/
+const DAQCapabilities *getCapabilities(void) {
+  return &driverCaps;
+}
+/*------------------------------------------------------------*/
+/*Valve and sensor functions used by the server--------------*/
+/*----------------------------------------------------------*/
+//keeps track of the valves open, and tells the clients following the readings when that changes
+static void publishLines(int *chan, int numChans) {
+  unsigned long long on = 0;
+  char text[CTL_EVENT_TEXT];
+  int n = 0;
+
+  for (int i = 0; i < numChans; i++)
+    if ((chan[i] >= 0) && (chan[i] < 64))
+      on |= 1ULL << chan[i];
+  if (on == linesOn)
+    return;
+  linesOn = on;
+  if (on == 0) {
+    ctlPublishEvent(clockTime(), "valves closed");
+    return;
+  }
+  for (int i = 0; (i < 64) && (n < CTL_EVENT_TEXT - 8); i++)
+    if (on & (1ULL << i))
+      n += sprintf(text + n, " %i", i);
+  ctlPublishEvent(clockTime(), "valves open:%s", text);
+}
+/*--------------------------------------------------------------*/
+int chanOn(int *chan, int numChans) {
+  int ret = driver->writeLines(chan, numChans);
+  if (ret < 0)
+    metricsAdd(&metrics.daqErrors);
+  else
+    publishLines(chan, numChans);
+  return ret;
+}
+/*--------------------------------------------------------------*/
+int chanOn(int chan) {
+  return chanOn(&chan, 1);
+}
+/*--------------------------------------------------------------*/
+int chanOff(void) {
+  return chanOn(NULL, 0);
+}
+/*--------------------------------------------------------------*/
+int measureChannels(int *chan, int numChans, float *volts) {
+  int ret = driver->readChannels(chan, numChans, volts);
+  if (ret < 0)
+    metricsAdd(&metrics.daqErrors);
+  return ret;
+}
+/*--------------------------------------------------------------*/
+float measure(int channel) {
+  float volts = 10.0f;
+  measureChannels(&channel, 1, &volts);
+  return volts;
+}
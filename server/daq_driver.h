@@ -0,0 +1,82 @@
+//interface implemented by every DAQ backend used with the LN2 server
+//
+//Each backend is built as a shared object (eg. daq_nidaq.so, daq_test.so) which
+//exports a factory function through the DAQ_DRIVER_EXPORT macro below.  The server
+//loads the backend named by the daq_driver parameter in parameters.dat at startup,
+//so new backends can be added without rebuilding the server.
+
+#ifndef __DAQ_DRIVER
+#define __DAQ_DRIVER
+
+#include "clock.h"
+
+#define DAQ_DRIVER_API_VERSION 3
+
+//capability flags
+#define DAQ_CAP_DIGITAL_OUT 0x01 //valves can be switched
+#define DAQ_CAP_ANALOG_IN   0x02 //voltages can be measured
+#define DAQ_CAP_STREAMING   0x04 //continuous hardware-timed acquisition is supported
+#define DAQ_CAP_SIMULATED   0x08 //backend doesn't talk to real hardware
+
+typedef struct {
+  int flags;                //combination of the DAQ_CAP_* flags
+  int numDigitalLines;      //number of valve outputs available
+  int numAnalogInputs;      //number of voltage inputs available
+  double minVoltage;        //analog input range (V)
+  double maxVoltage;
+  double maxStreamRate;     //maximum streaming rate per channel (samples/s), 0 if not supported
+  char description[128];    //human readable name of the backend
+} DAQCapabilities;
+
+class DAQDriver
+{
+public:
+  virtual ~DAQDriver(void) {};
+
+  //called before open() with the clock the server runs on, backends which model
+  //time (eg. the simulator) must use it instead of the system clock
+  virtual void setClock(Clock *clk) {};
+
+  //set up the hardware, config is the daq_config parameter (may be empty)
+  //returns a negative value on failure
+  virtual int open(const char *config) = 0;
+  virtual void close(void) = 0;
+  virtual void capabilities(DAQCapabilities *caps) = 0;
+
+  //batch write: turns on exactly the listed digital lines, all other lines are turned off
+  //(numChans=0 turns everything off)
+  virtual int writeLines(const int *chan, int numChans) = 0;
+
+  //whether digital line chan is connected, backends with gaps in their numbering override this
+  virtual bool hasLine(int chan) {
+    DAQCapabilities caps;
+    capabilities(&caps);
+    return (chan >= 0) && (chan < caps.numDigitalLines);
+  };
+
+  //batch read: stores the (averaged) voltage of each listed analog input in volts[]
+  virtual int readChannels(const int *chan, int numChans, float *volts) = 0;
+
+  //streaming mode: continuous acquisition of the listed inputs at the given rate (samples/s per channel).
+  //readStream() returns up to maxScans scans (numChans values each, interleaved) acquired since the
+  //last call.  Backends without DAQ_CAP_STREAMING keep these defaults.
+  virtual int startStream(const int *chan, int numChans, double rate) { return -1; };
+  virtual int readStream(float *volts, int maxScans, int *scansRead) { *scansRead = 0; return -1; };
+  virtual int stopStream(void) { return -1; };
+};
+
+typedef DAQDriver *(*create_daq_driver_t)(void);
+typedef int (*daq_driver_api_version_t)(void);
+
+//put this once in the backend source file, with the name of the class implementing DAQDriver
+#define DAQ_DRIVER_EXPORT(cls) \
+  extern "C" DAQDriver *create_daq_driver(void) { return new cls(); } \
+  extern "C" int daq_driver_api_version(void) { return DAQ_DRIVER_API_VERSION; }
+
+//functions used by the server to load the backend and talk to it
+int loadDriver(const char *path, const char *config);
+void unloadDriver(void);
+DAQDriver *getDriver(void);
+const DAQCapabilities *getCapabilities(void); //of the driver loaded
+
+#endif
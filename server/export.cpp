@@ -0,0 +1,429 @@
+//exports of the recent readings (see export.h)
+#include "export.h"
+#include "ctlsock.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+static volatile int exportBusy = 0; //1 while an export is being written
+
+/*------------------------------------------------------------*/
+/*History of readings----------------------------------------*/
+/*----------------------------------------------------------*/
+int exportHistoryInit(ExportHistory *h, int size, int numChannels, const char names[][ARCHIVE_NAME_LENGTH]) {
+  memset(h, 0, sizeof(ExportHistory));
+  if ((size < 1) || (numChannels < 1) || (numChannels > ARCHIVE_MAX_CHANNELS)) {
+    printf("ERROR: Can't keep a history of %i rows of %i channels.\n", size, numChannels);
+    return -1;
+  }
+  h->size = size;
+  h->numChannels = numChannels;
+  for (int i = 0; i < numChannels; i++)
+    strncpy(h->names[i], names[i], ARCHIVE_NAME_LENGTH - 1);
+  h->t = (time_t *)calloc(size, sizeof(time_t));
+  h->runTime = (double *)calloc(size, sizeof(double));
+  h->values = (float *)calloc((size_t)size*numChannels, sizeof(float));
+  if ((h->t == NULL) || (h->runTime == NULL) || (h->values == NULL)) {
+    printf("ERROR: Could not allocate the history of readings.\n");
+    return -1;
+  }
+  return rollupInit(h->rollups, numChannels);
+}
+/*--------------------------------------------------------------*/
+void exportHistoryAppend(ExportHistory *h, time_t t, double runTime, const float *values) {
+  if (h->values == NULL)
+    return;
+  int row = (h->start + h->count) % h->size;
+  h->t[row] = t;
+  h->runTime[row] = runTime;
+  memcpy(&h->values[(size_t)row*h->numChannels], values, h->numChannels*sizeof(float));
+  if (h->count == h->size)
+    h->start = (h->start + 1) % h->size; //full, overwrite the oldest row
+  else
+    h->count++;
+  rollupAdd(h->rollups, t, values);
+}
+/*------------------------------------------------------------*/
+/*Parsing the save command-----------------------------------*/
+/*----------------------------------------------------------*/
+//converts HH:MM[:SS] (the last time it was that time of day) or YYYY-MM-DD,HH:MM[:SS] to a time
+int exportParseTime(const char *str, time_t now, time_t *t) {
+  struct tm tm;
+  int n;
+
+  localtime_r(&now, &tm);
+  tm.tm_sec = 0;
+  if (strchr(str, '-') != NULL) {
+    n = sscanf(str, "%d-%d-%d,%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n < 5)
+      return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+  } else {
+    n = sscanf(str, "%d:%d:%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n < 2)
+      return -1;
+  }
+  if ((tm.tm_hour < 0) || (tm.tm_hour > 23) || (tm.tm_min < 0) || (tm.tm_min > 59) || (tm.tm_sec < 0) || (tm.tm_sec > 59))
+    return -1;
+  tm.tm_isdst = -1;
+  *t = mktime(&tm);
+  if ((n <= 3) && (*t > now)) {
+    //a time of day later than now means yesterday
+    tm.tm_mday -= 1;
+    tm.tm_isdst = -1;
+    *t = mktime(&tm);
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+int exportParse(ExportRequest *r, const char *path, char *options, time_t now) {
+  char *save, *tok;
+
+  memset(r, 0, sizeof(ExportRequest));
+  if ((path == NULL) || (strlen(path) >= sizeof(r->path))) {
+    ctlPrintf("ERROR: Invalid file name to save to.\n");
+    return -1;
+  }
+  strcpy(r->path, path);
+  r->format = EXPORT_CSV;
+  r->resolution = -1;
+  r->tFrom = 0;
+  r->tTo = (time_t)0x7fffffff;
+
+  if (options == NULL)
+    return 1;
+  for (tok = strtok_r(options, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save)) {
+    if (strcmp(tok, "csv") == 0) {
+      r->format = EXPORT_CSV;
+    } else if (strcmp(tok, "bin") == 0) {
+      r->format = EXPORT_ARCHIVE;
+    } else if (rollupFind(tok) >= 0) {
+      r->resolution = rollupFind(tok);
+    } else if ((strcmp(tok, "from") == 0) || (strcmp(tok, "to") == 0)) {
+      bool from = (tok[0] == 'f');
+      tok = strtok_r(NULL, " ", &save);
+      if ((tok == NULL) || (exportParseTime(tok, now, from ? &r->tFrom : &r->tTo) < 0)) {
+        ctlPrintf("ERROR: Invalid time in the save command (expected HH:MM[:SS] or YYYY-MM-DD,HH:MM[:SS]).\n");
+        return -1;
+      }
+    } else if (strcmp(tok, "channels") == 0) {
+      char *save2, *name;
+      tok = strtok_r(NULL, " ", &save);
+      if (tok == NULL) {
+        ctlPrintf("ERROR: No channels given in the save command.\n");
+        return -1;
+      }
+      for (name = strtok_r(tok, ",", &save2); name != NULL; name = strtok_r(NULL, ",", &save2)) {
+        if (r->numSelected == EXPORT_MAX_SELECTED) {
+          ctlPrintf("ERROR: At most %i channels can be named in the save command.\n", EXPORT_MAX_SELECTED);
+          return -1;
+        }
+        strncpy(r->selected[r->numSelected++], name, ARCHIVE_NAME_LENGTH - 1);
+      }
+    } else {
+      ctlPrintf("ERROR: Unknown save option %s.\n", tok);
+      return -1;
+    }
+  }
+  if (r->tFrom > r->tTo) {
+    ctlPrintf("ERROR: The start of the time range to save is after its end.\n");
+    return -1;
+  }
+  return 1;
+}
+/*------------------------------------------------------------*/
+/*Copying the rows out of the history------------------------*/
+/*----------------------------------------------------------*/
+//copies the intervals of a rollup tier in the time range: the number of readings, then
+//the minimum, mean and maximum of each channel
+static ExportJob *rollupSnapshot(RollupTier *t, const char names[][ARCHIVE_NAME_LENGTH], ExportRequest *r, const int *column, int numColumns) {
+  static const char *suffix[3] = {"min", "mean", "max"};
+
+  if (1 + 3*numColumns > ARCHIVE_MAX_CHANNELS) {
+    ctlPrintf("ERROR: Too many channels to save with a resolution, select at most %i.\n", (ARCHIVE_MAX_CHANNELS - 1) / 3);
+    return NULL;
+  }
+  int first = 0, last = t->count;
+  while ((first < t->count) && (t->t[rollupSlot(t, first)] + t->width <= r->tFrom))
+    first++;
+  while ((last > first) && (t->t[rollupSlot(t, last - 1)] > r->tTo))
+    last--;
+  if (first == last) {
+    ctlPrintf("No readings were taken in the time range to save.\n");
+    return NULL;
+  }
+
+  ExportJob *j = (ExportJob *)calloc(1, sizeof(ExportJob));
+  if (j == NULL)
+    return NULL;
+  j->req = *r;
+  j->numRows = last - first;
+  j->numChannels = 1 + 3*numColumns;
+  strcpy(j->names[0], "samples");
+  for (int c = 0; c < numColumns; c++)
+    for (int k = 0; k < 3; k++)
+      snprintf(j->names[1 + 3*c + k], ARCHIVE_NAME_LENGTH, "%s_%s", names[column[c]], suffix[k]);
+  j->t = (time_t *)malloc(j->numRows*sizeof(time_t));
+  j->values = (float *)malloc((size_t)j->numRows*j->numChannels*sizeof(float));
+  if ((j->t == NULL) || (j->values == NULL)) {
+    ctlPrintf("ERROR: Could not allocate memory for %i rows to save.\n", j->numRows);
+    exportFree(j);
+    return NULL;
+  }
+
+  for (int i = 0; i < j->numRows; i++) {
+    int slot = rollupSlot(t, first + i);
+    float *dst = &j->values[(size_t)i*j->numChannels];
+    j->t[i] = t->t[slot];
+    dst[0] = (float)t->samples[slot];
+    for (int c = 0; c < numColumns; c++) {
+      int src = slot*t->numChannels + column[c];
+      dst[1 + 3*c] = t->min[src];
+      dst[2 + 3*c] = (float)(t->sum[src] / t->samples[slot]);
+      dst[3 + 3*c] = t->max[src];
+    }
+  }
+  return j;
+}
+/*--------------------------------------------------------------*/
+ExportJob *exportSnapshot(ExportHistory *h, ExportRequest *r) {
+  int column[ARCHIVE_MAX_CHANNELS];
+  int numColumns = 0;
+
+  if (h->values == NULL) {
+    ctlPrintf("ERROR: No readings have been kept to save.\n");
+    return NULL;
+  }
+  if (r->numSelected > 0) {
+    for (int i = 0; i < r->numSelected; i++) {
+      column[numColumns] = -1;
+      for (int c = 0; c < h->numChannels; c++)
+        if (strcmp(h->names[c], r->selected[i]) == 0)
+          column[numColumns] = c;
+      if (column[numColumns] < 0) {
+        ctlPrintf("ERROR: Unknown channel %s (the channels are", r->selected[i]);
+        for (int c = 0; c < h->numChannels; c++)
+          ctlPrintf(" %s", h->names[c]);
+        ctlPrintf(").\n");
+        return NULL;
+      }
+      numColumns++;
+    }
+  } else {
+    for (int c = 0; c < h->numChannels; c++)
+      column[numColumns++] = c;
+  }
+
+  if (r->resolution >= 0)
+    return rollupSnapshot(&h->rollups[r->resolution], h->names, r, column, numColumns);
+
+  //rows are kept in time order, so the range is a contiguous run of them
+  int first = 0, last = h->count;
+  while ((first < h->count) && (h->t[(h->start + first) % h->size] < r->tFrom))
+    first++;
+  while ((last > first) && (h->t[(h->start + last - 1) % h->size] > r->tTo))
+    last--;
+  if (first == last) {
+    ctlPrintf("No readings were taken in the time range to save.\n");
+    return NULL;
+  }
+
+  ExportJob *j = (ExportJob *)calloc(1, sizeof(ExportJob));
+  if (j == NULL)
+    return NULL;
+  j->req = *r;
+  j->numRows = last - first;
+  j->numChannels = numColumns;
+  for (int c = 0; c < numColumns; c++)
+    strcpy(j->names[c], h->names[column[c]]);
+  j->t = (time_t *)malloc(j->numRows*sizeof(time_t));
+  j->runTime = (double *)malloc(j->numRows*sizeof(double));
+  j->values = (float *)malloc((size_t)j->numRows*numColumns*sizeof(float));
+  if ((j->t == NULL) || (j->runTime == NULL) || (j->values == NULL)) {
+    ctlPrintf("ERROR: Could not allocate memory for %i rows to save.\n", j->numRows);
+    exportFree(j);
+    return NULL;
+  }
+
+  for (int i = 0; i < j->numRows; i++) {
+    int row = (h->start + first + i) % h->size;
+    const float *src = &h->values[(size_t)row*h->numChannels];
+    float *dst = &j->values[(size_t)i*numColumns];
+    j->t[i] = h->t[row];
+    j->runTime[i] = h->runTime[row];
+    if (r->numSelected == 0)
+      memcpy(dst, src, numColumns*sizeof(float));
+    else
+      for (int c = 0; c < numColumns; c++)
+        dst[c] = src[column[c]];
+  }
+  return j;
+}
+/*--------------------------------------------------------------*/
+void exportFree(ExportJob *j) {
+  if (j == NULL)
+    return;
+  free(j->t);
+  free(j->runTime);
+  free(j->values);
+  free(j);
+}
+/*------------------------------------------------------------*/
+/*Writing----------------------------------------------------*/
+/*----------------------------------------------------------*/
+//writes v with 6 decimals, as printf("%f") does, returns the length
+static int putFixed(char *out, double v) {
+  char digits[24];
+  int len = 0, n = 0;
+
+  if ((v != v) || (v > 1.0E12) || (v < -1.0E12))
+    return sprintf(out, "%f", v);
+  if (v < 0) {
+    out[len++] = '-';
+    v = -v;
+  }
+  unsigned long long u = (unsigned long long)(v*1.0E6 + 0.5);
+  unsigned long long whole = u / 1000000;
+  unsigned int frac = (unsigned int)(u % 1000000);
+  do {
+    digits[n++] = (char)('0' + whole % 10);
+    whole /= 10;
+  } while (whole);
+  while (n)
+    out[len++] = digits[--n];
+  out[len++] = '.';
+  for (int i = 5; i >= 0; i--) {
+    out[len + i] = (char)('0' + frac % 10);
+    frac /= 10;
+  }
+  return len + 6;
+}
+/*--------------------------------------------------------------*/
+static int writeCSV(ExportJob *j) {
+  FILE *fp = fopen(j->req.path, "w");
+  if (fp == NULL) {
+    printf("ERROR: Could not open %s to save the data.\n", j->req.path);
+    return -1;
+  }
+  setvbuf(fp, NULL, _IONBF, 0); //rows are formatted into buf below, which is written in large pieces
+  char *buf = (char *)malloc(EXPORT_WRITE_BUFFER);
+  if (buf == NULL) {
+    fclose(fp);
+    return -1;
+  }
+
+  int rowMax = 48 + 32*j->numChannels; //longest possible row
+  int len = sprintf(buf, (j->runTime != NULL) ? "time,run_time" : "time");
+  for (int c = 0; c < j->numChannels; c++)
+    len += sprintf(buf + len, ",%s", j->names[c]);
+  buf[len++] = '\n';
+
+  bool ok = true;
+  for (int row = 0; (row < j->numRows) && ok; row++) {
+    struct tm local;
+    localtime_r(&j->t[row], &local);
+    len += strftime(buf + len, 32, "%Y-%m-%d %H:%M:%S", &local);
+    if (j->runTime != NULL) {
+      buf[len++] = ',';
+      len += putFixed(buf + len, j->runTime[row]);
+    }
+    const float *v = &j->values[(size_t)row*j->numChannels];
+    for (int c = 0; c < j->numChannels; c++) {
+      buf[len++] = ',';
+      len += putFixed(buf + len, v[c]);
+    }
+    buf[len++] = '\n';
+    if (len + rowMax > EXPORT_WRITE_BUFFER) {
+      ok = (fwrite(buf, 1, len, fp) == (size_t)len);
+      len = 0;
+    }
+  }
+  if (ok && (len > 0))
+    ok = (fwrite(buf, 1, len, fp) == (size_t)len);
+  free(buf);
+  if ((fclose(fp) != 0) || !ok) {
+    printf("ERROR: Could not write all data to %s.\n", j->req.path);
+    return -1;
+  }
+  return j->numRows;
+}
+/*--------------------------------------------------------------*/
+static int writeArchive(ExportJob *j) {
+  ArchiveWriter a;
+  char indexPath[sizeof(j->req.path) + 8];
+
+  //archiveOpen appends to an existing archive, an export replaces it
+  sprintf(indexPath, "%s.idx", j->req.path);
+  remove(j->req.path);
+  remove(indexPath);
+  if (archiveOpen(&a, j->req.path, j->numChannels, j->names) < 0)
+    return -1;
+  //archiveAppend and archiveFlush report write errors themselves
+  for (int row = 0; row < j->numRows; row++) {
+    if (archiveAppend(&a, 1000LL*j->t[row], &j->values[(size_t)row*j->numChannels]) < 0) {
+      archiveClose(&a);
+      return -1;
+    }
+  }
+  if (archiveFlush(&a) < 0) {
+    archiveClose(&a);
+    return -1;
+  }
+  archiveClose(&a);
+  return j->numRows;
+}
+/*--------------------------------------------------------------*/
+int exportWrite(ExportJob *j) {
+  if (j->req.format == EXPORT_ARCHIVE)
+    return writeArchive(j);
+  return writeCSV(j);
+}
+/*------------------------------------------------------------*/
+/*Background writer------------------------------------------*/
+/*----------------------------------------------------------*/
+static void *exportThread(void *arg) {
+  ExportJob *j = (ExportJob *)arg;
+
+  int rows = exportWrite(j);
+  if (rows >= 0)
+    printf("Data saved locally to file %s (%i rows).\n", j->req.path, rows);
+  exportFree(j);
+  __sync_lock_release(&exportBusy);
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+int exportStart(ExportHistory *h, ExportRequest *r) {
+  pthread_t thread;
+
+  if (!__sync_bool_compare_and_swap(&exportBusy, 0, 1)) {
+    ctlPrintf("ERROR: Still saving the previous file, try again when it is done.\n");
+    return -1;
+  }
+  ExportJob *j = exportSnapshot(h, r);
+  if (j == NULL) {
+    __sync_lock_release(&exportBusy);
+    return -1;
+  }
+  ctlPrintf("Saving %i rows to %s...\n", j->numRows, j->req.path);
+  if (pthread_create(&thread, NULL, exportThread, j) != 0) {
+    ctlPrintf("ERROR: Could not start the thread writing %s.\n", j->req.path);
+    exportFree(j);
+    __sync_lock_release(&exportBusy);
+    return -1;
+  }
+  pthread_detach(thread);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+bool exportRunning(void) {
+  return __sync_fetch_and_add(&exportBusy, 0) != 0;
+}
+/*--------------------------------------------------------------*/
+void exportWait(void) {
+  if (exportRunning())
+    printf("Waiting for the file being saved...\n");
+  while (exportRunning())
+    usleep(10000);
+}
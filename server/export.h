@@ -0,0 +1,79 @@
+//exports of the recent readings (the save command)
+//
+//Next to the text buffers shown by the table command, the server keeps the last
+//buffer_size rows of readings as numbers (ExportHistory, one row per cycle with the
+//same channels as the archive).  The save command copies the rows and channels it
+//asks for out of the history on the control thread, which is little more than a
+//memcpy, and a background thread formats and writes the copy, so the control loop
+//never waits on the disk however large the export is.
+//
+//Exports are written as CSV, or in the archive format (see archive.h), which is a
+//fraction of the size and can be read back with ln2_query -f.  The history also keeps
+//the rollups of the readings (see rollup.h), and instead of every reading an export can
+//hold the number of readings and the minimum, mean and maximum of each channel over
+//every 1 min, 15 min, 1 h or 1 day.
+
+#ifndef __EXPORT
+#define __EXPORT
+
+#include <time.h>
+#include "archive.h"
+#include "rollup.h"
+
+#define EXPORT_CSV 0
+#define EXPORT_ARCHIVE 1
+#define EXPORT_MAX_SELECTED 16          //channels which can be named in one save command
+#define EXPORT_WRITE_BUFFER (1 << 20)   //CSV is formatted into a buffer of this size and written in one go
+
+//rows of recent readings (a circular buffer)
+typedef struct {
+  int size;                 //maximum number of rows
+  int start;                //oldest row
+  int count;                //rows stored
+  int numChannels;
+  char names[ARCHIVE_MAX_CHANNELS][ARCHIVE_NAME_LENGTH];
+  time_t *t;
+  double *runTime;          //run time (s) when the row was taken
+  float *values;            //values[row*numChannels + channel]
+  RollupTier rollups[ROLLUP_TIERS];
+} ExportHistory;
+
+//what to export, parsed from the save command
+typedef struct {
+  char path[256];
+  int format;               //EXPORT_CSV or EXPORT_ARCHIVE
+  int resolution;           //-1 for every reading, otherwise the rollup tier to export
+  time_t tFrom, tTo;        //rows taken outside this range are left out
+  int numSelected;          //0 = all channels
+  char selected[EXPORT_MAX_SELECTED][ARCHIVE_NAME_LENGTH];
+} ExportRequest;
+
+//rows copied out of the history for one export
+typedef struct {
+  ExportRequest req;
+  int numRows;
+  int numChannels;
+  char names[ARCHIVE_MAX_CHANNELS][ARCHIVE_NAME_LENGTH];
+  time_t *t;
+  double *runTime;          //NULL for rollups
+  float *values;            //values[row*numChannels + channel]
+} ExportJob;
+
+int exportHistoryInit(ExportHistory *h, int size, int numChannels, const char names[][ARCHIVE_NAME_LENGTH]);
+void exportHistoryAppend(ExportHistory *h, time_t t, double runTime, const float *values);
+
+//options: [csv|bin] [1m|15m|1h|1d] [from TIME] [to TIME] [channels name,name,...], where TIME is HH:MM[:SS]
+//(the last time it was that time of day) or YYYY-MM-DD,HH:MM[:SS]
+int exportParse(ExportRequest *r, const char *path, char *options, time_t now);
+int exportParseTime(const char *str, time_t now, time_t *t); //one TIME, returns -1 if it isn't valid
+
+ExportJob *exportSnapshot(ExportHistory *h, ExportRequest *r); //NULL if nothing could be copied
+int exportWrite(ExportJob *j);                                  //returns the number of rows written, -1 on error
+void exportFree(ExportJob *j);
+
+//copies the rows and writes them on a background thread (one export at a time)
+int exportStart(ExportHistory *h, ExportRequest *r);
+bool exportRunning(void);
+void exportWait(void);
+
+#endif
@@ -0,0 +1,43 @@
+//the rule which ends a fill, shared by the server and ln2_replay
+//
+//While a fill runs, its overflow sensor is read once every FILL_STEP_US.  The fill is done once
+//readings_before_fill_stop readings (not necessarily in a row) have been above sensor_threshold_V.
+//It is stopped if that hasn't happened after max_filling_time, or, with sensor_fault_action[stop],
+//as soon as the sensor is disconnected or frozen (see health.h; a saturated sensor is allowed
+//while filling, the dewar may be full).
+
+#ifndef __FILLRULE
+#define __FILLRULE
+
+#include "health.h"
+
+#define FILL_STEP_US 1000000       //time between the sensor readings of a fill (us)
+
+//what a reading means for the fill
+enum {
+  FILL_RUNNING,
+  FILL_DONE,                //the threshold was reached
+  FILL_TIMEOUT,             //max_filling_time has passed
+  FILL_SENSOR               //the sensor can't be trusted any more
+};
+
+typedef struct {
+  double threshold;         //sensor_threshold_V
+  int readings;             //readings_before_fill_stop
+  double maxTime;           //max_filling_time (s)
+  bool sensorStop;          //sensor_fault_action[stop]
+} FillRule;
+
+//one reading of the sensor, elapsed s after the valves were opened, with the health flags of the sensor
+//once the reading was checked; above counts the readings over the threshold so far (0 when the fill starts)
+static inline int fillStep(const FillRule *r, int *above, double elapsed, float reading, int health) {
+  if (reading > r->threshold)
+    (*above)++;
+  if (elapsed > r->maxTime)
+    return FILL_TIMEOUT;
+  if (r->sensorStop && (health & (HEALTH_OPEN | HEALTH_FROZEN)))
+    return FILL_SENSOR;
+  return (*above >= r->readings) ? FILL_DONE : FILL_RUNNING;
+}
+
+#endif
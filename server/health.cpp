@@ -0,0 +1,81 @@
+//health of the analog inputs (see health.h)
+#include "health.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/*--------------------------------------------------------------*/
+void healthInit(ChannelHealth *h, const char *name, bool sensor) {
+  memset(h, 0, sizeof(ChannelHealth));
+  snprintf(h->name, sizeof(h->name), "%s", name);
+  h->sensor = sensor;
+}
+/*--------------------------------------------------------------*/
+int healthUpdate(ChannelHealth *h, const HealthConfig *c, double t, float v) {
+  int flags = 0;
+
+  //mean and variance of the window
+  if (h->n == HEALTH_WINDOW) {
+    h->windowMean = h->mean;
+    h->windowStd = sqrt(h->m2/(h->n - 1));
+    h->windowJumps = h->jumps;
+    h->n = 0;
+    h->mean = h->m2 = 0.0;
+    h->jumps = 0;
+  }
+  h->n++;
+  double delta = v - h->mean;
+  h->mean += delta/h->n;
+  h->m2 += delta*(v - h->mean);
+
+  //changes from the last reading
+  if (h->readings > 0) {
+    if (v == h->last)
+      h->stuckRun++;
+    else
+      h->stuckRun = 0;
+    double dt = t - h->lastT;
+    if ((dt > 0.0) && (fabs(v - h->last) > c->maxRate*dt))
+      h->jumps++;
+  }
+  h->readings++;
+  h->last = v;
+  h->lastT = t;
+
+  //range
+  double margin = 0.01*(c->maxV - c->minV);
+  if ((v >= c->maxV - margin) || (v <= c->minV + margin))
+    h->saturatedRun++;
+  else
+    h->saturatedRun = 0;
+  if (h->sensor && (fabs(v) < c->openV))
+    h->openRun++;
+  else
+    h->openRun = 0;
+
+  if (h->openRun >= c->faultReadings)
+    flags |= HEALTH_OPEN;
+  if (h->saturatedRun >= c->faultReadings)
+    flags |= HEALTH_SATURATED;
+  if (h->stuckRun + 1 >= c->frozenReadings)
+    flags |= HEALTH_FROZEN;
+  if ((h->jumps >= HEALTH_MAX_JUMPS) || (h->windowJumps >= HEALTH_MAX_JUMPS))
+    flags |= HEALTH_ERRATIC;
+
+  int changed = flags ^ h->flags;
+  h->flags = flags;
+  return changed;
+}
+/*--------------------------------------------------------------*/
+const char *healthDescribe(int flags, char *buf, size_t size) {
+  static const char *names[4] = {"open", "saturated", "frozen", "erratic"};
+  size_t used = 0;
+
+  buf[0] = '\0';
+  for (int i = 0; i < 4; i++)
+    if ((flags & (1 << i)) && (used < size))
+      used += snprintf(buf + used, size - used, "%s%s", used ? ", " : "", names[i]);
+  if (used == 0)
+    snprintf(buf, size, "ok");
+  return buf;
+}
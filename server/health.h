@@ -0,0 +1,69 @@
+//health of the analog inputs, worked out from the stream of their readings
+//
+//Every reading of a channel (the scale and the overflow sensors, each cycle, and each second
+//during fills) updates its statistics in constant time: the mean and standard deviation of the
+//readings (Welford's method, over windows of HEALTH_WINDOW readings, the last complete window
+//being kept for the health command), how many readings in a row were exactly the same, and how
+//many times the reading changed faster than the channel can.  A channel is flagged:
+//
+//  open       an overflow sensor reading closer to 0 V than sensor_open_V for sensor_fault_readings
+//             readings in a row (a disconnected input reads around 0 V, a dry sensor around 1 V)
+//  saturated  within 1% of the limits of the DAQ input range for sensor_fault_readings readings in
+//             a row (a shorted sensor, or an input the driver couldn't read)
+//  frozen     the same reading, to the last bit, sensor_frozen_readings times in a row (a real input
+//             always has some noise)
+//  erratic    changing faster than sensor_max_rate_V_s at least HEALTH_MAX_JUMPS times within the
+//             current or the last window (a loose contact)
+//
+//A flag is cleared with the first reading which doesn't show the problem (erratic, once a whole
+//window had fewer fast changes).
+
+#ifndef __HEALTH
+#define __HEALTH
+
+#include <stddef.h>
+
+#define HEALTH_WINDOW 60           //readings per window of the mean and standard deviation
+#define HEALTH_MAX_JUMPS 3         //changes faster than the maximum rate within a window to flag a channel as erratic
+#define HEALTH_NAME_LENGTH 64
+
+enum {
+  HEALTH_OPEN = 1,
+  HEALTH_SATURATED = 2,
+  HEALTH_FROZEN = 4,
+  HEALTH_ERRATIC = 8
+};
+#define HEALTH_FAULT (HEALTH_OPEN | HEALTH_SATURATED | HEALTH_FROZEN) //flags of a channel which can't be trusted
+
+typedef struct {
+  double minV, maxV;        //input range of the DAQ
+  double openV;             //overflow sensors reading closer to 0 V are open circuits
+  int faultReadings;        //readings in a row for an open or saturated channel to be flagged
+  int frozenReadings;       //identical readings in a row for a channel to be flagged as frozen
+  double maxRate;           //fastest change of a reading (V/s)
+} HealthConfig;
+
+typedef struct {
+  char name[HEALTH_NAME_LENGTH];
+  bool sensor;              //an overflow sensor (checked for open circuits)
+  long long readings;
+  float last;               //last reading, and when it was taken (s)
+  double lastT;
+  //current window
+  int n;
+  double mean, m2;          //Welford's running mean and sum of squared deviations
+  int jumps;
+  //last complete window
+  double windowMean, windowStd;
+  int windowJumps;
+  //readings in a row showing each problem
+  int openRun, saturatedRun, stuckRun;
+  int flags;
+} ChannelHealth;
+
+void healthInit(ChannelHealth *h, const char *name, bool sensor);
+//returns the flags which changed with this reading (t in s)
+int healthUpdate(ChannelHealth *h, const HealthConfig *c, double t, float v);
+const char *healthDescribe(int flags, char *buf, size_t size); //eg. "open, frozen", "ok" if none
+
+#endif
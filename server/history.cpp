@@ -0,0 +1,242 @@
+//history of every fill (see history.h for the format)
+#define _FILE_OFFSET_BITS 64
+#include "history.h"
+#include "checksum.h"
+#include "export.h"
+#include "ctlsock.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+/*--------------------------------------------------------------*/
+bool historyValid(const HistoryRecord *r) {
+  return (memcmp(r->magic, "LN2F", 4) == 0) && (r->version == HISTORY_VERSION) &&
+         (r->checksum == checksum((const unsigned char *)r, offsetof(HistoryRecord, checksum)));
+}
+/*--------------------------------------------------------------*/
+double historyUsed(const HistoryRecord *r) {
+  return (r->massBefore > r->massAfter) ? r->massBefore - r->massAfter : 0.0;
+}
+/*--------------------------------------------------------------*/
+//index of the entry's fills, added if it has none yet (-1 if there are too many entries)
+static int addEntry(FillHistory *h, const char *name) {
+  int e = historyEntry(h, name);
+  if (e >= 0)
+    return e;
+  if (h->numEntries == HISTORY_MAX_ENTRIES)
+    return -1;
+  e = h->numEntries++;
+  snprintf(h->names[e], HISTORY_NAME_LENGTH, "%s", name);
+  h->fills[e] = NULL;
+  h->numFills[e] = h->sizeFills[e] = 0;
+  return e;
+}
+/*--------------------------------------------------------------*/
+static int addFill(FillHistory *h, int e, int record) {
+  if (h->numFills[e] == h->sizeFills[e]) {
+    int size = (h->sizeFills[e] > 0) ? 2*h->sizeFills[e] : 64;
+    int *fills = (int *)realloc(h->fills[e], size*sizeof(int));
+    if (fills == NULL)
+      return -1;
+    h->fills[e] = fills;
+    h->sizeFills[e] = size;
+  }
+  h->fills[e][h->numFills[e]++] = record;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+int historyOpen(FillHistory *h, const char *path) {
+  HistoryRecord r;
+
+  memset(h, 0, sizeof(FillHistory));
+  h->file = fopen(path, "r+b");
+  if (h->file == NULL)
+    h->file = fopen(path, "w+b");
+  if (h->file == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  //index the fills of each entry, up to the first record which isn't complete
+  while ((fread(&r, sizeof(r), 1, h->file) == 1) && historyValid(&r)) {
+    r.entry[HISTORY_NAME_LENGTH - 1] = '\0';
+    int e = addEntry(h, r.entry);
+    if ((e < 0) || (addFill(h, e, h->numRecords) < 0))
+      printf("ERROR: Could not index the fill of %s in %s (too many schedule entries?).\n", r.entry, path);
+    h->numRecords++;
+  }
+  off_t end = (off_t)h->numRecords*(off_t)sizeof(HistoryRecord);
+  fseeko(h->file, 0, SEEK_END);
+  if (ftello(h->file) > end)
+    printf("Cutting off %lli bytes after the last complete fill in %s.\n", (long long)(ftello(h->file) - end), path);
+  fflush(h->file);
+  if (ftruncate(fileno(h->file), end) < 0) {
+    perror(path);
+    historyClose(h);
+    return -1;
+  }
+  return h->numRecords;
+}
+/*--------------------------------------------------------------*/
+int historyRead(FillHistory *h, int record, HistoryRecord *r) {
+  if ((record < 0) || (record >= h->numRecords))
+    return -1;
+  if ((fseeko(h->file, (off_t)record*sizeof(HistoryRecord), SEEK_SET) != 0) || (fread(r, sizeof(HistoryRecord), 1, h->file) != 1))
+    return -1;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+int historyAppend(FillHistory *h, HistoryRecord *r) {
+  HistoryRecord prev;
+
+  r->entry[HISTORY_NAME_LENGTH - 1] = '\0';
+  int e = addEntry(h, r->entry);
+  if (e < 0)
+    return -1;
+
+  //the entry's totals carry on from its previous fill
+  memcpy(r->magic, "LN2F", 4);
+  r->version = HISTORY_VERSION;
+  r->prevFill = -1;
+  r->entryFills = 1;
+  r->entryTimeouts = (r->reason == HISTORY_TIMEOUT) ? 1 : 0;
+  r->entryStopped = ((r->reason == HISTORY_STOPPED) || (r->reason == HISTORY_SENSOR)) ? 1 : 0;
+  r->entryDuration = r->duration;
+  r->entryUsed = historyUsed(r);
+  if ((h->numFills[e] > 0) && (historyRead(h, h->fills[e][h->numFills[e] - 1], &prev) > 0)) {
+    r->prevFill = h->fills[e][h->numFills[e] - 1];
+    r->entryFills += prev.entryFills;
+    r->entryTimeouts += prev.entryTimeouts;
+    r->entryStopped += prev.entryStopped;
+    r->entryDuration += prev.entryDuration;
+    r->entryUsed += prev.entryUsed;
+  }
+  r->checksum = checksum((const unsigned char *)r, offsetof(HistoryRecord, checksum));
+
+  if ((fseeko(h->file, (off_t)h->numRecords*sizeof(HistoryRecord), SEEK_SET) != 0) ||
+      (fwrite(r, sizeof(HistoryRecord), 1, h->file) != 1) || (fflush(h->file) != 0) ||
+      (addFill(h, e, h->numRecords) < 0))
+    return -1;
+  return h->numRecords++;
+}
+/*--------------------------------------------------------------*/
+int historyEntry(FillHistory *h, const char *name) {
+  for (int e = 0; e < h->numEntries; e++)
+    if (strncmp(h->names[e], name, HISTORY_NAME_LENGTH - 1) == 0)
+      return e;
+  return -1;
+}
+/*--------------------------------------------------------------*/
+int historyFill(FillHistory *h, int entry, int n) {
+  return (entry < 0) ? n : h->fills[entry][n];
+}
+/*--------------------------------------------------------------*/
+int historyCount(FillHistory *h, int entry, time_t t) {
+  HistoryRecord r;
+  int lo = 0, hi = (entry < 0) ? h->numRecords : h->numFills[entry];
+
+  //the first fill which started at or after t
+  while (lo < hi) {
+    int mid = (lo + hi)/2;
+    if (historyRead(h, historyFill(h, entry, mid), &r) < 0)
+      return -1;
+    if (r.start < (long long)t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+/*--------------------------------------------------------------*/
+int historySummarize(FillHistory *h, int entry, time_t from, time_t to, HistorySummary *s) {
+  HistoryRecord first, last, before;
+  int n0 = historyCount(h, entry, from);
+  int n1 = historyCount(h, entry, to);
+
+  memset(s, 0, sizeof(HistorySummary));
+  if ((entry < 0) || (n0 < 0) || (n1 <= n0))
+    return 0;
+  if ((historyRead(h, h->fills[entry][n0], &first) < 0) || (historyRead(h, h->fills[entry][n1 - 1], &last) < 0))
+    return -1;
+  //the totals up to the last fill, less those up to the fill before the first
+  s->fills = last.entryFills;
+  s->timeouts = last.entryTimeouts;
+  s->stopped = last.entryStopped;
+  s->duration = last.entryDuration;
+  s->used = last.entryUsed;
+  if (n0 > 0) {
+    if (historyRead(h, h->fills[entry][n0 - 1], &before) < 0)
+      return -1;
+    s->fills -= before.entryFills;
+    s->timeouts -= before.entryTimeouts;
+    s->stopped -= before.entryStopped;
+    s->duration -= before.entryDuration;
+    s->used -= before.entryUsed;
+  }
+  s->first = (time_t)first.start;
+  s->last = (time_t)last.start;
+  return s->fills;
+}
+/*--------------------------------------------------------------*/
+void historyClose(FillHistory *h) {
+  if (h->file != NULL)
+    fclose(h->file);
+  h->file = NULL;
+  for (int e = 0; e < h->numEntries; e++)
+    free(h->fills[e]);
+  h->numEntries = 0;
+  h->numRecords = 0;
+}
+/*--------------------------------------------------------------*/
+int historyParse(HistoryQuery *q, char *options, time_t now) {
+  char *save, *tok;
+  struct tm local;
+
+  memset(q, 0, sizeof(HistoryQuery));
+  q->last = 20;
+  q->from = 0;
+  q->to = (time_t)0x7fffffff;
+  if (options == NULL)
+    return 1;
+  for (tok = strtok_r(options, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save)) {
+    if (strcmp(tok, "summary") == 0) {
+      q->summary = true;
+    } else if (strcmp(tok, "last") == 0) {
+      tok = strtok_r(NULL, " ", &save);
+      if ((tok == NULL) || (atoi(tok) <= 0)) {
+        ctlPrintf("ERROR: Invalid number of fills in the history command.\n");
+        return -1;
+      }
+      q->last = atoi(tok);
+    } else if ((strcmp(tok, "from") == 0) || (strcmp(tok, "to") == 0)) {
+      bool from = (tok[0] == 'f');
+      tok = strtok_r(NULL, " ", &save);
+      if ((tok == NULL) || (exportParseTime(tok, now, from ? &q->from : &q->to) < 0)) {
+        ctlPrintf("ERROR: Invalid time in the history command (expected HH:MM[:SS] or YYYY-MM-DD,HH:MM[:SS]).\n");
+        return -1;
+      }
+    } else if ((strcmp(tok, "today") == 0) || (strcmp(tok, "week") == 0) || (strcmp(tok, "month") == 0)) {
+      //since midnight, 7 days ago or the first of the month
+      localtime_r(&now, &local);
+      local.tm_hour = local.tm_min = local.tm_sec = 0;
+      if (tok[0] == 'w')
+        local.tm_mday -= 7;
+      else if (tok[0] == 'm')
+        local.tm_mday = 1;
+      local.tm_isdst = -1;
+      q->from = mktime(&local);
+    } else if (q->entry[0] == '\0') {
+      strncpy(q->entry, tok, HISTORY_NAME_LENGTH - 1);
+    } else {
+      ctlPrintf("ERROR: Unknown history option %s.\n", tok);
+      return -1;
+    }
+  }
+  if (q->from > q->to) {
+    ctlPrintf("ERROR: The start of the time range is after its end.\n");
+    return -1;
+  }
+  return 1;
+}
@@ -0,0 +1,102 @@
+//history of every fill, queried with the history command
+//
+//Each fill appends one fixed size HistoryRecord to the history file.  Fills run one at a time,
+//so the records are in the order of their start (and end) times, and the n-th record is at a
+//known place in the file: the file is its own time index, searched by bisection.  Each record
+//also links to the previous fill of its schedule entry, and carries the running totals of the
+//entry's fills up to and including it (number of fills, time filling, LN2 used, timeouts and fills
+//stopped, by a command or a sensor fault), so the totals over any range of an entry's fills are the difference of two records.
+//Finding the fills of an entry in a time range, and their averages, takes a few reads whatever
+//the number of fills.
+//
+//The record numbers of each entry's fills are kept in memory, rebuilt from the file when it is
+//opened (a torn record left at the end by a crash is cut off then).
+
+#ifndef __HISTORY
+#define __HISTORY
+
+#include <stdio.h>
+#include <time.h>
+
+#define HISTORY_NAME_LENGTH 64     //longest entry name, including the terminating 0
+#define HISTORY_MAX_ENTRIES 256    //entries with fills in one history file
+#define HISTORY_VERSION 1
+
+//how a fill ended
+enum {
+  HISTORY_THRESHOLD,        //the overflow sensor reached the threshold
+  HISTORY_TIMEOUT,          //it didn't within max_filling_time
+  HISTORY_STOPPED,          //stopped with stopfill, end or exit
+  HISTORY_SENSOR            //not started or stopped since the overflow sensor couldn't be trusted (see health.h)
+};
+#define HISTORY_MANUAL 1          //flags: started with the fill command
+#define HISTORY_TRACE 2           //traced (see trace.h)
+
+//one fill (stored little endian, as on x86, and laid out the same by 32 and 64 bit builds)
+typedef struct {
+  char magic[4];            //"LN2F"
+  unsigned int version;     //HISTORY_VERSION
+  char entry[HISTORY_NAME_LENGTH];
+  long long start;          //s since the epoch
+  long long end;
+  long long prevFill;       //record of the previous fill of the entry, -1 for its first
+  double entryDuration;     //totals of the entry's fills up to and including this one: time filling (s)
+  double entryUsed;         //LN2 used (kg)
+  int reason;               //HISTORY_THRESHOLD, HISTORY_TIMEOUT or HISTORY_STOPPED
+  int flags;
+  unsigned int entryFills;  //number of fills
+  unsigned int entryTimeouts;
+  unsigned int entryStopped;
+  float duration;           //s
+  float massBefore;         //scale weight (kg) when the fill started and ended
+  float massAfter;
+  float peakVoltage;        //highest overflow sensor reading during the fill
+  unsigned int checksum;    //FNV-1a hash of the record up to here
+} HistoryRecord;
+
+typedef struct {
+  FILE *file;
+  int numRecords;
+  int numEntries;
+  char names[HISTORY_MAX_ENTRIES][HISTORY_NAME_LENGTH];
+  int *fills[HISTORY_MAX_ENTRIES]; //record numbers of each entry's fills, oldest first
+  int numFills[HISTORY_MAX_ENTRIES];
+  int sizeFills[HISTORY_MAX_ENTRIES];
+} FillHistory;
+
+//what a history command asks for
+typedef struct {
+  bool summary;             //totals and averages per entry, instead of the fills
+  char entry[HISTORY_NAME_LENGTH]; //empty for every entry
+  int last;                 //fills listed, the last ones in the range
+  time_t from, to;          //fills started in this range
+} HistoryQuery;
+
+//totals over a range of an entry's fills
+typedef struct {
+  int fills;
+  int timeouts;
+  int stopped;
+  double duration;          //s
+  double used;              //kg
+  time_t first, last;       //start of the first and last fill
+} HistorySummary;
+
+int historyOpen(FillHistory *h, const char *path); //returns the number of fills, -1 on errors
+int historyAppend(FillHistory *h, HistoryRecord *r); //fills in the links and totals, returns the record number
+int historyRead(FillHistory *h, int record, HistoryRecord *r);
+int historyEntry(FillHistory *h, const char *name); //-1 if it has no fills
+//fills (of the entry, or all of them if entry < 0) which started before t
+int historyCount(FillHistory *h, int entry, time_t t);
+int historyFill(FillHistory *h, int entry, int n); //record of the n-th fill (of the entry, if entry >= 0)
+int historySummarize(FillHistory *h, int entry, time_t from, time_t to, HistorySummary *s);
+void historyClose(FillHistory *h);
+//whether a record read from the file is complete (for tools reading the file while the server appends to it,
+//which stop at the first record which isn't)
+bool historyValid(const HistoryRecord *r);
+double historyUsed(const HistoryRecord *r); //LN2 (kg) the fill used: the weight before it less after, 0 if it went up
+
+//options: [summary] [entry] [last N] [from TIME] [to TIME] [today|week|month], with TIME as for save
+int historyParse(HistoryQuery *q, char *options, time_t now);
+
+#endif
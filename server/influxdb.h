@@ -6,6 +6,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <sys/uio.h>
 
 /*
   Usage:
@@ -33,17 +35,22 @@
 #define INFLUX_TS(ts)         IF_TYPE_TIMESTAMP, (long long)(ts)
 #define INFLUX_END            IF_TYPE_ARG_END
 
+#define INFLUX_UDP_MTU     1500 // default MTU used by send_udp
+#define INFLUX_UDP_HEADERS 28   // IPv4 + UDP header size
+
 typedef struct _influx_client_t
 {
     char* host;
     int   port;
-    char* db;  // http only
+    char* db;  // http only (udp writes go to the database configured for the udp listener)
     char* usr; // http only [optional for auth]
     char* pwd; // http only [optional for auth]
 } influx_client_t;
 
-static int post_http(influx_client_t* c, ...);
-//static int send_udp(influx_client_t* c, ...);
+static inline int post_http(influx_client_t* c, ...);
+static inline int post_http_lines(influx_client_t* c, const char* lines, size_t len);
+static inline int send_udp(influx_client_t* c, ...);
+static inline int send_udp_lines(influx_client_t* c, const char* lines, size_t len, int mtu, int* failed);
 
 #define IF_TYPE_ARG_END       0
 #define IF_TYPE_MEAS          1
@@ -54,45 +61,44 @@ static int post_http(influx_client_t* c, ...);
 #define IF_TYPE_FIELD_BOOLEAN 6
 #define IF_TYPE_TIMESTAMP     7
 
-static int _escaped_append(char** dest, size_t* len, size_t* used, const char* src, const char* escape_seq);
-static int _format_line(char** buf, va_list ap);
+static inline int _escaped_append(char** dest, size_t* len, size_t* used, const char* src, const char* escape_seq);
+static inline int _format_line(char** buf, va_list ap);
 
-static int post_http(influx_client_t* c, ...)
+static inline int post_http(influx_client_t* c, ...)
 {
     va_list ap;
-    struct iovec iv[2];
-    struct sockaddr_in addr;
-    int sock, ret_code = 0, content_length = 0, len = 0;
-    char ch;
-
-   
+    char* line = NULL;
+    int ret = 0, len = 0;
 
     va_start(ap, c);
-    len = _format_line((char**)&iv[1].iov_base, ap);
+    len = _format_line(&line, ap);
     va_end(ap);
     if(len < 0)
         return -1;
-    
-    iv[1].iov_len = len;
 
-    if(!(iv[0].iov_base = (char*)malloc(len = 0x100))) {
-        free(iv[1].iov_base);
-        return -2;
-    }
-    
-    for(;;) {
-        iv[0].iov_len = snprintf((char*)iv[0].iov_base, len, "POST /write?db=%s&u=%s&p=%s HTTP/1.1\r\nHost: %s\r\nContent-Length: %zd\r\n\r\n",
-            c->db, c->usr ? c->usr : "", c->pwd ? c->pwd : "", c->host, iv[1].iov_len);
-     
-        if((int)iv[0].iov_len > len && !(iv[0].iov_base = (char*)realloc(iv[0].iov_base, len *= 2))) {
-            free(iv[1].iov_base);
-            return -3;
-        }
-        else
-            break;
-    }
+    ret = post_http_lines(c, line, len);
+    free(line);
+    return ret;
+}
+
+// posts lines which are already in line protocol format, without allocating
+static inline int post_http_lines(influx_client_t* c, const char* lines, size_t size)
+{
+    struct iovec iv[2];
+    struct sockaddr_in addr;
+    char header[512];
+    int sock, ret_code = 0, content_length = 0, len = sizeof(header);
+    char ch;
+
+    iv[1].iov_base = (void*)lines;
+    iv[1].iov_len = size;
+
+    iv[0].iov_base = header;
+    iv[0].iov_len = snprintf(header, len, "POST /write?db=%s&u=%s&p=%s HTTP/1.1\r\nHost: %s\r\nContent-Length: %zd\r\n\r\n",
+        c->db, c->usr ? c->usr : "", c->pwd ? c->pwd : "", c->host, iv[1].iov_len);
+    if((int)iv[0].iov_len >= len)
+        return -3;
 
- 
     addr.sin_family = AF_INET;
     addr.sin_port = htons(c->port);
     if((addr.sin_addr.s_addr = inet_addr(c->host)) == INADDR_NONE)
@@ -110,6 +116,7 @@ static int post_http(influx_client_t* c, ...)
         ret_code = -7;
         goto END;
     }
+    //the header buffer is reused to read the response
     iv[0].iov_len = len;
 
 #define _GET_NEXT_CHAR() (ch = (len >= (int)iv[0].iov_len && \
@@ -140,8 +147,6 @@ static int post_http(influx_client_t* c, ...)
     ret_code = -11;
 END:
     close(sock);
-    free(iv[0].iov_base);
-    free(iv[1].iov_base);
     return ret_code / 100 == 2 ? 0 : ret_code;
 }
 #undef _GET_NEXT_CHAR
@@ -150,12 +155,11 @@ END:
 #undef _GET_NUMBER
 #undef _
 
-/*static int send_udp(influx_client_t* c, ...)
+static inline int send_udp(influx_client_t* c, ...)
 {
     va_list ap;
     char* line = NULL;
-    int sock, len = 0, ret = 0;
-    struct sockaddr_in addr;
+    int len = 0, ret = 0, failed = 0;
 
     va_start(ap, c);
     len = _format_line(&line, ap);
@@ -163,28 +167,52 @@ END:
     if(len < 0)
         return -1;
 
+    ret = send_udp_lines(c, line, len, INFLUX_UDP_MTU, &failed);
+    free(line);
+    return (ret < 0 || failed) ? -4 : 0;
+}
+
+// sends lines which are already in line protocol format as UDP datagrams, packing as many
+// whole lines into each datagram as fit in the given MTU (a line which is too long on its
+// own is sent by itself).  Returns the number of datagrams sent, or a negative value if
+// the socket couldn't be set up; *failed is set to the number of datagrams which couldn't be sent.
+static inline int send_udp_lines(influx_client_t* c, const char* lines, size_t len, int mtu, int* failed)
+{
+    struct sockaddr_in addr;
+    int sock, sent = 0;
+    size_t payload = mtu > INFLUX_UDP_HEADERS + 64 ? mtu - INFLUX_UDP_HEADERS : 64;
+    size_t start = 0;
+
+    *failed = 0;
     addr.sin_family = AF_INET;
     addr.sin_port = htons(c->port);
-    if((addr.sin_addr.s_addr = inet_addr(c->host)) == INADDR_NONE) {
-        ret = -2;
-        goto END;
-    }
+    if((addr.sin_addr.s_addr = inet_addr(c->host)) == INADDR_NONE)
+        return -2;
 
-    if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        ret = -3;
-        goto END;
-    }
+    if((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return -3;
 
-    if(sendto(sock, line, len, 0, (struct sockaddr *)&addr, sizeof(addr)) < len)
-        ret = -4;
+    while(start < len) {
+        size_t end = start;
+        while(end < len) {
+            const char* nl = (const char*)memchr(lines + end, '\n', len - end);
+            size_t line_end = nl ? (size_t)(nl - lines) + 1 : len;
+            if(line_end - start > payload && end > start)
+                break;
+            end = line_end;
+        }
+        if(sendto(sock, lines + start, end - start, 0, (struct sockaddr *)&addr, sizeof(addr)) < (int)(end - start))
+            (*failed)++;
+        else
+            sent++;
+        start = end;
+    }
 
     close(sock);
-END:
-    free(line);
-    return ret;
-}*/
+    return sent;
+}
 
-static int _format_line(char** buf, va_list ap)
+static inline int _format_line(char** buf, va_list ap)
 {
 #define _APPEND(fmter...) \
     for(;;) {\
@@ -270,7 +298,7 @@ FAIL:
 }
 #undef _APPEND
 
-static int _escaped_append(char** dest, size_t* len, size_t* used, const char* src, const char* escape_seq)
+static inline int _escaped_append(char** dest, size_t* len, size_t* used, const char* src, const char* escape_seq)
 {
     size_t i = 0;
 
@@ -293,3 +321,446 @@ static int _escaped_append(char** dest, size_t* len, size_t* used, const char* s
     }
     return 0;
 }
+
+/*
+  Allocation-free encoder, for points which are written over and over with the same
+  measurement and tags.  The escaped "measurement,tag=value" prefix of each series is
+  built once, lines are then written into a caller-owned buffer and sent in one request:
+
+    influx_series_t s;
+    influx_series_init(&s, "ln2");
+    influx_series_tag(&s, "channel", "ai3");
+
+    char storage[4096];
+    influx_buf_t b;
+    influx_buf_init(&b, storage, sizeof(storage));
+    influx_line_begin(&b, &s);
+    influx_line_float(&b, "voltage", 4.123456);
+    influx_line_end(&b, 1512722735522840439LL);
+    post_http_lines(c, b.buf, b.used);
+
+  Floats are written in the shortest form which reads back as the same double (Grisu2,
+  as used by RapidJSON: always exact, and one digit longer than necessary for a small
+  fraction of a percent of values).  Nothing is written past the end of the buffer,
+  b.error is set instead and the whole batch should be dropped.
+ */
+
+#define INFLUX_SERIES_MAX 256 //longest escaped measurement+tags prefix
+#define INFLUX_NUMBER_MAX 32  //longest formatted number
+
+typedef struct _influx_buf_t
+{
+    char*  buf;    // caller-owned storage
+    size_t len;    // size of buf
+    size_t used;   // bytes written so far
+    int    fields; // fields written on the current line
+    int    error;  // non-zero if buf was too small or a value couldn't be encoded
+} influx_buf_t;
+
+typedef struct _influx_series_t
+{
+    char   prefix[INFLUX_SERIES_MAX]; // escaped "measurement,tag=value,..."
+    size_t len;
+} influx_series_t;
+
+static inline int _escape_into(char* dest, size_t len, const char* src, const char* escape_seq)
+{
+    size_t used = 0;
+    for(; *src; src++) {
+        if(strchr(escape_seq, *src)) {
+            if(used + 1 >= len)
+                return -1;
+            dest[used++] = '\\';
+        }
+        if(used + 1 >= len)
+            return -1;
+        dest[used++] = *src;
+    }
+    dest[used] = '\0';
+    return used;
+}
+
+static inline int influx_series_init(influx_series_t* s, const char* measurement)
+{
+    int n = _escape_into(s->prefix, sizeof(s->prefix), measurement, ", ");
+    s->len = n < 0 ? 0 : n;
+    return n < 0 ? -1 : 0;
+}
+
+// tags should be added sorted by key
+static inline int influx_series_tag(influx_series_t* s, const char* key, const char* value)
+{
+    int n;
+    if(s->len + 2 >= sizeof(s->prefix))
+        return -1;
+    s->prefix[s->len++] = ',';
+    if((n = _escape_into(s->prefix + s->len, sizeof(s->prefix) - s->len, key, ",= ")) < 0)
+        return -1;
+    s->len += n;
+    if(s->len + 2 >= sizeof(s->prefix))
+        return -1;
+    s->prefix[s->len++] = '=';
+    if((n = _escape_into(s->prefix + s->len, sizeof(s->prefix) - s->len, value, ",= ")) < 0)
+        return -1;
+    s->len += n;
+    return 0;
+}
+
+static inline void influx_buf_init(influx_buf_t* b, char* storage, size_t len)
+{
+    b->buf = storage;
+    b->len = len;
+    b->used = 0;
+    b->fields = 0;
+    b->error = 0;
+}
+
+static inline void influx_buf_reset(influx_buf_t* b)
+{
+    b->used = 0;
+    b->fields = 0;
+    b->error = 0;
+}
+
+/*Shortest round-trip double formatting (Grisu2)-------------*/
+
+typedef struct { unsigned long long f; int e; } _influx_diyfp;
+
+static const unsigned long long _influx_pow10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+    10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+    1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+    10000000000000000000ULL
+};
+
+// normalized significands and binary exponents of 10^-348, 10^-340, ..., 10^340
+static const unsigned long long _influx_cached_f[87] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+};
+static const short _influx_cached_e[87] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static inline _influx_diyfp _diyfp_mul(_influx_diyfp x, _influx_diyfp y)
+{
+    const unsigned long long M32 = 0xFFFFFFFFULL;
+    unsigned long long a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+    unsigned long long ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    unsigned long long tmp = (bd >> 32) + (ad & M32) + (bc & M32) + (1ULL << 31); // rounded
+    _influx_diyfp r;
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+static inline _influx_diyfp _diyfp_normalize(_influx_diyfp x)
+{
+    int s = __builtin_clzll(x.f);
+    x.f <<= s;
+    x.e -= s;
+    return x;
+}
+
+static inline void _influx_grisu_round(char* buffer, int len, unsigned long long delta, unsigned long long rest,
+                                unsigned long long ten_kappa, unsigned long long wp_w)
+{
+    while(rest < wp_w && delta - rest >= ten_kappa &&
+          (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static inline void _influx_digit_gen(_influx_diyfp W, _influx_diyfp Mp, unsigned long long delta, char* buffer, int* len, int* K)
+{
+    _influx_diyfp one;
+    one.f = 1ULL << -Mp.e;
+    one.e = Mp.e;
+    unsigned long long wp_w = Mp.f - W.f;
+    unsigned int p1 = (unsigned int)(Mp.f >> -one.e);
+    unsigned long long p2 = Mp.f & (one.f - 1);
+    int kappa = 1;
+    while(kappa < 10 && p1 >= _influx_pow10[kappa])
+        kappa++;
+    *len = 0;
+
+    while(kappa > 0) {
+        unsigned int d = p1 / (unsigned int)_influx_pow10[kappa - 1];
+        p1 %= (unsigned int)_influx_pow10[kappa - 1];
+        if(d || *len)
+            buffer[(*len)++] = (char)('0' + d);
+        kappa--;
+        unsigned long long tmp = ((unsigned long long)p1 << -one.e) + p2;
+        if(tmp <= delta) {
+            *K += kappa;
+            _influx_grisu_round(buffer, *len, delta, tmp, _influx_pow10[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    for(;;) {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if(d || *len)
+            buffer[(*len)++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if(p2 < delta) {
+            *K += kappa;
+            int index = -kappa;
+            _influx_grisu_round(buffer, *len, delta, p2, one.f, wp_w * (index < 20 ? _influx_pow10[index] : 0));
+            return;
+        }
+    }
+}
+
+// digits of a positive finite value, such that value = digits * 10^K
+static inline void _influx_grisu2(double value, char* buffer, int* length, int* K)
+{
+    union { double d; unsigned long long u; } bits;
+    const unsigned long long hidden = 0x0010000000000000ULL;
+    _influx_diyfp v, pl, mi, c_mk, W, Wp, Wm;
+
+    bits.d = value;
+    int biased_e = (int)((bits.u & 0x7FF0000000000000ULL) >> 52);
+    unsigned long long significand = bits.u & 0x000FFFFFFFFFFFFFULL;
+    if(biased_e != 0) {
+        v.f = significand + hidden;
+        v.e = biased_e - 1075;
+    } else {
+        v.f = significand;
+        v.e = -1074;
+    }
+
+    // boundaries halfway to the neighbouring doubles
+    pl.f = (v.f << 1) + 1;
+    pl.e = v.e - 1;
+    while(!(pl.f & (hidden << 1))) {
+        pl.f <<= 1;
+        pl.e--;
+    }
+    pl.f <<= 64 - 52 - 2;
+    pl.e -= 64 - 52 - 2;
+    if(v.f == hidden) {
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    } else {
+        mi.f = (v.f << 1) - 1;
+        mi.e = v.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+
+    // cached power of ten which brings the exponent into [-60,-32]
+    double dk = (-61 - pl.e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if(dk - k > 0.0)
+        k++;
+    int index = (k >> 3) + 1;
+    *K = -(-348 + index * 8);
+    c_mk.f = _influx_cached_f[index];
+    c_mk.e = _influx_cached_e[index];
+
+    W = _diyfp_mul(_diyfp_normalize(v), c_mk);
+    Wp = _diyfp_mul(pl, c_mk);
+    Wm = _diyfp_mul(mi, c_mk);
+    Wm.f++;
+    Wp.f--;
+    _influx_digit_gen(W, Wp, Wp.f - Wm.f, buffer, length, K);
+}
+
+static inline int _influx_write_exponent(int K, char* buffer)
+{
+    char* p = buffer;
+    if(K < 0) {
+        *p++ = '-';
+        K = -K;
+    }
+    if(K >= 100) {
+        *p++ = (char)('0' + K / 100);
+        K %= 100;
+        *p++ = (char)('0' + K / 10);
+    } else if(K >= 10)
+        *p++ = (char)('0' + K / 10);
+    *p++ = (char)('0' + K % 10);
+    return p - buffer;
+}
+
+// turns digits*10^k into plain or exponent notation, returns the length
+static inline int _influx_prettify(char* buffer, int length, int k)
+{
+    int kk = length + k; // 10^(kk-1) <= v < 10^kk
+
+    if(k >= 0 && kk <= 21) {        // 1234e7 -> 12340000000
+        for(int i = length; i < kk; i++)
+            buffer[i] = '0';
+        return kk;
+    } else if(kk > 0 && kk <= 21) { // 1234e-2 -> 12.34
+        memmove(&buffer[kk + 1], &buffer[kk], length - kk);
+        buffer[kk] = '.';
+        return length + 1;
+    } else if(kk > -6 && kk <= 0) { // 1234e-6 -> 0.001234
+        int offset = 2 - kk;
+        memmove(&buffer[offset], &buffer[0], length);
+        buffer[0] = '0';
+        buffer[1] = '.';
+        for(int i = 2; i < offset; i++)
+            buffer[i] = '0';
+        return length + offset;
+    } else if(length == 1) {        // 1e30
+        buffer[1] = 'e';
+        return 2 + _influx_write_exponent(kk - 1, &buffer[2]);
+    } else {                        // 1234e30 -> 1.234e33
+        memmove(&buffer[2], &buffer[1], length - 1);
+        buffer[1] = '.';
+        buffer[length + 1] = 'e';
+        return length + 2 + _influx_write_exponent(kk - 1, &buffer[length + 2]);
+    }
+}
+
+// writes the shortest decimal form of value which reads back as the same double (at most
+// 25 characters, not terminated), returns the length or -1 for NaN/infinity
+static inline int influx_dtoa(double value, char* out)
+{
+    int length, K;
+    char* p = out;
+
+    if(value != value || value - value != 0.0)
+        return -1;
+    if(value == 0.0) {
+        *p = '0';
+        return 1;
+    }
+    if(value < 0) {
+        *p++ = '-';
+        value = -value;
+    }
+    _influx_grisu2(value, p, &length, &K);
+    return (p - out) + _influx_prettify(p, length, K);
+}
+
+// writes a (signed) integer, returns the length
+static inline int influx_lltoa(long long value, char* out)
+{
+    char tmp[24];
+    int n = 0, len = 0;
+    unsigned long long u = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    if(value < 0)
+        out[len++] = '-';
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while(u);
+    while(n)
+        out[len++] = tmp[--n];
+    return len;
+}
+
+/*Writing lines----------------------------------------------*/
+
+static inline void _influx_put(influx_buf_t* b, const char* src, size_t n)
+{
+    if(b->error)
+        return;
+    if(b->used + n > b->len) {
+        b->error = 1;
+        return;
+    }
+    memcpy(b->buf + b->used, src, n);
+    b->used += n;
+}
+
+static inline void influx_line_begin(influx_buf_t* b, const influx_series_t* s)
+{
+    _influx_put(b, s->prefix, s->len);
+    b->fields = 0;
+}
+
+static inline void _influx_field_key(influx_buf_t* b, const char* key)
+{
+    char escaped[INFLUX_SERIES_MAX];
+    int n = _escape_into(escaped, sizeof(escaped), key, ",= ");
+    if(n < 0) {
+        b->error = 1;
+        return;
+    }
+    _influx_put(b, b->fields++ ? "," : " ", 1);
+    _influx_put(b, escaped, n);
+    _influx_put(b, "=", 1);
+}
+
+static inline void influx_line_float(influx_buf_t* b, const char* key, double value)
+{
+    char number[INFLUX_NUMBER_MAX];
+    int n = influx_dtoa(value, number);
+    if(n < 0) {
+        b->error = 1; // line protocol has no NaN or infinity
+        return;
+    }
+    _influx_field_key(b, key);
+    _influx_put(b, number, n);
+}
+
+static inline void influx_line_int(influx_buf_t* b, const char* key, long long value)
+{
+    char number[INFLUX_NUMBER_MAX];
+    int n = influx_lltoa(value, number);
+    number[n++] = 'i';
+    _influx_field_key(b, key);
+    _influx_put(b, number, n);
+}
+
+static inline void influx_line_bool(influx_buf_t* b, const char* key, int value)
+{
+    _influx_field_key(b, key);
+    _influx_put(b, value ? "t" : "f", 1);
+}
+
+static inline void influx_line_end(influx_buf_t* b, long long ts)
+{
+    char number[INFLUX_NUMBER_MAX];
+    int n = 0;
+    if(b->fields == 0)
+        b->error = 1; // a line needs at least one field
+    number[n++] = ' ';
+    n += influx_lltoa(ts, number + n);
+    number[n++] = '\n';
+    _influx_put(b, number, n);
+}
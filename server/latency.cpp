@@ -0,0 +1,73 @@
+#include "latency.h"
+#include <string.h>
+
+/*--------------------------------------------------------------*/
+static int bucketIndex(unsigned long long ns) {
+  if (ns < LAT_SUB_BUCKETS)
+    return (int)ns;
+  int msb = 63 - __builtin_clzll(ns);
+  int shift = msb - LAT_SUB_BITS;
+  if (shift > LAT_MAX_SHIFT)
+    return LAT_NUM_BUCKETS - 1;
+  //(ns >> shift) has its top bit at LAT_SUB_BITS, the bits below it select the sub-bucket
+  return (shift + 1) * LAT_SUB_BUCKETS + (int)((ns >> shift) & (LAT_SUB_BUCKETS - 1));
+}
+/*--------------------------------------------------------------*/
+unsigned long long latencyBucketValue(int bucket) {
+  if (bucket < LAT_SUB_BUCKETS)
+    return bucket;
+  int shift = bucket / LAT_SUB_BUCKETS - 1;
+  unsigned long long lower = (unsigned long long)(LAT_SUB_BUCKETS + bucket % LAT_SUB_BUCKETS) << shift;
+  return lower + (1ULL << shift) - 1;
+}
+/*--------------------------------------------------------------*/
+void latencyInit(LatencyHist *h, const char *name) {
+  memset((void *)h, 0, sizeof(LatencyHist));
+  h->name = name;
+}
+/*--------------------------------------------------------------*/
+void latencyReset(LatencyHist *h) {
+  for (int i = 0; i < LAT_NUM_BUCKETS; i++)
+    h->buckets[i] = 0;
+  h->count = 0;
+  h->sum = 0;
+  h->max = 0;
+}
+/*--------------------------------------------------------------*/
+void latencyRecord(LatencyHist *h, unsigned long long ns) {
+  __sync_fetch_and_add(&h->buckets[bucketIndex(ns)], 1ULL);
+  __sync_fetch_and_add(&h->count, 1ULL);
+  __sync_fetch_and_add(&h->sum, ns);
+  unsigned long long max = h->max;
+  while (ns > max) {
+    unsigned long long prev = __sync_val_compare_and_swap(&h->max, max, ns);
+    if (prev == max)
+      break;
+    max = prev;
+  }
+}
+/*--------------------------------------------------------------*/
+//value below which the given percentage of recorded values lie (0 if nothing was recorded)
+unsigned long long latencyPercentile(LatencyHist *h, double percentile) {
+  unsigned long long total = 0;
+  unsigned long long counts[LAT_NUM_BUCKETS];
+  for (int i = 0; i < LAT_NUM_BUCKETS; i++) {
+    counts[i] = latencyLoad(&h->buckets[i]);
+    total += counts[i];
+  }
+  if (total == 0)
+    return 0;
+
+  unsigned long long target = (unsigned long long)(total * percentile / 100.0 + 0.5);
+  if (target < 1)
+    target = 1;
+  unsigned long long seen = 0, max = latencyLoad(&h->max);
+  for (int i = 0; i < LAT_NUM_BUCKETS; i++) {
+    seen += counts[i];
+    if (seen >= target) {
+      unsigned long long v = latencyBucketValue(i);
+      return (v < max) ? v : max;
+    }
+  }
+  return max;
+}
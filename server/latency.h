@@ -0,0 +1,46 @@
+//lock-free log-linear latency histograms (HDR style)
+//
+//Values (in nanoseconds) are counted in buckets which are linear within each power
+//of two, so every recorded value is resolved to within 1/LAT_SUB_BUCKETS (~6%) from
+//1 ns up to ~18 minutes.  Recording is a couple of atomic adds and never blocks, so
+//the histograms can stay on permanently in the control loop; reading them (percentiles)
+//may run concurrently with recording and sees a consistent-enough snapshot.
+
+#ifndef __LATENCY
+#define __LATENCY
+
+#include <time.h>
+
+#define LAT_SUB_BITS 4
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_MAX_SHIFT 36 //values above 2^(LAT_MAX_SHIFT+LAT_SUB_BITS+1) ns go in the last bucket
+#define LAT_NUM_BUCKETS ((LAT_MAX_SHIFT + 2) * LAT_SUB_BUCKETS)
+
+typedef struct {
+  const char *name;
+  volatile unsigned long long count;  //number of recorded values
+  volatile unsigned long long sum;    //sum of recorded values (ns)
+  volatile unsigned long long max;    //largest recorded value (ns)
+  volatile unsigned long long buckets[LAT_NUM_BUCKETS];
+} LatencyHist;
+
+void latencyInit(LatencyHist *h, const char *name);
+void latencyReset(LatencyHist *h);
+void latencyRecord(LatencyHist *h, unsigned long long ns);
+unsigned long long latencyPercentile(LatencyHist *h, double percentile);
+unsigned long long latencyBucketValue(int bucket); //largest value counted in a bucket
+
+//atomic read of a counter (64 bit loads aren't atomic on 32 bit x86 otherwise)
+static inline unsigned long long latencyLoad(volatile unsigned long long *v) {
+  return __sync_fetch_and_add(v, 0ULL);
+}
+
+//monotonic system time in ns, used for all latency measurements (also when the
+//server runs on a virtual clock, since latencies are always real time)
+static inline unsigned long long latencyNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,179 @@
+//reads the archive written by the LN2 server (see archive.h)
+//
+//  ./ln2_query [-f archive] -l
+//      lists the blocks in the archive and the channels they hold
+//  ./ln2_query [-f archive] [-s "YYYY-MM-DD HH:MM"] [-e "YYYY-MM-DD HH:MM"] [-c channel,channel,...]
+//      prints the readings between the start and end times (default: everything) as CSV
+//  ./ln2_query -f traces/<entry>_YYYYMMDD_HHMMSS.dat
+//      prints the trace of a fill (see trace.h), whose readings are less than a second apart
+#include "archive.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_QUERY_CHANNELS 64
+
+/*--------------------------------------------------------------*/
+static void usage(void) {
+  printf("Usage: ln2_query [-f archive] -l\n");
+  printf("       ln2_query [-f archive] [-s \"YYYY-MM-DD HH:MM\"] [-e \"YYYY-MM-DD HH:MM\"] [-c channel,channel,...]\n\n");
+  printf("  -f  archive to read (default LN2_archive.dat)\n");
+  printf("  -l  list the blocks in the archive and their channels\n");
+  printf("  -s  first time to print (local time, default: start of the archive)\n");
+  printf("  -e  last time to print (local time, default: end of the archive)\n");
+  printf("  -c  channels to print (default: all)\n");
+}
+/*--------------------------------------------------------------*/
+//converts local time (YYYY-MM-DD HH:MM[:SS]) to ms since the epoch
+static int parseTime(const char *str, long long *tMs) {
+  struct tm t;
+  memset(&t, 0, sizeof(t));
+  int n = sscanf(str, "%d-%d-%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday, &t.tm_hour, &t.tm_min, &t.tm_sec);
+  if (n < 3) {
+    printf("ERROR: Invalid time (%s), expected YYYY-MM-DD HH:MM.\n", str);
+    return -1;
+  }
+  t.tm_year -= 1900;
+  t.tm_mon -= 1;
+  t.tm_isdst = -1;
+  *tMs = 1000LL*mktime(&t);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//with the ms if the time isn't a whole second (the readings of fill traces)
+static void formatTime(long long tMs, char *str) {
+  time_t tt = (time_t)(tMs / 1000);
+  struct tm local;
+  localtime_r(&tt, &local);
+  strftime(str, 32, "%Y-%m-%d %H:%M:%S", &local);
+  if (tMs % 1000 != 0)
+    sprintf(str + strlen(str), ".%03i", (int)(tMs % 1000));
+}
+/*--------------------------------------------------------------*/
+static int listArchive(ArchiveReader *r) {
+  ArchiveBlock b;
+  char first[32], last[32];
+  long long rows = 0, bytes = 0, values = 0;
+
+  memset(&b, 0, sizeof(b));
+  printf("block,first,last,rows,bytes,channels\n");
+  for (int i = 0; i < r->numBlocks; i++) {
+    formatTime(r->index[i].tFirst, first);
+    formatTime(r->index[i].tLast, last);
+    printf("%i,%s,%s,%u,%u", i, first, last, r->index[i].numRows, r->index[i].blockBytes);
+    if (archiveReadBlock(r, i, &b) > 0) {
+      printf(",");
+      for (int c = 0; c < b.numChannels; c++)
+        printf("%s%s", c ? " " : "", b.names[c]);
+      values += (long long)b.numRows*(b.numChannels + 1);
+    }
+    printf("\n");
+    rows += r->index[i].numRows;
+    bytes += r->index[i].blockBytes;
+  }
+  archiveFreeBlock(&b);
+
+  printf("\n%i blocks, %lld rows, %lld bytes", r->numBlocks, rows, bytes);
+  if (values > 0)
+    printf(" (%.2f bytes per reading)", (double)bytes/values);
+  printf("\n");
+  return 0;
+}
+/*--------------------------------------------------------------*/
+static int printReadings(ArchiveReader *r, long long tFrom, long long tTo, char **channels, int numChannels) {
+  ArchiveBlock b;
+  char timeStr[32], header[8192];
+  int column[ARCHIVE_MAX_CHANNELS];
+  int numColumns;
+
+  memset(&b, 0, sizeof(b));
+  header[0] = '\0';
+  for (int i = archiveFindBlock(r, tFrom); (i < r->numBlocks) && (r->index[i].tFirst <= tTo); i++) {
+    if (archiveReadBlock(r, i, &b) < 0)
+      continue;
+
+    //columns to print, a new header is printed whenever they change
+    char newHeader[8192];
+    strcpy(newHeader, "time");
+    if (numChannels > 0) {
+      numColumns = numChannels;
+      for (int c = 0; c < numChannels; c++) {
+        column[c] = archiveChannel(&b, channels[c]);
+        strcat(newHeader, ",");
+        strcat(newHeader, channels[c]);
+      }
+    } else {
+      numColumns = b.numChannels;
+      for (int c = 0; c < b.numChannels; c++) {
+        column[c] = c;
+        if (strlen(newHeader) + strlen(b.names[c]) + 2 < sizeof(newHeader)) {
+          strcat(newHeader, ",");
+          strcat(newHeader, b.names[c]);
+        }
+      }
+    }
+    if (strcmp(newHeader, header) != 0) {
+      printf("%s\n", newHeader);
+      strcpy(header, newHeader);
+    }
+
+    for (int row = 0; row < b.numRows; row++) {
+      if ((b.t[row] < tFrom) || (b.t[row] > tTo))
+        continue;
+      formatTime(b.t[row], timeStr);
+      printf("%s", timeStr);
+      for (int c = 0; c < numColumns; c++) {
+        if (column[c] >= 0)
+          printf(",%.7g", b.values[column[c]*b.numRows + row]);
+        else
+          printf(","); //channel not recorded in this block
+      }
+      printf("\n");
+    }
+  }
+  archiveFreeBlock(&b);
+  return 0;
+}
+/*--------------------------------------------------------------*/
+int main(int argc, char *argv[]) {
+  const char *path = "LN2_archive.dat";
+  long long tFrom = -9223372036854775807LL, tTo = 9223372036854775807LL;
+  char *channels[MAX_QUERY_CHANNELS];
+  int numChannels = 0;
+  bool list = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:ls:e:c:h")) != -1) {
+    switch (opt) {
+      case 'f':
+        path = optarg;
+        break;
+      case 'l':
+        list = true;
+        break;
+      case 's':
+        if (parseTime(optarg, &tFrom) < 0)
+          return 1;
+        break;
+      case 'e':
+        if (parseTime(optarg, &tTo) < 0)
+          return 1;
+        break;
+      case 'c':
+        for (char *tok = strtok(optarg, ","); (tok != NULL) && (numChannels < MAX_QUERY_CHANNELS); tok = strtok(NULL, ","))
+          channels[numChannels++] = tok;
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+  ArchiveReader r;
+  if (archiveOpenReader(&r, path) < 0)
+    return 1;
+  int ret = list ? listArchive(&r) : printReadings(&r, tFrom, tTo, channels, numChannels);
+  archiveCloseReader(&r);
+  return ret;
+}
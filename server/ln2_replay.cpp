@@ -0,0 +1,697 @@
+//replays the recorded fills against other fill parameters
+//
+//  ./ln2_replay [-p parameters.dat] [-H history] [-T trace_dir] [-f recording]... [-s TIME] [-e TIME] [-n entry]
+//               [-t V,...] [-r N,...] [-m s,...] [-F V] [-j threads] [-v]
+//
+//Each fill in the fill history (see history.h) is replayed from the readings of its overflow sensor:
+//from its trace (see trace.h) if it has one, otherwise from the recordings given with -f (the local
+//archive, or tables written by the save command, as CSV or in the archive format).  The replay runs
+//the rule the server ends fills with (see fillrule.h), with the sensor health checks, on a virtual
+//clock stepping through the readings a second at a time, so a fill takes a few microseconds.  Past
+//the end of the recording (the replayed fill runs longer than the real one did) the sensor is taken
+//to stay at its last reading.
+//
+//The fills are replayed with every combination of the thresholds (-t), readings above them (-r) and
+//maximum filling times (-m) given, each defaulting to its value in parameters.dat; a list is
+//V,V,... or from:to:step.  The combinations are shared out between threads (one per core).
+//
+//A dewar is taken to be full once its sensor first read above -F volts (by default, the threshold in
+//parameters.dat).  Fills stopped before that were cut off early, and the LN2 they didn't get is
+//estimated from the rate the supply tank emptied at while the fill was recorded; fills stopped after
+//that spilled for as long, at the same rate.  For each combination the tool prints, as CSV, how the
+//fills would have ended, how many were cut off early and by how much, how much LN2 was spilled, and
+//how much longer (or shorter) the fills were than the recorded ones; with -v, the replay of each fill.
+#define _FILE_OFFSET_BITS 64
+#include "archive.h"
+#include "history.h"
+#include "trace.h"
+#include "fillrule.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define REPLAY_MAX_RECORDINGS 16
+#define REPLAY_MAX_VALUES 256      //values of each parameter in a grid
+#define REPLAY_MAX_THREADS 256
+#define REPLAY_BATCH 64            //replays a thread takes at once
+
+//a recording the readings of fills are looked up in
+typedef struct {
+  char path[256];
+  bool table;               //a CSV table, read whole into block
+  ArchiveReader reader;
+  ArchiveBlock block;       //the last block read (or the table)
+  int cached;               //index of the block read, -1 if none
+} Recording;
+
+//a fill, as recorded
+typedef struct {
+  char entry[HISTORY_NAME_LENGTH];
+  long long start;          //s since the epoch
+  int reason;               //HISTORY_THRESHOLD, ...
+  double duration;          //s
+  int numSteps;             //readings of the fill, one a second after the valves opened
+  float *steps;
+  unsigned char *fresh;     //whether each one is a new reading (the recording may have gaps)
+  double full;              //s after the start when the sensor first read above the full level, -1 if it never did
+  double flow;              //kg/s drawn from the supply tank while filling, 0 if unknown
+} ReplayFill;
+
+//outcome of one replay
+typedef struct {
+  float stop;               //s after the start
+  unsigned char reason;     //FILL_DONE, FILL_TIMEOUT or FILL_SENSOR
+  unsigned char pastEnd;    //stopped after the end of the recording
+} ReplayResult;
+
+static FillRule *rules;
+static int numRules;
+static ReplayFill *fills;
+static int numFills;
+static ReplayResult *results;
+static HealthConfig healthConfig;
+static long long nextReplay;
+
+/*--------------------------------------------------------------*/
+static void usage(void) {
+  printf("Usage: ln2_replay [-p parameters.dat] [-H history] [-T trace_dir] [-f recording]... [-s TIME] [-e TIME] [-n entry]\n");
+  printf("                  [-t V,...] [-r N,...] [-m s,...] [-F V] [-j threads] [-v]\n\n");
+  printf("  -p  server parameters, the defaults of the options below (default parameters.dat)\n");
+  printf("  -H  fill history (default fill_history)\n");
+  printf("  -T  directory of the fill traces (default trace_dir)\n");
+  printf("  -f  archive, or table saved with the save command, to read fills without a trace from (default archive_file)\n");
+  printf("  -s  replay the fills started from this time on (local time, YYYY-MM-DD HH:MM)\n");
+  printf("  -e  replay the fills started up to this time\n");
+  printf("  -n  replay the fills of this entry only\n");
+  printf("  -t  sensor thresholds (V) to replay the fills with (default sensor_threshold_V)\n");
+  printf("  -r  readings above the threshold to end a fill (default readings_before_fill_stop)\n");
+  printf("  -m  maximum filling times (s, default max_filling_time)\n");
+  printf("  -F  sensor reading (V) from which a dewar is taken to be full (default sensor_threshold_V)\n");
+  printf("  -j  threads (default: one per core)\n");
+  printf("  -v  print the replay of each fill instead of the totals\n\n");
+  printf("Lists are V,V,... or from:to:step.\n");
+}
+/*--------------------------------------------------------------*/
+//converts local time (YYYY-MM-DD HH:MM[:SS]) to s since the epoch
+static int parseTime(const char *str, long long *t) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  int n = sscanf(str, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+  if (n < 3) {
+    printf("ERROR: Invalid time (%s), expected YYYY-MM-DD HH:MM.\n", str);
+    return -1;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  *t = mktime(&tm);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+static void formatTime(long long t, char *str) {
+  time_t tt = (time_t)t;
+  struct tm local;
+  localtime_r(&tt, &local);
+  strftime(str, 32, "%Y-%m-%d %H:%M:%S", &local);
+}
+/*--------------------------------------------------------------*/
+//values of a list (V,V,... or from:to:step), returns their number, -1 if the list isn't valid
+static int parseList(const char *str, double *values) {
+  char buf[1024], *save, *tok;
+  int n = 0;
+
+  snprintf(buf, sizeof(buf), "%s", str);
+  for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    double from, to, step;
+    if (sscanf(tok, "%lf:%lf:%lf", &from, &to, &step) == 3) {
+      if ((step <= 0.0) || (to < from))
+        return -1;
+      for (int i = 0; from + i*step <= to + 1.0E-9*step; i++) {
+        if (n == REPLAY_MAX_VALUES)
+          return -1;
+        values[n++] = from + i*step;
+      }
+    } else if (sscanf(tok, "%lf", &from) == 1) {
+      if (n == REPLAY_MAX_VALUES)
+        return -1;
+      values[n++] = from;
+    } else {
+      return -1;
+    }
+  }
+  return n;
+}
+/*--------------------------------------------------------------*/
+/*Parameters-------------------------------------------------*/
+/*----------------------------------------------------------*/
+//the parameters of the fill rule and where the server keeps its files, from parameters.dat
+static void readParameters(const char *path, FillRule *rule, char *history, char *traceDir, char *archive) {
+  char line[512], name[256], value[256];
+
+  rule->threshold = 5.0;
+  rule->readings = 6;
+  rule->maxTime = 1500.0;
+  rule->sensorStop = true;
+  healthConfig.minV = -10.0; //the input range only matters to saturation, which doesn't stop fills
+  healthConfig.maxV = 10.0;
+  healthConfig.openV = 0.1;
+  healthConfig.faultReadings = 3;
+  healthConfig.frozenReadings = 20;
+  healthConfig.maxRate = 5.0;
+  strcpy(history, "LN2_fills.dat");
+  strcpy(traceDir, "traces");
+  strcpy(archive, "LN2_archive.dat");
+
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("WARNING: Could not open %s, replaying with the default parameters.\n", path);
+    return;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "%255[^[][%255[^]]]", name, value) != 2)
+      continue;
+    if (strcmp(name, "sensor_threshold_V") == 0)
+      rule->threshold = atof(value);
+    else if (strcmp(name, "readings_before_fill_stop") == 0)
+      rule->readings = atoi(value);
+    else if (strcmp(name, "max_filling_time") == 0)
+      rule->maxTime = atof(value);
+    else if (strcmp(name, "sensor_fault_action") == 0)
+      rule->sensorStop = (strcmp(value, "alert") != 0);
+    else if (strcmp(name, "sensor_open_V") == 0)
+      healthConfig.openV = atof(value);
+    else if (strcmp(name, "sensor_fault_readings") == 0)
+      healthConfig.faultReadings = atoi(value);
+    else if (strcmp(name, "sensor_frozen_readings") == 0)
+      healthConfig.frozenReadings = atoi(value);
+    else if (strcmp(name, "sensor_max_rate_V_s") == 0)
+      healthConfig.maxRate = atof(value);
+    else if (strcmp(name, "fill_history") == 0)
+      strcpy(history, value);
+    else if (strcmp(name, "trace_dir") == 0)
+      strcpy(traceDir, value);
+    else if (strcmp(name, "archive_file") == 0)
+      strcpy(archive, value);
+  }
+  fclose(fp);
+}
+/*--------------------------------------------------------------*/
+/*Recordings-------------------------------------------------*/
+/*----------------------------------------------------------*/
+//reads a CSV table written by the save command (time[,run_time],channel,...) into one block
+static int readTable(Recording *rec) {
+  char line[16384], *save, *tok;
+  int rows = 0;
+
+  FILE *fp = fopen(rec->path, "r");
+  if (fp == NULL) {
+    printf("ERROR: Could not open %s.\n", rec->path);
+    return -1;
+  }
+  if ((fgets(line, sizeof(line), fp) == NULL) || (strncmp(line, "time", 4) != 0)) {
+    printf("ERROR: %s is neither an archive nor a table saved by the server.\n", rec->path);
+    fclose(fp);
+    return -1;
+  }
+  ArchiveBlock *b = &rec->block;
+  int skip = (strncmp(line, "time,run_time", 13) == 0) ? 2 : 1; //columns before the channels
+  int column = 0;
+  b->numChannels = 0;
+  for (tok = strtok_r(line, ",\r\n", &save); tok != NULL; tok = strtok_r(NULL, ",\r\n", &save))
+    if ((column++ >= skip) && (b->numChannels < ARCHIVE_MAX_CHANNELS))
+      snprintf(b->names[b->numChannels++], ARCHIVE_NAME_LENGTH, "%s", tok);
+  while (fgets(line, sizeof(line), fp) != NULL)
+    rows++;
+
+  b->t = (long long *)malloc((rows + 1)*sizeof(long long));
+  b->values = (float *)malloc(((size_t)rows*b->numChannels + 1)*sizeof(float));
+  if ((b->t == NULL) || (b->values == NULL)) {
+    fclose(fp);
+    return -1;
+  }
+  rewind(fp);
+  fgets(line, sizeof(line), fp);
+  b->numRows = 0;
+  while ((b->numRows < rows) && (fgets(line, sizeof(line), fp) != NULL)) {
+    int row = b->numRows;
+    long long t;
+    column = 0;
+    for (tok = strtok_r(line, ",\r\n", &save); tok != NULL; tok = strtok_r(NULL, ",\r\n", &save), column++) {
+      if (column == 0) {
+        if (parseTime(tok, &t) < 0)
+          break;
+        b->t[row] = 1000LL*t;
+      } else if ((column >= skip) && (column - skip < b->numChannels)) {
+        b->values[(size_t)(column - skip)*rows + row] = (float)atof(tok);
+      }
+    }
+    if (column == skip + b->numChannels)
+      b->numRows++;
+  }
+  fclose(fp);
+  //the values are laid out as in a block of rows rows
+  if (b->numRows < rows)
+    for (int c = 1; c < b->numChannels; c++)
+      memmove(&b->values[(size_t)c*b->numRows], &b->values[(size_t)c*rows], b->numRows*sizeof(float));
+  rec->cached = 0;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+static int openRecording(Recording *rec, const char *path) {
+  char magic[4];
+
+  memset(rec, 0, sizeof(Recording));
+  snprintf(rec->path, sizeof(rec->path), "%s", path);
+  rec->cached = -1;
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    printf("ERROR: Could not open %s.\n", path);
+    return -1;
+  }
+  rec->table = (fread(magic, 4, 1, fp) != 1) || (memcmp(magic, "LN2A", 4) != 0);
+  fclose(fp);
+  if (rec->table)
+    return readTable(rec);
+  return archiveOpenReader(&rec->reader, path);
+}
+/*--------------------------------------------------------------*/
+static void closeRecording(Recording *rec) {
+  if (rec->table) {
+    free(rec->block.t);
+    free(rec->block.values);
+  } else {
+    archiveFreeBlock(&rec->block);
+    archiveCloseReader(&rec->reader);
+  }
+}
+/*--------------------------------------------------------------*/
+//readings of the sensor and the weight of a fill, gathered from the blocks of a recording
+typedef struct {
+  int n, size;
+  long long *t;             //ms since the epoch
+  float *sensor;
+  float *weight;            //0 if the weight wasn't recorded
+} Samples;
+
+static int addSamples(Samples *s, ArchiveBlock *b, const char *entry, long long tFrom, long long tTo) {
+  int sensor = archiveChannel(b, entry);
+  int weight = archiveChannel(b, "weight");
+
+  if (sensor < 0)
+    return 0;
+  for (int row = 0; row < b->numRows; row++) {
+    if ((b->t[row] < tFrom) || (b->t[row] > tTo))
+      continue;
+    if (s->n == s->size) {
+      s->size = (s->size > 0) ? 2*s->size : 1024;
+      s->t = (long long *)realloc(s->t, s->size*sizeof(long long));
+      s->sensor = (float *)realloc(s->sensor, s->size*sizeof(float));
+      s->weight = (float *)realloc(s->weight, s->size*sizeof(float));
+      if ((s->t == NULL) || (s->sensor == NULL) || (s->weight == NULL))
+        return -1;
+    }
+    s->t[s->n] = b->t[row];
+    s->sensor[s->n] = b->values[sensor*b->numRows + row];
+    s->weight[s->n] = (weight >= 0) ? b->values[weight*b->numRows + row] : 0.0f;
+    s->n++;
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//readings of the entry between tFrom and tTo (ms) in a recording
+static int findSamples(Recording *rec, Samples *s, const char *entry, long long tFrom, long long tTo) {
+  s->n = 0;
+  if (rec->table)
+    return addSamples(s, &rec->block, entry, tFrom, tTo);
+  for (int i = archiveFindBlock(&rec->reader, tFrom); (i < rec->reader.numBlocks) && (rec->reader.index[i].tFirst <= tTo); i++) {
+    if (rec->cached != i) {
+      rec->cached = -1;
+      if (archiveReadBlock(&rec->reader, i, &rec->block) < 0)
+        continue;
+      rec->cached = i;
+    }
+    if (addSamples(s, &rec->block, entry, tFrom, tTo) < 0)
+      return -1;
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//readings of a fill's trace
+static int traceSamples(Samples *s, const char *traceDir, HistoryRecord *r) {
+  char path[512];
+  ArchiveReader reader;
+  ArchiveBlock b;
+
+  s->n = 0;
+  tracePath(path, sizeof(path), traceDir, r->entry, (time_t)r->start);
+  if (access(path, R_OK) != 0)
+    return 0;
+  if (archiveOpenReader(&reader, path) < 0)
+    return 0;
+  memset(&b, 0, sizeof(b));
+  for (int i = 0; i < reader.numBlocks; i++)
+    if (archiveReadBlock(&reader, i, &b) > 0)
+      addSamples(s, &b, "sensor", -9223372036854775807LL, 9223372036854775807LL);
+  archiveFreeBlock(&b);
+  archiveCloseReader(&reader);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//the readings the fill would have taken from t0 (ms), one a second, and when the dewar was full
+static int fillSteps(ReplayFill *f, Samples *s, long long t0, long long tEnd, double fullV) {
+  f->numSteps = (int)((tEnd - t0)/1000);
+  if ((s->n == 0) || (f->numSteps <= 0))
+    return 0;
+  f->steps = (float *)malloc(f->numSteps*sizeof(float));
+  f->fresh = (unsigned char *)malloc(f->numSteps);
+  if ((f->steps == NULL) || (f->fresh == NULL))
+    return -1;
+  int i = 0, last = -1;
+  for (int k = 0; k < f->numSteps; k++) {
+    long long tk = t0 + 1000LL*(k + 1);
+    while ((i + 1 < s->n) && (s->t[i + 1] <= tk))
+      i++;
+    f->steps[k] = s->sensor[i];
+    f->fresh[k] = (i != last);
+    last = i;
+  }
+
+  f->full = -1.0;
+  for (i = 0; i < s->n; i++) {
+    if (s->sensor[i] > fullV) {
+      f->full = (s->t[i] - t0)/1000.0;
+      break;
+    }
+  }
+  f->flow = 0.0;
+  if ((s->n > 1) && (s->t[s->n - 1] > s->t[0]) && (s->weight[0] > s->weight[s->n - 1]))
+    f->flow = (s->weight[0] - s->weight[s->n - 1])/((s->t[s->n - 1] - s->t[0])/1000.0);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//the fills of the history started between tFrom and tTo (of the entry, unless it's empty), with their readings;
+//returns the number of fills without readings
+static int loadFills(const char *historyPath, const char *traceDir, Recording *recs, int numRecs, long long tFrom,
+                     long long tTo, const char *entry, double fullV) {
+  HistoryRecord r;
+  Samples s;
+  int size = 0, missing = 0;
+
+  FILE *fp = fopen(historyPath, "rb");
+  if (fp == NULL) {
+    printf("ERROR: Could not open the fill history %s.\n", historyPath);
+    return -1;
+  }
+  memset(&s, 0, sizeof(s));
+  while ((fread(&r, sizeof(r), 1, fp) == 1) && historyValid(&r)) {
+    r.entry[HISTORY_NAME_LENGTH - 1] = '\0';
+    if ((r.start < tFrom) || (r.start > tTo) || (r.duration <= 0.0f) || ((entry[0] != '\0') && (strcmp(r.entry, entry) != 0)))
+      continue;
+    if (numFills == size) {
+      size = (size > 0) ? 2*size : 256;
+      fills = (ReplayFill *)realloc(fills, size*sizeof(ReplayFill));
+      if (fills == NULL)
+        return -1;
+    }
+    ReplayFill *f = &fills[numFills];
+    memset(f, 0, sizeof(ReplayFill));
+    strcpy(f->entry, r.entry);
+    f->start = r.start;
+    f->reason = r.reason;
+    f->duration = r.duration;
+
+    //from its trace, which starts as the valves open, or from the readings taken during the fill
+    int found = 0;
+    if ((r.flags & HISTORY_TRACE) && (strcmp(traceDir, "off") != 0) && (traceSamples(&s, traceDir, &r) > 0) && (s.n > 0))
+      found = fillSteps(f, &s, s.t[0], s.t[s.n - 1], fullV);
+    for (int i = 0; (i < numRecs) && (found == 0); i++) {
+      long long t0 = 1000LL*r.start, tEnd = t0 + (long long)(1000.0*r.duration);
+      if (findSamples(&recs[i], &s, r.entry, t0, tEnd) < 0)
+        return -1;
+      found = fillSteps(f, &s, t0, tEnd, fullV);
+    }
+    if (found < 0)
+      return -1;
+    if (found == 0)
+      missing++;
+    else
+      numFills++;
+  }
+  fclose(fp);
+  free(s.t);
+  free(s.sensor);
+  free(s.weight);
+  return missing;
+}
+/*--------------------------------------------------------------*/
+/*Replay-----------------------------------------------------*/
+/*----------------------------------------------------------*/
+//runs the fill rule over the readings, on a virtual clock stepping a second at a time
+static void replayFill(const FillRule *rule, const ReplayFill *f, ReplayResult *res) {
+  ChannelHealth h;
+  int above = 0, step = FILL_RUNNING, k;
+  float reading = f->steps[0];
+
+  healthInit(&h, f->entry, true);
+  for (k = 1; step == FILL_RUNNING; k++) {
+    if (k <= f->numSteps) {
+      reading = f->steps[k - 1];
+      if (f->fresh[k - 1])
+        healthUpdate(&h, &healthConfig, k, reading);
+    }
+    step = fillStep(rule, &above, k, reading, h.flags);
+  }
+  res->stop = k - 1;
+  res->reason = step;
+  res->pastEnd = (k - 1 > f->numSteps);
+}
+/*--------------------------------------------------------------*/
+//replays every fill with every rule, threads take REPLAY_BATCH of them at a time
+static void *replayThread(void *arg) {
+  long long total = (long long)numRules*numFills;
+  for (;;) {
+    long long first = __sync_fetch_and_add(&nextReplay, (long long)REPLAY_BATCH);
+    if (first >= total)
+      break;
+    for (long long i = first; (i < first + REPLAY_BATCH) && (i < total); i++)
+      replayFill(&rules[i / numFills], &fills[i % numFills], &results[i]);
+  }
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+static int runReplays(int numThreads) {
+  pthread_t threads[REPLAY_MAX_THREADS];
+  int started = 0;
+
+  results = (ReplayResult *)malloc(((size_t)numRules*numFills + 1)*sizeof(ReplayResult));
+  if (results == NULL) {
+    printf("ERROR: Not enough memory for %i replays.\n", numRules*numFills);
+    return -1;
+  }
+  nextReplay = 0;
+  for (int i = 1; i < numThreads; i++)
+    if (pthread_create(&threads[started], NULL, replayThread, NULL) == 0)
+      started++;
+  replayThread(NULL);
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  return started + 1;
+}
+/*--------------------------------------------------------------*/
+/*Results----------------------------------------------------*/
+/*----------------------------------------------------------*/
+//LN2 spilled (> 0), or not delivered by a fill stopped early (< 0), in kg, and the same in s
+static double spill(const ReplayFill *f, const ReplayResult *res, double *seconds) {
+  *seconds = (f->full >= 0.0) ? res->stop - f->full : 0.0;
+  return *seconds*f->flow;
+}
+/*--------------------------------------------------------------*/
+static void printFills(void) {
+  static const char *recorded[] = {"threshold", "timeout", "stopped", "sensor"};
+  static const char *replayed[] = {"running", "threshold", "timeout", "sensor"};
+  char start[32];
+
+  printf("threshold_V,readings,max_time_s,entry,start,recorded_s,recorded,full_s,stop_s,stop,past_recording,spill_s,spill_kg\n");
+  for (int i = 0; i < numRules; i++) {
+    for (int j = 0; j < numFills; j++) {
+      const ReplayFill *f = &fills[j];
+      const ReplayResult *res = &results[(size_t)i*numFills + j];
+      double seconds, kg = spill(f, res, &seconds);
+      formatTime(f->start, start);
+      printf("%g,%i,%g,%s,%s,%.0f,%s,", rules[i].threshold, rules[i].readings, rules[i].maxTime, f->entry, start,
+             f->duration, ((f->reason >= 0) && (f->reason <= HISTORY_SENSOR)) ? recorded[f->reason] : "?");
+      if (f->full >= 0.0)
+        printf("%.1f,%.0f,%s,%i,%.1f,%.3f\n", f->full, res->stop, replayed[res->reason], res->pastEnd, seconds, kg);
+      else
+        printf(",%.0f,%s,%i,,\n", res->stop, replayed[res->reason], res->pastEnd);
+    }
+  }
+}
+/*--------------------------------------------------------------*/
+//totals of each rule over the fills
+static void printTotals(void) {
+  printf("threshold_V,readings,max_time_s,fills,done,timeouts,sensor_stops,past_recording,early_cutoffs,early_kg,spills,spill_s,spill_kg,change_s\n");
+  for (int i = 0; i < numRules; i++) {
+    int ended[4] = {0, 0, 0, 0}, pastEnd = 0, early = 0, spills = 0;
+    double earlyKg = 0.0, spillS = 0.0, spillKg = 0.0, change = 0.0;
+    for (int j = 0; j < numFills; j++) {
+      const ReplayFill *f = &fills[j];
+      const ReplayResult *res = &results[(size_t)i*numFills + j];
+      double seconds, kg = spill(f, res, &seconds);
+      ended[res->reason]++;
+      pastEnd += res->pastEnd;
+      change += res->stop - f->duration;
+      if (f->full < 0.0)
+        continue; //never full while recorded
+      if (seconds < 0.0) {
+        early++;
+        earlyKg -= kg;
+      } else {
+        spills++;
+        spillS += seconds;
+        spillKg += kg;
+      }
+    }
+    printf("%g,%i,%g,%i,%i,%i,%i,%i,%i,%.2f,%i,%.1f,%.2f,%.1f\n", rules[i].threshold, rules[i].readings, rules[i].maxTime,
+           numFills, ended[FILL_DONE], ended[FILL_TIMEOUT], ended[FILL_SENSOR], pastEnd, early, earlyKg, spills,
+           (spills > 0) ? spillS/spills : 0.0, spillKg, (numFills > 0) ? change/numFills : 0.0);
+  }
+}
+/*--------------------------------------------------------------*/
+int main(int argc, char *argv[]) {
+  const char *paramPath = "parameters.dat";
+  char historyPath[256], traceDir[256], archivePath[256];
+  const char *historyOpt = NULL, *traceOpt = NULL;
+  const char *recPaths[REPLAY_MAX_RECORDINGS];
+  const char *lists[3] = {NULL, NULL, NULL};
+  int numRecs = 0;
+  int numThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  double fullV = -1.0;
+  bool verbose = false;
+  long long tFrom = -9223372036854775807LL, tTo = 9223372036854775807LL;
+  const char *entry = "";
+  FillRule base;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p:H:T:f:s:e:n:t:r:m:F:j:vh")) != -1) {
+    switch (opt) {
+      case 'p':
+        paramPath = optarg;
+        break;
+      case 'H':
+        historyOpt = optarg;
+        break;
+      case 'T':
+        traceOpt = optarg;
+        break;
+      case 'f':
+        if (numRecs < REPLAY_MAX_RECORDINGS)
+          recPaths[numRecs++] = optarg;
+        break;
+      case 's':
+        if (parseTime(optarg, &tFrom) < 0)
+          return 1;
+        break;
+      case 'e':
+        if (parseTime(optarg, &tTo) < 0)
+          return 1;
+        break;
+      case 'n':
+        entry = optarg;
+        break;
+      case 't':
+        lists[0] = optarg;
+        break;
+      case 'r':
+        lists[1] = optarg;
+        break;
+      case 'm':
+        lists[2] = optarg;
+        break;
+      case 'F':
+        fullV = atof(optarg);
+        break;
+      case 'j':
+        numThreads = atoi(optarg);
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (numThreads < 1)
+    numThreads = 1;
+  if (numThreads > REPLAY_MAX_THREADS)
+    numThreads = REPLAY_MAX_THREADS;
+
+  //the grid of rules, each parameter defaulting to the one the server runs with
+  readParameters(paramPath, &base, historyPath, traceDir, archivePath);
+  double values[3][REPLAY_MAX_VALUES];
+  int numValues[3];
+  values[0][0] = base.threshold;
+  values[1][0] = base.readings;
+  values[2][0] = base.maxTime;
+  for (int i = 0; i < 3; i++) {
+    numValues[i] = (lists[i] != NULL) ? parseList(lists[i], values[i]) : 1;
+    if (numValues[i] <= 0) {
+      printf("ERROR: Invalid list of values (%s).\n", lists[i]);
+      return 1;
+    }
+  }
+  numRules = numValues[0]*numValues[1]*numValues[2];
+  rules = (FillRule *)malloc(numRules*sizeof(FillRule));
+  for (int i = 0; i < numRules; i++) {
+    rules[i] = base;
+    rules[i].threshold = values[0][i / (numValues[1]*numValues[2])];
+    rules[i].readings = (int)values[1][(i / numValues[2]) % numValues[1]];
+    rules[i].maxTime = values[2][i % numValues[2]];
+  }
+  if (fullV < 0.0)
+    fullV = base.threshold;
+
+  //the recorded fills
+  Recording *recs = (Recording *)malloc(REPLAY_MAX_RECORDINGS*sizeof(Recording));
+  if ((numRecs == 0) && (strcmp(archivePath, "off") != 0) && (access(archivePath, R_OK) == 0))
+    recPaths[numRecs++] = archivePath;
+  int opened = 0;
+  for (int i = 0; i < numRecs; i++)
+    if (openRecording(&recs[opened], recPaths[i]) > 0)
+      opened++;
+  struct timespec t0, t1, t2;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  int missing = loadFills((historyOpt != NULL) ? historyOpt : historyPath, (traceOpt != NULL) ? traceOpt : traceDir,
+                          recs, opened, tFrom, tTo, entry, fullV);
+  for (int i = 0; i < opened; i++)
+    closeRecording(&recs[i]);
+  free(recs);
+  if (missing < 0)
+    return 1;
+  if (numFills == 0) {
+    printf("No fills to replay (%i without readings).\n", missing);
+    return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  int threads = runReplays(numThreads);
+  if (threads < 0)
+    return 1;
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+
+  if (verbose)
+    printFills();
+  else
+    printTotals();
+  char first[32], last[32];
+  formatTime(fills[0].start, first);
+  formatTime(fills[numFills - 1].start, last);
+  printf("\n%i fills from %s to %s (%i more without readings) loaded in %.2f s, full above %g V.\n", numFills, first, last,
+         missing, (t1.tv_sec - t0.tv_sec) + 1.0E-9*(t1.tv_nsec - t0.tv_nsec), fullV);
+  printf("%i replays with %i sets of parameters on %i threads in %.3f s.\n", numRules*numFills, numRules, threads,
+         (t2.tv_sec - t1.tv_sec) + 1.0E-9*(t2.tv_nsec - t1.tv_nsec));
+  return 0;
+}
@@ -0,0 +1,248 @@
+#include "LN2_server.h"
+#include "metrics.h"
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define METRICS_BUF_SIZE 65536
+#define METRICS_TIMEOUT 2          //s a scraper is given to send its request and take the reply
+#define METRICS_ACCEPT_BACKOFF 100 //ms to wait after accept() fails (eg. out of file descriptors)
+
+ServerMetrics metrics;
+
+//histogram bucket boundaries (s) used for all histograms
+static const double metricsBounds[] = {1.0E-5, 2.5E-5, 5.0E-5, 1.0E-4, 2.5E-4, 5.0E-4, 1.0E-3, 2.5E-3, 5.0E-3,
+                                       1.0E-2, 2.5E-2, 5.0E-2, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0,
+                                       30.0, 60.0, 120.0, 300.0, 600.0, 1200.0, 1800.0};
+static const int numMetricsBounds = sizeof(metricsBounds)/sizeof(metricsBounds[0]);
+
+typedef struct {
+  char *buf;
+  int len;
+  int used;
+} MetricsText;
+
+/*--------------------------------------------------------------*/
+void initMetrics(void) {
+  memset((void *)&metrics, 0, sizeof(metrics));
+  latencyInit(&metrics.fillDuration, "fill");
+  metrics.tankSecondsToEmpty = -1;
+}
+/*--------------------------------------------------------------*/
+static void append(MetricsText *t, const char *fmt, ...) {
+  va_list ap;
+  if (t->used < 0)
+    return;
+  va_start(ap, fmt);
+  int n = vsnprintf(t->buf + t->used, t->len - t->used, fmt, ap);
+  va_end(ap);
+  if ((n < 0) || (n >= t->len - t->used))
+    t->used = -1; //out of space
+  else
+    t->used += n;
+}
+/*--------------------------------------------------------------*/
+static void counter(MetricsText *t, const char *name, const char *help, volatile unsigned long long *value) {
+  append(t, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, latencyLoad(value));
+}
+/*--------------------------------------------------------------*/
+static void gauge(MetricsText *t, const char *name, const char *help, double value) {
+  append(t, "# HELP %s %s\n# TYPE %s gauge\n%s %.10g\n", name, help, name, name, value);
+}
+/*--------------------------------------------------------------*/
+//writes one latency histogram (recorded in ns) as a Prometheus histogram in seconds.
+//The log-linear buckets don't line up exactly with the boundaries above, each of
+//them is counted under the first boundary its upper end fits in (within ~6%).
+static void histogram(MetricsText *t, const char *name, const char *labels, LatencyHist *h) {
+  unsigned long long counts[LAT_NUM_BUCKETS];
+  unsigned long long total = 0;
+  for (int i = 0; i < LAT_NUM_BUCKETS; i++) {
+    counts[i] = latencyLoad(&h->buckets[i]);
+    total += counts[i];
+  }
+
+  int b = 0;
+  unsigned long long cumulative = 0;
+  for (int j = 0; j < numMetricsBounds; j++) {
+    double bound = metricsBounds[j]*1.0E9;
+    while ((b < LAT_NUM_BUCKETS) && (latencyBucketValue(b) <= bound))
+      cumulative += counts[b++];
+    append(t, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels, labels[0] ? "," : "", metricsBounds[j], cumulative);
+  }
+  append(t, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, labels[0] ? "," : "", total);
+  if (labels[0]) {
+    append(t, "%s_sum{%s} %.9f\n", name, labels, 1.0E-9*latencyLoad(&h->sum));
+    append(t, "%s_count{%s} %llu\n", name, labels, total);
+  } else {
+    append(t, "%s_sum %.9f\n", name, 1.0E-9*latencyLoad(&h->sum));
+    append(t, "%s_count %llu\n", name, total);
+  }
+}
+/*--------------------------------------------------------------*/
+int renderMetrics(char *buf, int len) {
+  MetricsText t;
+  t.buf = buf;
+  t.len = len;
+  t.used = 0;
+
+  counter(&t, "ln2_commands_total", "Commands received from LN2_master.", &metrics.commands);
+  counter(&t, "ln2_daq_errors_total", "DAQ writes and reads which failed.", &metrics.daqErrors);
+  counter(&t, "ln2_influx_posts_total", "Readings sent to InfluxDB.", &metrics.posts);
+  counter(&t, "ln2_influx_post_failures_total", "Readings which could not be sent to InfluxDB.", &metrics.postFailures);
+  counter(&t, "ln2_telemetry_dropped_total", "Readings not sent to InfluxDB or not archived because the thread doing it fell behind.", &metrics.telemetryDropped);
+  counter(&t, "ln2_influx_udp_datagrams_total", "UDP datagrams sent to InfluxDB.", &metrics.udpDatagrams);
+  counter(&t, "ln2_influx_udp_send_failures_total", "UDP datagrams which could not be sent to InfluxDB.", &metrics.udpSendFailures);
+  counter(&t, "ln2_fills_started_total", "Fills started.", &metrics.fillsStarted);
+  counter(&t, "ln2_fills_completed_total", "Fills finished because the overflow sensor reached the threshold.", &metrics.fillsCompleted);
+  counter(&t, "ln2_fills_stopped_total", "Fills stopped by the user or by the maximum fill time.", &metrics.fillsStopped);
+  counter(&t, "ln2_cycle_overruns_total", "Main loop cycles whose work took longer than the polling time.", &cycleOverruns);
+  counter(&t, "ln2_fill_overruns_total", "Fill loop passes whose work took longer than 1 s.", &fillOverruns);
+  counter(&t, "ln2_alerts_sent_total", "Alerts sent to every sink.", &metrics.alertsSent);
+  counter(&t, "ln2_alerts_suppressed_total", "Alerts not sent because one with the same key was sent recently.", &metrics.alertsSuppressed);
+  counter(&t, "ln2_alerts_dropped_total", "Alerts dropped because the queue was full.", &metrics.alertsDropped);
+  counter(&t, "ln2_alert_failures_total", "Alerts which a sink couldn't send.", &metrics.alertFailures);
+  counter(&t, "ln2_sensor_faults_total", "Times a channel was found open, saturated, frozen or erratic.", &metrics.sensorFaults);
+  counter(&t, "ln2_tank_swaps_total", "Supply tank swaps detected from the scale readings.", &metrics.tankSwaps);
+  counter(&t, "ln2_metrics_scrapes_total", "Requests served by the metrics endpoint.", &metrics.scrapes);
+
+  gauge(&t, "ln2_running", "1 while a run is in progress.", signaled.RUNNING ? 1.0 : 0.0);
+  gauge(&t, "ln2_filling", "1 while a fill is in progress.", signaled.FILLING ? 1.0 : 0.0);
+  gauge(&t, "ln2_command_queue_depth", "Commands waiting for the control loop.", ringCount(&commandQueue));
+  gauge(&t, "ln2_control_clients", "Clients connected to the control socket.", ctlClients());
+  gauge(&t, "ln2_tank_weight_kg", "Last scale reading.", 1.0E-3*__sync_fetch_and_add(&metrics.weightGrams, 0LL));
+  gauge(&t, "ln2_tank_level_kg", "Estimated supply tank level.", 1.0E-3*__sync_fetch_and_add(&metrics.tankLevelGrams, 0LL));
+  gauge(&t, "ln2_tank_boiloff_kg_per_hour", "Estimated supply tank boil-off.", 1.0E-3*__sync_fetch_and_add(&metrics.tankBoiloffGramsPerHour, 0LL));
+  long long toEmpty = __sync_fetch_and_add(&metrics.tankSecondsToEmpty, 0LL);
+  gauge(&t, "ln2_tank_hours_to_empty", "Hours until the supply tank is expected to reach the refill weight (-1 if not known or more than a week).",
+        (toEmpty >= 0) ? toEmpty/3600.0 : -1.0);
+
+  unsigned long long valves = openValveMask;
+  int numValves = getCapabilities()->numDigitalLines;
+  if (numValves > MAXVALVES)
+    numValves = MAXVALVES;
+  append(&t, "# HELP ln2_valve_open 1 if the valve is held open by the fill cycle.\n# TYPE ln2_valve_open gauge\n");
+  for (int v = 0; v < numValves; v++)
+    append(&t, "ln2_valve_open{valve=\"%i\"} %i\n", v, (int)((valves >> v) & 1));
+
+  append(&t, "# HELP ln2_sensor_health Problems found with each channel read every cycle (1=open, 2=saturated, 4=frozen, 8=erratic, 0=none).\n# TYPE ln2_sensor_health gauge\n");
+  for (int i = 0; i < numHealthChannels; i++)
+    append(&t, "ln2_sensor_health{channel=\"%s\"} %i\n", channelHealth[i].name, channelHealth[i].flags);
+
+  append(&t, "# HELP ln2_fill_duration_seconds Duration of fills (server clock time).\n# TYPE ln2_fill_duration_seconds histogram\n");
+  histogram(&t, "ln2_fill_duration_seconds", "", &metrics.fillDuration);
+
+  append(&t, "# HELP ln2_stage_duration_seconds Time spent in each stage of the server cycle.\n# TYPE ln2_stage_duration_seconds histogram\n");
+  for (int i = 0; i < NUM_STAGES; i++) {
+    char labels[64];
+    sprintf(labels, "stage=\"%s\"", stageHist[i].name);
+    histogram(&t, "ln2_stage_duration_seconds", labels, &stageHist[i]);
+  }
+
+  return t.used;
+}
+/*--------------------------------------------------------------*/
+static void sendAll(int sock, const char *data, int len) {
+  while (len > 0) {
+    int n = send(sock, data, len, MSG_NOSIGNAL);
+    if (n <= 0)
+      return;
+    data += n;
+    len -= n;
+  }
+}
+/*--------------------------------------------------------------*/
+//answers one request at a time, scrapes are infrequent and the output is small
+static void *metricsServer(void *arg) {
+  int listenSock = *(int *)arg;
+  static char body[METRICS_BUF_SIZE];
+  char request[1024], header[256];
+  struct timeval timeout;
+
+  for (;;) {
+    int sock = accept(listenSock, NULL, NULL);
+    if (sock < 0) {
+      //errors such as EMFILE don't clear by themselves, so don't spin on them
+      if (errno != EINTR)
+        usleep(METRICS_ACCEPT_BACKOFF * 1000);
+      continue;
+    }
+    //a client which connects and sends nothing mustn't hold up the next scrape
+    timeout.tv_sec = METRICS_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    //only the request line is needed
+    int used = 0;
+    while (used < (int)sizeof(request) - 1) {
+      int r = recv(sock, request + used, sizeof(request) - 1 - used, 0);
+      if (r <= 0)
+        break;
+      used += r;
+      request[used] = '\0';
+      if (strstr(request, "\r\n") != NULL)
+        break;
+    }
+    request[used] = '\0';
+
+    if ((strncmp(request, "GET /metrics ", 13) == 0) || (strncmp(request, "GET / ", 6) == 0)) {
+      metricsAdd(&metrics.scrapes);
+      int len = renderMetrics(body, sizeof(body));
+      if (len < 0) {
+        const char *response = "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+        sendAll(sock, response, strlen(response));
+      } else {
+        int n = sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %i\r\n\r\n", len);
+        sendAll(sock, header, n);
+        sendAll(sock, body, len);
+      }
+    } else {
+      const char *response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+      sendAll(sock, response, strlen(response));
+    }
+    close(sock);
+  }
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+//starts the listener on 127.0.0.1:port in a background thread (port 0 disables it)
+int startMetricsServer(int port) {
+  static int listenSock;
+  struct sockaddr_in addr;
+  pthread_t thread;
+  int yes = 1;
+
+  if (port <= 0)
+    return 0;
+
+  listenSock = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenSock < 0) {
+    printf("ERROR: Could not create the metrics socket.\n");
+    return -1;
+  }
+  setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+  addr.sin_port = htons(port);
+  if ((bind(listenSock, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(listenSock, 8) < 0)) {
+    printf("ERROR: Could not listen for metrics requests on port %i.\n", port);
+    close(listenSock);
+    return -1;
+  }
+  if (pthread_create(&thread, NULL, metricsServer, &listenSock) != 0) {
+    printf("ERROR: Could not start the metrics thread.\n");
+    close(listenSock);
+    return -1;
+  }
+  pthread_detach(thread);
+
+  printf("Serving metrics on http://127.0.0.1:%i/metrics\n", port);
+  return 1;
+}
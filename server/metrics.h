@@ -0,0 +1,48 @@
+//counters describing the health of the server, and a small HTTP listener serving
+//them (together with the latency histograms and current state) in the Prometheus
+//text format on http://127.0.0.1:<metrics_port>/metrics
+//
+//All counters are updated with atomic adds from the server threads, and the listener
+//only ever reads them, so scraping never blocks or slows down the server.
+
+#ifndef __METRICS
+#define __METRICS
+
+#include "latency.h"
+
+typedef struct {
+  volatile unsigned long long commands;        //commands received from LN2_master
+  volatile unsigned long long daqErrors;       //failed DAQ writes/reads
+  volatile unsigned long long posts;           //readings sent to InfluxDB
+  volatile unsigned long long postFailures;    //readings InfluxDB didn't accept
+  volatile unsigned long long telemetryDropped; //readings not sent or archived because a telemetry thread fell behind
+  volatile unsigned long long udpDatagrams;    //UDP datagrams sent to InfluxDB
+  volatile unsigned long long udpSendFailures; //UDP datagrams which couldn't be sent
+  volatile unsigned long long fillsStarted;
+  volatile unsigned long long fillsCompleted;  //fills stopped by the overflow sensor
+  volatile unsigned long long fillsStopped;    //fills stopped by the user or the maximum fill time
+  volatile unsigned long long scrapes;         //requests served by the metrics listener
+  volatile long long weightGrams;              //last scale reading
+  volatile long long tankLevelGrams;           //estimated supply tank level
+  volatile long long tankBoiloffGramsPerHour;
+  volatile long long tankSecondsToEmpty;       //until the tank reaches the refill weight, -1 if not known
+  volatile unsigned long long tankSwaps;
+  volatile unsigned long long alertsSent;
+  volatile unsigned long long alertsSuppressed;  //by the rate limit
+  volatile unsigned long long alertsDropped;     //queue full
+  volatile unsigned long long alertFailures;     //alerts which a sink couldn't send
+  volatile unsigned long long sensorFaults;      //channels found open, saturated, frozen or erratic (see health.h)
+  LatencyHist fillDuration;                    //fill durations (ns of server clock time)
+} ServerMetrics;
+
+extern ServerMetrics metrics;
+
+static inline void metricsAdd(volatile unsigned long long *counter) {
+  __sync_fetch_and_add(counter, 1ULL);
+}
+
+void initMetrics(void);
+int startMetricsServer(int port);
+int renderMetrics(char *buf, int len); //returns the length of the text, or -1 if buf is too small
+
+#endif
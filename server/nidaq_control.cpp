@@ -1,189 +1,493 @@
+//code for controlling the NIDAQmx based system used for GEARBOX
 #include "nidaq_control.h"
 
+DAQ_DRIVER_EXPORT(NIDAQDriver)
+
 /*------------------------------------------------------------*/
 /*Functions controlling the DAQ------------------------------*/
 /*----------------------------------------------------------*/
-int chanOn(int* chan, int numChans) {
+NIDAQDriver::NIDAQDriver(void) {
+  numDevices = 0;
+  numValves = 0;
+  numInputs = 0;
+  for (int i = 0; i < NIDAQ_MAX_CHANNELS; i++) {
+    valves[i].device = -1;
+    inputs[i].device = -1;
+  }
+  streamTask = 0;
+  numStreamChans = 0;
+  streamData = NULL;
+  streamDataSize = 0;
+}
+/*--------------------------------------------------------------*/
+//config is the channel map (eg. daq_channels.dat), without one the valves are
+//Dev1/port0/line0:7 and the inputs Dev1/ai0:7
+int NIDAQDriver::open(const char *config) {
+  if ((config == NULL) || (config[0] == '\0'))
+    defaultMap();
+  else if (readMap(config) < 0)
+    return -1;
+
+  if (createTasks() < 0) {
+    clearTasks();
+    return -1;
+  }
+  for (int d = 0; d < numDevices; d++) {
+    printf("NIDAQ device %s: ports", devices[d].name);
+    for (int p = 0; p < devices[d].numPorts; p++)
+      printf(" %i", devices[d].port[p]);
+    printf(", %i analog inputs.\n", devices[d].numInputs);
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void NIDAQDriver::close(void) {
+  if (streamTask != 0)
+    stopStream();
+  clearTasks();
+}
+/*--------------------------------------------------------------*/
+void NIDAQDriver::capabilities(DAQCapabilities *caps) {
+  memset(caps, 0, sizeof(DAQCapabilities));
+  caps->flags = DAQ_CAP_DIGITAL_OUT | DAQ_CAP_ANALOG_IN | DAQ_CAP_STREAMING;
+  caps->numDigitalLines = numValves;
+  caps->numAnalogInputs = numInputs;
+  caps->minVoltage = -10.0;
+  caps->maxVoltage = 10.0;
+  caps->maxStreamRate = 10000.0;
+  strcpy(caps->description, "NIDAQmx Base (");
+  for (int d = 0; d < numDevices; d++) {
+    if (strlen(caps->description) + strlen(devices[d].name) + 3 >= sizeof(caps->description))
+      break;
+    if (d > 0)
+      strcat(caps->description, ", ");
+    strcat(caps->description, devices[d].name);
+  }
+  strcat(caps->description, ")");
+}
+/*--------------------------------------------------------------*/
+//index of the named device in devices[], adding it if it isn't there yet
+int NIDAQDriver::findDevice(const char *name) {
+  for (int d = 0; d < numDevices; d++)
+    if (strcmp(devices[d].name, name) == 0)
+      return d;
+  if (numDevices >= NIDAQ_MAX_DEVICES) {
+    printf("ERROR: Maximum number of NIDAQ devices (%i) exceeded.\n", NIDAQ_MAX_DEVICES);
+    return -1;
+  }
+  NIDAQDevice *dev = &devices[numDevices];
+  memset(dev, 0, sizeof(NIDAQDevice));
+  strcpy(dev->name, name);
+  return numDevices++;
+}
+/*--------------------------------------------------------------*/
+//maps valve chan to an address of the form DevX/portP/lineL
+int NIDAQDriver::mapValve(int chan, const char *address) {
+  char name[32];
+  int port, line;
+
+  if ((sscanf(address, "%31[^/]/port%i/line%i", name, &port, &line) != 3) || (port < 0) || (line < 0) || (line > 31)) {
+    printf("ERROR: Invalid valve address '%s' (should be DevX/portP/lineL).\n", address);
+    return -1;
+  }
+  if ((chan < 0) || (chan >= NIDAQ_MAX_CHANNELS)) {
+    printf("ERROR: Valve %i is out of range (0 to %i).\n", chan, NIDAQ_MAX_CHANNELS - 1);
+    return -1;
+  }
+  if (valves[chan].device >= 0) {
+    printf("ERROR: Valve %i is mapped twice.\n", chan);
+    return -1;
+  }
+  int d = findDevice(name);
+  if (d < 0)
+    return -1;
+  NIDAQDevice *dev = &devices[d];
+  int p;
+  for (p = 0; p < dev->numPorts; p++)
+    if (dev->port[p] == port)
+      break;
+  //two valves on one line would open together
+  for (int i = 0; i < numValves; i++) {
+    if ((valves[i].device == d) && (valves[i].port == p) && (valves[i].line == line)) {
+      printf("ERROR: %s is mapped to both valve %i and valve %i.\n", address, i, chan);
+      return -1;
+    }
+  }
+  if (p == dev->numPorts) {
+    if (dev->numPorts >= NIDAQ_MAX_PORTS) {
+      printf("ERROR: Maximum number of ports (%i) used on %s exceeded.\n", NIDAQ_MAX_PORTS, name);
+      return -1;
+    }
+    dev->port[dev->numPorts++] = port;
+  }
 
-  int32 error = 0;
-  TaskHandle taskHandle = 0;
-  uInt32 data[1] = {0}; //all channels off by default
+  valves[chan].device = d;
+  valves[chan].port = p;
+  valves[chan].line = line;
+  if (chan >= numValves)
+    numValves = chan + 1;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//maps analog input chan to an address of the form DevX/aiN, terminal is rse, nrse, diff or default
+int NIDAQDriver::mapInput(int chan, const char *address, const char *terminal) {
+  char name[32];
+  int ai;
+
+  if ((sscanf(address, "%31[^/]/ai%i", name, &ai) != 2) || (ai < 0)) {
+    printf("ERROR: Invalid analog input address '%s' (should be DevX/aiN).\n", address);
+    return -1;
+  }
+  if ((chan < 0) || (chan >= NIDAQ_MAX_CHANNELS)) {
+    printf("ERROR: Analog input %i is out of range (0 to %i).\n", chan, NIDAQ_MAX_CHANNELS - 1);
+    return -1;
+  }
+  if (inputs[chan].device >= 0) {
+    printf("ERROR: Analog input %i is mapped twice.\n", chan);
+    return -1;
+  }
+  int config;
+  if ((terminal == NULL) || (strcmp(terminal, "default") == 0))
+    config = DAQmx_Val_Cfg_Default;
+  else if (strcmp(terminal, "rse") == 0)
+    config = DAQmx_Val_RSE;
+  else if (strcmp(terminal, "nrse") == 0)
+    config = DAQmx_Val_NRSE;
+  else if (strcmp(terminal, "diff") == 0)
+    config = DAQmx_Val_Diff;
+  else {
+    printf("ERROR: Invalid terminal configuration '%s' for analog input %i (should be rse, nrse, diff or default).\n", terminal, chan);
+    return -1;
+  }
+  int d = findDevice(name);
+  if (d < 0)
+    return -1;
+
+  NIDAQDevice *dev = &devices[d];
+  inputs[chan].device = d;
+  inputs[chan].port = dev->numInputs;
+  inputs[chan].line = ai;
+  inputs[chan].terminal = config;
+  dev->input[dev->numInputs++] = chan;
+  if (chan >= numInputs)
+    numInputs = chan + 1;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//the single DAQ the server was written for
+void NIDAQDriver::defaultMap(void) {
+  char address[64];
+  for (int i = 0; i < 8; i++) {
+    sprintf(address, "Dev1/port0/line%i", i);
+    mapValve(i, address);
+    //compensate for different default configuration of the two different channel banks on the DAQ (specific to the NI USB DAQ being used)
+    sprintf(address, "Dev1/ai%i", i);
+    mapInput(i, address, (i < 4) ? "rse" : "default");
+  }
+}
+/*--------------------------------------------------------------*/
+int NIDAQDriver::readMap(const char *filename) {
+  // Read the channel map from text file (eg. daq_channels.dat)
+  char *tok;
+  char str[256],parameter[256],value[256];
+  char *fields[3];
+  int ret = 1;
+
+  FILE *mapfile = fopen(filename, "r");
+  if(mapfile == NULL){
+    printf("ERROR: Could not open NIDAQ channel map %s.\n",filename);
+    return -1;
+  }
 
-  //turn on the specified channels
-  if(chan[0]<0){
-    printf("Invalid channel specified (%i), not taking any action.",chan[0]);
-    return 1;
-  }
-  data[0] = 1 << chan[0]; //turn on specfied channel, leave others off
-  printf("Turning on channel %i (NIDAQ).\n", chan[0]);
-  for(int i=1;i<numChans;i++){
-    if(chan[i]<0){
-      printf("Invalid channel specified (%i), not taking any action.",chan[i]);
-      return 1;
+  while(!(feof(mapfile)))//go until the end of file is reached
+    {
+      if(fgets(str,256,mapfile)!=NULL) //get an entire line
+        {
+          tok=strtok(str,"[");
+          if(tok!=NULL){
+            tok[strcspn(tok, "\r\n")] = 0;//strips newline characters from the string
+            strcpy(parameter,tok);
+            tok = strtok (NULL, "]");
+            if(tok!=NULL){
+              tok[strcspn(tok, "\r\n")] = 0;//strips newline characters from the string
+              strcpy(value,tok);
+              if((strcmp(parameter,"valve")==0)||(strcmp(parameter,"input")==0)){
+                //valve[N,DevX/portP/lineL] or input[N,DevX/aiN,terminal]
+                int numFields = 0;
+                for(tok=strtok(value,",");(tok!=NULL)&&(numFields<3);tok=strtok(NULL,","))
+                  fields[numFields++] = tok;
+                if(numFields < 2){
+                  printf("ERROR: Invalid channel '%s[%s]' in %s.\n",parameter,value,filename);
+                  ret = -1;
+                }else if(parameter[0] == 'v'){
+                  if(mapValve(atoi(fields[0]),fields[1]) < 0)
+                    ret = -1;
+                }else{
+                  if(mapInput(atoi(fields[0]),fields[1],(numFields > 2) ? fields[2] : NULL) < 0)
+                    ret = -1;
+                }
+              }
+            }
+          }
+        }
     }
-    printf("Turning on channel %i (NIDAQ).\n", chan[i]);
-    data[0] |= 1 << chan[i]; //turn on specified channel
+  fclose(mapfile);
+  if(ret < 0)
+    return -1;
+  if(numDevices == 0){
+    printf("ERROR: No channels found in the NIDAQ channel map %s.\n",filename);
+    return -1;
   }
 
+  printf("\nFile '%s' read sucessfully!\n",filename);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+//prints the details of the last DAQmx error
+static void printError(void) {
   char errBuff[2048] = {'\0'};
-
-  // DAQmx Configure Code
-  DAQmxErrChk(DAQmxBaseCreateTask("", &taskHandle));
-  DAQmxErrChk(DAQmxBaseCreateDOChan(taskHandle, "Dev1/port0", "", DAQmx_Val_ChanForAllLines));
-
-  // DAQmx Start Code
-  DAQmxErrChk(DAQmxBaseStartTask(taskHandle));
-
-  // DAQmx Write Code
-  DAQmxErrChk(DAQmxBaseWriteDigitalU32(taskHandle, 1, 1, 10.0, DAQmx_Val_GroupByChannel, data, NULL, NULL));
+  DAQmxBaseGetExtendedErrorInfo(errBuff, 2048);
+  printf("DAQmxBase Error: %s\n", errBuff);
+}
+/*--------------------------------------------------------------*/
+//sets up the tasks used for every write and read, so that they don't have to be
+//created (which takes much longer than the writes and reads themselves) each time
+int NIDAQDriver::createTasks(void) {
+  int32 error = 0;
+  char mchannel[256];
+
+  for (int d = 0; d < numDevices; d++) {
+    NIDAQDevice *dev = &devices[d];
+    for (int p = 0; p < dev->numPorts; p++) {
+      sprintf(mchannel, "%s/port%i", dev->name, dev->port[p]);
+      DAQmxErrChk(DAQmxBaseCreateTask("", &dev->portTask[p]));
+      DAQmxErrChk(DAQmxBaseCreateDOChan(dev->portTask[p], mchannel, "", DAQmx_Val_ChanForAllLines));
+      DAQmxErrChk(DAQmxBaseStartTask(dev->portTask[p]));
+    }
+    if (dev->numInputs > 0) {
+      DAQmxErrChk(DAQmxBaseCreateTask("", &dev->inputTask));
+      //all inputs of the device are read in one task, so a batch costs a single acquisition
+      DAQmxErrChk(addAIChannels(dev->inputTask, dev->input, dev->numInputs));
+      DAQmxErrChk(DAQmxBaseCfgSampClkTiming(dev->inputTask, "", 10000.0, DAQmx_Val_Rising, DAQmx_Val_FiniteSamps, NIDAQ_NUM_MEASUREMENTS));
+    }
+  }
+  return 1;
 
 Error:
-  if (DAQmxFailed(error))
-    DAQmxBaseGetExtendedErrorInfo(errBuff, 2048);
-  if (taskHandle != 0) {
-    // DAQmx Stop Code
-    DAQmxBaseStopTask(taskHandle);
-    DAQmxBaseClearTask(taskHandle);
-  }
-  if (DAQmxFailed(error))
-    printf("DAQmx Error: %s\n", errBuff);
-  //printf("Turned on channel %i.\n", chan);
-  //getchar();
-  return 1;
+  printError();
+  return -1;
 }
 /*--------------------------------------------------------------*/
-int chanOn(int chan) {
+void NIDAQDriver::clearTasks(void) {
+  for (int d = 0; d < numDevices; d++) {
+    NIDAQDevice *dev = &devices[d];
+    for (int p = 0; p < dev->numPorts; p++) {
+      if (dev->portTask[p] != 0) {
+        DAQmxBaseStopTask(dev->portTask[p]);
+        DAQmxBaseClearTask(dev->portTask[p]);
+        dev->portTask[p] = 0;
+      }
+    }
+    if (dev->inputTask != 0) {
+      DAQmxBaseStopTask(dev->inputTask);
+      DAQmxBaseClearTask(dev->inputTask);
+      dev->inputTask = 0;
+    }
+  }
+}
+/*--------------------------------------------------------------*/
+int NIDAQDriver::writeLines(const int *chan, int numChans) {
 
-  printf("Turning on channel %i (NIDAQ).\n", chan);
+  uInt32 data[NIDAQ_MAX_DEVICES][NIDAQ_MAX_PORTS]; //all channels off by default
+  memset(data, 0, sizeof(data));
 
-  int32 error = 0;
-  TaskHandle taskHandle = 0;
-  uInt32 data[1] = {0}; //all channels off by default
+  if(numChans == 0)
+    printf("Turning off all channels (NIDAQ).\n");
 
   //turn on the specified channels
-  if(chan<0){
-    printf("Invalid channel specified (%i), not taking any action.",chan);
-    return 1;
+  for(int i=0;i<numChans;i++){
+    if((chan[i]<0)||(chan[i]>=NIDAQ_MAX_CHANNELS)||(valves[chan[i]].device<0)){
+      printf("Invalid channel specified (%i), not taking any action.\n",chan[i]);
+      return -1;
+    }
+    NIDAQChannel *v = &valves[chan[i]];
+    printf("Turning on channel %i (NIDAQ %s/port%i/line%i).\n", chan[i], devices[v->device].name, devices[v->device].port[v->port], v->line);
+    data[v->device][v->port] |= 1u << v->line; //turn on specified channel
   }
-  data[0] = 1 << chan; //turn on specfied channel, leave others off
-
-  char errBuff[2048] = {'\0'};
 
-  // DAQmx Configure Code
-  DAQmxErrChk(DAQmxBaseCreateTask("", &taskHandle));
-  DAQmxErrChk(DAQmxBaseCreateDOChan(taskHandle, "Dev1/port0", "", DAQmx_Val_ChanForAllLines));
+  //every port is written, so that the lines which aren't listed are turned off
+  //(a port which fails doesn't stop the others from being written)
+  bool failed = false;
+  for (int d = 0; d < numDevices; d++) {
+    for (int p = 0; p < devices[d].numPorts; p++) {
+      int32 error = DAQmxBaseWriteDigitalU32(devices[d].portTask[p], 1, 1, 10.0, DAQmx_Val_GroupByChannel, &data[d][p], NULL, NULL);
+      if (DAQmxFailed(error)) {
+        printf("Could not write %s/port%i.\n", devices[d].name, devices[d].port[p]);
+        printError();
+        failed = true;
+      }
+    }
+  }
+  if (failed)
+    return -1;
+  return (numChans == 0) ? 0 : 1;
+}
+/*--------------------------------------------------------------*/
+bool NIDAQDriver::hasLine(int chan) {
+  return (chan >= 0) && (chan < NIDAQ_MAX_CHANNELS) && (valves[chan].device >= 0);
+}
+/*--------------------------------------------------------------*/
+//adds the analog inputs (server numbering) to a task
+int NIDAQDriver::addAIChannels(TaskHandle taskHandle, const int *chan, int numChans) {
+
+  char mchannel[256];
+
+  for(int i=0;i<numChans;i++){
+    NIDAQChannel *in = &inputs[chan[i]];
+    //Generate the DAQ channel (eg. Dev1/ai1) that will be measured
+    sprintf(mchannel, "%s/ai%i", devices[in->device].name, in->line);
+    int32 error = DAQmxBaseCreateAIVoltageChan(taskHandle, mchannel, "", in->terminal, -10.0, 10.0, DAQmx_Val_Volts, NULL);
+    if (DAQmxFailed(error))
+      return error;
+  }
+  return 0;
+}
+/*--------------------------------------------------------------*/
+int NIDAQDriver::readChannels(const int *chan, int numChans, float *volts) {
+
+  //invalid channels read 10 V
+  for(int i=0;i<numChans;i++){
+    volts[i] = 10.0f;
+    if((chan[i]<0)||(chan[i]>=NIDAQ_MAX_CHANNELS)||(inputs[chan[i]].device<0)){
+      printf("Invalid channel specified (%i), returning 10 V.",chan[i]);
+    }else{
+      devices[inputs[chan[i]].device].reading = true;
+    }
+  }
 
-  // DAQmx Start Code
-  DAQmxErrChk(DAQmxBaseStartTask(taskHandle));
+  //every device taking part is started first, so that they all acquire at the same time and
+  //reading several devices takes as long as reading one (the DAQmx Base library isn't
+  //thread safe, so the devices can't be read from separate threads instead)
+  int32 error;
+  bool failed = false;
+  for (int d = 0; d < numDevices; d++) {
+    if (!devices[d].reading)
+      continue;
+    error = DAQmxBaseStartTask(devices[d].inputTask);
+    if (DAQmxFailed(error)) {
+      printError();
+      devices[d].reading = false;
+      failed = true;
+    }
+  }
+  for (int d = 0; d < numDevices; d++) {
+    NIDAQDevice *dev = &devices[d];
+    if (!dev->reading)
+      continue;
+    int32 read;
+    error = DAQmxBaseReadAnalogF64(dev->inputTask, NIDAQ_NUM_MEASUREMENTS, 10.0, DAQmx_Val_GroupByChannel, dev->data, NIDAQ_NUM_MEASUREMENTS*dev->numInputs, &read, NULL);
+    DAQmxBaseStopTask(dev->inputTask);
+    if (DAQmxFailed(error)) {
+      printError();
+      dev->reading = false;
+      failed = true;
+    }
+  }
 
-  // DAQmx Write Code
-  DAQmxErrChk(DAQmxBaseWriteDigitalU32(taskHandle, 1, 1, 10.0, DAQmx_Val_GroupByChannel, data, NULL, NULL));
+  //average the readings of each channel, data is grouped by channel
+  for(int i=0;i<numChans;i++){
+    if((chan[i]<0)||(chan[i]>=NIDAQ_MAX_CHANNELS)||(inputs[chan[i]].device<0))
+      continue;
+    NIDAQDevice *dev = &devices[inputs[chan[i]].device];
+    if(!dev->reading)
+      continue;
+    float64 avg = 0; //will contain average voltage
+    for (int ind = 0; ind < NIDAQ_NUM_MEASUREMENTS; ind++) {
+      avg = avg + dev->data[inputs[chan[i]].port*NIDAQ_NUM_MEASUREMENTS + ind];
+    }
+    volts[i] = avg / NIDAQ_NUM_MEASUREMENTS;
+  }
+  for (int d = 0; d < numDevices; d++)
+    devices[d].reading = false;
 
-Error:
-  if (DAQmxFailed(error))
-    DAQmxBaseGetExtendedErrorInfo(errBuff, 2048);
-  if (taskHandle != 0) {
-    // DAQmx Stop Code
-    DAQmxBaseStopTask(taskHandle);
-    DAQmxBaseClearTask(taskHandle);
-  }
-  if (DAQmxFailed(error))
-    printf("DAQmx Error: %s\n", errBuff);
-  //printf("Turned on channel %i.\n", chan);
-  //getchar();
-  return 1;
+  return failed ? -1 : 1;
 }
 /*--------------------------------------------------------------*/
-int chanOff(void) {
-
-  printf("Turning off all channels (NIDAQ).\n");
+//streamed inputs must all be on one device (a task can't span devices)
+int NIDAQDriver::startStream(const int *chan, int numChans, double rate) {
+
+  if((numChans <= 0)||(numChans > NIDAQ_MAX_STREAM_CHANS))
+    return -1;
+  for(int i=0;i<numChans;i++){
+    if((chan[i]<0)||(chan[i]>=NIDAQ_MAX_CHANNELS)||(inputs[chan[i]].device<0)){
+      printf("Invalid channel specified (%i), not streaming.\n",chan[i]);
+      return -1;
+    }
+    if(inputs[chan[i]].device != inputs[chan[0]].device){
+      printf("Streamed inputs must all be on the same device, not streaming.\n");
+      return -1;
+    }
+  }
+  if(streamTask != 0)
+    stopStream();
 
   int32 error = 0;
-  TaskHandle taskHandle = 0;
-  uInt8 data[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-  char errBuff[2048] = {'\0'};
-
-  // DAQmx Configure Code
-  DAQmxErrChk(DAQmxBaseCreateTask("", &taskHandle));
-  DAQmxErrChk(DAQmxBaseCreateDOChan(taskHandle, "Dev1/port0/line0:7", "", DAQmx_Val_ChanForAllLines));
 
-  // DAQmx Start Code
-  DAQmxErrChk(DAQmxBaseStartTask(taskHandle));
+  DAQmxErrChk(DAQmxBaseCreateTask("", &streamTask));
+  DAQmxErrChk(addAIChannels(streamTask, chan, numChans));
+  //hardware buffer holds 10 s of data, readStream() must be called more often than that
+  DAQmxErrChk(DAQmxBaseCfgSampClkTiming(streamTask, "", rate, DAQmx_Val_Rising, DAQmx_Val_ContSamps, (uInt64)(rate*10)));
+  DAQmxErrChk(DAQmxBaseStartTask(streamTask));
 
-  // DAQmx Write Code
-  DAQmxErrChk(DAQmxBaseWriteDigitalU8(taskHandle, 1, 1, 10.0, DAQmx_Val_GroupByChannel, data, NULL, NULL));
+  numStreamChans = numChans;
+  return 1;
 
 Error:
-  if (DAQmxFailed(error))
-    DAQmxBaseGetExtendedErrorInfo(errBuff, 2048);
-  if (taskHandle != 0) {
-    // DAQmx Stop Code
-    DAQmxBaseStopTask(taskHandle);
-    DAQmxBaseClearTask(taskHandle);
-  }
-  if (DAQmxFailed(error))
-    printf("DAQmx Error: %s\n", errBuff);
-  //printf("Turned off all channels.\n");
-  //getchar();*/
-  return 0;
+  printError();
+  if (streamTask != 0) {
+    DAQmxBaseStopTask(streamTask);
+    DAQmxBaseClearTask(streamTask);
+    streamTask = 0;
+  }
+  return -1;
 }
 /*--------------------------------------------------------------*/
-float measure(int channel) {
+int NIDAQDriver::readStream(float *volts, int maxScans, int *scansRead) {
 
-  if(channel<0){
-    printf("Invalid channel specified (%i), returning 10 V.",channel);
-    return 10.0f;
-  }
+  *scansRead = 0;
+  if(streamTask == 0)
+    return -1;
 
-  //Generate the DAQ channel (eg. Dev1/ai1) that will be measured
-  char mch[256];
-  char *mchannel = strcpy(mch,"Dev1/ai");
-  stringstream ss;
-  ss << mchannel << channel;
-  const std::string tmp = ss.str();
-  mchannel = (char *)tmp.c_str();
+  if(streamDataSize < maxScans*numStreamChans){
+    free(streamData);
+    streamDataSize = maxScans*numStreamChans;
+    streamData = (float64 *)malloc(streamDataSize*sizeof(float64));
+  }
 
   int32 error = 0;
-  TaskHandle taskHandle = 0;
-  int32 read;
-  int32 numMeasurements = 10; //number of measurements to average over
-  float64 data[numMeasurements];
-  float64 avg = 0; //will contain average voltage
-
-  char errBuff[2048] = {'\0'};
-  int ind;
-  // DAQmx Configure Code
-  DAQmxErrChk(DAQmxBaseCreateTask("", &taskHandle));
-
-  //compensate for different default configuration of the two different channel banks on the DAQ (specific to the NI USB DAQ being used)
-  if (channel < 4)
-    DAQmxErrChk(DAQmxBaseCreateAIVoltageChan(taskHandle, mchannel, "", DAQmx_Val_RSE, -10.0, 10.0, DAQmx_Val_Volts, NULL));
-  else
-    DAQmxErrChk(DAQmxBaseCreateAIVoltageChan(taskHandle, mchannel, "", DAQmx_Val_Cfg_Default, -10.0, 10.0, DAQmx_Val_Volts, NULL));
-
-  DAQmxErrChk(DAQmxBaseCfgSampClkTiming(taskHandle, "", 10000.0, DAQmx_Val_Rising, DAQmx_Val_FiniteSamps, numMeasurements));
-
-  // DAQmx Start Code
-  DAQmxErrChk(DAQmxBaseStartTask(taskHandle));
-
-  // DAQmx Read Code
-  DAQmxErrChk(DAQmxBaseReadAnalogF64(taskHandle, numMeasurements, 10.0, DAQmx_Val_GroupByChannel, data, numMeasurements, &read, NULL));
+  int32 read = 0;
 
-  for (ind = 0; ind < numMeasurements; ind++) {
-    //printf("%4d %10.3f\n",ind,data[ind]);
-    avg = avg + data[ind];
+  //read whatever has been acquired so far without waiting
+  DAQmxErrChk(DAQmxBaseReadAnalogF64(streamTask, -1, 0.0, DAQmx_Val_GroupByScanNumber, streamData, maxScans*numStreamChans, &read, NULL));
+  for(int i=0;i<read*numStreamChans;i++){
+    volts[i] = streamData[i];
   }
+  *scansRead = read;
+  return 1;
+
 Error:
-  if (DAQmxFailed(error))
-    DAQmxBaseGetExtendedErrorInfo(errBuff, 2048);
-  if (taskHandle != 0) {
-    // DAQmx Stop Code
-    DAQmxBaseStopTask(taskHandle);
-    DAQmxBaseClearTask(taskHandle);
-  }
-  if (DAQmxFailed(error))
-    printf("DAQmxBase Error: %s\n", errBuff);
-
-  avg = avg / numMeasurements;
-  return avg;
+  printError();
+  return -1;
+}
+/*--------------------------------------------------------------*/
+int NIDAQDriver::stopStream(void) {
+  if(streamTask != 0){
+    DAQmxBaseStopTask(streamTask);
+    DAQmxBaseClearTask(streamTask);
+    streamTask = 0;
+  }
+  free(streamData);
+  streamData = NULL;
+  streamDataSize = 0;
+  return 1;
 }
@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <sstream>
 #include <NIDAQmxBase.h>
+#include "daq_driver.h"
 using namespace std;
 
 #define read_ports 2
@@ -12,3 +13,63 @@ using namespace std;
 #define write_ports 1
 
 #define DAQmxErrChk(functionCall) if( DAQmxFailed(error=(functionCall)) ) goto Error; else
+
+#define NIDAQ_MAX_STREAM_CHANS 16
+#define NIDAQ_MAX_DEVICES 8        //DAQs used by one server
+#define NIDAQ_MAX_PORTS 4          //digital ports used on each DAQ
+#define NIDAQ_MAX_CHANNELS 64      //valves and analog inputs in the channel map
+#define NIDAQ_NUM_MEASUREMENTS 10  //number of measurements to average over (per channel)
+
+//a DAQ and the tasks kept open on it
+typedef struct {
+  char name[32];                        //eg. Dev1
+  int numPorts;
+  int port[NIDAQ_MAX_PORTS];            //digital ports with valves on them
+  TaskHandle portTask[NIDAQ_MAX_PORTS]; //output task of each port
+  int numInputs;
+  int input[NIDAQ_MAX_CHANNELS];        //analog inputs (server numbering) in the order of the input task
+  TaskHandle inputTask;                 //finite acquisition of all the inputs, started for every read
+  bool reading;                         //inputTask has been started by the current read
+  float64 data[NIDAQ_MAX_CHANNELS*NIDAQ_NUM_MEASUREMENTS];
+} NIDAQDevice;
+
+//where a valve or analog input (as numbered in schedule.dat and parameters.dat) is connected
+typedef struct {
+  int device;                           //index in devices[], -1 if the channel isn't mapped
+  int port;                             //valves: index in the device's ports, inputs: position in its input task
+  int line;                             //valves: line of the port, inputs: the N of DevX/aiN
+  int terminal;                         //inputs: terminal configuration (DAQmx_Val_RSE, ...)
+} NIDAQChannel;
+
+class NIDAQDriver : public DAQDriver
+{
+public:
+  NIDAQDriver(void);
+  int open(const char *config);
+  void close(void);
+  void capabilities(DAQCapabilities *caps);
+  int writeLines(const int *chan, int numChans);
+  bool hasLine(int chan);
+  int readChannels(const int *chan, int numChans, float *volts);
+  int startStream(const int *chan, int numChans, double rate);
+  int readStream(float *volts, int maxScans, int *scansRead);
+  int stopStream(void);
+private:
+  int readMap(const char *filename);
+  void defaultMap(void);
+  int findDevice(const char *name);
+  int mapValve(int chan, const char *address);
+  int mapInput(int chan, const char *address, const char *terminal);
+  int createTasks(void);
+  void clearTasks(void);
+  int addAIChannels(TaskHandle taskHandle, const int *chan, int numChans);
+  int numDevices;
+  NIDAQDevice devices[NIDAQ_MAX_DEVICES];
+  int numValves, numInputs;             //highest valve/input mapped + 1
+  NIDAQChannel valves[NIDAQ_MAX_CHANNELS];
+  NIDAQChannel inputs[NIDAQ_MAX_CHANNELS];
+  TaskHandle streamTask; //task used for continuous acquisition, 0 when not streaming
+  int numStreamChans;
+  float64 *streamData;
+  int streamDataSize;
+};
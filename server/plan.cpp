@@ -0,0 +1,398 @@
+//Monte Carlo planning of the supply tank deliveries (see plan.h)
+#include "plan.h"
+#include "ctlsock.h"
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+
+static volatile int planBusy = 0; //1 from planStart until planCollect
+static volatile int planDone = 0; //1 once the plan thread is done with planReply
+static Reply *planReply;
+
+//runs shared out between the threads of one planRun
+typedef struct {
+  const PlanCase *c;
+  int numBlocks;
+  int next;                 //next block to simulate
+  int runs;
+  float *levels;            //levels[day*runs + run], at the end of each day
+  unsigned char *dryDay;    //day each run went dry, numDays if it didn't
+} PlanBlocks;
+
+/*--------------------------------------------------------------*/
+//first random state of a run (never 0, which xorshift would stay at)
+static unsigned int seedRun(unsigned int seed, unsigned int run) {
+  unsigned int h = run*0x9E3779B9u + seed;
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return (h != 0) ? h : 1;
+}
+/*--------------------------------------------------------------*/
+//simulates the runs first to first + PLAN_BLOCK - 1
+static void simulateBlock(PlanBlocks *j, int first) {
+  const PlanCase *c = j->c;
+  float level[PLAN_BLOCK];
+  unsigned int state[PLAN_BLOCK];
+  unsigned char dry[PLAN_BLOCK];
+  float refill = (float)c->refillKg;
+  double t = 0.0;
+  int k = 0;
+
+  for (int r = 0; r < PLAN_BLOCK; r++) {
+    level[r] = (float)c->startKg;
+    state[r] = seedRun(c->seed, first + r);
+    dry[r] = (unsigned char)c->numDays;
+  }
+  for (int d = 0; d < c->numDays; d++) {
+    unsigned char day = (unsigned char)d;
+    //the fills of the day, each drawing what it uses from the recorded fills of its entry
+    for (; (k < c->numFills) && (c->fillHour[k] < c->dayEnd[d]); k++) {
+      const PlanUsage *u = &c->usage[c->fillEntry[k]];
+      unsigned int n = u->numSamples;
+      float drop = (float)(c->boiloff*(c->fillHour[k] - t));
+      t = c->fillHour[k];
+      if (n == 0) {
+        for (int r = 0; r < PLAN_BLOCK; r++)
+          level[r] -= drop;
+        continue;
+      }
+      for (int r = 0; r < PLAN_BLOCK; r++) {
+        unsigned int x = state[r];
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        state[r] = x;
+        level[r] -= drop + u->kg[(unsigned int)(((unsigned long long)x*n) >> 32)];
+      }
+      for (int r = 0; r < PLAN_BLOCK; r++)
+        dry[r] = ((level[r] < refill) && (dry[r] > day)) ? day : dry[r];
+    }
+    //and the boil-off up to the end of the day
+    float drop = (float)(c->boiloff*(c->dayEnd[d] - t));
+    t = c->dayEnd[d];
+    float *end = &j->levels[(size_t)d*j->runs + first];
+    for (int r = 0; r < PLAN_BLOCK; r++) {
+      level[r] -= drop;
+      dry[r] = ((level[r] < refill) && (dry[r] > day)) ? day : dry[r];
+      end[r] = level[r];
+    }
+  }
+  memcpy(&j->dryDay[first], dry, PLAN_BLOCK);
+}
+/*--------------------------------------------------------------*/
+static void *blockThread(void *arg) {
+  PlanBlocks *j = (PlanBlocks *)arg;
+
+  for (;;) {
+    int block = __sync_fetch_and_add(&j->next, 1);
+    if (block >= j->numBlocks)
+      break;
+    simulateBlock(j, block*PLAN_BLOCK);
+  }
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+int planRun(const PlanCase *c, int threads, PlanResult *r) {
+  pthread_t thread[PLAN_MAX_THREADS];
+  PlanBlocks j;
+  int started = 0;
+
+  memset(r, 0, sizeof(PlanResult));
+  if ((c->numDays <= 0) || (c->numDays > PLAN_MAX_DAYS) || (c->runs <= 0))
+    return -1;
+  j.c = c;
+  j.numBlocks = (c->runs + PLAN_BLOCK - 1)/PLAN_BLOCK;
+  j.next = 0;
+  j.runs = j.numBlocks*PLAN_BLOCK;
+  j.levels = (float *)malloc((size_t)j.runs*c->numDays*sizeof(float));
+  j.dryDay = (unsigned char *)malloc(j.runs);
+  if ((j.levels == NULL) || (j.dryDay == NULL)) {
+    free(j.levels);
+    free(j.dryDay);
+    return -1;
+  }
+
+  if (threads > j.numBlocks)
+    threads = j.numBlocks;
+  if (threads > PLAN_MAX_THREADS)
+    threads = PLAN_MAX_THREADS;
+  for (int i = 1; i < threads; i++)
+    if (pthread_create(&thread[started], NULL, blockThread, &j) == 0)
+      started++;
+  blockThread(&j);
+  for (int i = 0; i < started; i++)
+    pthread_join(thread[i], NULL);
+
+  //share of the runs dry by the end of each day, and the spread of the levels
+  int dry[PLAN_MAX_DAYS + 1];
+  memset(dry, 0, sizeof(dry));
+  for (int i = 0; i < j.runs; i++)
+    dry[j.dryDay[i]]++;
+  r->runs = j.runs;
+  int total = 0;
+  for (int d = 0; d < c->numDays; d++) {
+    total += dry[d];
+    r->dry[d] = 100.0*total/j.runs;
+    float *v = &j.levels[(size_t)d*j.runs];
+    double sum = 0.0;
+    for (int i = 0; i < j.runs; i++)
+      sum += v[i];
+    r->mean[d] = sum/j.runs;
+    std::nth_element(v, v + j.runs/20, v + j.runs);
+    r->low[d] = v[j.runs/20];
+  }
+  free(j.levels);
+  free(j.dryDay);
+  return 1;
+}
+/*------------------------------------------------------------*/
+/*The plan command-------------------------------------------*/
+/*----------------------------------------------------------*/
+//fills of the case being simulated, only used by the plan thread
+static double caseHour[PLAN_MAX_FILLS];
+static int caseEntry[PLAN_MAX_FILLS];
+
+//picks the scheduled fills from start up to days later for a case of the plan
+static void planFills(const PlanJob *j, PlanCase *c, time_t start, int days) {
+  int n = 0;
+
+  for (int k = 0; k < j->numFills; k++) {
+    if ((j->fills[k].t < start) || (j->fills[k].t >= start + 86400*(time_t)days))
+      continue;
+    caseHour[n] = (j->fills[k].t - start)/3600.0;
+    caseEntry[n++] = j->fills[k].entry;
+  }
+  c->numFills = n;
+  c->fillHour = caseHour;
+  c->fillEntry = caseEntry;
+}
+/*--------------------------------------------------------------*/
+//the tank in use, day by day up to midnight
+static void reportNow(const PlanJob *j, PlanCase *c, FILE *csv) {
+  const PlanRequest *q = &j->req;
+  time_t now = j->now;
+  double dayEnd[PLAN_MAX_DAYS];
+  time_t midnight[PLAN_MAX_DAYS];
+  char when[64];
+  struct tm local;
+  PlanResult result;
+
+  c->startKg = j->level;
+  c->numDays = q->every;
+  planFills(j, c, now, q->every + 1);
+  c->dayEnd = dayEnd;
+  c->seed = 1;
+  for (int d = 0; d < q->every; d++) {
+    localtime_r(&now, &local);
+    local.tm_mday += d + 1;
+    local.tm_hour = local.tm_min = local.tm_sec = 0;
+    local.tm_isdst = -1;
+    midnight[d] = mktime(&local);
+    dayEnd[d] = (midnight[d] - now)/3600.0;
+  }
+  if (planRun(c, j->threads, &result) < 0) {
+    ctlPrintf("ERROR: Could not run the plan.\n");
+    return;
+  }
+  ctlPrintf("\nSupply tank now at %.1f kg (refill weight %.1f kg), %i runs:\n", c->startKg, j->refillKg, q->runs);
+  ctlPrintf("%-13s %9s %12s %12s\n", "by the end of", "dry", "mean level", "5% lowest");
+  int swapBy = -1;
+  for (int d = 0; d < q->every; d++) {
+    time_t t = midnight[d] - 1;
+    localtime_r(&t, &local);
+    strftime(when, sizeof(when), "%a %d %b", &local);
+    ctlPrintf("%-13s %9.1f%% %9.1f kg %9.1f kg\n", when, result.dry[d], result.mean[d], result.low[d]);
+    if ((swapBy < 0) && (result.dry[d] > q->risk))
+      swapBy = d;
+    if (csv != NULL)
+      fprintf(csv, "now,%ld,%ld,%.3f,%.3f,%.3f\n", (long)now, (long)midnight[d], result.dry[d], result.mean[d], result.low[d]);
+  }
+  if (swapBy < 0) {
+    ctlPrintf("The chance of running dry stays below %.1f%% for the next %i days.\n", q->risk, q->every);
+  } else {
+    time_t t = midnight[swapBy] - 1;
+    localtime_r(&t, &local);
+    strftime(when, sizeof(when), "%a %d %b", &local);
+    if (swapBy == 0)
+      ctlPrintf("The chance of running dry by the end of today is over %.1f%%, swap the tank now.\n", q->risk);
+    else
+      ctlPrintf("Swap the tank before %s (the chance of running dry by then is over %.1f%%).\n", when, q->risk);
+  }
+}
+/*--------------------------------------------------------------*/
+//a full tank delivered on each day of the week, up to the next delivery
+static void reportWeekdays(const PlanJob *j, PlanCase *c, FILE *csv) {
+  static const char *weekdays[7] = {"Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday"};
+  const PlanRequest *q = &j->req;
+  time_t now = j->now;
+  double dayEnd[PLAN_MAX_DAYS];
+  struct tm local;
+  PlanResult result;
+
+  ctlPrintf("\nFull tank of %.1f kg delivered every %i days at %02i:00, %i runs:\n", j->fullKg, q->every, PLAN_SWAP_HOUR, q->runs);
+  ctlPrintf("%-13s %9s %12s %12s\n", "delivered", "dry", "mean left", "5% lowest");
+  c->startKg = j->fullKg;
+  c->numDays = q->every;
+  c->dayEnd = dayEnd;
+  for (int d = 0; d < q->every; d++)
+    dayEnd[d] = 24.0*(d + 1);
+  int best = -1;
+  double bestDry = 0.0, bestMean = 0.0;
+  for (int w = 0; w < 7; w++) {
+    time_t start = 0;
+    for (int d = 0; d <= 7; d++) {
+      localtime_r(&now, &local);
+      local.tm_mday += d;
+      local.tm_hour = PLAN_SWAP_HOUR;
+      local.tm_min = local.tm_sec = 0;
+      local.tm_isdst = -1;
+      time_t t = mktime(&local);
+      if ((t > now) && (local.tm_wday == w)) {
+        start = t;
+        break;
+      }
+    }
+    planFills(j, c, start, q->every);
+    c->seed = 2 + w;
+    if (planRun(c, j->threads, &result) < 0) {
+      ctlPrintf("ERROR: Could not run the plan.\n");
+      return;
+    }
+    double dry = result.dry[q->every - 1], mean = result.mean[q->every - 1];
+    ctlPrintf("%-13s %9.1f%% %9.1f kg %9.1f kg\n", weekdays[w], dry, mean, result.low[q->every - 1]);
+    if ((best < 0) || (dry < bestDry) || ((dry == bestDry) && (mean > bestMean))) {
+      best = w;
+      bestDry = dry;
+      bestMean = mean;
+    }
+    if (csv != NULL)
+      fprintf(csv, "swap_%s,%ld,%ld,%.3f,%.3f,%.3f\n", weekdays[w], (long)start, (long)start + 86400L*q->every,
+              dry, mean, result.low[q->every - 1]);
+  }
+  ctlPrintf("Best delivery day %s (%.1f%% chance of running dry before the next delivery%s).\n", weekdays[best], bestDry,
+            (bestDry > q->risk) ? ", over the risk asked for: deliver more often or a larger tank" : "");
+}
+/*--------------------------------------------------------------*/
+static void *planThread(void *arg) {
+  PlanJob *j = (PlanJob *)arg;
+  FILE *csv = NULL;
+  PlanCase c;
+
+  ctlBegin(planReply); //ctlPrintf on this thread adds to the reply of the plan command
+  if (j->req.csv[0] != '\0') {
+    csv = fopen(j->req.csv, "w");
+    if (csv == NULL)
+      ctlPrintf("ERROR: Could not open %s for writing.\n", j->req.csv);
+    else
+      fprintf(csv, "case,start,day_end,dry_percent,mean_kg,low_kg\n");
+  }
+  unsigned long long t0 = latencyNow();
+  memset(&c, 0, sizeof(c));
+  c.refillKg = j->refillKg;
+  c.boiloff = j->boiloff;
+  c.usage = j->usage;
+  c.runs = j->req.runs;
+  if (j->levelValid)
+    reportNow(j, &c, csv);
+  else
+    ctlPrintf("\nThe supply tank level is not known yet.\n");
+  if (j->fullKg > 0.0)
+    reportWeekdays(j, &c, csv);
+  else
+    ctlPrintf("\nThe level of a full tank is not known (set tank_full_kg, or it is measured at the next tank swap).\n");
+  if (csv != NULL) {
+    fclose(csv);
+    ctlPrintf("Written to %s.\n", j->req.csv);
+  }
+  ctlPrintf("Simulated in %.1f ms (%i thread%s).\n", (latencyNow() - t0)/1e6, j->threads, (j->threads == 1) ? "" : "s");
+  ctlBegin(NULL);
+  free(j);
+  __sync_lock_test_and_set(&planDone, 1); //the reply is complete
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+int planStart(PlanJob *j, Reply *reply) {
+  pthread_t thread;
+
+  if (!__sync_bool_compare_and_swap(&planBusy, 0, 1)) {
+    free(j);
+    return -1;
+  }
+  planReply = reply;
+  planDone = 0;
+  if (pthread_create(&thread, NULL, planThread, j) != 0) {
+    free(j);
+    __sync_lock_release(&planBusy);
+    return -1;
+  }
+  pthread_detach(thread);
+  return 1;
+}
+/*--------------------------------------------------------------*/
+bool planRunning(void) {
+  return __sync_fetch_and_add(&planBusy, 0) != 0;
+}
+/*--------------------------------------------------------------*/
+bool planCollect(Reply **reply) {
+  if (__sync_fetch_and_add(&planDone, 0) == 0)
+    return false;
+  *reply = planReply;
+  planDone = 0;
+  __sync_lock_release(&planBusy);
+  return true;
+}
+/*--------------------------------------------------------------*/
+void planWait(void) {
+  if (planRunning())
+    printf("Waiting for the plan being run...\n");
+  while (__sync_fetch_and_add(&planDone, 0) == 0 && planRunning())
+    usleep(10000);
+}
+/*--------------------------------------------------------------*/
+int planParse(PlanRequest *q, char *options) {
+  char *save, *tok;
+
+  memset(q, 0, sizeof(PlanRequest));
+  q->risk = PLAN_DEFAULT_RISK;
+  if (options == NULL)
+    return 1;
+  for (tok = strtok_r(options, " ", &save); tok != NULL; tok = strtok_r(NULL, " ", &save)) {
+    char *value = strtok_r(NULL, " ", &save);
+    if (value == NULL) {
+      ctlPrintf("ERROR: No value given for %s in the plan command.\n", tok);
+      return -1;
+    }
+    if (strcmp(tok, "every") == 0) {
+      q->every = atoi(value);
+      if ((q->every <= 0) || (q->every > PLAN_MAX_DAYS)) {
+        ctlPrintf("ERROR: Deliveries must be 1 to %i days apart in the plan command.\n", PLAN_MAX_DAYS);
+        return -1;
+      }
+    } else if (strcmp(tok, "runs") == 0) {
+      q->runs = atoi(value);
+      if ((q->runs <= 0) || (q->runs > PLAN_MAX_RUNS)) {
+        ctlPrintf("ERROR: The plan command takes 1 to %i runs.\n", PLAN_MAX_RUNS);
+        return -1;
+      }
+    } else if (strcmp(tok, "risk") == 0) {
+      q->risk = atof(value);
+      if ((q->risk <= 0.0) || (q->risk >= 100.0)) {
+        ctlPrintf("ERROR: The risk in the plan command must be a percentage between 0 and 100.\n");
+        return -1;
+      }
+    } else if (strcmp(tok, "csv") == 0) {
+      snprintf(q->csv, sizeof(q->csv), "%s", value);
+    } else {
+      ctlPrintf("ERROR: Unknown plan option %s.\n", tok);
+      return -1;
+    }
+  }
+  return 1;
+}
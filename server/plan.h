@@ -0,0 +1,105 @@
+//Monte Carlo planning of the supply tank deliveries (the plan command)
+//
+//The fills of the coming days are known from the schedule, but not what each will take from the
+//supply tank, which varies from fill to fill.  The planner draws the LN2 used by each scheduled fill
+//from the recorded fills of its entry, and runs the tank level forward through the schedule, losing
+//the boil-off in between, many times over.  The fraction of the runs in which the level went below
+//the refill weight by the end of a day is the chance of the tank running dry by then.
+//
+//The runs are simulated PLAN_BLOCK at a time side by side: the level, random state and the day the
+//tank ran dry of each run are kept in arrays, so every step of the schedule is a loop over the block
+//without branches, which the compiler vectorizes.  The blocks are shared out between threads.  Each
+//run has its own random numbers, seeded from its number, so the results don't depend on the number
+//of threads.
+//
+//The control loop only copies what a plan works from (the fills scheduled, what each entry's fills
+//use, the tank level and boil-off) into a PlanJob; planStart runs it on a thread of its own, which
+//prints the results into the reply of the plan command.  The control loop gives the reply back once
+//planCollect says the plan is done, so a plan never holds up the readings or a fill in progress.
+
+#ifndef __PLAN
+#define __PLAN
+
+#include <time.h>
+#include "ctlsock.h"
+
+#define PLAN_BLOCK 256             //runs simulated side by side
+#define PLAN_MAX_SAMPLES 64        //recorded fills of an entry drawn from (the most recent ones)
+#define PLAN_MAX_DAYS 28           //days simulated
+#define PLAN_MAX_THREADS 64
+#define PLAN_MAX_RUNS 100000       //runs of one case
+#define PLAN_MAX_FILLS 4096        //scheduled fills a plan considers
+#define PLAN_MAX_ENTRIES 256       //schedule entries (MAXSCHEDENTRIES)
+#define PLAN_SWAP_HOUR 9           //deliveries are planned at this time of day
+#define PLAN_DEFAULT_RISK 5.0      //chance (%) of running dry the plan command aims below
+
+//LN2 used by the fills of an entry
+typedef struct {
+  int numSamples;           //0 if not known, the entry's fills are then left out
+  float kg[PLAN_MAX_SAMPLES];
+} PlanUsage;
+
+//one set of runs, all starting from the same level
+typedef struct {
+  double startKg;
+  double refillKg;          //the tank counts as dry below this
+  double boiloff;           //kg/hour
+  int numDays;
+  const double *dayEnd;     //end of each day, in hours after the start
+  int numFills;             //fills scheduled, in time order
+  const double *fillHour;   //hours after the start
+  const int *fillEntry;
+  const PlanUsage *usage;   //indexed by entry
+  int runs;
+  unsigned int seed;
+} PlanCase;
+
+typedef struct {
+  int runs;                 //simulated (a whole number of blocks)
+  double dry[PLAN_MAX_DAYS];  //% of the runs dry by the end of each day
+  double mean[PLAN_MAX_DAYS]; //mean level at the end of each day (kg)
+  double low[PLAN_MAX_DAYS];  //and its 5th percentile
+} PlanResult;
+
+//what a plan command asks for
+typedef struct {
+  int every;                //days between deliveries, 0 for delivery_interval_days
+  int runs;                 //0 for plan_runs
+  double risk;              //%
+  char csv[256];            //file the results are also written to, empty for none
+} PlanRequest;
+
+//a scheduled fill
+typedef struct {
+  time_t t;
+  int entry;
+} PlanFill;
+
+//what a plan command works from, copied by the control loop
+typedef struct {
+  PlanRequest req;          //with every and runs filled in
+  time_t now;
+  double refillKg;
+  double boiloff;           //kg/hour, 0 if not known
+  bool levelValid;
+  double level;             //kg now
+  double fullKg;            //level of a newly delivered tank, 0 if not known
+  int threads;
+  int numFills;
+  PlanFill fills[PLAN_MAX_FILLS]; //in time order, up to 7 + req.every days ahead
+  PlanUsage usage[PLAN_MAX_ENTRIES]; //indexed by entry
+} PlanJob;
+
+int planRun(const PlanCase *c, int threads, PlanResult *r); //returns -1 on errors
+
+//runs the plan of j (allocated with malloc, and freed once done) on a thread of its own, printing
+//the results to reply; returns -1 (and frees j) if the thread couldn't be started
+int planStart(PlanJob *j, Reply *reply);
+bool planRunning(void);   //from planStart until planCollect has given the reply back
+bool planCollect(Reply **reply); //true once the plan is done, with the reply to give back
+void planWait(void);      //waits for the plan being run to be done
+
+//options: [every DAYS] [runs N] [risk PERCENT] [csv FILE]
+int planParse(PlanRequest *q, char *options);
+
+#endif
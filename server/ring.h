@@ -0,0 +1,69 @@
+//lock-free ring of fixed size records, for exactly one producer thread and one consumer thread
+//
+//The producer only ever writes head and the consumer only ever writes tail, so neither
+//takes a lock or waits for the other: ringPush fails straight away when the ring is full
+//and ringPop when it is empty.  head and tail count records from the start and wrap
+//around at 2^32, which works because the size is a power of 2.
+
+#ifndef __RING
+#define __RING
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  volatile unsigned int head; //records pushed (only changed by the producer)
+  volatile unsigned int tail; //records popped (only changed by the consumer)
+  unsigned int size;          //capacity, a power of 2
+  unsigned int recordSize;
+  char *records;
+} Ring;
+
+//returns -1 if the size isn't a power of 2 or the ring can't be allocated
+static inline int ringInit(Ring *r, unsigned int size, unsigned int recordSize) {
+  memset(r, 0, sizeof(Ring));
+  if ((size == 0) || ((size & (size - 1)) != 0))
+    return -1;
+  r->records = (char *)malloc((size_t)size*recordSize);
+  if (r->records == NULL)
+    return -1;
+  r->size = size;
+  r->recordSize = recordSize;
+  return 1;
+}
+
+static inline void ringFree(Ring *r) {
+  free(r->records);
+  r->records = NULL;
+  r->size = 0;
+}
+
+//producer: copies the record into the ring, false if it is full
+static inline bool ringPush(Ring *r, const void *record) {
+  unsigned int head = r->head;
+  if (head - r->tail == r->size)
+    return false;
+  memcpy(r->records + (size_t)(head & (r->size - 1))*r->recordSize, record, r->recordSize);
+  __sync_synchronize(); //the record is written before the consumer can see it
+  r->head = head + 1;
+  return true;
+}
+
+//consumer: copies the oldest record out of the ring, false if it is empty
+static inline bool ringPop(Ring *r, void *record) {
+  unsigned int tail = r->tail;
+  if (r->head == tail)
+    return false;
+  __sync_synchronize(); //the record is read after head was
+  memcpy(record, r->records + (size_t)(tail & (r->size - 1))*r->recordSize, r->recordSize);
+  __sync_synchronize(); //and before the producer can reuse its slot
+  r->tail = tail + 1;
+  return true;
+}
+
+//records waiting (either thread, may be out of date by the time it returns)
+static inline unsigned int ringCount(Ring *r) {
+  return r->head - r->tail;
+}
+
+#endif
@@ -0,0 +1,84 @@
+//summaries of the readings over fixed intervals (see rollup.h)
+#include "rollup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *rollupNames[ROLLUP_TIERS] = {"1m", "15m", "1h", "1d"};
+static const int rollupWidths[ROLLUP_TIERS] = {60, 900, 3600, 86400};
+static const int rollupSlots[ROLLUP_TIERS] = {ROLLUP_1M_SLOTS, ROLLUP_15M_SLOTS, ROLLUP_1H_SLOTS, ROLLUP_1D_SLOTS};
+
+/*--------------------------------------------------------------*/
+int rollupInit(RollupTier tiers[ROLLUP_TIERS], int numChannels) {
+  for (int i = 0; i < ROLLUP_TIERS; i++) {
+    RollupTier *r = &tiers[i];
+    memset(r, 0, sizeof(RollupTier));
+    r->name = rollupNames[i];
+    r->width = rollupWidths[i];
+    r->size = rollupSlots[i];
+    r->numChannels = numChannels;
+    r->t = (time_t *)calloc(r->size, sizeof(time_t));
+    r->samples = (unsigned int *)calloc(r->size, sizeof(unsigned int));
+    r->min = (float *)calloc((size_t)r->size*numChannels, sizeof(float));
+    r->max = (float *)calloc((size_t)r->size*numChannels, sizeof(float));
+    r->sum = (double *)calloc((size_t)r->size*numChannels, sizeof(double));
+    if ((r->t == NULL) || (r->samples == NULL) || (r->min == NULL) || (r->max == NULL) || (r->sum == NULL)) {
+      printf("ERROR: Could not allocate the %s summaries of the readings.\n", r->name);
+      r->size = 0;
+      return -1;
+    }
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void rollupAdd(RollupTier tiers[ROLLUP_TIERS], time_t t, const float *values) {
+  struct tm local;
+
+  //intervals start on the local minute/quarter hour/hour/day
+  localtime_r(&t, &local);
+  long long tLocal = (long long)t + local.tm_gmtoff;
+
+  for (int i = 0; i < ROLLUP_TIERS; i++) {
+    RollupTier *r = &tiers[i];
+    if (r->size == 0)
+      continue;
+    time_t start = (time_t)(tLocal - tLocal % r->width - local.tm_gmtoff);
+    int slot = rollupSlot(r, r->count - 1);
+
+    //a reading in a new interval starts the next slot (readings from before the
+    //current interval, if the clock was set back, are added to the current one)
+    if ((r->count == 0) || (start > r->t[slot])) {
+      if (r->count == r->size)
+        r->start = (r->start + 1) % r->size; //full, overwrite the oldest interval
+      else
+        r->count++;
+      slot = rollupSlot(r, r->count - 1);
+      r->t[slot] = start;
+      r->samples[slot] = 0;
+      for (int c = 0; c < r->numChannels; c++) {
+        r->min[slot*r->numChannels + c] = values[c];
+        r->max[slot*r->numChannels + c] = values[c];
+        r->sum[slot*r->numChannels + c] = 0.0;
+      }
+    }
+
+    float *min = &r->min[slot*r->numChannels];
+    float *max = &r->max[slot*r->numChannels];
+    double *sum = &r->sum[slot*r->numChannels];
+    for (int c = 0; c < r->numChannels; c++) {
+      if (values[c] < min[c])
+        min[c] = values[c];
+      if (values[c] > max[c])
+        max[c] = values[c];
+      sum[c] += values[c];
+    }
+    r->samples[slot]++;
+  }
+}
+/*--------------------------------------------------------------*/
+int rollupFind(const char *name) {
+  for (int i = 0; i < ROLLUP_TIERS; i++)
+    if (strcmp(name, rollupNames[i]) == 0)
+      return i;
+  return -1;
+}
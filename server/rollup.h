@@ -0,0 +1,44 @@
+//summaries of the readings over fixed intervals (1 min, 15 min, 1 h and 1 day)
+//
+//Each tier keeps the minimum, maximum, mean and number of samples of every channel
+//for each of its intervals, in a ring of the last ROLLUP_*_SLOTS intervals.  Every
+//reading is added to all tiers as it is taken: only the current interval of each tier
+//changes, so adding a reading costs the same however long the tiers reach back, and
+//nothing is recomputed when they are shown or saved.  With the slots below the tiers
+//reach back 6 hours, 4 days, 2 weeks and a year, in about 25 kB per channel.
+
+#ifndef __ROLLUP
+#define __ROLLUP
+
+#include <time.h>
+
+#define ROLLUP_TIERS 4
+#define ROLLUP_1M_SLOTS 360
+#define ROLLUP_15M_SLOTS 384
+#define ROLLUP_1H_SLOTS 336
+#define ROLLUP_1D_SLOTS 366
+
+typedef struct {
+  const char *name;         //resolution as given to the table and save commands (eg. 15m)
+  int width;                //length of the intervals (s)
+  int size;                 //maximum number of intervals
+  int start;                //oldest interval
+  int count;                //intervals stored
+  int numChannels;
+  time_t *t;                //start of each interval
+  unsigned int *samples;    //readings added to each interval
+  float *min;               //min[slot*numChannels + channel]
+  float *max;
+  double *sum;
+} RollupTier;
+
+int rollupInit(RollupTier tiers[ROLLUP_TIERS], int numChannels);
+void rollupAdd(RollupTier tiers[ROLLUP_TIERS], time_t t, const float *values);
+int rollupFind(const char *name); //tier with the given resolution, -1 if there is none
+
+//slot of the i-th oldest interval of a tier
+static inline int rollupSlot(RollupTier *r, int i) {
+  return (r->start + i) % r->size;
+}
+
+#endif
@@ -0,0 +1,388 @@
+#include "sim_control.h"
+#include <string.h>
+#include <math.h>
+
+DAQ_DRIVER_EXPORT(SimDriver)
+
+/*------------------------------------------------------------*/
+/*Functions controlling the simulated DAQ--------------------*/
+/*----------------------------------------------------------*/
+SimDriver::SimDriver(void) {
+  clk = NULL;
+  tankBoiloff = 0.5/3600.0;
+  flowRate = 3.0/60.0;
+  lineCooldown = 60.0;
+  lineWarmup = 600.0;
+  sensorWarmV = 1.0;
+  sensorColdV = 9.0;
+  sensorTau = 5.0;
+  noiseV = 0.02;
+  scaleInput = 7;
+  scaleFit[0] = 224.047836;
+  scaleFit[1] = 0.0074602166;
+
+  simTime = 0.0;
+  tankMass = 180.0;
+  lineCold = 0.0;
+  valves = 0;
+  numDewars = 0;
+  numFaults = 0;
+  seed = 12345;
+  numStreamChans = 0;
+  streamRate = 0.0;
+  streamLast = 0.0;
+}
+/*--------------------------------------------------------------*/
+int SimDriver::open(const char *config) {
+
+  if (clk == NULL) {
+    printf("ERROR: The simulator needs the server clock (DAQ driver API version %i).\n", DAQ_DRIVER_API_VERSION);
+    return -1;
+  }
+  if ((config == NULL) || (config[0] == '\0')) {
+    printf("ERROR: The simulator needs a configuration file, set daq_config[simulation.dat] in parameters.dat.\n");
+    return -1;
+  }
+  if (readConfig(config) < 0)
+    return -1;
+
+  clockStart = clk->monotonic();
+  simTime = 0.0;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void SimDriver::setClock(Clock *clk) {
+  this->clk = clk;
+}
+/*--------------------------------------------------------------*/
+void SimDriver::close(void) {
+}
+/*--------------------------------------------------------------*/
+void SimDriver::capabilities(DAQCapabilities *caps) {
+  memset(caps, 0, sizeof(DAQCapabilities));
+  caps->flags = DAQ_CAP_DIGITAL_OUT | DAQ_CAP_ANALOG_IN | DAQ_CAP_STREAMING | DAQ_CAP_SIMULATED;
+  caps->numDigitalLines = 32;
+  caps->numAnalogInputs = SIM_MAX_INPUTS;
+  caps->minVoltage = -10.0;
+  caps->maxVoltage = 10.0;
+  caps->maxStreamRate = 1000.0;
+  sprintf(caps->description, "LN2 simulator (%i dewars)", numDewars);
+}
+/*--------------------------------------------------------------*/
+int SimDriver::writeLines(const int *chan, int numChans) {
+
+  advance(); //valves switch at the current virtual time
+
+  valves = 0;
+  if(numChans == 0)
+    printf("Turning off all channels (simulator).\n");
+  for(int i=0;i<numChans;i++){
+    if((chan[i]<0)||(chan[i]>=32)){
+      printf("Invalid channel specified (%i), not taking any action.\n",chan[i]);
+      return -1;
+    }
+    printf("Turning on channel %i (simulator).\n",chan[i]);
+    valves |= 1u << chan[i];
+  }
+  return (numChans == 0) ? 0 : 1;
+}
+/*--------------------------------------------------------------*/
+int SimDriver::readChannels(const int *chan, int numChans, float *volts) {
+
+  advance();
+  for(int i=0;i<numChans;i++){
+    volts[i] = inputVoltage(chan[i]);
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+int SimDriver::startStream(const int *chan, int numChans, double rate) {
+
+  if((numChans <= 0)||(numChans > SIM_MAX_STREAM_CHANS)||(rate <= 0.0))
+    return -1;
+  advance();
+  for(int i=0;i<numChans;i++){
+    streamChans[i] = chan[i];
+  }
+  numStreamChans = numChans;
+  streamRate = rate;
+  streamLast = simTime;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+int SimDriver::readStream(float *volts, int maxScans, int *scansRead) {
+
+  *scansRead = 0;
+  if(numStreamChans == 0)
+    return -1;
+
+  //hand out one scan per sampling period of virtual time since the last read,
+  //the model is stepped up to each scan so that the trace has the proper shape
+  double now = virtualTime();
+  double period = 1.0/streamRate;
+  while((*scansRead < maxScans)&&(streamLast + period <= now)){
+    streamLast += period;
+    advanceTo(streamLast);
+    for(int i=0;i<numStreamChans;i++){
+      volts[(*scansRead)*numStreamChans + i] = inputVoltage(streamChans[i]);
+    }
+    (*scansRead)++;
+  }
+  return 1;
+}
+/*--------------------------------------------------------------*/
+int SimDriver::stopStream(void) {
+  numStreamChans = 0;
+  return 1;
+}
+/*------------------------------------------------------------*/
+/*Simulation model-------------------------------------------*/
+/*----------------------------------------------------------*/
+//time since the simulation was started (s), on the server clock so that the
+//model runs as fast as the server does when it is on a virtual clock
+double SimDriver::virtualTime(void) {
+  return clk->monotonic() - clockStart;
+}
+/*--------------------------------------------------------------*/
+//bring the model up to the current virtual time
+void SimDriver::advance(void) {
+  advanceTo(virtualTime());
+}
+/*--------------------------------------------------------------*/
+//bring the model up to the given virtual time, in steps of at most 1 s
+void SimDriver::advanceTo(double t) {
+  while(simTime < t){
+    double dt = t - simTime;
+    if(dt > 1.0)
+      dt = 1.0;
+    step(dt);
+    simTime += dt;
+  }
+}
+/*--------------------------------------------------------------*/
+void SimDriver::step(double dt) {
+
+  //find the dewars which currently have an open path from the supply tank
+  int numOpen = 0;
+  for(int i=0;i<numDewars;i++){
+    if((dewar[i].valveMask != 0)&&((valves & dewar[i].valveMask) == dewar[i].valveMask))
+      numOpen++;
+  }
+
+  //supply tank boil-off and transfer line temperature
+  tankMass -= tankBoiloff*dt;
+  double drawn = 0.0;
+  if((numOpen > 0)&&(tankMass > 0.0)){
+    drawn = flowRate*dt;
+    if(drawn > tankMass)
+      drawn = tankMass;
+    tankMass -= drawn;
+    lineCold += dt/lineCooldown;
+  }else{
+    lineCold -= dt/lineWarmup;
+  }
+  if(tankMass < 0.0)
+    tankMass = 0.0;
+  if(lineCold > 1.0)
+    lineCold = 1.0;
+  if(lineCold < 0.0)
+    lineCold = 0.0;
+
+  //LN2 drawn through a warm line boils off before reaching the dewars
+  double liquid = drawn*lineCold;
+  double sensorDecay = 1.0 - exp(-dt/sensorTau);
+  for(int i=0;i<numDewars;i++){
+    dewar[i].spilling = false;
+    if((numOpen > 0)&&(dewar[i].valveMask != 0)&&((valves & dewar[i].valveMask) == dewar[i].valveMask)){
+      dewar[i].level += liquid/numOpen;
+      if((dewar[i].level >= dewar[i].capacity)&&(liquid > 0.0)){
+        dewar[i].spilling = true;
+      }
+    }
+    if(dewar[i].level > dewar[i].capacity)
+      dewar[i].level = dewar[i].capacity;
+    dewar[i].level -= dewar[i].boiloff*dt;
+    if(dewar[i].level < 0.0)
+      dewar[i].level = 0.0;
+
+    //overflow sensor relaxes towards the cold voltage while LN2 spills over it
+    //(only partly while the line is still warm and the overflow is mostly gas)
+    double target = dewar[i].spilling ? sensorWarmV + (sensorColdV - sensorWarmV)*lineCold : sensorWarmV;
+    dewar[i].sensorV += (target - dewar[i].sensorV)*sensorDecay;
+  }
+}
+/*--------------------------------------------------------------*/
+double SimDriver::inputVoltage(int channel) {
+
+  //inputs broken with sensor_fault
+  for(int i=0;i<numFaults;i++){
+    if((fault[i].channel == channel)&&(simTime >= fault[i].start)){
+      if(fault[i].kind == SIM_FAULT_OPEN)
+        return noise();
+      if(fault[i].kind == SIM_FAULT_SATURATED)
+        return 10.0;
+      if(!fault[i].held){
+        fault[i].value = modelVoltage(channel);
+        fault[i].held = true;
+      }
+      return fault[i].value;
+    }
+  }
+  return modelVoltage(channel);
+}
+/*--------------------------------------------------------------*/
+double SimDriver::modelVoltage(int channel) {
+
+  if(channel == scaleInput){
+    return (tankMass - scaleFit[1])/scaleFit[0] + noise();
+  }
+
+  //overflow sensors, several dewars may share one sensor (eg. precool vents)
+  bool found = false;
+  double v = 0.0;
+  for(int i=0;i<numDewars;i++){
+    if(dewar[i].sensor == channel){
+      if((!found)||(dewar[i].sensorV > v))
+        v = dewar[i].sensorV;
+      found = true;
+    }
+  }
+  if(!found)
+    return noise(); //nothing connected
+  return v + noise();
+}
+/*--------------------------------------------------------------*/
+//uniformly distributed noise in [-noiseV,noiseV], reproducible from run to run
+double SimDriver::noise(void) {
+  seed = seed*1103515245u + 12345u;
+  return noiseV*(((seed >> 8) & 0xFFFF)/32767.5 - 1.0);
+}
+/*--------------------------------------------------------------*/
+int SimDriver::readConfig(const char *filename) {
+  // Read simulation parameters from text file (eg. simulation.dat)
+  char *tok;
+  char str[256],parameter[256],value[256];
+  double initialFraction = 0.5;
+
+  FILE *parfile = fopen(filename, "r");
+  if(parfile == NULL){
+    printf("ERROR: Could not open simulator configuration file %s.\n",filename);
+    return -1;
+  }
+
+  while(!(feof(parfile)))//go until the end of file is reached
+    {
+      if(fgets(str,256,parfile)!=NULL) //get an entire line
+        {
+          tok=strtok(str,"[");
+          if(tok!=NULL){
+            tok[strcspn(tok, "\r\n")] = 0;//strips newline characters from the string
+            strcpy(parameter,tok);
+            tok = strtok (NULL, "]");
+            if(tok!=NULL){
+              tok[strcspn(tok, "\r\n")] = 0;//strips newline characters from the string
+              strcpy(value,tok);
+              if(strcmp(parameter,"tank_initial_kg")==0){
+                tankMass = atof(value);
+              }else if(strcmp(parameter,"tank_boiloff_kg_per_h")==0){
+                tankBoiloff = atof(value)/3600.0;
+              }else if(strcmp(parameter,"flow_rate_kg_per_min")==0){
+                flowRate = atof(value)/60.0;
+              }else if(strcmp(parameter,"line_cooldown_s")==0){
+                lineCooldown = atof(value);
+              }else if(strcmp(parameter,"line_warmup_s")==0){
+                lineWarmup = atof(value);
+              }else if(strcmp(parameter,"sensor_warm_V")==0){
+                sensorWarmV = atof(value);
+              }else if(strcmp(parameter,"sensor_cold_V")==0){
+                sensorColdV = atof(value);
+              }else if(strcmp(parameter,"sensor_time_constant_s")==0){
+                sensorTau = atof(value);
+              }else if(strcmp(parameter,"sensor_noise_V")==0){
+                noiseV = atof(value);
+              }else if(strcmp(parameter,"dewar_initial_fraction")==0){
+                initialFraction = atof(value);
+              }else if(strcmp(parameter,"random_seed")==0){
+                seed = atoi(value);
+              }else if(strcmp(parameter,"scale_input")==0){
+                scaleInput = atoi(value);
+              }else if(strcmp(parameter,"V_to_weight_A")==0){
+                scaleFit[0] = atof(value);
+              }else if(strcmp(parameter,"V_to_weight_B")==0){
+                scaleFit[1] = atof(value);
+              }else if(strcmp(parameter,"dewar")==0){
+                //dewar[name,sensor,capacity_kg,boiloff_kg_per_h,valve,valve,...]
+                if(numDewars >= SIM_MAX_DEWARS){
+                  printf("ERROR: Maximum number of simulated dewars (%i) exceeded.\n",SIM_MAX_DEWARS);
+                  fclose(parfile);
+                  return -1;
+                }
+                SimDewar *d = &dewar[numDewars];
+                memset(d, 0, sizeof(SimDewar));
+                int field = 0;
+                for(tok=strtok(value,",");tok!=NULL;tok=strtok(NULL,",")){
+                  if(field == 0)
+                    strcpy(d->name,tok);
+                  else if(field == 1)
+                    d->sensor = atoi(tok);
+                  else if(field == 2)
+                    d->capacity = atof(tok);
+                  else if(field == 3)
+                    d->boiloff = atof(tok)/3600.0;
+                  else if((atoi(tok) >= 0)&&(atoi(tok) < 32))
+                    d->valveMask |= 1u << atoi(tok);
+                  field++;
+                }
+                if(field < 5){
+                  printf("ERROR: Invalid simulated dewar '%s' (syntax: dewar[name,sensor,capacity_kg,boiloff_kg_per_h,valve,valve,...]).\n",value);
+                  fclose(parfile);
+                  return -1;
+                }
+                numDewars++;
+              }else if(strcmp(parameter,"sensor_fault")==0){
+                //sensor_fault[input,open|saturated|frozen,after_s]
+                char kind[256];
+                if(numFaults >= SIM_MAX_FAULTS){
+                  printf("ERROR: Maximum number of simulated sensor faults (%i) exceeded.\n",SIM_MAX_FAULTS);
+                  fclose(parfile);
+                  return -1;
+                }
+                SimFault *f = &fault[numFaults];
+                memset(f, 0, sizeof(SimFault));
+                if((sscanf(value,"%d,%255[^,],%lf",&f->channel,kind,&f->start) != 3)||
+                   ((strcmp(kind,"open") != 0)&&(strcmp(kind,"saturated") != 0)&&(strcmp(kind,"frozen") != 0))){
+                  printf("ERROR: Invalid simulated sensor fault '%s' (syntax: sensor_fault[input,open|saturated|frozen,after_s]).\n",value);
+                  fclose(parfile);
+                  return -1;
+                }
+                f->kind = (kind[0] == 'o') ? SIM_FAULT_OPEN : ((kind[0] == 's') ? SIM_FAULT_SATURATED : SIM_FAULT_FROZEN);
+                numFaults++;
+              }
+            }
+          }
+        }
+    }
+  fclose(parfile);
+
+  for(int i=0;i<numDewars;i++){
+    dewar[i].level = dewar[i].capacity*initialFraction;
+    dewar[i].sensorV = sensorWarmV;
+  }
+
+  printf("\nFile '%s' read sucessfully!\n",filename);
+  printf("Simulating %i dewars, supply tank holds %.1f kg.\n",numDewars,tankMass);
+  for(int i=0;i<numDewars;i++){
+    printf("Simulated dewar %i: %s, overflow sensor [ %i ], capacity %.1f kg, valves: [",i+1,dewar[i].name,dewar[i].sensor,dewar[i].capacity);
+    for(int v=0;v<32;v++){
+      if(dewar[i].valveMask & (1u << v))
+        printf(" %i",v);
+    }
+    printf(" ]\n");
+  }
+  for(int i=0;i<numFaults;i++){
+    static const char *kinds[3] = {"open", "saturated", "frozen"};
+    printf("Simulated input %i goes %s after %.0f s.\n",fault[i].channel,kinds[fault[i].kind],fault[i].start);
+  }
+
+  return 1;
+}
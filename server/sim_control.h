@@ -0,0 +1,94 @@
+//code for a simulated LN2 system (supply tank, transfer line, dewars and overflow sensors)
+//which can be used to exercise the scheduling and fill logic without DAQ hardware
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include "daq_driver.h"
+using namespace std;
+
+#define SIM_MAX_DEWARS 32
+#define SIM_MAX_INPUTS 32
+#define SIM_MAX_STREAM_CHANS 16
+#define SIM_MAX_FAULTS 16
+
+enum {
+  SIM_FAULT_OPEN,         //disconnected, reads only noise around 0 V
+  SIM_FAULT_SATURATED,    //reads the top of the input range
+  SIM_FAULT_FROZEN        //keeps returning the same reading
+};
+
+typedef struct {
+  char name[256];
+  unsigned int valveMask; //valves which all have to be open for LN2 to reach this dewar
+  int sensor;             //analog input of the overflow sensor
+  double capacity;        //dewar capacity (kg), 0 for a vent which overflows as soon as liquid arrives
+  double boiloff;         //boil-off rate (kg/s)
+  double level;           //current LN2 content (kg)
+  double sensorV;         //current overflow sensor voltage
+  bool spilling;          //true while LN2 is coming out of the overflow
+} SimDewar;
+
+typedef struct {
+  int channel;            //analog input which breaks
+  int kind;               //SIM_FAULT_OPEN, SIM_FAULT_SATURATED or SIM_FAULT_FROZEN
+  double start;           //virtual time from which it is broken (s since the simulation started)
+  bool held;              //frozen: the reading it is stuck at has been taken
+  double value;
+} SimFault;
+
+class SimDriver : public DAQDriver
+{
+public:
+  SimDriver(void);
+  void setClock(Clock *clk);
+  int open(const char *config);
+  void close(void);
+  void capabilities(DAQCapabilities *caps);
+  int writeLines(const int *chan, int numChans);
+  int readChannels(const int *chan, int numChans, float *volts);
+  int startStream(const int *chan, int numChans, double rate);
+  int readStream(float *volts, int maxScans, int *scansRead);
+  int stopStream(void);
+private:
+  int readConfig(const char *filename);
+  double virtualTime(void);
+  void advance(void);
+  void advanceTo(double t);
+  void step(double dt);
+  double inputVoltage(int channel);
+  double modelVoltage(int channel);
+  double noise(void);
+
+  Clock *clk;               //clock of the server, the model runs on its monotonic time
+
+  //simulation parameters
+  double tankBoiloff;       //supply tank boil-off (kg/s)
+  double flowRate;          //LN2 drawn from the supply tank while a path is open (kg/s)
+  double lineCooldown;      //time for the transfer line to go from warm to cold while flowing (s)
+  double lineWarmup;        //time for the transfer line to go from cold to warm when closed (s)
+  double sensorWarmV;       //overflow sensor voltage when dry
+  double sensorColdV;       //overflow sensor voltage when LN2 is spilling over it
+  double sensorTau;         //overflow sensor time constant (s)
+  double noiseV;            //amplitude of the noise added to every reading (V)
+  int scaleInput;           //analog input the scale is connected to
+  double scaleFit[2];       //scale calibration (weight = A*V + B)
+
+  //simulation state
+  double clockStart;        //clock reading at which the simulation was started (s)
+  double simTime;           //virtual time up to which the model has been advanced (s)
+  double tankMass;          //LN2 left in the supply tank (kg)
+  double lineCold;          //0=transfer line warm, 1=cold (all LN2 arrives as liquid)
+  unsigned int valves;      //currently open valves (bit N = valve N)
+  SimDewar dewar[SIM_MAX_DEWARS];
+  int numDewars;
+  SimFault fault[SIM_MAX_FAULTS];
+  int numFaults;
+  unsigned int seed;
+
+  //streaming state
+  int streamChans[SIM_MAX_STREAM_CHANS];
+  int numStreamChans;
+  double streamRate;
+  double streamLast;        //virtual time of the last scan handed out
+};
@@ -0,0 +1,215 @@
+//estimates of the LN2 in the supply tank (see tank.h)
+#include "tank.h"
+#include <string.h>
+#include <algorithm>
+
+/*--------------------------------------------------------------*/
+void tankInit(TankEstimator *e, double swapKg) {
+  memset(e, 0, sizeof(TankEstimator));
+  e->swapKg = swapKg;
+}
+/*--------------------------------------------------------------*/
+//median of v (reorders it)
+static double median(double *v, int n) {
+  std::nth_element(v, v + n/2, v + n);
+  double m = v[n/2];
+  if ((n % 2) == 0) {
+    std::nth_element(v, v + n/2 - 1, v + n/2);
+    m = 0.5*(m + v[n/2 - 1]);
+  }
+  return m;
+}
+/*--------------------------------------------------------------*/
+//fits the level and boil-off to the averages in the window
+static void fit(TankEstimator *e) {
+  static double v[TANK_WINDOW_BINS*(TANK_WINDOW_BINS - 1)/2];
+  int last = (e->start + e->count - 1) % TANK_WINDOW_BINS;
+  int n = 0;
+
+  e->valid = true;
+  e->levelTime = (time_t)e->binT[last];
+  if (e->count < TANK_MIN_BINS) {
+    e->level = e->binW[last];
+    return;
+  }
+
+  //Theil-Sen: the slope is the median of the slopes between all pairs of averages
+  for (int i = 0; i < e->count; i++) {
+    int a = (e->start + i) % TANK_WINDOW_BINS;
+    for (int j = i + 1; j < e->count; j++) {
+      int b = (e->start + j) % TANK_WINDOW_BINS;
+      v[n++] = (e->binW[b] - e->binW[a]) / (e->binT[b] - e->binT[a]);
+    }
+  }
+  double slope = median(v, n);
+
+  //and the level now is the median of the averages moved along the slope to now
+  for (int i = 0; i < e->count; i++) {
+    int a = (e->start + i) % TANK_WINDOW_BINS;
+    v[i] = e->binW[a] + slope*(e->binT[last] - e->binT[a]);
+  }
+  e->level = median(v, e->count);
+  e->boiloff = -3600.0*slope;
+  e->boiloffValid = true;
+}
+/*--------------------------------------------------------------*/
+static void addBin(TankEstimator *e, double t, double w) {
+  if (e->count == TANK_WINDOW_BINS)
+    e->start = (e->start + 1) % TANK_WINDOW_BINS;
+  else
+    e->count++;
+  int last = (e->start + e->count - 1) % TANK_WINDOW_BINS;
+  e->binT[last] = t;
+  e->binW[last] = w;
+}
+/*--------------------------------------------------------------*/
+//the average of a bin of readings is complete
+static int closeBin(TankEstimator *e) {
+  int flags = 0;
+  double t = e->binTimeSum / e->binCount;
+  double w = e->binSum / e->binCount;
+
+  if (e->settle > 0) {
+    e->settle--;
+    return 0;
+  }
+
+  if (e->numPending > 0) {
+    //first level after the fill(s)
+    if (e->levelBeforeValid) {
+      double used = e->levelBefore - w;
+      if (e->boiloffValid)
+        used -= e->boiloff*(t - e->fillStart)/3600.0;
+      if (used < 0.0)
+        used = 0.0;
+      e->lastUsed = used;
+      for (int i = 0; i < e->numPending; i++) {
+        int entry = e->pending[i];
+        double share = used / e->numPending;
+        if (e->fills[entry] == 0)
+          e->used[entry] = share;
+        else
+          e->used[entry] += TANK_USAGE_WEIGHT*(share - e->used[entry]);
+        e->fills[entry]++;
+      }
+      e->usedTotal += used;
+      e->fillsTotal += e->numPending;
+      flags |= TANK_FILL_MEASURED;
+    }
+    e->numPending = 0;
+  } else if (e->valid && (e->count > 0)) {
+    //a step away from the fitted line is a swap (or LN2 taken some other way)
+    double step = w - tankLevel(e, (time_t)t);
+    if (step > e->swapKg) {
+      e->swaps++;
+      e->swapLevel = w;
+      e->count = 0;
+      flags |= TANK_SWAP;
+    } else if (step < -e->swapKg) {
+      e->count = 0;
+      flags |= TANK_STEP;
+    }
+  }
+
+  addBin(e, t, w);
+  fit(e);
+  return flags | TANK_UPDATED;
+}
+/*--------------------------------------------------------------*/
+int tankAdd(TankEstimator *e, time_t t, double weight) {
+  int flags = 0;
+
+  if (e->filling)
+    return 0; //the scale is only read to measure the fill once it is over
+  time_t bin = t - t % TANK_BIN_SECONDS;
+  if ((e->binCount > 0) && (bin != e->binStart)) {
+    if (e->binCount >= TANK_MIN_READINGS)
+      flags = closeBin(e);
+    e->binCount = 0;
+  }
+  if (e->binCount == 0) {
+    e->binStart = bin;
+    e->binSum = 0.0;
+    e->binTimeSum = 0.0;
+  }
+  e->binSum += weight;
+  e->binTimeSum += (double)t;
+  e->binCount++;
+  return flags;
+}
+/*--------------------------------------------------------------*/
+void tankFillStart(TankEstimator *e, int entry, time_t t) {
+  if (e->numPending == 0) {
+    e->levelBeforeValid = e->valid;
+    e->levelBefore = tankLevel(e, t);
+    e->fillStart = t;
+  }
+  if ((e->numPending < TANK_MAX_CHAIN) && (entry >= 0) && (entry < TANK_MAX_ENTRIES))
+    e->pending[e->numPending++] = entry;
+  e->filling = true;
+  e->binCount = 0; //the readings before the fill are already in the level
+}
+/*--------------------------------------------------------------*/
+void tankFillEnd(TankEstimator *e) {
+  e->filling = false;
+  e->settle = TANK_SETTLE_BINS;
+  e->count = 0; //the fitted line is for the level before the fill
+  e->binCount = 0;
+  e->valid = false; //until the level after it is measured
+}
+/*--------------------------------------------------------------*/
+double tankLevel(TankEstimator *e, time_t t) {
+  if (!e->boiloffValid)
+    return e->level;
+  return e->level - e->boiloff*(double)(t - e->levelTime)/3600.0;
+}
+/*--------------------------------------------------------------*/
+double tankUsage(TankEstimator *e, int entry) {
+  if ((entry >= 0) && (entry < TANK_MAX_ENTRIES) && (e->fills[entry] > 0))
+    return e->used[entry];
+  if (e->fillsTotal > 0)
+    return e->usedTotal / e->fillsTotal; //entry not measured yet, assume an average fill
+  return -1.0;
+}
+/*--------------------------------------------------------------*/
+void tankForecast(TankEstimator *e, time_t now, double refillKg, const time_t *fillTime, const int *fillEntry,
+                  int numFills, double horizonHours, TankForecast *f) {
+  f->hoursToEmpty = -1.0;
+  f->shortEntry = -1;
+  if (!e->valid)
+    return;
+
+  double rate = (e->boiloffValid && (e->boiloff > 0.0)) ? e->boiloff : 0.0;
+  double level = tankLevel(e, now);
+  time_t t = now;
+  for (int i = 0; i < numFills; i++) {
+    if (fillTime[i] < now)
+      continue;
+    double before = level - rate*(fillTime[i] - t)/3600.0;
+    if (before <= refillKg)
+      break; //boil-off takes it to the refill weight before this fill
+    level = before;
+    t = fillTime[i];
+    double use = tankUsage(e, fillEntry[i]);
+    if (use <= 0.0)
+      continue;
+    if (level - use < refillKg) {
+      f->shortEntry = fillEntry[i];
+      f->shortTime = t;
+      f->shortLevel = level;
+      f->shortNeed = use;
+      f->hoursToEmpty = (t - now)/3600.0;
+      return;
+    }
+    level -= use;
+  }
+
+  double hours = (t - now)/3600.0;
+  if (level > refillKg) {
+    if (rate <= 0.0)
+      return;
+    hours += (level - refillKg)/rate;
+  }
+  if (hours <= horizonHours)
+    f->hoursToEmpty = hours;
+}
@@ -0,0 +1,92 @@
+//estimates of the LN2 in the supply tank, from the scale readings
+//
+//Between fills the tank only loses LN2 to boil-off, which is slow and steady, while
+//the scale readings are noisy.  Readings are averaged over TANK_BIN_SECONDS, and the
+//boil-off rate is the Theil-Sen slope (the median of the slopes between all pairs) of
+//the last TANK_WINDOW_BINS averages, which a few bad averages don't throw off the way
+//they would a least squares fit.  The level is where the fitted line is now.
+//
+//A fill restarts the averages: what it used is the level when it started less the
+//first average once the scale has settled (less the boil-off in between), kept for
+//each schedule entry as a moving average.  Fills chained one after the other are
+//measured together and shared evenly between their entries.  An average which is
+//more than swapKg above the fitted line while no fill is running is a tank swap
+//(more than swapKg below it, LN2 taken some other way), which also restarts them.
+//
+//tankForecast runs the estimates forward through the fills which are scheduled, to
+//find when the tank will reach the refill weight and the first fill which won't fit.
+
+#ifndef __TANK
+#define __TANK
+
+#include <time.h>
+
+#define TANK_BIN_SECONDS 300    //readings are averaged over 5 min
+#define TANK_WINDOW_BINS 72     //the boil-off is fitted over the last 6 hours without fills
+#define TANK_MIN_BINS 6         //averages needed to fit the boil-off
+#define TANK_MIN_READINGS 3     //readings needed for an average to count
+#define TANK_SETTLE_BINS 1      //averages left out after a fill while the scale settles
+#define TANK_MAX_ENTRIES 256    //schedule entries (MAXSCHEDENTRIES)
+#define TANK_MAX_CHAIN 16       //fills measured together
+#define TANK_USAGE_WEIGHT 0.3   //weight of the newest fill in the average of what an entry uses
+
+//what tankAdd found
+#define TANK_UPDATED 1          //the level and boil-off were updated
+#define TANK_SWAP 2             //the tank was swapped
+#define TANK_STEP 4             //the level dropped while no fill was running
+#define TANK_FILL_MEASURED 8    //what the last fill(s) used was measured
+
+typedef struct {
+  double swapKg;
+  //average being built
+  time_t binStart;
+  double binSum, binTimeSum;
+  int binCount;
+  //averages since the last fill or swap (a ring)
+  double binT[TANK_WINDOW_BINS];
+  double binW[TANK_WINDOW_BINS];
+  int start, count;
+  //estimates
+  bool valid;               //level is known
+  double level;             //kg at levelTime
+  time_t levelTime;
+  bool boiloffValid;
+  double boiloff;           //kg/hour
+  //fills waiting to be measured
+  bool filling;
+  int settle;               //averages still to leave out
+  int numPending;
+  int pending[TANK_MAX_CHAIN];
+  bool levelBeforeValid;
+  double levelBefore;
+  time_t fillStart;
+  //what fills use
+  double lastUsed;          //kg used by the last fill(s) measured
+  double used[TANK_MAX_ENTRIES];
+  int fills[TANK_MAX_ENTRIES];
+  double usedTotal;
+  int fillsTotal;
+  unsigned int swaps;
+  double swapLevel;         //level measured after the last swap, 0 if none was seen
+} TankEstimator;
+
+typedef struct {
+  double hoursToEmpty;      //until the tank reaches the refill weight, -1 if not within the horizon
+  int shortEntry;           //first scheduled fill which won't fit, -1 if they all do
+  time_t shortTime;
+  double shortLevel;        //level expected when that fill starts
+  double shortNeed;         //and what it is expected to use
+} TankForecast;
+
+void tankInit(TankEstimator *e, double swapKg);
+int tankAdd(TankEstimator *e, time_t t, double weight); //returns TANK_* flags
+void tankFillStart(TankEstimator *e, int entry, time_t t);
+void tankFillEnd(TankEstimator *e);
+double tankLevel(TankEstimator *e, time_t t);  //level expected at t
+double tankUsage(TankEstimator *e, int entry); //LN2 a fill of the entry is expected to use, -1 if unknown
+
+//fills must be sorted by time
+void tankForecast(TankEstimator *e, time_t now, double refillKg, const time_t *fillTime, const int *fillEntry,
+                  int numFills, double horizonHours, TankForecast *f);
+
+#endif
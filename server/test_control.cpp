@@ -1,10 +1,34 @@
 #include "test_control.h"
+#include <string.h>
+
+DAQ_DRIVER_EXPORT(TestDriver)
 
 /*------------------------------------------------------------*/
 /*Functions controlling the DAQ------------------------------*/
 /*----------------------------------------------------------*/
-int chanOn(int* chan, int numChans) {
+int TestDriver::open(const char *config) {
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void TestDriver::close(void) {
+}
+/*--------------------------------------------------------------*/
+void TestDriver::capabilities(DAQCapabilities *caps) {
+  memset(caps, 0, sizeof(DAQCapabilities));
+  caps->flags = DAQ_CAP_DIGITAL_OUT | DAQ_CAP_ANALOG_IN | DAQ_CAP_SIMULATED;
+  caps->numDigitalLines = 8;
+  caps->numAnalogInputs = 8;
+  caps->minVoltage = -10.0;
+  caps->maxVoltage = 10.0;
+  strcpy(caps->description, "test controller");
+}
+/*--------------------------------------------------------------*/
+int TestDriver::writeLines(const int *chan, int numChans) {
 
+  if(numChans == 0){
+    printf("Turning off all channels (test controller).\n");
+    return 0;
+  }
   for(int i=0;i<numChans;i++){
     printf("Turning on channel %i (test controller).\n",chan[i]);
   }
@@ -12,19 +36,9 @@ int chanOn(int* chan, int numChans) {
   return 1;
 }
 /*--------------------------------------------------------------*/
-int chanOn(int chan) {
-  
-  printf("Turning on channel %i (test controller).\n",chan);
-  
+int TestDriver::readChannels(const int *chan, int numChans, float *volts) {
+  for(int i=0;i<numChans;i++){
+    volts[i] = 10.0;
+  }
   return 1;
 }
-/*--------------------------------------------------------------*/
-int chanOff(void) {
-
-  printf("Turning off all channels (test controller).\n");
-  return 0;
-}
-/*--------------------------------------------------------------*/
-float measure(int channel) {
-	return 10.0;
-}
@@ -3,4 +3,15 @@
 #include <string>
 #include <cstdio>
 #include <cstdlib>
-using namespace std;
\ No newline at end of file
+#include "daq_driver.h"
+using namespace std;
+
+class TestDriver : public DAQDriver
+{
+public:
+  int open(const char *config);
+  void close(void);
+  void capabilities(DAQCapabilities *caps);
+  int writeLines(const int *chan, int numChans);
+  int readChannels(const int *chan, int numChans, float *volts);
+};
@@ -0,0 +1,69 @@
+//high rate traces of the fills (see trace.h)
+#include "trace.h"
+#include "archive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*--------------------------------------------------------------*/
+int traceAlloc(FillTrace *t, int maxSamples) {
+  memset(t, 0, sizeof(FillTrace));
+  t->samples = (TraceSample *)malloc(maxSamples*sizeof(TraceSample));
+  if (t->samples == NULL)
+    return -1;
+  t->maxSamples = maxSamples;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+void traceFree(FillTrace *t) {
+  free(t->samples);
+  t->samples = NULL;
+  t->maxSamples = 0;
+}
+/*--------------------------------------------------------------*/
+void tracePath(char *path, size_t size, const char *dir, const char *entry, time_t start) {
+  char when[32];
+  struct tm local;
+
+  localtime_r(&start, &local);
+  strftime(when, sizeof(when), "%Y%m%d_%H%M%S", &local);
+  snprintf(path, size, "%s/%s_%s.dat", dir, entry, when);
+}
+/*--------------------------------------------------------------*/
+void traceStart(FillTrace *t, const char *path) {
+  snprintf(t->path, sizeof(t->path), "%s", path);
+  t->numSamples = 0;
+  t->dropped = 0;
+}
+/*--------------------------------------------------------------*/
+int traceWrite(FillTrace *t) {
+  static const char names[5][ARCHIVE_NAME_LENGTH] = {"sensor", "weight", "valves", "valves24", "valves48"};
+  ArchiveWriter a;
+  unsigned long long valves = 0;
+  float row[5];
+
+  if (t->numSamples == 0)
+    return 0;
+  //columns for the higher valves only if they were used
+  for (int i = 0; i < t->numSamples; i++)
+    valves |= t->samples[i].valves;
+  int numChannels = (valves >> 48) ? 5 : ((valves >> 24) ? 4 : 3);
+
+  if (archiveCreate(&a, t->path, numChannels, names) < 0)
+    return -1;
+  for (int i = 0; i < t->numSamples; i++) {
+    const TraceSample *s = &t->samples[i];
+    row[0] = s->sensor;
+    row[1] = s->weight;
+    row[2] = (float)(s->valves & 0xFFFFFF);
+    row[3] = (float)((s->valves >> 24) & 0xFFFFFF);
+    row[4] = (float)(s->valves >> 48);
+    if (archiveAppend(&a, s->t, row) < 0) {
+      archiveClose(&a);
+      return -1;
+    }
+  }
+  int ret = archiveFlush(&a);
+  archiveClose(&a);
+  return ret;
+}
@@ -0,0 +1,60 @@
+//high rate traces of the fills
+//
+//While a fill runs, the overflow sensor of the entry being filled, the scale and the valves held
+//open are read every trace_interval_ms (100 ms by default, where the fill itself takes one sensor
+//reading a second), from the valves opening until they close.  The readings go into a buffer
+//allocated at start up, large enough for the longest fill (max_filling_time), so that nothing is
+//allocated or written while filling.  When the fill ends the buffer is handed to a worker thread
+//which writes it to its own file, while the next fill (eg. the next step of a chain) takes the
+//other buffer.
+//
+//Each trace is a file in the archive format (see archive.h), without an index, so that it is
+//compressed the same way and read with ./ln2_query -f <trace>.  Its columns are sensor (V),
+//weight (kg) and valves (bit N = valve N; the values are floats, so valves 24 to 47 and 48 to 63
+//are in the columns valves24 and valves48, added if they were opened).  The file is named after
+//the entry and the start of the fill, <trace_dir>/<entry>_YYYYMMDD_HHMMSS.dat, and the fill's
+//record in the fill history is flagged with HISTORY_TRACE.
+
+#ifndef __TRACE
+#define __TRACE
+
+#include <stddef.h>
+#include <time.h>
+
+#define TRACE_BUFFERS 2            //fills traced or being written at once
+
+typedef struct {
+  long long t;              //ms since the epoch
+  float sensor;             //V
+  float weight;             //kg
+  unsigned long long valves; //bit N = valve N open
+} TraceSample;
+
+typedef struct {
+  TraceSample *samples;
+  int numSamples;
+  int maxSamples;
+  int dropped;              //readings which didn't fit in the buffer
+  char path[512];
+  volatile int busy;        //set while the fill is traced and until its trace has been written
+} FillTrace;
+
+int traceAlloc(FillTrace *t, int maxSamples);
+void traceFree(FillTrace *t);
+void tracePath(char *path, size_t size, const char *dir, const char *entry, time_t start);
+void traceStart(FillTrace *t, const char *path);
+int traceWrite(FillTrace *t); //writes the file, -1 on errors
+
+static inline void traceAdd(FillTrace *t, long long tMs, float sensor, float weight, unsigned long long valves) {
+  if (t->numSamples == t->maxSamples) {
+    t->dropped++;
+    return;
+  }
+  TraceSample *s = &t->samples[t->numSamples++];
+  s->t = tMs;
+  s->sensor = sensor;
+  s->weight = weight;
+  s->valves = valves;
+}
+
+#endif
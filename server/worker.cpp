@@ -0,0 +1,62 @@
+//background threads which consume records handed over by the control loop (see worker.h)
+#include "worker.h"
+#include <stdio.h>
+#include <errno.h>
+
+/*--------------------------------------------------------------*/
+static void *workerThread(void *arg) {
+  Worker *w = (Worker *)arg;
+
+  while (true) {
+    while ((sem_wait(&w->ready) != 0) && (errno == EINTR))
+      ;
+    if (ringPop(&w->ring, w->record))
+      w->consume(w->record);
+    else if (w->stopping)
+      break; //everything queued before the stop has been consumed
+  }
+  return NULL;
+}
+/*--------------------------------------------------------------*/
+int workerStart(Worker *w, const char *name, unsigned int size, unsigned int recordSize, worker_consume_t consume) {
+  memset(w, 0, sizeof(Worker));
+  w->name = name;
+  w->consume = consume;
+  if ((ringInit(&w->ring, size, recordSize) < 0) || ((w->record = malloc(recordSize)) == NULL)) {
+    printf("ERROR: Could not allocate the %s queue.\n", name);
+    ringFree(&w->ring);
+    return -1;
+  }
+  sem_init(&w->ready, 0, 0);
+  if (pthread_create(&w->thread, NULL, workerThread, w) != 0) {
+    printf("ERROR: Could not start the %s thread.\n", name);
+    sem_destroy(&w->ready);
+    ringFree(&w->ring);
+    free(w->record);
+    return -1;
+  }
+  w->running = true;
+  return 1;
+}
+/*--------------------------------------------------------------*/
+bool workerPush(Worker *w, const void *record) {
+  if (!w->running)
+    return false;
+  if (!ringPush(&w->ring, record))
+    return false;
+  sem_post(&w->ready);
+  return true;
+}
+/*--------------------------------------------------------------*/
+void workerStop(Worker *w) {
+  if (!w->running)
+    return;
+  w->stopping = true;
+  sem_post(&w->ready);
+  pthread_join(w->thread, NULL);
+  w->running = false;
+  sem_destroy(&w->ready);
+  ringFree(&w->ring);
+  free(w->record);
+  w->record = NULL;
+}
@@ -0,0 +1,31 @@
+//background threads which consume records handed over by the control loop
+//
+//Each worker has its own lock-free ring (see ring.h) and a semaphore which is posted
+//for every record.  Handing a record over never blocks the control loop: if the worker
+//has fallen so far behind that its ring is full, the record is dropped.
+
+#ifndef __WORKER
+#define __WORKER
+
+#include <pthread.h>
+#include <semaphore.h>
+#include "ring.h"
+
+typedef void (*worker_consume_t)(const void *record);
+
+typedef struct {
+  const char *name;
+  Ring ring;
+  sem_t ready;              //posted for every record pushed, and to stop
+  pthread_t thread;
+  volatile bool stopping;
+  bool running;
+  worker_consume_t consume;
+  void *record;             //the record being consumed
+} Worker;
+
+int workerStart(Worker *w, const char *name, unsigned int size, unsigned int recordSize, worker_consume_t consume);
+bool workerPush(Worker *w, const void *record); //false if the record was dropped
+void workerStop(Worker *w);                     //consumes the records still queued and stops the thread
+
+#endif